@@ -0,0 +1,1065 @@
+/*
+ * This file is a part of MAFW
+ *
+ * Copyright (C) 2007, 2008, 2009 Nokia Corporation, all rights reserved.
+ *
+ * Contact: Visa Smolander <visa.smolander@nokia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+/* Include files */
+#include <string.h>
+
+#include <glib.h>
+#include <glib-object.h>
+
+#include "mafw-caching-source.h"
+#include "mafw-source-private.h"
+#include "mafw-metadata.h"
+#include "mafw-callbas.h"
+#include "mafw-marshal.h"
+
+/**
+ * SECTION:mafwcachingsource
+ * @short_description: metadata caching wrapper of a #MafwSource
+ *
+ * #MafwCachingSource wraps another #MafwSource and remembers the
+ * results of mafw_source_get_metadata() and mafw_source_get_metadatas()
+ * in a least-recently-used cache, so that asking about the same object
+ * again does not reach the wrapped source.  Results are cached per
+ * object ID and set of requested keys; the order of the keys does not
+ * matter.  Errors are not cached.  Requests missing from the cache are
+ * cancelled in the wrapped source along with the original ones, see
+ * mafw_source_get_current_token().
+ *
+ * The size of the cache is limited to a number of bytes (estimated by
+ * mafw_metadata_size()), and cached results are only served for a
+ * limited time.  All cached metadata of an object is dropped when the
+ * wrapped source emits #MafwSource::metadata-changed about it, and
+ * the whole cache is dropped on #MafwSource::container-changed, since
+ * it is not known which objects are inside the container.  These
+ * signals, #MafwSource::updating and the wrapped source's run-time
+ * properties are relayed, and all other operations are passed on
+ * as they are.
+ *
+ * The wrapper takes the UUID, name and plugin of the wrapped source,
+ * so object IDs stay valid; register it instead of the wrapped one.
+ * Its hit rate can be queried through the #MAFW_PROPERTY_CACHE_HITS
+ * and #MAFW_PROPERTY_CACHE_MISSES run-time properties.
+ */
+
+/* GObject prerequisites */
+typedef MafwSourceClass MafwCachingSourceClass;
+
+G_DEFINE_TYPE(MafwCachingSource, mafw_caching_source, MAFW_TYPE_SOURCE);
+
+/* A cached get_metadata() result.  $key is the object ID and the
+ * canonical key set separated by a newline (see make_key()).  $link
+ * is in the LRU queue with $link.data pointing back to the entry. */
+struct entry {
+	gchar *key;
+	GHashTable *metadata;
+	gsize size;
+	glong stamp;
+	GList link;
+};
+
+struct _MafwCachingSourcePrivate {
+	MafwSource *wrapped;
+	gulong handlers[4];
+
+	/* key -> struct entry, owning the entries.  The head of $lru
+	 * is the most recently used entry. */
+	GHashTable *entries;
+	GQueue lru;
+	gsize size, budget;
+	guint ttl;
+
+	/* Incremented at every invalidation.  Results of requests
+	 * started before are not cached, because they may be stale. */
+	guint generation;
+	guint hits, misses;
+};
+
+/* Keeps the callback of a request passed on to the wrapped source,
+ * to be called with the caching source instead of the wrapped one.
+ * Relays of browse sessions are registered in $Browse_relays under
+ * $serial, which is passed to the wrapped source instead of the relay,
+ * until the session ends or cancel_browse() cancels $browse_id.
+ * Results arriving later are dropped. */
+struct relay {
+	MafwCachingSource *self;
+	gpointer cb;
+	gpointer user_data;
+	gchar *object_id;
+	guint serial, browse_id;
+};
+
+static GHashTable *Browse_relays;
+
+/* Like relay, for get_metadata() and get_metadatas().  $token is the
+ * current one of the request, passed on to the wrapped source, which
+ * doesn't call back once it is cancelled, so we answer then. */
+struct md_request {
+	MafwCachingSource *self;
+	gpointer cb;
+	gpointer user_data;
+	guint generation;
+	/* The canonical key set. */
+	gchar *keys;
+	/* The object of get_metadata(). */
+	gchar *object_id;
+	/* Results already found in the cache by get_metadatas(). */
+	GHashTable *results;
+	MafwSourceToken *token;
+	gulong handler;
+};
+
+/* Program code */
+
+/* Relays */
+static struct relay *relay_new(MafwCachingSource *self, gpointer cb,
+			       gpointer user_data, const gchar *object_id)
+{
+	struct relay *relay;
+
+	relay = g_new(struct relay, 1);
+	relay->self = g_object_ref(self);
+	relay->cb = cb;
+	relay->user_data = user_data;
+	relay->object_id = g_strdup(object_id);
+	return relay;
+}
+
+static void relay_free(struct relay *relay)
+{
+	g_object_unref(relay->self);
+	g_free(relay->object_id);
+	g_free(relay);
+}
+
+/* Registers a relay for a browse session and returns its key. */
+static gpointer browse_relay_new(MafwCachingSource *self, gpointer cb,
+				 gpointer user_data)
+{
+	static guint serial;
+	struct relay *relay;
+
+	if (!Browse_relays)
+		Browse_relays = g_hash_table_new_full(g_direct_hash,
+					g_direct_equal, NULL,
+					(GDestroyNotify)relay_free);
+	if (!++serial)
+		serial++;
+
+	relay = relay_new(self, cb, user_data, NULL);
+	relay->serial = serial;
+	relay->browse_id = MAFW_SOURCE_INVALID_BROWSE_ID;
+	g_hash_table_insert(Browse_relays, GUINT_TO_POINTER(serial), relay);
+	return GUINT_TO_POINTER(serial);
+}
+
+/* Records the $browse_id the wrapped source returned for the relay of
+ * $key, or forgets the relay if the browse failed. */
+static guint browse_relay_started(gpointer key, guint browse_id)
+{
+	struct relay *relay;
+
+	/* The session may have ended already. */
+	if (!(relay = g_hash_table_lookup(Browse_relays, key)))
+		return browse_id;
+	if (browse_id == MAFW_SOURCE_INVALID_BROWSE_ID)
+		/* Failed without telling. */
+		g_hash_table_remove(Browse_relays, key);
+	else
+		relay->browse_id = browse_id;
+	return browse_id;
+}
+
+/* Returns the relay of $key for a result of $browse_id, unregistering
+ * it if this is the last result. */
+static struct relay *browse_relay_get(gpointer key, guint browse_id,
+				      gboolean last)
+{
+	struct relay *relay;
+
+	if (!(relay = g_hash_table_lookup(Browse_relays, key)))
+		return NULL;
+	relay->browse_id = browse_id;
+	if (last)
+		g_hash_table_steal(Browse_relays, key);
+	return relay;
+}
+
+static gboolean same_browse(gpointer key, struct relay *relay,
+			    struct relay *which)
+{
+	return relay->self == which->self
+		&& relay->browse_id == which->browse_id;
+}
+
+static void md_request_free(struct md_request *req)
+{
+	if (req->token) {
+		mafw_source_token_disconnect(req->token, req->handler);
+		mafw_source_token_unref(req->token);
+	}
+	g_object_unref(req->self);
+	g_free(req->keys);
+	g_free(req->object_id);
+	if (req->results)
+		g_hash_table_unref(req->results);
+	g_free(req);
+}
+
+/* Cache */
+
+/* Returns the comma-separated canonical list of $mdkeys, see
+ * _mafw_source_canonical_keys(). */
+static gchar *canonical_keys(const gchar *const *mdkeys)
+{
+	gchar **keys, *joined;
+
+	keys = _mafw_source_canonical_keys(mdkeys);
+	joined = keys ? g_strjoinv(",", keys) : g_strdup("");
+	g_strfreev(keys);
+	return joined;
+}
+
+static gchar *make_key(const gchar *object_id, const gchar *keys)
+{
+	return g_strconcat(object_id, "\n", keys, NULL);
+}
+
+static glong now(void)
+{
+	GTimeVal tv;
+
+	g_get_current_time(&tv);
+	return tv.tv_sec;
+}
+
+static void entry_free(struct entry *e)
+{
+	g_free(e->key);
+	g_hash_table_unref(e->metadata);
+	g_free(e);
+}
+
+static void entry_remove(MafwCachingSourcePrivate *priv, struct entry *e)
+{
+	g_queue_unlink(&priv->lru, &e->link);
+	priv->size -= e->size;
+	g_hash_table_remove(priv->entries, e->key);
+}
+
+/* Evicts the least recently used entries until the cache fits in
+ * $budget. */
+static void cache_trim(MafwCachingSourcePrivate *priv, gsize budget)
+{
+	while (priv->size > budget)
+		entry_remove(priv, g_queue_peek_tail(&priv->lru));
+}
+
+/* Returns the cached metadata of $key, or %NULL if it is not cached
+ * or has expired. */
+static GHashTable *cache_lookup(MafwCachingSourcePrivate *priv,
+				const gchar *key)
+{
+	struct entry *e;
+	glong t;
+
+	if (!(e = g_hash_table_lookup(priv->entries, key)))
+		return NULL;
+
+	if (priv->ttl) {
+		t = now();
+		if (t < e->stamp || t - e->stamp >= priv->ttl) {
+			entry_remove(priv, e);
+			return NULL;
+		}
+	}
+
+	g_queue_unlink(&priv->lru, &e->link);
+	g_queue_push_head_link(&priv->lru, &e->link);
+	return e->metadata;
+}
+
+static void cache_store(MafwCachingSourcePrivate *priv,
+			const gchar *object_id, const gchar *keys,
+			GHashTable *metadata)
+{
+	struct entry *e;
+	gchar *key;
+	gsize size;
+
+	key = make_key(object_id, keys);
+	size = sizeof(*e) + strlen(key) + 1 + mafw_metadata_size(metadata);
+	if (size > priv->budget) {
+		g_free(key);
+		return;
+	}
+
+	if ((e = g_hash_table_lookup(priv->entries, key)))
+		entry_remove(priv, e);
+	cache_trim(priv, priv->budget - size);
+
+	e = g_new(struct entry, 1);
+	e->key = key;
+	e->metadata = mafw_metadata_copy(metadata);
+	e->size = size;
+	e->stamp = now();
+	e->link.data = e;
+	e->link.prev = e->link.next = NULL;
+	g_hash_table_insert(priv->entries, e->key, e);
+	g_queue_push_head_link(&priv->lru, &e->link);
+	priv->size += size;
+}
+
+static gboolean remove_object(const gchar *key, struct entry *e,
+			      gpointer args[2])
+{
+	MafwCachingSourcePrivate *priv = args[0];
+	const gchar *object_id = args[1];
+	gsize len;
+
+	len = strlen(object_id);
+	if (strncmp(key, object_id, len) || key[len] != '\n')
+		return FALSE;
+	g_queue_unlink(&priv->lru, &e->link);
+	priv->size -= e->size;
+	return TRUE;
+}
+
+/**
+ * mafw_caching_source_invalidate:
+ * @self:      a #MafwCachingSource instance.
+ * @object_id: the object whose metadata to forget, or %NULL.
+ *
+ * Drops all cached metadata of @object_id, or the whole cache if
+ * @object_id is %NULL.  Results of requests in progress are not
+ * cached either.  This happens automatically when the wrapped source
+ * signals a change.
+ */
+void mafw_caching_source_invalidate(MafwCachingSource *self,
+				    const gchar *object_id)
+{
+	MafwCachingSourcePrivate *priv;
+
+	g_return_if_fail(MAFW_IS_CACHING_SOURCE(self));
+
+	priv = self->priv;
+	priv->generation++;
+	if (object_id) {
+		gpointer args[] = { priv, (gpointer)object_id };
+
+		g_hash_table_foreach_remove(priv->entries,
+					    (GHRFunc)remove_object, args);
+	} else {
+		/* The links are embedded in the entries. */
+		g_hash_table_remove_all(priv->entries);
+		g_queue_init(&priv->lru);
+		priv->size = 0;
+	}
+}
+
+/* Metadata */
+/* Answers a cancelled request, whose result is ignored. */
+static gboolean emit_cancelled(struct md_request *req)
+{
+	if (req->results)
+		((MafwSourceMetadataResultsCb)req->cb)(MAFW_SOURCE(req->self),
+						       req->results,
+						       req->user_data, NULL);
+	else
+		((MafwSourceMetadataResultCb)req->cb)(MAFW_SOURCE(req->self),
+						      req->object_id, NULL,
+						      req->user_data, NULL);
+	md_request_free(req);
+	return FALSE;
+}
+
+static void md_request_cancelled(MafwSourceToken *token,
+				 struct md_request *req)
+{
+	req->handler = 0;
+	g_idle_add((GSourceFunc)emit_cancelled, req);
+}
+
+/* Takes the current token for $req, see mafw_source_get_current_token().
+ * Returns FALSE if it is cancelled already, when $req is answered
+ * without asking the wrapped source. */
+static gboolean md_request_watch(struct md_request *req)
+{
+	MafwSourceToken *token;
+
+	if (!(token = mafw_source_get_current_token()))
+		return TRUE;
+	req->token = mafw_source_token_ref(token);
+	if (mafw_source_token_is_cancelled(token)) {
+		g_idle_add((GSourceFunc)emit_cancelled, req);
+		return FALSE;
+	}
+	req->handler = mafw_source_token_connect(token,
+					(MafwSourceTokenCancelledCb)
+					md_request_cancelled, req);
+	return TRUE;
+}
+
+static void got_metadata(MafwSource *wrapped, const gchar *object_id,
+			 GHashTable *metadata, struct md_request *req,
+			 const GError *error)
+{
+	MafwCachingSourcePrivate *priv = req->self->priv;
+
+	if (!error && metadata && req->generation == priv->generation)
+		cache_store(priv, object_id, req->keys, metadata);
+	((MafwSourceMetadataResultCb)req->cb)(MAFW_SOURCE(req->self),
+					      object_id, metadata,
+					      req->user_data, error);
+	md_request_free(req);
+}
+
+static void get_metadata(MafwSource *source, const gchar *object_id,
+			 const gchar *const *mdkeys,
+			 MafwSourceMetadataResultCb cb, gpointer user_data)
+{
+	MafwCachingSourcePrivate *priv;
+	struct md_request *req;
+	GHashTable *metadata;
+	gchar *keys, *key;
+
+	g_return_if_fail(object_id != NULL);
+	g_return_if_fail(cb != NULL);
+
+	priv = MAFW_CACHING_SOURCE(source)->priv;
+	keys = canonical_keys(mdkeys);
+	key = make_key(object_id, keys);
+	metadata = cache_lookup(priv, key);
+	g_free(key);
+
+	if (metadata) {
+		priv->hits++;
+		g_free(keys);
+		mafw_callbas_defer(mafw_callbas_new(G_CALLBACK(cb),
+			mafw_marshal_VOID__STRING_BOXED_POINTER_POINTER,
+			source, MAFW_CBAS_STRING(object_id),
+			MAFW_CBAS_HASH(mafw_metadata_copy(metadata)),
+			MAFW_CBAS_POINTER(user_data), MAFW_CBAS_NULL,
+			MAFW_CBAS_END));
+		return;
+	}
+
+	priv->misses++;
+	req = g_new0(struct md_request, 1);
+	req->self = g_object_ref(source);
+	req->cb = cb;
+	req->user_data = user_data;
+	req->generation = priv->generation;
+	req->keys = keys;
+	req->object_id = g_strdup(object_id);
+	if (!md_request_watch(req))
+		return;
+	/* The request has waited for its turn already. */
+	mafw_source_get_metadata_full(priv->wrapped, object_id, mdkeys,
+				      MAFW_SOURCE_PRIORITY_INTERACTIVE,
+				      req->token,
+				      (MafwSourceMetadataResultCb)
+				      got_metadata,
+				      req);
+}
+
+static void store_and_collect(const gchar *object_id, GHashTable *metadata,
+			      struct md_request *req)
+{
+	MafwCachingSourcePrivate *priv = req->self->priv;
+
+	if (!metadata)
+		return;
+	if (req->generation == priv->generation)
+		cache_store(priv, object_id, req->keys, metadata);
+	g_hash_table_insert(req->results, g_strdup(object_id),
+			    g_hash_table_ref(metadata));
+}
+
+static void got_metadatas(MafwSource *wrapped, GHashTable *metadatas,
+			  struct md_request *req, const GError *error)
+{
+	if (metadatas)
+		g_hash_table_foreach(metadatas, (GHFunc)store_and_collect,
+				     req);
+	((MafwSourceMetadataResultsCb)req->cb)(MAFW_SOURCE(req->self),
+					       req->results, req->user_data,
+					       error);
+	md_request_free(req);
+}
+
+static gboolean emit_cached(struct md_request *req)
+{
+	((MafwSourceMetadataResultsCb)req->cb)(MAFW_SOURCE(req->self),
+					       req->results, req->user_data,
+					       NULL);
+	md_request_free(req);
+	return FALSE;
+}
+
+static void get_metadatas(MafwSource *source, const gchar **object_ids,
+			  const gchar *const *mdkeys,
+			  MafwSourceMetadataResultsCb cb, gpointer user_data)
+{
+	MafwCachingSourcePrivate *priv;
+	struct md_request *req;
+	GPtrArray *missing;
+	guint i;
+
+	g_return_if_fail(object_ids != NULL && object_ids[0] != NULL);
+	g_return_if_fail(cb != NULL);
+
+	priv = MAFW_CACHING_SOURCE(source)->priv;
+	req = g_new0(struct md_request, 1);
+	req->self = g_object_ref(source);
+	req->cb = cb;
+	req->user_data = user_data;
+	req->generation = priv->generation;
+	req->keys = canonical_keys(mdkeys);
+	req->results = g_hash_table_new_full(g_str_hash, g_str_equal,
+					     (GDestroyNotify)g_free,
+					     (GDestroyNotify)
+					     mafw_metadata_release);
+
+	missing = g_ptr_array_new();
+	for (i = 0; object_ids[i]; i++) {
+		GHashTable *metadata;
+		gchar *key;
+
+		key = make_key(object_ids[i], req->keys);
+		metadata = cache_lookup(priv, key);
+		g_free(key);
+		if (metadata) {
+			priv->hits++;
+			g_hash_table_insert(req->results,
+					    g_strdup(object_ids[i]),
+					    mafw_metadata_copy(metadata));
+		} else {
+			priv->misses++;
+			g_ptr_array_add(missing, (gpointer)object_ids[i]);
+		}
+	}
+
+	if (missing->len) {
+		g_ptr_array_add(missing, NULL);
+		if (md_request_watch(req))
+			mafw_source_get_metadatas_full(priv->wrapped,
+				(const gchar **)missing->pdata, mdkeys,
+				MAFW_SOURCE_METADATAS_CONCURRENCY,
+				mafw_extension_get_timeout(
+					MAFW_EXTENSION(priv->wrapped)),
+				MAFW_SOURCE_PRIORITY_INTERACTIVE,
+				req->token, NULL,
+				(MafwSourceMetadataResultsCb)got_metadatas,
+				req);
+	} else
+		g_idle_add((GSourceFunc)emit_cached, req);
+	g_ptr_array_free(missing, TRUE);
+}
+
+/* Pass-through operations */
+/* The callback may cancel the session, freeing the relay, so it is
+ * only touched afterwards if it was unregistered before. */
+static void relay_browse_result(MafwSource *wrapped, guint browse_id,
+				gint remaining_count, guint index,
+				const gchar *object_id, GHashTable *metadata,
+				gpointer key, const GError *error)
+{
+	struct relay *relay;
+	gboolean last;
+
+	last = !remaining_count || error;
+	if (!(relay = browse_relay_get(key, browse_id, last)))
+		return;
+	((MafwSourceBrowseResultCb)relay->cb)(MAFW_SOURCE(relay->self),
+					      browse_id, remaining_count,
+					      index, object_id, metadata,
+					      relay->user_data, error);
+	if (last)
+		relay_free(relay);
+}
+
+static guint browse(MafwSource *source, const gchar *object_id,
+		    gboolean recursive, const MafwFilter *filter,
+		    const gchar *sort_criteria, const gchar *const *mdkeys,
+		    guint skip_count, guint item_count,
+		    MafwSourceBrowseResultCb cb, gpointer user_data)
+{
+	MafwCachingSource *self = MAFW_CACHING_SOURCE(source);
+	gpointer key;
+
+	key = browse_relay_new(self, cb, user_data);
+	return browse_relay_started(key,
+		mafw_source_browse(self->priv->wrapped, object_id, recursive,
+				   filter, sort_criteria, mdkeys,
+				   skip_count, item_count,
+				   (MafwSourceBrowseResultCb)
+				   relay_browse_result, key));
+}
+
+static void relay_browse_chunk(MafwSource *wrapped, guint browse_id,
+			       gint remaining_count, guint index,
+			       const gchar *const *object_ids,
+			       GHashTable **metadatas, guint nitems,
+			       gpointer key, const GError *error)
+{
+	struct relay *relay;
+	gboolean last;
+
+	last = !remaining_count || error;
+	if (!(relay = browse_relay_get(key, browse_id, last)))
+		return;
+	((MafwSourceBrowseChunkCb)relay->cb)(MAFW_SOURCE(relay->self),
+					     browse_id, remaining_count,
+					     index, object_ids, metadatas,
+					     nitems, relay->user_data, error);
+	if (last)
+		relay_free(relay);
+}
+
+static guint browse_chunked(MafwSource *source, const gchar *object_id,
+			    gboolean recursive, const MafwFilter *filter,
+			    const gchar *sort_criteria,
+			    const gchar *const *mdkeys,
+			    guint skip_count, guint item_count,
+			    guint chunk_size,
+			    MafwSourceBrowseChunkCb cb, gpointer user_data)
+{
+	MafwCachingSource *self = MAFW_CACHING_SOURCE(source);
+	gpointer key;
+
+	key = browse_relay_new(self, cb, user_data);
+	return browse_relay_started(key,
+		mafw_source_browse_chunked(self->priv->wrapped, object_id,
+					   recursive, filter, sort_criteria,
+					   mdkeys, skip_count, item_count,
+					   chunk_size,
+					   (MafwSourceBrowseChunkCb)
+					   relay_browse_chunk, key));
+}
+
+/* The wrapped source may not call back after the cancellation, so the
+ * relay is freed here, releasing its reference to the wrapper. */
+static gboolean cancel_browse(MafwSource *source, guint browse_id,
+			      GError **error)
+{
+	struct relay which;
+	gboolean ret;
+
+	ret = mafw_source_cancel_browse(
+		MAFW_CACHING_SOURCE(source)->priv->wrapped,
+		browse_id, error);
+	if (Browse_relays) {
+		which.self = MAFW_CACHING_SOURCE(source);
+		which.browse_id = browse_id;
+		g_hash_table_foreach_remove(Browse_relays,
+					    (GHRFunc)same_browse, &which);
+	}
+	return ret;
+}
+
+/* A cursor of the wrapped source, whose fetches are passed on to the
+ * callback of the current one. */
+struct cursor_relay {
+	MafwCachingSource *self;
+	MafwSourceCursor *cursor;
+	MafwSourceBrowseChunkCb cb;
+	gpointer user_data;
+};
+
+static gpointer cursor_new(MafwSource *source, const gchar *object_id,
+			   gboolean recursive, const MafwFilter *filter,
+			   const gchar *sort_criteria,
+			   const gchar *const *mdkeys)
+{
+	MafwCachingSource *self = MAFW_CACHING_SOURCE(source);
+	struct cursor_relay *relay;
+
+	relay = g_new0(struct cursor_relay, 1);
+	relay->self = self;
+	relay->cursor = mafw_source_cursor_new(self->priv->wrapped,
+					       object_id, recursive, filter,
+					       sort_criteria, mdkeys);
+	return relay;
+}
+
+static void relay_fetch(MafwSourceCursor *cursor, guint index,
+			const gchar *const *object_ids,
+			GHashTable **metadatas, guint nitems,
+			gboolean finished, struct cursor_relay *relay,
+			const GError *error)
+{
+	relay->cb(MAFW_SOURCE(relay->self), MAFW_SOURCE_INVALID_BROWSE_ID,
+		  0, index, object_ids, metadatas, nitems, relay->user_data,
+		  error);
+}
+
+static void cursor_fetch(MafwSource *source, gpointer cursor, guint count,
+			 MafwSourceBrowseChunkCb cb, gpointer user_data)
+{
+	struct cursor_relay *relay = cursor;
+
+	relay->cb = cb;
+	relay->user_data = user_data;
+	mafw_source_cursor_fetch(relay->cursor, count,
+				 (MafwSourceCursorFetchCb)relay_fetch, relay);
+}
+
+static void cursor_free(MafwSource *source, gpointer cursor)
+{
+	struct cursor_relay *relay = cursor;
+
+	mafw_source_cursor_free(relay->cursor);
+	g_free(relay);
+}
+
+static gint get_update_progress(MafwSource *source, gint *processed_items,
+				gint *remaining_items, gint *remaining_time)
+{
+	return mafw_source_get_update_progress(
+		MAFW_CACHING_SOURCE(source)->priv->wrapped,
+		processed_items, remaining_items, remaining_time);
+}
+
+static void relay_metadata_set(MafwSource *wrapped, const gchar *object_id,
+			       const gchar **failed_keys,
+			       struct relay *relay, const GError *error)
+{
+	mafw_caching_source_invalidate(relay->self, relay->object_id);
+	if (relay->cb)
+		((MafwSourceMetadataSetCb)relay->cb)(MAFW_SOURCE(relay->self),
+						     object_id, failed_keys,
+						     relay->user_data, error);
+	relay_free(relay);
+}
+
+static void set_metadata(MafwSource *source, const gchar *object_id,
+			 GHashTable *metadata, MafwSourceMetadataSetCb cb,
+			 gpointer user_data)
+{
+	MafwCachingSource *self = MAFW_CACHING_SOURCE(source);
+
+	g_return_if_fail(object_id != NULL);
+
+	/* Don't cache the old metadata being read meanwhile. */
+	mafw_caching_source_invalidate(self, object_id);
+	mafw_source_set_metadata(self->priv->wrapped, object_id, metadata,
+				 (MafwSourceMetadataSetCb)relay_metadata_set,
+				 relay_new(self, cb, user_data, object_id));
+}
+
+static void relay_object_created(MafwSource *wrapped, const gchar *object_id,
+				 struct relay *relay, const GError *error)
+{
+	/* The child count of the parent has changed. */
+	mafw_caching_source_invalidate(relay->self, relay->object_id);
+	if (relay->cb)
+		((MafwSourceObjectCreatedCb)relay->cb)(
+			MAFW_SOURCE(relay->self), object_id,
+			relay->user_data, error);
+	relay_free(relay);
+}
+
+static void create_object(MafwSource *source, const gchar *parent,
+			  GHashTable *metadata, MafwSourceObjectCreatedCb cb,
+			  gpointer user_data)
+{
+	MafwCachingSource *self = MAFW_CACHING_SOURCE(source);
+
+	g_return_if_fail(parent != NULL);
+
+	mafw_source_create_object(self->priv->wrapped, parent, metadata,
+				  (MafwSourceObjectCreatedCb)
+				  relay_object_created,
+				  relay_new(self, cb, user_data, parent));
+}
+
+static void relay_object_destroyed(MafwSource *wrapped,
+				   const gchar *object_id,
+				   struct relay *relay, const GError *error)
+{
+	mafw_caching_source_invalidate(relay->self, relay->object_id);
+	if (relay->cb)
+		((MafwSourceObjectDestroyedCb)relay->cb)(
+			MAFW_SOURCE(relay->self), object_id,
+			relay->user_data, error);
+	relay_free(relay);
+}
+
+static void destroy_object(MafwSource *source, const gchar *object_id,
+			   MafwSourceObjectDestroyedCb cb, gpointer user_data)
+{
+	MafwCachingSource *self = MAFW_CACHING_SOURCE(source);
+
+	g_return_if_fail(object_id != NULL);
+
+	mafw_source_destroy_object(self->priv->wrapped, object_id,
+				   (MafwSourceObjectDestroyedCb)
+				   relay_object_destroyed,
+				   relay_new(self, cb, user_data, object_id));
+}
+
+/* Run-time properties */
+static void set_extension_property(MafwExtension *extension,
+				   const gchar *name, const GValue *value)
+{
+	MafwCachingSourcePrivate *priv;
+
+	priv = MAFW_CACHING_SOURCE(extension)->priv;
+	if (!strcmp(name, MAFW_PROPERTY_CACHE_BUDGET)) {
+		priv->budget = g_value_get_ulong(value);
+		cache_trim(priv, priv->budget);
+	} else if (!strcmp(name, MAFW_PROPERTY_CACHE_TTL)) {
+		priv->ttl = g_value_get_uint(value);
+	} else if (!strcmp(name, MAFW_PROPERTY_CACHE_HITS)
+		   || !strcmp(name, MAFW_PROPERTY_CACHE_MISSES)) {
+		/* Read-only. */
+		return;
+	} else {
+		mafw_extension_set_property(MAFW_EXTENSION(priv->wrapped),
+					    name, value);
+		return;
+	}
+	mafw_extension_emit_property_changed(extension, name, value);
+}
+
+static void relay_property(MafwExtension *wrapped, const gchar *name,
+			   GValue *value, struct relay *relay,
+			   const GError *error)
+{
+	((MafwExtensionPropertyCallback)relay->cb)(
+		MAFW_EXTENSION(relay->self), name, value,
+		relay->user_data, error);
+	relay_free(relay);
+}
+
+static void get_extension_property(MafwExtension *extension,
+				   const gchar *name,
+				   MafwExtensionPropertyCallback cb,
+				   gpointer udata)
+{
+	MafwCachingSource *self = MAFW_CACHING_SOURCE(extension);
+	MafwCachingSourcePrivate *priv = self->priv;
+	GValue v = { 0 };
+
+	if (!strcmp(name, MAFW_PROPERTY_CACHE_HITS)) {
+		g_value_init(&v, G_TYPE_UINT);
+		g_value_set_uint(&v, priv->hits);
+	} else if (!strcmp(name, MAFW_PROPERTY_CACHE_MISSES)) {
+		g_value_init(&v, G_TYPE_UINT);
+		g_value_set_uint(&v, priv->misses);
+	} else if (!strcmp(name, MAFW_PROPERTY_CACHE_BUDGET)) {
+		g_value_init(&v, G_TYPE_ULONG);
+		g_value_set_ulong(&v, priv->budget);
+	} else if (!strcmp(name, MAFW_PROPERTY_CACHE_TTL)) {
+		g_value_init(&v, G_TYPE_UINT);
+		g_value_set_uint(&v, priv->ttl);
+	} else {
+		mafw_extension_get_property(MAFW_EXTENSION(priv->wrapped),
+					    name,
+					    (MafwExtensionPropertyCallback)
+					    relay_property,
+					    relay_new(self, cb, udata, NULL));
+		return;
+	}
+	cb(extension, name, &v, udata, NULL);
+	g_value_unset(&v);
+}
+
+/* Signals of the wrapped source */
+static void metadata_changed(MafwSource *wrapped, const gchar *object_id,
+			     MafwCachingSource *self)
+{
+	mafw_caching_source_invalidate(self, object_id);
+	g_signal_emit_by_name(self, "metadata-changed", object_id);
+}
+
+static void container_changed(MafwSource *wrapped, const gchar *object_id,
+			      MafwCachingSource *self)
+{
+	mafw_caching_source_invalidate(self, NULL);
+	g_signal_emit_by_name(self, "container-changed", object_id);
+}
+
+static void updating(MafwSource *wrapped, gint progress,
+		     gint processed_items, gint remaining_items,
+		     gint remaining_time, MafwCachingSource *self)
+{
+	g_signal_emit_by_name(self, "updating", progress, processed_items,
+			      remaining_items, remaining_time);
+}
+
+static void property_changed(MafwExtension *wrapped, const gchar *name,
+			     const GValue *value, MafwCachingSource *self)
+{
+	mafw_extension_emit_property_changed(MAFW_EXTENSION(self),
+					     name, value);
+}
+
+/* Object construction */
+static void mafw_caching_source_dispose(GObject *object)
+{
+	MafwCachingSourcePrivate *priv = MAFW_CACHING_SOURCE(object)->priv;
+	guint i;
+
+	if (priv->wrapped) {
+		for (i = 0; i < G_N_ELEMENTS(priv->handlers); i++)
+			g_signal_handler_disconnect(priv->wrapped,
+						    priv->handlers[i]);
+		g_object_unref(priv->wrapped);
+		priv->wrapped = NULL;
+	}
+	G_OBJECT_CLASS(mafw_caching_source_parent_class)->dispose(object);
+}
+
+static void mafw_caching_source_finalize(GObject *object)
+{
+	MafwCachingSourcePrivate *priv = MAFW_CACHING_SOURCE(object)->priv;
+
+	g_hash_table_destroy(priv->entries);
+	G_OBJECT_CLASS(mafw_caching_source_parent_class)->finalize(object);
+}
+
+static void mafw_caching_source_class_init(MafwCachingSourceClass *klass)
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS(klass);
+	MafwExtensionClass *extension_class = MAFW_EXTENSION_CLASS(klass);
+
+	g_type_class_add_private(klass, sizeof(MafwCachingSourcePrivate));
+
+	gobject_class->dispose = mafw_caching_source_dispose;
+	gobject_class->finalize = mafw_caching_source_finalize;
+
+	extension_class->set_extension_property = set_extension_property;
+	extension_class->get_extension_property = get_extension_property;
+
+	klass->browse = browse;
+	klass->browse_chunked = browse_chunked;
+	klass->cancel_browse = cancel_browse;
+	klass->cursor_new = cursor_new;
+	klass->cursor_fetch = cursor_fetch;
+	klass->cursor_free = cursor_free;
+	klass->get_update_progress = get_update_progress;
+	klass->get_metadata = get_metadata;
+	klass->get_metadatas = get_metadatas;
+	klass->set_metadata = set_metadata;
+	klass->create_object = create_object;
+	klass->destroy_object = destroy_object;
+}
+
+static void mafw_caching_source_init(MafwCachingSource *self)
+{
+	MafwCachingSourcePrivate *priv;
+
+	self->priv = priv = G_TYPE_INSTANCE_GET_PRIVATE(self,
+						MAFW_TYPE_CACHING_SOURCE,
+						MafwCachingSourcePrivate);
+	memset(priv, 0, sizeof(*priv));
+	priv->entries = g_hash_table_new_full(g_str_hash, g_str_equal,
+					      NULL,
+					      (GDestroyNotify)entry_free);
+	g_queue_init(&priv->lru);
+
+	mafw_extension_add_property(MAFW_EXTENSION(self),
+				    MAFW_PROPERTY_CACHE_HITS, G_TYPE_UINT);
+	mafw_extension_add_property(MAFW_EXTENSION(self),
+				    MAFW_PROPERTY_CACHE_MISSES, G_TYPE_UINT);
+	mafw_extension_add_property(MAFW_EXTENSION(self),
+				    MAFW_PROPERTY_CACHE_BUDGET, G_TYPE_ULONG);
+	mafw_extension_add_property(MAFW_EXTENSION(self),
+				    MAFW_PROPERTY_CACHE_TTL, G_TYPE_UINT);
+}
+
+/**
+ * mafw_caching_source_new:
+ * @wrapped: the #MafwSource to cache the metadata of.
+ * @budget:  the maximal size of the cache in bytes, for example
+ *           #MAFW_CACHING_SOURCE_DEFAULT_BUDGET.
+ * @ttl:     the number of seconds to serve cached metadata for, or
+ *           zero to keep it until invalidated.
+ *
+ * Creates a #MafwCachingSource wrapping @wrapped, which is referenced
+ * for the lifetime of the wrapper.  The run-time properties of
+ * @wrapped are available through the wrapper too.
+ *
+ * Returns: a new #MafwCachingSource
+ */
+MafwSource *mafw_caching_source_new(MafwSource *wrapped,
+				    gsize budget, guint ttl)
+{
+	MafwCachingSource *self;
+	MafwCachingSourcePrivate *priv;
+	const GPtrArray *props;
+	guint i;
+
+	g_return_val_if_fail(MAFW_IS_SOURCE(wrapped), NULL);
+
+	self = g_object_new(MAFW_TYPE_CACHING_SOURCE,
+			    "uuid", mafw_extension_get_uuid(
+				    MAFW_EXTENSION(wrapped)),
+			    "name", mafw_extension_get_name(
+				    MAFW_EXTENSION(wrapped)),
+			    "plugin", mafw_extension_get_plugin(
+				    MAFW_EXTENSION(wrapped)),
+			    NULL);
+	priv = self->priv;
+	priv->wrapped = g_object_ref_sink(wrapped);
+	priv->budget = budget;
+	priv->ttl = ttl;
+
+	props = mafw_extension_list_properties(MAFW_EXTENSION(wrapped));
+	for (i = 0; props && i < props->len; i++) {
+		const MafwExtensionProperty *p = props->pdata[i];
+
+		mafw_extension_add_property(MAFW_EXTENSION(self),
+					    p->name, p->type);
+	}
+
+	priv->handlers[0] = g_signal_connect(wrapped, "metadata-changed",
+					     G_CALLBACK(metadata_changed),
+					     self);
+	priv->handlers[1] = g_signal_connect(wrapped, "container-changed",
+					     G_CALLBACK(container_changed),
+					     self);
+	priv->handlers[2] = g_signal_connect(wrapped, "updating",
+					     G_CALLBACK(updating), self);
+	priv->handlers[3] = g_signal_connect(wrapped, "property-changed",
+					     G_CALLBACK(property_changed),
+					     self);
+	return MAFW_SOURCE(self);
+}
+
+/**
+ * mafw_caching_source_get_wrapped:
+ * @self: a #MafwCachingSource instance.
+ *
+ * Returns: the #MafwSource wrapped by @self.  It is not referenced.
+ */
+MafwSource *mafw_caching_source_get_wrapped(MafwCachingSource *self)
+{
+	g_return_val_if_fail(MAFW_IS_CACHING_SOURCE(self), NULL);
+	return self->priv->wrapped;
+}
+
+/* vi: set noexpandtab ts=8 sw=8 cino=t0,(0: */
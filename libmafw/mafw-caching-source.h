@@ -0,0 +1,121 @@
+/*
+ * This file is a part of MAFW
+ *
+ * Copyright (C) 2007, 2008, 2009 Nokia Corporation, all rights reserved.
+ *
+ * Contact: Visa Smolander <visa.smolander@nokia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#ifndef __MAFW_CACHING_SOURCE_H__
+#define __MAFW_CACHING_SOURCE_H__
+
+#include <glib.h>
+#include <glib-object.h>
+
+#include <libmafw/mafw-source.h>
+
+G_BEGIN_DECLS
+
+#define MAFW_TYPE_CACHING_SOURCE		\
+        (mafw_caching_source_get_type ())
+#define MAFW_CACHING_SOURCE(obj)					\
+        (G_TYPE_CHECK_INSTANCE_CAST ((obj), MAFW_TYPE_CACHING_SOURCE,	\
+				     MafwCachingSource))
+#define MAFW_IS_CACHING_SOURCE(obj)				\
+        (G_TYPE_CHECK_INSTANCE_TYPE ((obj), MAFW_TYPE_CACHING_SOURCE))
+
+typedef struct _MafwCachingSource MafwCachingSource;
+typedef struct _MafwCachingSourcePrivate MafwCachingSourcePrivate;
+
+/**
+ * MAFW_CACHING_SOURCE_DEFAULT_BUDGET:
+ *
+ * A reasonable cache size in bytes for mafw_caching_source_new().
+ */
+#define MAFW_CACHING_SOURCE_DEFAULT_BUDGET (256 * 1024)
+
+/**
+ * MAFW_CACHING_SOURCE_DEFAULT_TTL:
+ *
+ * A reasonable lifetime of the cached metadata in seconds for
+ * mafw_caching_source_new().
+ */
+#define MAFW_CACHING_SOURCE_DEFAULT_TTL (60)
+
+/**
+ * MAFW_PROPERTY_CACHE_HITS:
+ *
+ * Read-only property telling how many metadata requests were answered
+ * from the cache.  In mafw_source_get_metadatas() every object counts.
+ * Type: #G_TYPE_UINT
+ */
+#define MAFW_PROPERTY_CACHE_HITS "cache-hits"
+
+/**
+ * MAFW_PROPERTY_CACHE_MISSES:
+ *
+ * Read-only property telling how many metadata requests were passed
+ * on to the wrapped source.
+ * Type: #G_TYPE_UINT
+ */
+#define MAFW_PROPERTY_CACHE_MISSES "cache-misses"
+
+/**
+ * MAFW_PROPERTY_CACHE_BUDGET:
+ *
+ * The maximal size of the cached metadata in bytes.  Setting it to
+ * zero disables caching.
+ * Type: #G_TYPE_ULONG
+ */
+#define MAFW_PROPERTY_CACHE_BUDGET "cache-budget"
+
+/**
+ * MAFW_PROPERTY_CACHE_TTL:
+ *
+ * The time in seconds cached metadata is served for.  Zero means
+ * it is kept until invalidated or evicted.
+ * Type: #G_TYPE_UINT
+ */
+#define MAFW_PROPERTY_CACHE_TTL "cache-ttl"
+
+/**
+ * MafwCachingSource:
+ *
+ * MafwCachingSource object structure
+ */
+struct _MafwCachingSource {
+	MafwSource parent;
+
+	/*< private >*/
+	MafwCachingSourcePrivate *priv;
+};
+
+extern GType mafw_caching_source_get_type(void);
+
+extern MafwSource *mafw_caching_source_new(MafwSource *wrapped,
+					   gsize budget, guint ttl);
+extern MafwSource *mafw_caching_source_get_wrapped(MafwCachingSource *self);
+extern void mafw_caching_source_invalidate(MafwCachingSource *self,
+					   const gchar *object_id);
+
+G_END_DECLS
+
+#endif
+
+/* vi: set noexpandtab ts=8 sw=8 cino=t0,(0: */
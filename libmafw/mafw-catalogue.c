@@ -0,0 +1,990 @@
+/*
+ * This file is a part of MAFW
+ *
+ * Copyright (C) 2007, 2008, 2009 Nokia Corporation, all rights reserved.
+ *
+ * Contact: Visa Smolander <visa.smolander@nokia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+#include <glib-object.h>
+
+#include "mafw-catalogue.h"
+#include "mafw-metadata.h"
+
+/**
+ * SECTION: mafwcatalogue
+ * @short_description: in-memory metadata catalogue
+ * @see_also: #MafwSource, #MafwFilter
+ *
+ * #MafwCatalogue is a helper for sources keeping the metadata of their
+ * objects in memory.  Sources feed it with (object ID, metadata) pairs
+ * with mafw_catalogue_add(), and can answer browse requests with
+ * mafw_catalogue_query(), which takes the filter, sorting criteria,
+ * skip and item counts of mafw_source_browse().
+ *
+ * Instead of evaluating the filter against every object, the catalogue
+ * maintains indexes for each metadata key: a hash index for equality,
+ * a sorted one for `&lt;' and `&gt;', and a trigram index for
+ * approximate matching.  These are used to narrow down the candidates,
+ * which are then checked with mafw_metadata_filter_batch(), so the
+ * results are exactly the same as if mafw_metadata_filter() was called
+ * for all objects.  Notably, objects lacking a key referred by a simple
+ * expression are always candidates, since such expressions are ignored
+ * by mafw_metadata_filter().  Indexes are built only for keys whose
+ * values are all strings or all integers.
+ *
+ * The catalogue is not thread-safe.
+ */
+
+#undef  G_LOG_DOMAIN
+#define G_LOG_DOMAIN		"mafw-catalogue"
+
+/* Bitmaps of rows are arrays of words. */
+#define WORD_BITS		(8 * sizeof(gulong))
+#define NWORDS(n)		(((n) + WORD_BITS - 1) / WORD_BITS)
+#define BIT(i)			(1UL << ((i) % WORD_BITS))
+
+/* Private variables */
+/* An object of the catalogue. */
+typedef struct {
+	gchar *objectid;
+	GHashTable *md;
+	guint rowid;
+} Row;
+
+/* An entry of Column::sorted. */
+typedef struct {
+	union {
+		/* Borrowed from Column::eq. */
+		const gchar *skey;
+		gint ival;
+	};
+	guint row;
+} SortedEntry;
+
+/*
+ * Indexes of a metadata key.  @eq maps index keys (see index_key())
+ * or integers to the array of rows having that value, while @trigrams
+ * maps trigrams of folded strings (see fold()) to the rows containing
+ * them.  Rows are appended in increasing order, and those of removed
+ * objects are only masked with Catalogue::alive, until the catalogue
+ * is rebuilt.  @sorted is sorted lazily, equal values in row order.
+ * @multi tells that some rows have more than one value or a %NULL
+ * string, so @sorted can't order them like mafw_metadata_compare().
+ */
+typedef struct {
+	enum {
+		COL_NONE,
+		COL_STRING,
+		COL_INT,
+		/* Mixed or unsupported types, not indexed. */
+		COL_OTHER,
+	} type;
+
+	GArray *present;
+	GHashTable *eq;
+	GArray *sorted;
+	gboolean sorted_dirty;
+	gboolean multi;
+	GHashTable *trigrams;
+} Column;
+
+/**
+ * MafwCatalogue:
+ *
+ * Opaque structure of an in-memory metadata catalogue.
+ */
+struct _MafwCatalogue {
+	/* Row:s indexed by their row number, NULL for removed ones. */
+	GPtrArray *rows;
+	/* Object ID -> row number + 1 */
+	GHashTable *ids;
+	/* Metadata key -> Column */
+	GHashTable *columns;
+	/* Bitmap of the rows which are not removed. */
+	GArray *alive;
+	guint nalive;
+};
+
+/* Program code */
+/* Bitmaps */
+static void bitmap_set(GArray *bitmap, guint i)
+{
+	if (bitmap->len <= i / WORD_BITS)
+		g_array_set_size(bitmap, i / WORD_BITS + 1);
+	g_array_index(bitmap, gulong, i / WORD_BITS) |= BIT(i);
+}
+
+static void bitmap_clear(GArray *bitmap, guint i)
+{
+	if (i / WORD_BITS < bitmap->len)
+		g_array_index(bitmap, gulong, i / WORD_BITS) &= ~BIT(i);
+}
+
+static inline gulong bitmap_word(GArray *bitmap, guint w)
+{
+	return w < bitmap->len ? g_array_index(bitmap, gulong, w) : 0;
+}
+
+/* Sets the bits of the rows in the $posting list in $bits. */
+static void bitmap_add_posting(gulong *bits, GArray *posting)
+{
+	guint i, row;
+
+	for (i = 0; i < posting->len; i++) {
+		row = g_array_index(posting, guint, i);
+		bits[row / WORD_BITS] |= BIT(row);
+	}
+}
+
+/* Index keys */
+/*
+ * mafw_metadata_ordered() considers two strings equal if their
+ * collation keys are equal ignoring their case, so index them
+ * by the lower-case collation key.
+ */
+static gchar *index_key(const gchar *str)
+{
+	gchar *key, *lkey;
+
+	key = g_utf8_collate_key(str, -1);
+	lkey = g_ascii_strdown(key, -1);
+	g_free(key);
+	return lkey;
+}
+
+/* Folds $str the same way mafw_filter_glob_match() does. */
+static gchar *fold(const gchar *str, gssize len)
+{
+	gchar *folded, *normalized;
+
+	folded = g_utf8_casefold(str, len);
+	normalized = g_utf8_normalize(folded, -1,
+				      G_NORMALIZE_ALL_COMPOSE);
+	if (normalized) {
+		g_free(folded);
+		return normalized;
+	}
+
+	/* Invalid UTF-8, mafw_filter_glob_match() folds it byte-wise. */
+	g_free(folded);
+	return g_ascii_strdown(str, len);
+}
+
+#define TRIGRAM(s)	GUINT_TO_POINTER(((guint)(guchar)(s)[0] << 16) \
+					 | ((guint)(guchar)(s)[1] << 8) \
+					 | (guint)(guchar)(s)[2])
+
+/* Appends $row to the posting list of $key in $index. */
+static void posting_add(GHashTable *index, gpointer key, guint row)
+{
+	GArray *posting;
+
+	if (!(posting = g_hash_table_lookup(index, key))) {
+		posting = g_array_new(FALSE, FALSE, sizeof(guint));
+		g_hash_table_insert(index, key, posting);
+	}
+	if (!posting->len
+	    || g_array_index(posting, guint, posting->len - 1) != row)
+		g_array_append_val(posting, row);
+}
+
+static void posting_free(GArray *posting)
+{
+	g_array_free(posting, TRUE);
+}
+
+/* Columns */
+static Column *column_new(void)
+{
+	Column *col;
+
+	col = g_new0(Column, 1);
+	col->present = g_array_new(FALSE, TRUE, sizeof(gulong));
+	return col;
+}
+
+static void column_drop_indexes(Column *col)
+{
+	if (col->sorted)
+		g_array_free(col->sorted, TRUE);
+	if (col->eq)
+		g_hash_table_destroy(col->eq);
+	if (col->trigrams)
+		g_hash_table_destroy(col->trigrams);
+	col->sorted = NULL;
+	col->eq = col->trigrams = NULL;
+}
+
+static void column_free(Column *col)
+{
+	column_drop_indexes(col);
+	g_array_free(col->present, TRUE);
+	g_free(col);
+}
+
+/* Decides the type of $col by the first value it sees. */
+static void column_init(Column *col, GType vtype)
+{
+	col->sorted = g_array_new(FALSE, FALSE, sizeof(SortedEntry));
+	if (vtype == G_TYPE_STRING) {
+		col->type = COL_STRING;
+		col->eq = g_hash_table_new_full(
+					g_str_hash, g_str_equal, g_free,
+					(GDestroyNotify)posting_free);
+		col->trigrams = g_hash_table_new_full(
+					g_direct_hash, g_direct_equal, NULL,
+					(GDestroyNotify)posting_free);
+	} else if (vtype == G_TYPE_INT) {
+		col->type = COL_INT;
+		col->eq = g_hash_table_new_full(
+					g_direct_hash, g_direct_equal, NULL,
+					(GDestroyNotify)posting_free);
+	} else {
+		col->type = COL_OTHER;
+		g_array_free(col->sorted, TRUE);
+		col->sorted = NULL;
+	}
+}
+
+static void column_index_value(Column *col, const GValue *val, guint row)
+{
+	SortedEntry entry;
+
+	if (col->type == COL_NONE)
+		column_init(col, G_VALUE_TYPE(val));
+	if ((col->type == COL_STRING && !G_VALUE_HOLDS_STRING(val))
+	    || (col->type == COL_INT && !G_VALUE_HOLDS_INT(val))) {
+		/* Mixed types, give up indexing this key. */
+		column_drop_indexes(col);
+		col->type = COL_OTHER;
+	}
+
+	if (col->type == COL_STRING) {
+		const gchar *str;
+		gchar *key, *folded;
+		gpointer orig;
+		gsize i, len;
+
+		if (!(str = g_value_get_string(val))) {
+			col->multi = TRUE;
+			return;
+		}
+
+		/* Reuse the key if it's already in the index. */
+		key = index_key(str);
+		if (g_hash_table_lookup_extended(col->eq, key, &orig, NULL)) {
+			g_free(key);
+			key = orig;
+		}
+		posting_add(col->eq, key, row);
+		entry.skey = key;
+
+		folded = fold(str, -1);
+		len = strlen(folded);
+		for (i = 0; i + 3 <= len; i++)
+			posting_add(col->trigrams, TRIGRAM(&folded[i]), row);
+		g_free(folded);
+	} else if (col->type == COL_INT) {
+		entry.ival = g_value_get_int(val);
+		posting_add(col->eq, GINT_TO_POINTER(entry.ival), row);
+	} else
+		return;
+
+	entry.row = row;
+	g_array_append_val(col->sorted, entry);
+	col->sorted_dirty = TRUE;
+}
+
+static gint sorted_cmp_str(const SortedEntry *a, const SortedEntry *b)
+{
+	return strcmp(a->skey, b->skey);
+}
+
+static gint sorted_cmp_int(const SortedEntry *a, const SortedEntry *b)
+{
+	return a->ival < b->ival ? -1 : a->ival > b->ival;
+}
+
+/* Orders equal values by their rows. */
+static gint sorted_order(const SortedEntry *a, const SortedEntry *b,
+			 Column *col)
+{
+	gint cmp;
+
+	cmp = col->type == COL_STRING
+		? sorted_cmp_str(a, b) : sorted_cmp_int(a, b);
+	return cmp ? cmp : a->row < b->row ? -1 : a->row > b->row;
+}
+
+static void column_sort(Column *col)
+{
+	if (!col->sorted_dirty)
+		return;
+	g_array_sort_with_data(col->sorted, (GCompareDataFunc)sorted_order,
+			       col);
+	col->sorted_dirty = FALSE;
+}
+
+/* Returns whether the $i:th and $j:th entries of sorted $col are equal. */
+static gboolean column_same(Column *col, guint i, guint j)
+{
+	const SortedEntry *a, *b;
+
+	a = &g_array_index(col->sorted, SortedEntry, i);
+	b = &g_array_index(col->sorted, SortedEntry, j);
+	return col->type == COL_STRING
+		? !sorted_cmp_str(a, b) : a->ival == b->ival;
+}
+
+/*
+ * Returns the index of the first entry of the sorted $col which is
+ * not less than $rhs, or if $after, which is greater than $rhs.
+ */
+static guint column_bound(Column *col, const SortedEntry *rhs,
+			  gboolean after)
+{
+	guint lo, hi, mid;
+	gint cmp;
+
+	lo = 0;
+	hi = col->sorted->len;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (col->type == COL_STRING)
+			cmp = sorted_cmp_str(&g_array_index(col->sorted,
+							    SortedEntry, mid),
+					     rhs);
+		else
+			cmp = sorted_cmp_int(&g_array_index(col->sorted,
+							    SortedEntry, mid),
+					     rhs);
+		if (cmp < 0 || (after && cmp == 0))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* Rows */
+static void index_row(MafwCatalogue *cat, guint row, GHashTable *md)
+{
+	GHashTableIter iter;
+	gpointer key, vals;
+
+	g_hash_table_iter_init(&iter, md);
+	while (g_hash_table_iter_next(&iter, &key, &vals)) {
+		Column *col;
+		guint i;
+
+		if (!(col = g_hash_table_lookup(cat->columns, key))) {
+			col = column_new();
+			g_hash_table_insert(cat->columns, g_strdup(key), col);
+		}
+		bitmap_set(col->present, row);
+		if (((GValueArray *)vals)->n_values != 1)
+			col->multi = TRUE;
+		for (i = 0; i < ((GValueArray *)vals)->n_values; i++)
+			column_index_value(col, g_value_array_get_nth(vals, i),
+					   row);
+	}
+}
+
+static void row_free(Row *row)
+{
+	if (!row)
+		return;
+	g_free(row->objectid);
+	g_hash_table_unref(row->md);
+	g_free(row);
+}
+
+/* Renumbers the rows leaving out the removed ones and rebuilds
+ * the indexes from scratch. */
+static void rebuild(MafwCatalogue *cat)
+{
+	GPtrArray *old;
+	guint i;
+
+	old = cat->rows;
+	cat->rows = g_ptr_array_new();
+	g_hash_table_remove_all(cat->ids);
+	g_hash_table_remove_all(cat->columns);
+	g_array_set_size(cat->alive, 0);
+	cat->nalive = 0;
+
+	for (i = 0; i < old->len; i++) {
+		Row *row;
+
+		if (!(row = g_ptr_array_index(old, i)))
+			continue;
+		g_hash_table_insert(cat->ids, row->objectid,
+				    GUINT_TO_POINTER(cat->rows->len + 1));
+		bitmap_set(cat->alive, cat->rows->len);
+		row->rowid = cat->rows->len;
+		index_row(cat, cat->rows->len, row->md);
+		g_ptr_array_add(cat->rows, row);
+		cat->nalive++;
+	}
+	g_ptr_array_free(old, TRUE);
+}
+
+/* Query evaluation */
+/* Returns the value of the upper-case hex digit $c or -1. */
+static gint unhex(gchar c)
+{
+	if ('0' <= c && c <= '9')
+		return c - '0';
+	else if ('A' <= c && c <= 'F')
+		return c - 'A' + 10;
+	else
+		return -1;
+}
+
+/*
+ * Computes the rows of the string $col which may match the approximate
+ * $pattern into $bits: those containing all trigrams of the literal
+ * parts of $pattern.  Returns FALSE if there are no such trigrams.
+ */
+static gboolean column_approx(Column *col, const gchar *pattern,
+			      gulong *bits, guint nwords)
+{
+	gulong *acc, *tri;
+	GString *lit;
+	gboolean found;
+	const gchar *p;
+	guint w;
+
+	acc = g_new(gulong, nwords);
+	tri = g_new(gulong, nwords);
+	lit = g_string_new("");
+	found = FALSE;
+	for (p = pattern; ; p++) {
+		gchar *folded;
+		gsize i, len;
+
+		if (*p && *p != '*' && *p != '?') {
+			gint hi, lo;
+
+			/* Unescape like mafw_filter_glob_new(). */
+			if (*p == '\\' && (hi = unhex(p[1])) >= 0
+			    && (lo = unhex(p[2])) >= 0) {
+				g_string_append_c(lit, hi << 4 | lo);
+				p += 2;
+			} else
+				g_string_append_c(lit, *p);
+			continue;
+		}
+
+		/* End of a literal part. */
+		folded = fold(lit->str, lit->len);
+		len = strlen(folded);
+		for (i = 0; i + 3 <= len; i++) {
+			GArray *posting;
+
+			memset(tri, 0, sizeof(*tri) * nwords);
+			posting = g_hash_table_lookup(col->trigrams,
+						      TRIGRAM(&folded[i]));
+			if (posting)
+				bitmap_add_posting(tri, posting);
+			if (!found) {
+				memcpy(acc, tri, sizeof(*acc) * nwords);
+				found = TRUE;
+			} else
+				for (w = 0; w < nwords; w++)
+					acc[w] &= tri[w];
+		}
+		g_free(folded);
+		g_string_truncate(lit, 0);
+
+		if (!*p)
+			break;
+	}
+
+	if (found)
+		for (w = 0; w < nwords; w++)
+			bits[w] |= acc[w];
+
+	g_string_free(lit, TRUE);
+	g_free(acc);
+	g_free(tri);
+	return found;
+}
+
+/*
+ * Adds the rows of $col for which the simple expression $filter may
+ * hold to $bits, or returns FALSE if the indexes can't tell.
+ */
+static gboolean column_lookup(Column *col, const MafwFilter *filter,
+			      gulong *bits, guint nwords)
+{
+	SortedEntry rhs;
+	GArray *posting;
+	guint i, from, to;
+	gchar *key;
+
+	if (!filter->value)
+		return FALSE;
+
+	key = NULL;
+	if (col->type == COL_INT) {
+		/* Convert like mafw_metadata_filter() does. */
+		rhs.ival = atoi(filter->value);
+		if (filter->type == mafw_f_eq
+		    || filter->type == mafw_f_approx) {
+			posting = g_hash_table_lookup(
+					col->eq, GINT_TO_POINTER(rhs.ival));
+			if (posting)
+				bitmap_add_posting(bits, posting);
+			return TRUE;
+		}
+	} else if (col->type == COL_STRING) {
+		if (filter->type == mafw_f_approx)
+			return column_approx(col, filter->value, bits, nwords);
+
+		key = index_key(filter->value);
+		if (filter->type == mafw_f_eq) {
+			posting = g_hash_table_lookup(col->eq, key);
+			if (posting)
+				bitmap_add_posting(bits, posting);
+			g_free(key);
+			return TRUE;
+		}
+		rhs.skey = key;
+	} else
+		return FALSE;
+
+	/* Range expressions. */
+	column_sort(col);
+	if (filter->type == mafw_f_lt) {
+		from = 0;
+		to = column_bound(col, &rhs, FALSE);
+	} else {
+		g_assert(filter->type == mafw_f_gt);
+		from = column_bound(col, &rhs, TRUE);
+		to = col->sorted->len;
+	}
+	for (i = from; i < to; i++) {
+		guint row;
+
+		row = g_array_index(col->sorted, SortedEntry, i).row;
+		bits[row / WORD_BITS] |= BIT(row);
+	}
+	g_free(key);
+	return TRUE;
+}
+
+/*
+ * Returns the bitmap of rows for which $filter does not evaluate to
+ * FALSE according to the indexes.  This is a superset of the rows
+ * mafw_metadata_filter() would accept.
+ */
+static gulong *candidates(MafwCatalogue *cat, const MafwFilter *filter,
+			  guint nwords)
+{
+	gulong *bits, *part;
+	Column *col;
+	guint i, w;
+
+	bits = g_new0(gulong, nwords);
+	switch (filter->type) {
+	case mafw_f_and:
+		for (w = 0; w < nwords; w++)
+			bits[w] = bitmap_word(cat->alive, w);
+		for (i = 0; filter->parts[i]; i++) {
+			part = candidates(cat, filter->parts[i], nwords);
+			for (w = 0; w < nwords; w++)
+				bits[w] &= part[w];
+			g_free(part);
+		}
+		return bits;
+	case mafw_f_or:
+		for (i = 0; filter->parts[i]; i++) {
+			part = candidates(cat, filter->parts[i], nwords);
+			for (w = 0; w < nwords; w++)
+				bits[w] |= part[w];
+			g_free(part);
+		}
+		return bits;
+	case mafw_f_exists:
+		if ((col = g_hash_table_lookup(cat->columns, filter->key)))
+			for (w = 0; w < nwords; w++)
+				bits[w] = bitmap_word(col->present, w);
+		return bits;
+	default:
+		break;
+	}
+
+	col = NULL;
+	if (MAFW_FILTER_IS_SIMPLE(filter))
+		col = g_hash_table_lookup(cat->columns, filter->key);
+	if (col && column_lookup(col, filter, bits, nwords)) {
+		/* Those not having the key are undecidable, so they
+		 * match as far as mafw_metadata_filter() is concerned. */
+		for (w = 0; w < nwords; w++)
+			bits[w] |= ~bitmap_word(col->present, w);
+	} else {
+		/* Negations, unknown keys and unindexed columns. */
+		for (w = 0; w < nwords; w++)
+			bits[w] = ~0UL;
+	}
+	return bits;
+}
+
+/* Sorts rows by the terms passed in $terms. */
+static gint compare_rows(gconstpointer a, gconstpointer b, gpointer terms)
+{
+	const Row *ra = *(const Row **)a, *rb = *(const Row **)b;
+
+	return mafw_metadata_compare(ra->md, rb->md,
+				     (const gchar *const *)terms, NULL);
+}
+
+/* Sorts the rows of $rows from $start on by $terms, if there are any. */
+static void sort_run(GPtrArray *rows, guint start, gchar **terms)
+{
+	if (terms[0] && rows->len - start > 1)
+		g_qsort_with_data(&rows->pdata[start], rows->len - start,
+				  sizeof(gpointer), compare_rows, terms);
+}
+
+/*
+ * Sorts $matches, which are in row order, by walking the sorted index
+ * of the key of the first of $terms instead of comparing the rows.
+ * The rows equal by that key are sorted by the rest of $terms.
+ * Returns FALSE if the key is not indexed or it's cheaper to sort
+ * $matches by comparison.
+ */
+static gboolean sort_by_index(MafwCatalogue *cat, GPtrArray *matches,
+			      gchar **terms)
+{
+	const gchar *key;
+	GPtrArray *sorted;
+	gboolean desc;
+	Column *col;
+	gulong *bits;
+	guint i, j, n, lo, hi, row, start;
+
+	key = terms[0];
+	desc = key[0] == '-';
+	if (key[0] == '+' || key[0] == '-')
+		key++;
+	col = g_hash_table_lookup(cat->columns, key);
+	if (!col || !col->sorted || col->multi)
+		return FALSE;
+	/* Comparing a handful of rows beats walking the whole index. */
+	if (matches->len < 2 || col->sorted->len / 32 > matches->len)
+		return FALSE;
+
+	bits = g_new0(gulong, NWORDS(cat->rows->len));
+	for (i = 0; i < matches->len; i++) {
+		row = ((Row *)g_ptr_array_index(matches, i))->rowid;
+		bits[row / WORD_BITS] |= BIT(row);
+	}
+
+	/* Take the matches group by group of equal values, keeping
+	 * each group in row order, like a stable sort would. */
+	column_sort(col);
+	sorted = g_ptr_array_sized_new(matches->len);
+	n = col->sorted->len;
+	for (i = 0; i < n; i += hi - lo) {
+		if (!desc) {
+			lo = i;
+			for (hi = lo + 1; hi < n && column_same(col, lo, hi);
+			     hi++)
+				;
+		} else {
+			hi = n - i;
+			for (lo = hi - 1; lo > 0
+			     && column_same(col, lo - 1, hi - 1); lo--)
+				;
+		}
+
+		start = sorted->len;
+		for (j = lo; j < hi; j++) {
+			row = g_array_index(col->sorted, SortedEntry, j).row;
+			if (!(bits[row / WORD_BITS] & BIT(row)))
+				continue;
+			bits[row / WORD_BITS] &= ~BIT(row);
+			g_ptr_array_add(sorted,
+					g_ptr_array_index(cat->rows, row));
+		}
+		sort_run(sorted, start, &terms[1]);
+	}
+
+	/* Those lacking the key sort after the rest either way. */
+	start = sorted->len;
+	for (i = 0; i < matches->len; i++) {
+		row = ((Row *)g_ptr_array_index(matches, i))->rowid;
+		if (bits[row / WORD_BITS] & BIT(row))
+			g_ptr_array_add(sorted,
+					g_ptr_array_index(matches, i));
+	}
+	sort_run(sorted, start, &terms[1]);
+
+	g_assert(sorted->len == matches->len);
+	memcpy(matches->pdata, sorted->pdata,
+	       sizeof(gpointer) * matches->len);
+	g_ptr_array_free(sorted, TRUE);
+	g_free(bits);
+	return TRUE;
+}
+
+/* Interface functions */
+/**
+ * mafw_catalogue_new:
+ *
+ * Creates an empty catalogue.
+ *
+ * Returns: a new #MafwCatalogue
+ */
+MafwCatalogue *mafw_catalogue_new(void)
+{
+	MafwCatalogue *cat;
+
+	cat = g_new0(MafwCatalogue, 1);
+	cat->rows = g_ptr_array_new();
+	cat->ids = g_hash_table_new(g_str_hash, g_str_equal);
+	cat->columns = g_hash_table_new_full(g_str_hash, g_str_equal,
+					     g_free,
+					     (GDestroyNotify)column_free);
+	cat->alive = g_array_new(FALSE, TRUE, sizeof(gulong));
+	return cat;
+}
+
+/**
+ * mafw_catalogue_free:
+ * @cat: a #MafwCatalogue
+ *
+ * Frees @cat and releases the metadata of all its objects.
+ */
+void mafw_catalogue_free(MafwCatalogue *cat)
+{
+	if (!cat)
+		return;
+	g_ptr_array_foreach(cat->rows, (GFunc)row_free, NULL);
+	g_ptr_array_free(cat->rows, TRUE);
+	g_hash_table_destroy(cat->ids);
+	g_hash_table_destroy(cat->columns);
+	g_array_free(cat->alive, TRUE);
+	g_free(cat);
+}
+
+/**
+ * mafw_catalogue_add:
+ * @cat:      a #MafwCatalogue
+ * @objectid: object ID
+ * @metadata: mafw metadata hash table of the object
+ *
+ * Adds an object to @cat, replacing it if it was already present.
+ * @metadata is referenced and must not be modified afterwards, since
+ * the indexes would not follow the changes.  Call this function again
+ * with the updated metadata instead.
+ */
+void mafw_catalogue_add(MafwCatalogue *cat, const gchar *objectid,
+			GHashTable *metadata)
+{
+	Row *row;
+	guint rowid;
+
+	g_return_if_fail(cat != NULL);
+	g_return_if_fail(objectid != NULL);
+	g_return_if_fail(metadata != NULL);
+
+	mafw_catalogue_remove(cat, objectid);
+
+	row = g_new(Row, 1);
+	row->objectid = g_strdup(objectid);
+	row->md = g_hash_table_ref(metadata);
+
+	rowid = row->rowid = cat->rows->len;
+	g_ptr_array_add(cat->rows, row);
+	g_hash_table_insert(cat->ids, row->objectid,
+			    GUINT_TO_POINTER(rowid + 1));
+	bitmap_set(cat->alive, rowid);
+	cat->nalive++;
+	index_row(cat, rowid, metadata);
+}
+
+/**
+ * mafw_catalogue_remove:
+ * @cat:      a #MafwCatalogue
+ * @objectid: object ID
+ *
+ * Removes an object from @cat.
+ *
+ * Returns: %TRUE if @objectid was found.
+ */
+gboolean mafw_catalogue_remove(MafwCatalogue *cat, const gchar *objectid)
+{
+	guint rowid;
+
+	g_return_val_if_fail(cat != NULL, FALSE);
+
+	if (!(rowid = GPOINTER_TO_UINT(g_hash_table_lookup(cat->ids,
+							   objectid))))
+		return FALSE;
+	rowid--;
+
+	g_hash_table_remove(cat->ids, objectid);
+	row_free(g_ptr_array_index(cat->rows, rowid));
+	g_ptr_array_index(cat->rows, rowid) = NULL;
+	bitmap_clear(cat->alive, rowid);
+	cat->nalive--;
+
+	/* The indexes still refer to removed rows.  Once they
+	 * outnumber the live ones it's time to clean up. */
+	if (cat->rows->len - cat->nalive > MAX(cat->nalive, 64))
+		rebuild(cat);
+	return TRUE;
+}
+
+/**
+ * mafw_catalogue_lookup:
+ * @cat:      a #MafwCatalogue
+ * @objectid: object ID
+ *
+ * Returns: the metadata of @objectid, or %NULL if it's not in @cat.
+ * The hash table is owned by @cat.
+ */
+GHashTable *mafw_catalogue_lookup(MafwCatalogue *cat, const gchar *objectid)
+{
+	guint rowid;
+
+	g_return_val_if_fail(cat != NULL, NULL);
+
+	if (!(rowid = GPOINTER_TO_UINT(g_hash_table_lookup(cat->ids,
+							   objectid))))
+		return NULL;
+	return ((Row *)g_ptr_array_index(cat->rows, rowid - 1))->md;
+}
+
+/**
+ * mafw_catalogue_size:
+ * @cat: a #MafwCatalogue
+ *
+ * Returns: the number of objects in @cat.
+ */
+guint mafw_catalogue_size(MafwCatalogue *cat)
+{
+	g_return_val_if_fail(cat != NULL, 0);
+	return cat->nalive;
+}
+
+/**
+ * mafw_catalogue_query:
+ * @cat:           a #MafwCatalogue
+ * @filter:        a #MafwFilter, or %NULL
+ * @sort_criteria: sort criteria as passed to mafw_source_browse(),
+ *                 or %NULL
+ * @skip_count:    the number of matching objects to skip
+ * @item_count:    the maximal number of objects to return, or 0 for all
+ * @total:         return location of the number of all matching objects,
+ *                 or %NULL
+ *
+ * Finds the objects of @cat matching @filter, ordered by @sort_criteria,
+ * like mafw_metadata_filter() and mafw_metadata_compare() would.  Objects
+ * sorting equally are returned in the order they were added.
+ *
+ * Returns: a #GPtrArray of object IDs, owned by @cat and valid until it
+ * is modified.  Free the array with g_ptr_array_free().
+ */
+GPtrArray *mafw_catalogue_query(MafwCatalogue *cat, const MafwFilter *filter,
+				const gchar *sort_criteria,
+				guint skip_count, guint item_count,
+				guint *total)
+{
+	GPtrArray *matches, *ret;
+	guint i, nwords;
+	gulong *bits;
+
+	g_return_val_if_fail(cat != NULL, NULL);
+
+	/* Narrow down the candidates with the indexes. */
+	nwords = NWORDS(cat->rows->len);
+	if (filter) {
+		bits = candidates(cat, filter, nwords);
+		for (i = 0; i < nwords; i++)
+			bits[i] &= bitmap_word(cat->alive, i);
+	} else {
+		bits = g_new(gulong, nwords);
+		for (i = 0; i < nwords; i++)
+			bits[i] = bitmap_word(cat->alive, i);
+	}
+	matches = g_ptr_array_new();
+	for (i = 0; i < cat->rows->len; i++)
+		if (bits[i / WORD_BITS] & BIT(i))
+			g_ptr_array_add(matches,
+					g_ptr_array_index(cat->rows, i));
+	g_free(bits);
+
+	/* Check them for real. */
+	if (filter && matches->len > 0) {
+		GHashTable **mds;
+		gulong *accepted;
+		guint j;
+
+		mds = g_new(GHashTable *, matches->len);
+		for (i = 0; i < matches->len; i++)
+			mds[i] = ((Row *)g_ptr_array_index(matches, i))->md;
+		accepted = mafw_metadata_filter_batch(mds, matches->len,
+						      filter, NULL);
+		for (i = j = 0; i < matches->len; i++)
+			if (MAFW_METADATA_BITMAP_TEST(accepted, i))
+				g_ptr_array_index(matches, j++) =
+					g_ptr_array_index(matches, i);
+		g_ptr_array_set_size(matches, j);
+		g_free(accepted);
+		g_free(mds);
+	}
+
+	if (total)
+		*total = matches->len;
+
+	/* Sort.  g_qsort_with_data() is stable. */
+	if (sort_criteria && sort_criteria[0]) {
+		gchar **terms;
+
+		terms = mafw_metadata_sorting_terms(sort_criteria);
+		if (!sort_by_index(cat, matches, terms))
+			g_qsort_with_data(matches->pdata, matches->len,
+					  sizeof(gpointer), compare_rows,
+					  terms);
+		g_strfreev(terms);
+	}
+
+	/* Page. */
+	ret = g_ptr_array_new();
+	for (i = skip_count;
+	     i < matches->len && (!item_count || ret->len < item_count);
+	     i++)
+		g_ptr_array_add(ret,
+				((Row *)g_ptr_array_index(matches, i))
+				->objectid);
+	g_ptr_array_free(matches, TRUE);
+
+	return ret;
+}
+
+/* vi: set noexpandtab ts=8 sw=8 cino=t0,(0: */
@@ -0,0 +1,62 @@
+/*
+ * This file is a part of MAFW
+ *
+ * Copyright (C) 2007, 2008, 2009 Nokia Corporation, all rights reserved.
+ *
+ * Contact: Visa Smolander <visa.smolander@nokia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#ifndef __MAFW_CATALOGUE_H__
+#define __MAFW_CATALOGUE_H__
+
+#include <glib.h>
+
+#include <libmafw/mafw-filter.h>
+
+/**
+ * MafwCatalogue:
+ *
+ * Opaque structure of an in-memory metadata catalogue.
+ */
+typedef struct _MafwCatalogue MafwCatalogue;
+
+G_BEGIN_DECLS
+
+extern MafwCatalogue *mafw_catalogue_new(void);
+extern void mafw_catalogue_free(MafwCatalogue *cat);
+
+extern void mafw_catalogue_add(MafwCatalogue *cat, const gchar *objectid,
+			       GHashTable *metadata);
+extern gboolean mafw_catalogue_remove(MafwCatalogue *cat,
+				      const gchar *objectid);
+extern GHashTable *mafw_catalogue_lookup(MafwCatalogue *cat,
+					 const gchar *objectid);
+extern guint mafw_catalogue_size(MafwCatalogue *cat);
+
+extern GPtrArray *mafw_catalogue_query(MafwCatalogue *cat,
+				       const MafwFilter *filter,
+				       const gchar *sort_criteria,
+				       guint skip_count, guint item_count,
+				       guint *total);
+
+G_END_DECLS
+
+#endif
+
+/* vi: set noexpandtab ts=8 sw=8 cino=t0,(0: */
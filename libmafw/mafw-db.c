@@ -24,6 +24,7 @@
 
 /* Include files */
 #include <stdlib.h>
+#include <string.h>
 #include <ctype.h>
 
 #include <glib.h>
@@ -270,6 +271,265 @@ gint mafw_db_delete(sqlite3_stmt *stmt)
 	return ret;
 }
 
+/* Filter to SQL translation */
+/*
+ * Appends the SQL column expression corresponding to metadata $key
+ * to $sql.  If $columns is NULL $key is used as a quoted identifier,
+ * otherwise it must be mapped by $columns.  Returns FALSE if $key
+ * is unknown.
+ */
+static gboolean append_column(GString *sql, GHashTable *columns,
+			      gchar const *key)
+{
+	gchar const *column;
+
+	if (columns != NULL) {
+		if (!(column = g_hash_table_lookup(columns, key)))
+			return FALSE;
+		g_string_append(sql, column);
+		return TRUE;
+	}
+
+	/* Quote $key as an identifier, doubling the embedded quotes. */
+	g_string_append_c(sql, '"');
+	for (; *key; key++) {
+		if (*key == '"')
+			g_string_append_c(sql, '"');
+		g_string_append_c(sql, *key);
+	}
+	g_string_append_c(sql, '"');
+	return TRUE;
+}
+
+/*
+ * Turns a glob pattern of mafw_f_approx into a LIKE pattern to be
+ * used with ESCAPE '\'.  '*' and '?' become '%' and '_', while
+ * the LIKE metacharacters themselves are escaped.  Like in
+ * mafw_filter_glob_new(), escape sequences such as `\2A' and `\3F'
+ * stand for the character itself, to be matched literally.
+ */
+static gchar *glob_to_like(gchar const *glob)
+{
+	GString *like;
+	char c;
+
+	like = g_string_sized_new(strlen(glob) + 8);
+	for (; *glob; glob++) {
+		if (*glob == '*') {
+			g_string_append_c(like, '%');
+			continue;
+		} else if (*glob == '?') {
+			g_string_append_c(like, '_');
+			continue;
+		}
+
+		/* A backslash not followed by two hex digits is itself. */
+		if (*glob != '\\' || !mafw_filter_unquote_char(glob, &c))
+			c = *glob;
+		else
+			glob += 2;
+		if (c == '%' || c == '_' || c == '\\')
+			g_string_append_c(like, '\\');
+		g_string_append_c(like, c);
+	}
+	return g_string_free(like, FALSE);
+}
+
+/* Appends the WHERE expression of $filter to $sql, and the values
+ * of the placeholders it refers to to $binds.  Returns FALSE if
+ * $filter cannot be expressed with $columns. */
+static gboolean filter_to_sql_rec(GString *sql, GPtrArray *binds,
+				  const MafwFilter *filter,
+				  GHashTable *columns)
+{
+	if (!MAFW_FILTER_IS_VALID(filter))
+		return FALSE;
+
+	if (MAFW_FILTER_IS_COMPLEX(filter)) {
+		guint i;
+
+		if (filter->parts == NULL || filter->parts[0] == NULL) {
+			/* mafw_metadata_filter() matches on empty
+			 * aggregates, let's do the same. */
+			g_string_append_c(sql, '1');
+			return TRUE;
+		}
+
+		if (filter->type == mafw_f_not) {
+			if (filter->parts[1] != NULL)
+				return FALSE;
+			g_string_append(sql, "NOT ");
+		}
+
+		g_string_append_c(sql, '(');
+		for (i = 0; filter->parts[i]; i++) {
+			if (i > 0)
+				g_string_append(sql,
+						filter->type == mafw_f_and
+						? " AND " : " OR ");
+			if (!filter_to_sql_rec(sql, binds, filter->parts[i],
+					       columns))
+				return FALSE;
+		}
+		g_string_append_c(sql, ')');
+		return TRUE;
+	}
+
+	if (!filter->key || !filter->key[0])
+		return FALSE;
+	if (!append_column(sql, columns, filter->key))
+		return FALSE;
+
+	switch (filter->type) {
+	case mafw_f_exists:
+		g_string_append(sql, " IS NOT NULL");
+		return TRUE;
+	case mafw_f_eq:
+		g_string_append(sql, " = ?");
+		break;
+	case mafw_f_lt:
+		g_string_append(sql, " < ?");
+		break;
+	case mafw_f_gt:
+		g_string_append(sql, " > ?");
+		break;
+	case mafw_f_approx:
+		g_string_append(sql, " LIKE ? ESCAPE '\\'");
+		g_ptr_array_add(binds, glob_to_like(filter->value
+						    ? filter->value : ""));
+		return TRUE;
+	default:
+		g_assert_not_reached();
+	}
+
+	g_ptr_array_add(binds, g_strdup(filter->value ? filter->value : ""));
+	return TRUE;
+}
+
+/* Appends the ORDER BY clause of $sort_criteria to $sql. */
+static gboolean sort_to_sql(GString *sql, gchar const *sort_criteria,
+			    GHashTable *columns)
+{
+	guint i;
+	gchar **terms;
+	gboolean isok;
+
+	isok = TRUE;
+	terms = g_strsplit(sort_criteria, ",", 0);
+	for (i = 0; terms[i] && isok; i++) {
+		gchar const *key;
+
+		key = terms[i];
+		if (key[0] != '+' && key[0] != '-') {
+			isok = FALSE;
+			break;
+		}
+
+		g_string_append(sql, i == 0 ? " ORDER BY " : ", ");
+		if (!(isok = append_column(sql, columns, &key[1])))
+			break;
+		g_string_append(sql, key[0] == '+' ? " ASC" : " DESC");
+	}
+	g_strfreev(terms);
+
+	return isok;
+}
+
+/**
+ * mafw_db_filter_to_sql:
+ * @filter:        a #MafwFilter, or %NULL
+ * @sort_criteria: sort criteria as passed to mafw_source_browse(), or %NULL
+ * @skip_count:    number of rows to skip
+ * @item_count:    maximal number of rows to return, or 0 for all
+ * @columns:       mapping of metadata keys to SQL column expressions,
+ *                 or %NULL to use the keys themselves as column names
+ * @binds:         return location of the placeholder values
+ *
+ * Compiles the @filter, @sort_criteria, @skip_count and @item_count
+ * arguments of mafw_source_browse() into the trailing `WHERE ...
+ * ORDER BY ... LIMIT ...' clauses of a SELECT statement, so that
+ * sources keeping their catalogue in the database can let SQLite do
+ * the filtering and paging.  The returned string starts with a space,
+ * so it can simply be appended to the `SELECT ... FROM ...' part of
+ * the query; it is empty if there is nothing to restrict.
+ *
+ * Filter values are not embedded in the clause, but are referred by
+ * positional `?' placeholders.  Their values are returned in @binds,
+ * in the order of the placeholders, as a %NULL-terminated string array
+ * to be freed with g_strfreev().  Bind them with mafw_db_bind_strv()
+ * after mafw_db_prepare().
+ *
+ * Unlike mafw_metadata_filter() the generated clause follows SQL
+ * semantics: a relation over a %NULL column is never true, string
+ * comparisons depend on the collation of the column (append `COLLATE
+ * NOCASE' in @columns if needed), and %NULL values are sorted upwards.
+ * Approximate matching is done with LIKE, so only the `*' and `?'
+ * wildcards are recognized.
+ *
+ * Returns: a newly allocated SQL fragment, or %NULL if @filter is
+ * invalid, @sort_criteria is malformed or either of them refers to
+ * a key not in @columns.  In this case @binds is not touched.
+ */
+gchar *mafw_db_filter_to_sql(const MafwFilter *filter,
+			     const gchar *sort_criteria,
+			     guint skip_count, guint item_count,
+			     GHashTable *columns, gchar ***binds)
+{
+	GString *sql;
+	GPtrArray *vals;
+
+	g_return_val_if_fail(binds != NULL, NULL);
+
+	sql = g_string_new("");
+	vals = g_ptr_array_new();
+
+	if (filter != NULL) {
+		g_string_append(sql, " WHERE ");
+		if (!filter_to_sql_rec(sql, vals, filter, columns))
+			goto out;
+	}
+
+	if (sort_criteria != NULL && sort_criteria[0] != '\0')
+		if (!sort_to_sql(sql, sort_criteria, columns))
+			goto out;
+
+	if (item_count > 0)
+		g_string_append_printf(sql, " LIMIT %u", item_count);
+	else if (skip_count > 0)
+		g_string_append(sql, " LIMIT -1");
+	if (skip_count > 0)
+		g_string_append_printf(sql, " OFFSET %u", skip_count);
+
+	g_ptr_array_add(vals, NULL);
+	*binds = (gchar **)g_ptr_array_free(vals, FALSE);
+	return g_string_free(sql, FALSE);
+
+out:	g_ptr_array_foreach(vals, (GFunc)g_free, NULL);
+	g_ptr_array_free(vals, TRUE);
+	g_string_free(sql, TRUE);
+	return NULL;
+}
+
+/**
+ * mafw_db_bind_strv:
+ * @stmt:  statement
+ * @col:   first placeholder to bind
+ * @binds: %NULL-terminated array of values
+ *
+ * Binds @binds, as returned by mafw_db_filter_to_sql(), to consecutive
+ * placeholders of @stmt starting at @col.  Like mafw_db_bind_text() it
+ * counts placeholders from 0 and relies on @binds remaining valid until
+ * the statement is executed.
+ */
+void mafw_db_bind_strv(sqlite3_stmt *stmt, gint col,
+		       gchar const *const *binds)
+{
+	if (binds == NULL)
+		return;
+	for (; *binds; binds++, col++)
+		mafw_db_bind_text(stmt, col, *binds);
+}
+
 /**
  * mafw_db_begin:
  *
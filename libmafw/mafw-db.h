@@ -30,6 +30,8 @@
 #include <sqlite3.h>
 #include <glib.h>
 
+#include <libmafw/mafw-filter.h>
+
 /* Macros */
 /*
  * These macros are to make interference with SQLite prepared statements
@@ -184,6 +186,13 @@ extern gint mafw_db_select(sqlite3_stmt *stmt, gboolean expect_row);
 extern gint mafw_db_change(sqlite3_stmt *stmt, gboolean csint_may_fail);
 extern gint mafw_db_delete(sqlite3_stmt *stmt);
 
+extern gchar *mafw_db_filter_to_sql(const MafwFilter *filter,
+				    const gchar *sort_criteria,
+				    guint skip_count, guint item_count,
+				    GHashTable *columns, gchar ***binds);
+extern void mafw_db_bind_strv(sqlite3_stmt *stmt, gint col,
+			      gchar const *const *binds);
+
 extern gboolean mafw_db_begin(void);
 extern gboolean mafw_db_commit(void);
 extern gboolean mafw_db_rollback(void);
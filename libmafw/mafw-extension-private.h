@@ -0,0 +1,91 @@
+/*
+ * This file is a part of MAFW
+ *
+ * Copyright (C) 2007, 2008, 2009 Nokia Corporation, all rights reserved.
+ *
+ * Contact: Visa Smolander <visa.smolander@nokia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#ifndef __MAFW_EXTENSION_PRIVATE_H__
+#define __MAFW_EXTENSION_PRIVATE_H__
+
+/*
+ * Timing of the operations of #MafwSource and #MafwRenderer, see
+ * mafw_extension_set_timeout().  Not installed.
+ */
+
+/* Include files */
+#include <glib.h>
+#include "mafw-extension.h"
+
+/* Timer of an operation, embedded in its record. */
+typedef struct _MafwExtensionDeadline MafwExtensionDeadline;
+
+/* Called with the timeout error when $deadline passes. */
+typedef void (*MafwExtensionExpireFunc)(MafwExtensionDeadline *deadline,
+					const GError *error);
+
+struct _MafwExtensionDeadline {
+	MafwExtension *extension;
+	guint timeout;
+	guint timeout_id;
+	gboolean expired;
+	MafwExtensionExpireFunc expire;
+};
+
+/*
+ * Record of a timed operation, registered under $serial, which is
+ * passed to the extension as user data instead of the caller's $cb and
+ * $user_data.  Sources embed it first in a larger record and free the
+ * rest of it in $clear.
+ */
+typedef struct _MafwExtensionTimedOp MafwExtensionTimedOp;
+
+struct _MafwExtensionTimedOp {
+	MafwExtensionDeadline deadline;	/*< first for the expire functions */
+	gpointer self;
+	guint serial;
+	gpointer cb;
+	gpointer user_data;
+	GDestroyNotify clear;
+};
+
+/* Function prototypes */
+G_BEGIN_DECLS
+
+extern gboolean _mafw_extension_deadline_start(MafwExtension *self,
+					MafwExtensionDeadline *deadline,
+					guint timeout,
+					MafwExtensionExpireFunc expire);
+extern void _mafw_extension_deadline_restart(MafwExtensionDeadline *deadline);
+extern gboolean _mafw_extension_deadline_stop(MafwExtensionDeadline *deadline);
+
+extern gpointer _mafw_extension_timed_op_new(MafwExtension *self, gsize size,
+					     gpointer cb, gpointer user_data,
+					     MafwExtensionExpireFunc expire,
+					     GDestroyNotify clear);
+extern gpointer _mafw_extension_timed_op_lookup(gpointer serial);
+extern void _mafw_extension_timed_op_remove(gpointer op);
+extern gpointer _mafw_extension_timed_op_take(gpointer serial);
+extern void _mafw_extension_timed_op_free(gpointer op);
+extern void _mafw_extension_timed_ops_cancel(GHRFunc match, gpointer data);
+
+G_END_DECLS
+#endif /* ! __MAFW_EXTENSION_PRIVATE_H__ */
+/* vi: set noexpandtab ts=8 sw=8 cino=t0,(0: */
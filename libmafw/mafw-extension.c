@@ -29,6 +29,7 @@
 
 #include "mafw-marshal.h"
 #include "mafw-extension.h"
+#include "mafw-extension-private.h"
 #include "mafw-errors.h"
 
 /**
@@ -51,6 +52,16 @@
  * with mafw_extension_list_properties(); queried with
  * mafw_extension_get_property() and set using the
  * mafw_extension_set_property_*() family of functions.
+ *
+ * <emphasis>Timeouts</emphasis>
+ *
+ * A source or renderer which never calls back would leave its callers
+ * waiting forever.  mafw_extension_set_timeout() sets a deadline for
+ * the operations of #MafwSource and #MafwRenderer started afterwards.
+ * If the extension doesn't answer in time, the callback is called with
+ * a %MAFW_EXTENSION_ERROR_EXTENSION_NOT_RESPONDING error, and the late
+ * answer is ignored.  mafw_extension_get_timeout_count() tells how many
+ * operations timed out.
  */
 
 enum {
@@ -65,6 +76,8 @@ struct _MafwExtensionPrivate {
 	gchar *name;
 	gchar *plugin;
 	GPtrArray *rtprops;
+	guint timeout;
+	guint ntimeouts;
 };
 
 enum {
@@ -205,6 +218,227 @@ const gchar *mafw_extension_get_plugin(MafwExtension *self)
 	return self->priv->plugin;
 }
 
+/**
+ * mafw_extension_set_timeout:
+ * @self:    a #MafwExtension instance.
+ * @timeout: milliseconds, or 0 to wait indefinitely.
+ *
+ * Sets how long the operations of @self started from now on may take
+ * before their callback is called with a
+ * %MAFW_EXTENSION_ERROR_EXTENSION_NOT_RESPONDING error.  For a browse
+ * session it applies to each result, and the session is cancelled when
+ * it expires.  Operations without a callback are not timed.  By default
+ * there is no timeout.
+ */
+void mafw_extension_set_timeout(MafwExtension *self, guint timeout)
+{
+	g_return_if_fail(MAFW_IS_EXTENSION(self));
+	self->priv->timeout = timeout;
+}
+
+/**
+ * mafw_extension_get_timeout:
+ * @self: a #MafwExtension instance.
+ *
+ * Returns: the timeout set with mafw_extension_set_timeout().
+ */
+guint mafw_extension_get_timeout(MafwExtension *self)
+{
+	g_return_val_if_fail(MAFW_IS_EXTENSION(self), 0);
+	return self->priv->timeout;
+}
+
+/**
+ * mafw_extension_get_timeout_count:
+ * @self: a #MafwExtension instance.
+ *
+ * Returns: the number of operations of @self which timed out.
+ */
+guint mafw_extension_get_timeout_count(MafwExtension *self)
+{
+	g_return_val_if_fail(MAFW_IS_EXTENSION(self), 0);
+	return self->priv->ntimeouts;
+}
+
+static gboolean deadline_passed(MafwExtensionDeadline *deadline)
+{
+	MafwExtension *self;
+	GError *error;
+
+	/* $deadline may be freed by expire(). */
+	self = deadline->extension;
+	deadline->extension = NULL;
+	deadline->timeout_id = 0;
+	deadline->expired = TRUE;
+	self->priv->ntimeouts++;
+
+	error = g_error_new(MAFW_EXTENSION_ERROR,
+			    MAFW_EXTENSION_ERROR_EXTENSION_NOT_RESPONDING,
+			    "%s did not answer in %u ms",
+			    self->priv->uuid ? self->priv->uuid : "Extension",
+			    deadline->timeout);
+	deadline->expire(deadline, error);
+	g_error_free(error);
+	g_object_unref(self);
+	return FALSE;
+}
+
+/*
+ * Starts timing an operation of $self, unless $timeout (milliseconds,
+ * usually mafw_extension_get_timeout()) is 0.  Returns whether $deadline
+ * was started; expire() is called if it passes.
+ */
+gboolean _mafw_extension_deadline_start(MafwExtension *self,
+					MafwExtensionDeadline *deadline,
+					guint timeout,
+					MafwExtensionExpireFunc expire)
+{
+	memset(deadline, 0, sizeof(*deadline));
+	if (!timeout)
+		return FALSE;
+	deadline->extension = g_object_ref(self);
+	deadline->timeout = timeout;
+	deadline->expire = expire;
+	deadline->timeout_id = g_timeout_add(timeout,
+					     (GSourceFunc)deadline_passed,
+					     deadline);
+	return TRUE;
+}
+
+/* Gives the operation of a running $deadline another timeout from now on. */
+void _mafw_extension_deadline_restart(MafwExtensionDeadline *deadline)
+{
+	if (!deadline->timeout_id)
+		return;
+	g_source_remove(deadline->timeout_id);
+	deadline->timeout_id = g_timeout_add(deadline->timeout,
+					     (GSourceFunc)deadline_passed,
+					     deadline);
+}
+
+/*
+ * Stops timing an operation because its result has arrived.  $deadline
+ * needn't have been started.  Returns %FALSE if it has expired, and the
+ * result should be ignored.
+ */
+gboolean _mafw_extension_deadline_stop(MafwExtensionDeadline *deadline)
+{
+	if (deadline->timeout_id) {
+		g_source_remove(deadline->timeout_id);
+		deadline->timeout_id = 0;
+		g_object_unref(deadline->extension);
+		deadline->extension = NULL;
+	}
+	return !deadline->expired;
+}
+
+/*
+ * Timed operations of all sources and renderers are registered in
+ * $Timed_ops under their serial.  When the deadline passes or the last
+ * result arrives the record is taken out of the table, so results
+ * arriving later find nothing and are dropped.
+ */
+static GHashTable *Timed_ops;
+
+/*
+ * Returns a zeroed record of $size bytes for an operation of $self
+ * whose result goes to $cb with $user_data, or NULL if it needn't be
+ * timed.  $clear frees the rest of the record, if any.
+ */
+gpointer _mafw_extension_timed_op_new(MafwExtension *self, gsize size,
+				      gpointer cb, gpointer user_data,
+				      MafwExtensionExpireFunc expire,
+				      GDestroyNotify clear)
+{
+	static guint serial;
+	MafwExtensionTimedOp *op;
+	guint timeout;
+
+	g_assert(size >= sizeof(*op));
+	if (!cb || !(timeout = mafw_extension_get_timeout(self)))
+		return NULL;
+
+	if (!Timed_ops)
+		Timed_ops = g_hash_table_new(g_direct_hash, g_direct_equal);
+	op = g_malloc0(size);
+	op->self = self;
+	if (!++serial)
+		serial++;
+	op->serial = serial;
+	op->cb = cb;
+	op->user_data = user_data;
+	op->clear = clear;
+	g_hash_table_insert(Timed_ops, GUINT_TO_POINTER(op->serial), op);
+	_mafw_extension_deadline_start(self, &op->deadline, timeout, expire);
+	return op;
+}
+
+/* Returns the record of $serial, or NULL if it's been finished. */
+gpointer _mafw_extension_timed_op_lookup(gpointer serial)
+{
+	return Timed_ops ? g_hash_table_lookup(Timed_ops, serial) : NULL;
+}
+
+/* Finishes $op: results arriving later will be dropped. */
+void _mafw_extension_timed_op_remove(gpointer op)
+{
+	g_hash_table_remove(Timed_ops, GUINT_TO_POINTER(
+				((MafwExtensionTimedOp *)op)->serial));
+}
+
+/* Like _mafw_extension_timed_op_lookup(), but the caller must
+ * _mafw_extension_timed_op_free() it. */
+gpointer _mafw_extension_timed_op_take(gpointer serial)
+{
+	gpointer op;
+
+	if ((op = _mafw_extension_timed_op_lookup(serial)) != NULL)
+		_mafw_extension_timed_op_remove(op);
+	return op;
+}
+
+/* Frees a finished $op. */
+void _mafw_extension_timed_op_free(gpointer op)
+{
+	MafwExtensionTimedOp *timed = op;
+
+	_mafw_extension_deadline_stop(&timed->deadline);
+	if (timed->clear)
+		timed->clear(op);
+	g_free(op);
+}
+
+struct timed_ops_match {
+	GHRFunc match;
+	gpointer data;
+};
+
+static gboolean timed_op_matches(gpointer serial, MafwExtensionTimedOp *op,
+				 struct timed_ops_match *which)
+{
+	if (!which->match(serial, op, which->data))
+		return FALSE;
+	_mafw_extension_timed_op_free(op);
+	return TRUE;
+}
+
+/*
+ * Finishes and frees the operations $match()ing $data, without calling
+ * back.  $match sees the records of every extension, so it must check
+ * $self before looking further.
+ */
+void _mafw_extension_timed_ops_cancel(GHRFunc match, gpointer data)
+{
+	struct timed_ops_match which;
+
+	if (!Timed_ops)
+		return;
+	which.match = match;
+	which.data = data;
+	g_hash_table_foreach_remove(Timed_ops, (GHRFunc)timed_op_matches,
+				    &which);
+}
+
 /*
  * MafwExtension's implementation returns the priv->rtprops array.
  */
@@ -118,6 +118,10 @@ extern const gchar *mafw_extension_get_name(MafwExtension *self);
 extern const gchar *mafw_extension_get_uuid(MafwExtension *self);
 extern const gchar *mafw_extension_get_plugin(MafwExtension *self);
 
+extern void mafw_extension_set_timeout(MafwExtension *self, guint timeout);
+extern guint mafw_extension_get_timeout(MafwExtension *self);
+extern guint mafw_extension_get_timeout_count(MafwExtension *self);
+
 extern void mafw_extension_add_property(MafwExtension *self, const gchar *name, GType type);
 extern const GPtrArray *mafw_extension_list_properties(MafwExtension *self);
 extern gboolean mafw_extension_set_property(MafwExtension *self, const gchar *name,
@@ -394,7 +394,68 @@ static char const *parse_sexp(char const *filt, MafwFilter **result)
 	return filt;
 }
 
-static gboolean filter_to_string_rec(GString *string, const MafwFilter *filter)
+/* Appends $str to $string quoted like mafw_filter_quote() would. */
+static void append_quoted(GString *string, char const *str)
+{
+	static const char _hexchars[16] = "0123456789ABCDEF";
+	char const *t;
+
+	for (t = str; *t; t++) {
+		switch (*t) {
+		case '*': case '(':  case ')': case '\\':
+			g_string_append_len(string, str, t - str);
+			g_string_append_c(string, '\\');
+			g_string_append_c(string, _hexchars[*t >> 4]);
+			g_string_append_c(string, _hexchars[*t & 0xf]);
+			str = t + 1;
+			break;
+		}
+	}
+	g_string_append_len(string, str, t - str);
+}
+
+static gboolean filter_to_string_rec(GString *string, const MafwFilter *filter,
+				     gboolean canonical);
+
+static gint compare_strings(gconstpointer a, gconstpointer b)
+{
+	return strcmp(*(gchar **)a, *(gchar **)b);
+}
+
+/* Appends the string forms of the sub-filters of an AND or OR $filter
+ * in lexicographic order. */
+static gboolean parts_to_string_sorted(GString *string,
+				       const MafwFilter *filter)
+{
+	GPtrArray *parts;
+	gboolean valid;
+	guint i;
+
+	valid = TRUE;
+	parts = g_ptr_array_new();
+	for (i = 0; valid && filter->parts[i] != NULL; i++) {
+		GString *part;
+
+		part = g_string_new("");
+		valid = filter_to_string_rec(part, filter->parts[i], TRUE);
+		g_ptr_array_add(parts, g_string_free(part, FALSE));
+	}
+	valid = valid && parts->len > 0;
+
+	if (valid) {
+		g_ptr_array_sort(parts, compare_strings);
+		for (i = 0; i < parts->len; i++)
+			g_string_append(string, parts->pdata[i]);
+	}
+	for (i = 0; i < parts->len; i++)
+		g_free(parts->pdata[i]);
+	g_ptr_array_free(parts, TRUE);
+
+	return valid;
+}
+
+static gboolean filter_to_string_rec(GString *string, const MafwFilter *filter,
+				     gboolean canonical)
 {
 	gboolean valid = FALSE;
 	guchar symbol;
@@ -411,40 +472,30 @@ static gboolean filter_to_string_rec(GString *string, const MafwFilter *filter)
 
 		g_string_append_c(string, symbol);
 
-		do {
-			valid = filter_to_string_rec(string,
-						     filter->parts[i++]);
-		} while (valid && filter->parts[i] != NULL &&
-			 filter->type != mafw_f_not);
-
-		if (filter->type == mafw_f_not && filter->parts[i] != NULL) {
-			valid = FALSE;
+		if (canonical && filter->type != mafw_f_not) {
+			valid = parts_to_string_sorted(string, filter);
+		} else {
+			do {
+				valid = filter_to_string_rec(string,
+							     filter->parts[i++],
+							     canonical);
+			} while (valid && filter->parts[i] != NULL &&
+				 filter->type != mafw_f_not);
+
+			if (filter->type == mafw_f_not &&
+			    filter->parts[i] != NULL) {
+				valid = FALSE;
+			}
 		}
 	} else if (MAFW_FILTER_IS_SIMPLE(filter) && filter->key != NULL &&
 		   filter->key[0] != '\0' &&
 		   (filter->type != mafw_f_exists ||
 		    filter->value == NULL ||
 		    filter->value[0] == '\0')) {
-		gchar *quoted_key;
-
-		quoted_key = mafw_filter_quote(filter->key);
-                if (!quoted_key) {
-                        return FALSE;
-                }
-		g_string_append(string, quoted_key);
-		g_free(quoted_key);
-
+		append_quoted(string, filter->key);
 		g_string_append_c(string, symbol);
-
-		if (filter->value != NULL && filter->value[0] != '\0') {
-			gchar *quoted_value;
-			quoted_value = mafw_filter_quote(filter->value);
-                        if (!quoted_value) {
-                                return FALSE;
-                        }
-			g_string_append(string, quoted_value);
-			g_free(quoted_value);
-		}
+		if (filter->value != NULL)
+			append_quoted(string, filter->value);
 		valid = TRUE;
 	}
 
@@ -481,6 +532,271 @@ MafwFilter *mafw_filter_parse(char const *filter)
 	return filt;
 }
 
+/* Compact filters */
+/*
+ * A compact filter is parsed in two passes.  The first one only checks
+ * the syntax and measures how many nodes, child pointers and string
+ * bytes the tree needs.  The second one carves them out of a single
+ * block laid out as [nodes][parts arrays][strings].  The root is the
+ * first node, so freeing it releases the whole tree.
+ *
+ * While measuring, @nodes is %NULL and only the counters are updated.
+ * The number of children of each aggregate is recorded in @nchildren
+ * in the order the aggregates start, so that the second pass knows how
+ * large ->parts to carve for them without counting again.
+ */
+struct filter_arena {
+	MafwFilter *nodes;
+	MafwFilter **parts;
+	char *strs;
+
+	gsize nnodes, nparts, nstrs;
+	GArray *nchildren;
+	guint next_aggregate;
+};
+
+/* Returns the length of the first @len characters of @str unquoted,
+ * or -1 if it is quoted improperly. */
+static gssize unquoted_len(char const *str, gsize len)
+{
+	gsize i;
+	gssize n;
+	char c;
+
+	for (i = n = 0; i < len; i++, n++) {
+		if (str[i] != '\\')
+			continue;
+		if (i + 2 >= len
+		    || !hex2char(&c, str[i+1]) || !hex2char(&c, str[i+2]))
+			return -1;
+		i += 2;
+	}
+	return n;
+}
+
+/* Allocates a node from @a, or returns %NULL if measuring. */
+static MafwFilter *arena_node(struct filter_arena *a)
+{
+	if (!a->nodes) {
+		a->nnodes++;
+		return NULL;
+	}
+	return a->nodes++;
+}
+
+/* Like mafw_filter_unquote(), but on the first @len characters of @str
+ * and in @a.  Returns %NULL if measuring or if @str is quoted
+ * improperly, just like mafw_filter_unquote() would. */
+static char *arena_unquote(struct filter_arena *a, char const *str,
+			   gsize len)
+{
+	gssize n;
+	char *ret, *t;
+	char const *end;
+
+	if ((n = unquoted_len(str, len)) < 0)
+		return NULL;
+	if (!a->nodes) {
+		a->nstrs += n + 1;
+		return NULL;
+	}
+
+	ret = t = a->strs;
+	for (end = str + len; str < end; )
+		str = mafw_filter_unquote_char(str, t++);
+	*t++ = '\0';
+	a->strs = t;
+
+	return ret;
+}
+
+/* Compact counterpart of parse_simple(). */
+static char const *parse_simple_compact(char const *filt,
+					struct filter_arena *a,
+					MafwFilter **result)
+{
+	char const *t, *attr;
+	gsize attrlen;
+	int ftype;
+	MafwFilter *node;
+
+	t = attr = filt;
+	while (*t && (isalnum(*t) || *t == '-' || *t == '_')) t++;
+	if (!*t || t == filt) return NULL;
+	attrlen = t - attr;
+	filt = t;
+
+	ftype = char_to_simple(*filt);
+	if (ftype == MAFW_F_INVALID)
+		return NULL;
+	filt++;
+
+	t = filt;
+	while (*t && *t != ')') t++;
+	if (!*t)
+		return NULL;
+
+	node = arena_node(a);
+	if (node) {
+		node->type = ftype;
+		node->key = arena_unquote(a, attr, attrlen);
+		node->value = arena_unquote(a, filt, t - filt);
+		*result = node;
+	} else {
+		arena_unquote(a, attr, attrlen);
+		arena_unquote(a, filt, t - filt);
+	}
+
+	return t + 1;
+}
+
+static char const *parse_sexp_compact(char const *filt,
+				      struct filter_arena *a,
+				      MafwFilter **result);
+
+/*
+ * Parses the children of an aggregate of @ftype, storing them in @parts
+ * unless it's %NULL, and their number in *@nparts.  Returns a pointer
+ * after the aggregate or %NULL on syntax error.
+ */
+static char const *parse_parts_compact(char const *filt,
+				       struct filter_arena *a,
+				       int ftype, MafwFilter **parts,
+				       gsize *nparts)
+{
+	*nparts = 0;
+	while (1) {
+		MafwFilter *part;
+
+		part = NULL;
+		if (!(filt = parse_sexp_compact(filt, a, &part)))
+			return NULL;
+		if (parts)
+			parts[*nparts] = part;
+		(*nparts)++;
+
+		/* Same rules as in parse_sexp(). */
+		if (!*filt)
+			break;
+		if (*filt == ')') {
+			filt++;
+			break;
+		}
+		if (ftype == mafw_f_not)
+			return NULL;
+	}
+	return filt;
+}
+
+/* Compact counterpart of parse_sexp(). */
+static char const *parse_sexp_compact(char const *filt,
+				      struct filter_arena *a,
+				      MafwFilter **result)
+{
+	int ftype;
+	gsize nparts;
+	MafwFilter *node;
+
+	if (*filt != '(') return NULL;
+	filt++;
+
+	ftype = char_to_complex(*filt);
+	if (ftype == MAFW_F_INVALID)
+		return parse_simple_compact(filt, a, result);
+	filt++;
+
+	if (!(node = arena_node(a))) {
+		guint i;
+
+		/* Measuring, count the pointers we'll need.  Take our slot
+		 * before the children take theirs. */
+		i = a->nchildren->len;
+		g_array_set_size(a->nchildren, i + 1);
+		if (!(filt = parse_parts_compact(filt, a, ftype, NULL,
+						 &nparts)))
+			return NULL;
+		g_array_index(a->nchildren, gsize, i) = nparts;
+		a->nparts += nparts + 1;
+		return filt;
+	}
+
+	nparts = g_array_index(a->nchildren, gsize, a->next_aggregate++);
+	node->type = ftype;
+	node->parts = a->parts;
+	node->parts[nparts] = NULL;
+	a->parts += nparts + 1;
+	*result = node;
+
+	return parse_parts_compact(filt, a, ftype, node->parts, &nparts);
+}
+
+/**
+ * mafw_filter_parse_compact:
+ * @filter: the string representation of a MAFW filter.
+ *
+ * Like mafw_filter_parse(), but the returned tree, including all of its
+ * nodes, child arrays, keys and values, lives in a single memory block.
+ * This makes parsing large filters (like long disjunctions of object
+ * IDs) considerably cheaper, since only one allocation is made, and the
+ * tree can be released in one go with mafw_filter_free_compact().
+ *
+ * The result is an ordinary #MafwFilter which can be inspected and
+ * passed around as usual, but it must not be modified structurally
+ * (ie. with mafw_filter_add_children()) nor freed with
+ * mafw_filter_free().
+ *
+ * Returns: a newly allocated filter tree, or %NULL if the string contains
+ *          syntax errors.
+ */
+MafwFilter *mafw_filter_parse_compact(char const *filter)
+{
+	char const *fend;
+	struct filter_arena arena = { 0 };
+	MafwFilter *filt;
+
+	if (filter == NULL)
+		return NULL;
+
+	/* Check the syntax and measure. */
+	arena.nchildren = g_array_new(FALSE, FALSE, sizeof(gsize));
+	fend = parse_sexp_compact(filter, &arena, NULL);
+	if (!fend || *fend) {
+		g_array_free(arena.nchildren, TRUE);
+		return NULL;
+	}
+
+	arena.nodes = malloc(sizeof(MafwFilter) * arena.nnodes
+			     + sizeof(MafwFilter *) * arena.nparts
+			     + arena.nstrs);
+	if (!arena.nodes) {
+		g_array_free(arena.nchildren, TRUE);
+		return NULL;
+	}
+	arena.parts = (MafwFilter **)(arena.nodes + arena.nnodes);
+	arena.strs = (char *)(arena.parts + arena.nparts);
+
+	/* Build the tree.  The root is allocated first. */
+	filt = NULL;
+	parse_sexp_compact(filter, &arena, &filt);
+	g_assert((char *)filt + sizeof(MafwFilter) * arena.nnodes
+		 == (char *)arena.nodes);
+	g_assert(arena.next_aggregate == arena.nchildren->len);
+	g_array_free(arena.nchildren, TRUE);
+
+	return filt;
+}
+
+/**
+ * mafw_filter_free_compact:
+ * @filter: a filter tree returned by mafw_filter_parse_compact().
+ *
+ * Frees a compact filter tree.  Does nothing if %NULL is passed.
+ */
+void mafw_filter_free_compact(MafwFilter *filter)
+{
+	free(filter);
+}
+
 /**
  * mafw_filter_to_string:
  * @filter: a #MafwFilter
@@ -502,7 +818,35 @@ gchar *mafw_filter_to_string(const MafwFilter *filter)
 		gboolean valid;
 
 		string = g_string_new("");
-		valid = filter_to_string_rec(string, filter);
+		valid = filter_to_string_rec(string, filter, FALSE);
+		converted_string = g_string_free(string, !valid);
+	}
+
+	return converted_string;
+}
+
+/**
+ * mafw_filter_to_string_canonical:
+ * @filter: a #MafwFilter
+ *
+ * Like mafw_filter_to_string(), but the sub-filters of conjunctions
+ * and disjunctions are emitted in a well-defined order, so filters
+ * differing only in the order of their operands yield the same string.
+ * This makes the result suitable as a cache key.
+ *
+ * Returns: a newly allocated string, or %NULL if the filter was %NULL
+ * or incorrect
+ */
+gchar *mafw_filter_to_string_canonical(const MafwFilter *filter)
+{
+	gchar *converted_string = NULL;
+
+	if (filter != NULL) {
+		GString *string;
+		gboolean valid;
+
+		string = g_string_new("");
+		valid = filter_to_string_rec(string, filter, TRUE);
 		converted_string = g_string_free(string, !valid);
 	}
 
@@ -718,3 +1062,824 @@ void mafw_filter_free(MafwFilter *filter)
 	if (!filter) return;
 	mafw_filter_traverse(filter, mafw_filter_free_1, 0);
 }
+
+/* Binary serialization */
+/* Deeper filter trees are rejected by mafw_filter_thaw(). */
+#define FREEZE_MAX_DEPTH	64
+
+/* Encodes $n in little-endian base 128. */
+static void varint2bary(GByteArray *bary, guint n)
+{
+	guint8 c;
+
+	while (n >= 0x80) {
+		c = (n & 0x7f) | 0x80;
+		g_byte_array_append(bary, &c, 1);
+		n >>= 7;
+	}
+	c = n;
+	g_byte_array_append(bary, &c, 1);
+}
+
+/* Encodes a length-prefixed string.  %NULL is encoded as "". */
+static void lstr2bary(GByteArray *bary, char const *str)
+{
+	guint len;
+
+	len = str ? strlen(str) : 0;
+	varint2bary(bary, len);
+	g_byte_array_append(bary, (guint8 *)str, len);
+}
+
+static gboolean filter2bary(GByteArray *bary, const MafwFilter *filter)
+{
+	guint8 type;
+
+	if (!MAFW_FILTER_IS_VALID(filter))
+		return FALSE;
+
+	type = filter->type;
+	g_byte_array_append(bary, &type, 1);
+	if (MAFW_FILTER_IS_COMPLEX(filter)) {
+		guint i, n;
+
+		for (n = 0; filter->parts[n] != NULL; n++);
+		if (n < 1 || (filter->type == mafw_f_not && n != 1))
+			return FALSE;
+		varint2bary(bary, n);
+		for (i = 0; i < n; i++)
+			if (!filter2bary(bary, filter->parts[i]))
+				return FALSE;
+	} else {
+		if (filter->key == NULL || filter->key[0] == '\0')
+			return FALSE;
+		if (filter->type == mafw_f_exists && filter->value != NULL
+		    && filter->value[0] != '\0')
+			return FALSE;
+		lstr2bary(bary, filter->key);
+		lstr2bary(bary, filter->value);
+	}
+	return TRUE;
+}
+
+/* Decoder state of mafw_filter_thaw(). */
+struct filter_stream {
+	const guint8 *p, *end;
+};
+
+static gboolean bary2varint(struct filter_stream *in, guint *np)
+{
+	guint shift, n;
+
+	for (n = shift = 0; in->p < in->end && shift < 32; shift += 7) {
+		guint8 c;
+
+		c = *in->p++;
+		n |= (guint)(c & 0x7f) << shift;
+		if (!(c & 0x80)) {
+			*np = n;
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+/* Returns a malloc()ed copy of the next string of $in, or %NULL
+ * if it's truncated or contains NULs. */
+static char *bary2lstr(struct filter_stream *in)
+{
+	guint len;
+	char *str;
+
+	if (!bary2varint(in, &len) || len > in->end - in->p
+	    || memchr(in->p, '\0', len))
+		return NULL;
+	if (!(str = malloc(len + 1)))
+		return NULL;
+	memcpy(str, in->p, len);
+	str[len] = '\0';
+	in->p += len;
+	return str;
+}
+
+static MafwFilter *bary2filter(struct filter_stream *in, guint depth)
+{
+	MafwFilter *filter;
+
+	if (in->p >= in->end || depth > FREEZE_MAX_DEPTH)
+		return NULL;
+	if (!(filter = calloc(sizeof(MafwFilter), 1)))
+		return NULL;
+
+	filter->type = *in->p++;
+	if (!MAFW_FILTER_IS_VALID(filter)) {
+		free(filter);
+		return NULL;
+	}
+
+	if (MAFW_FILTER_IS_COMPLEX(filter)) {
+		guint i, n;
+
+		/* Every sub-filter takes at least a byte, which bounds
+		 * the number of parts we may need to allocate. */
+		if (!bary2varint(in, &n) || n < 1 || n > in->end - in->p
+		    || (filter->type == mafw_f_not && n != 1)
+		    || !(filter->parts = calloc(sizeof(MafwFilter *), n + 1)))
+			goto out;
+		for (i = 0; i < n; i++)
+			if (!(filter->parts[i] = bary2filter(in, depth + 1)))
+				goto out;
+	} else {
+		if (!(filter->key = bary2lstr(in)) || !filter->key[0])
+			goto out;
+		if (!(filter->value = bary2lstr(in)))
+			goto out;
+		if (filter->type == mafw_f_exists && filter->value[0])
+			goto out;
+	}
+	return filter;
+
+out:	/* mafw_filter_free() copes with partially built nodes. */
+	mafw_filter_free(filter);
+	return NULL;
+}
+
+/**
+ * mafw_filter_freeze_bary:
+ * @filter: a #MafwFilter
+ *
+ * Serializes @filter into a compact binary form which can be turned
+ * back into a #MafwFilter with mafw_filter_thaw() without parsing.
+ * Every node is encoded as its #MafwFilterType in a byte, followed by
+ * the number of its sub-filters and the sub-filters themselves for
+ * aggregates, or the length-prefixed key and value for simple filters.
+ * Numbers are stored in base 128, least significant group first.
+ *
+ * Returns: a #GByteArray, or %NULL if @filter was %NULL or incorrect
+ */
+GByteArray *mafw_filter_freeze_bary(const MafwFilter *filter)
+{
+	GByteArray *bary;
+
+	if (filter == NULL)
+		return NULL;
+
+	bary = g_byte_array_new();
+	if (!filter2bary(bary, filter)) {
+		g_byte_array_free(bary, TRUE);
+		return NULL;
+	}
+	return bary;
+}
+
+/**
+ * mafw_filter_freeze:
+ * @filter: a #MafwFilter
+ * @sstreamp: pointer to return the stream size
+ *
+ * Like mafw_filter_freeze_bary(), but returns a conventional
+ * C character array instead of a #GByteArray.
+ *
+ * Returns: the serialized @filter, or %NULL if @filter was %NULL
+ * or incorrect
+ */
+gchar *mafw_filter_freeze(const MafwFilter *filter, gsize *sstreamp)
+{
+	GByteArray *bary;
+
+	g_return_val_if_fail(sstreamp != NULL, NULL);
+
+	if (!(bary = mafw_filter_freeze_bary(filter)))
+		return NULL;
+	*sstreamp = bary->len;
+	return (gchar *)g_byte_array_free(bary, FALSE);
+}
+
+/**
+ * mafw_filter_thaw:
+ * @stream: a filter serialized by mafw_filter_freeze()
+ * @sstream: the stream size
+ *
+ * Recreates a #MafwFilter from its binary form.  Unlike the metadata
+ * deserializer it validates its input, since @stream typically comes
+ * from another process.  Values of simple filters are never %NULL
+ * in the result, #mafw_f_exists filters have an empty value.
+ *
+ * Returns: a newly allocated filter tree, or %NULL if @stream is
+ * malformed
+ */
+MafwFilter *mafw_filter_thaw(const gchar *stream, gsize sstream)
+{
+	struct filter_stream in;
+	MafwFilter *filter;
+
+	if (stream == NULL)
+		return NULL;
+
+	in.p = (const guint8 *)stream;
+	in.end = in.p + sstream;
+	filter = bary2filter(&in, 0);
+	if (filter && in.p != in.end) {
+		/* Trailing garbage. */
+		mafw_filter_free(filter);
+		filter = NULL;
+	}
+	return filter;
+}
+
+/* Structural comparison */
+/* Exists filters may have either NULL or "" as value. */
+#define filter_value(f)		((f)->value ? (f)->value : "")
+
+/**
+ * mafw_filter_hash:
+ * @filter: a #MafwFilter
+ *
+ * Computes a hash value of @filter based on its structure, so that
+ * filters considered equal by mafw_filter_equal() hash the same.
+ * Suitable as a #GHashFunc.
+ *
+ * Returns: the hash value
+ */
+guint mafw_filter_hash(gconstpointer filter)
+{
+	const MafwFilter *f = filter;
+	guint h;
+
+	if (f == NULL)
+		return 0;
+
+	h = f->type;
+	if (MAFW_FILTER_IS_COMPLEX(f)) {
+		MafwFilter **parts;
+
+		for (parts = f->parts; parts && *parts; parts++)
+			h = h * 31 + mafw_filter_hash(*parts);
+	} else if (MAFW_FILTER_IS_SIMPLE(f)) {
+		h = h * 31 + (f->key ? g_str_hash(f->key) : 0);
+		h = h * 31 + g_str_hash(filter_value(f));
+	}
+	return h;
+}
+
+/**
+ * mafw_filter_equal:
+ * @a: a #MafwFilter
+ * @b: another #MafwFilter
+ *
+ * Compares two filter trees structurally: they are equal if they have
+ * the same operators, keys and values, and their sub-filters are equal
+ * in the same order.  A %NULL and an empty value are treated the same.
+ * Suitable as a #GEqualFunc.
+ *
+ * Returns: %TRUE if @a and @b are equal
+ */
+gboolean mafw_filter_equal(gconstpointer a, gconstpointer b)
+{
+	const MafwFilter *fa = a, *fb = b;
+
+	if (fa == fb)
+		return TRUE;
+	if (fa == NULL || fb == NULL || fa->type != fb->type)
+		return FALSE;
+
+	if (MAFW_FILTER_IS_COMPLEX(fa)) {
+		MafwFilter **pa, **pb;
+
+		pa = fa->parts;
+		pb = fb->parts;
+		if (!pa || !pb)
+			return pa == pb;
+		for (; *pa && *pb; pa++, pb++)
+			if (!mafw_filter_equal(*pa, *pb))
+				return FALSE;
+		return *pa == *pb;
+	} else if (MAFW_FILTER_IS_SIMPLE(fa)) {
+		return !g_strcmp0(fa->key, fb->key)
+			&& !strcmp(filter_value(fa), filter_value(fb));
+	} else
+		return TRUE;
+}
+
+/* Parsed filter cache */
+/*
+ * Every cached filter is an entry, which may be reached through
+ * the strings it was parsed from (@aliases, keys of ->by_string)
+ * or its structure (->by_filter).  Entries nobody holds a reference
+ * to are linked in ->unused, most recently released first, and are
+ * evicted from its tail when the cache grows over ->max_entries.
+ * An entry keeps its last FILTER_CACHE_MAX_ALIASES strings, the latest
+ * first, so that spelling the same filter in ever new ways can't grow
+ * it without a bound.
+ */
+#define FILTER_CACHE_MAX_ALIASES	8
+
+struct filter_cache_entry {
+	MafwFilter *filter;
+	guint refcount;
+	GList *unused;
+	GSList *aliases;
+	guint naliases;
+};
+
+/**
+ * MafwFilterCache:
+ *
+ * Opaque structure of a parsed filter cache.
+ */
+struct _MafwFilterCache {
+	GHashTable *by_string;
+	GHashTable *by_filter;
+	GQueue unused;
+	guint max_entries;
+};
+
+static void filter_cache_evict(MafwFilterCache *cache,
+			       struct filter_cache_entry *e)
+{
+	GSList *alias;
+
+	for (alias = e->aliases; alias; alias = alias->next) {
+		g_hash_table_remove(cache->by_string, alias->data);
+		g_free(alias->data);
+	}
+	g_slist_free(e->aliases);
+	if (e->unused)
+		g_queue_delete_link(&cache->unused, e->unused);
+	g_hash_table_remove(cache->by_filter, e->filter);
+	mafw_filter_free_compact(e->filter);
+	g_free(e);
+}
+
+/* Evicts unreferenced entries until the cache fits in its bounds. */
+static void filter_cache_trim(MafwFilterCache *cache)
+{
+	while (g_hash_table_size(cache->by_filter) > cache->max_entries
+	       && !g_queue_is_empty(&cache->unused))
+		filter_cache_evict(cache, g_queue_peek_tail(&cache->unused));
+}
+
+static const MafwFilter *filter_cache_ref(MafwFilterCache *cache,
+					  struct filter_cache_entry *e)
+{
+	if (e->refcount++ == 0 && e->unused) {
+		g_queue_delete_link(&cache->unused, e->unused);
+		e->unused = NULL;
+	}
+	return e->filter;
+}
+
+/* Looks up or adds the compact $filt, registering $alias for it.
+ * Takes ownership of both. */
+static const MafwFilter *filter_cache_add(MafwFilterCache *cache,
+					  MafwFilter *filt, gchar *alias)
+{
+	struct filter_cache_entry *e;
+
+	if ((e = g_hash_table_lookup(cache->by_filter, filt)) != NULL) {
+		mafw_filter_free_compact(filt);
+	} else {
+		e = g_new0(struct filter_cache_entry, 1);
+		e->filter = filt;
+		g_hash_table_insert(cache->by_filter, filt, e);
+	}
+
+	if (!g_hash_table_lookup(cache->by_string, alias)) {
+		if (e->naliases == FILTER_CACHE_MAX_ALIASES) {
+			GSList *oldest;
+
+			/* Forget the oldest spelling. */
+			oldest = g_slist_last(e->aliases);
+			g_hash_table_remove(cache->by_string, oldest->data);
+			g_free(oldest->data);
+			e->aliases = g_slist_delete_link(e->aliases, oldest);
+		} else
+			e->naliases++;
+		e->aliases = g_slist_prepend(e->aliases, alias);
+		g_hash_table_insert(cache->by_string, alias, e);
+	} else
+		g_free(alias);
+
+	filter_cache_ref(cache, e);
+	filter_cache_trim(cache);
+	return e->filter;
+}
+
+/**
+ * mafw_filter_cache_new:
+ * @max_entries: the number of filters to keep
+ *
+ * Creates a cache of parsed filters.  Sources receiving the same
+ * filter strings over and over can use it to avoid parsing and
+ * freeing them on every browse request.  Once the cache holds more
+ * than @max_entries filters, those not in use are evicted, the least
+ * recently released first.  Filters in use are never evicted, so the
+ * cache may exceed @max_entries while they are held.  The cache is not
+ * thread-safe.
+ *
+ * Returns: a new #MafwFilterCache
+ */
+MafwFilterCache *mafw_filter_cache_new(guint max_entries)
+{
+	MafwFilterCache *cache;
+
+	cache = g_new0(MafwFilterCache, 1);
+	cache->by_string = g_hash_table_new(g_str_hash, g_str_equal);
+	cache->by_filter = g_hash_table_new(mafw_filter_hash,
+					    mafw_filter_equal);
+	g_queue_init(&cache->unused);
+	cache->max_entries = max_entries;
+	return cache;
+}
+
+/**
+ * mafw_filter_cache_free:
+ * @cache: a #MafwFilterCache
+ *
+ * Frees @cache with all the filters it holds.  The filters obtained
+ * from the cache must not be used afterwards.
+ */
+void mafw_filter_cache_free(MafwFilterCache *cache)
+{
+	GList *entries, *e;
+
+	if (!cache)
+		return;
+
+	entries = g_hash_table_get_values(cache->by_filter);
+	for (e = entries; e; e = e->next)
+		filter_cache_evict(cache, e->data);
+	g_list_free(entries);
+	g_hash_table_destroy(cache->by_string);
+	g_hash_table_destroy(cache->by_filter);
+	g_free(cache);
+}
+
+/**
+ * mafw_filter_cache_parse:
+ * @cache:  a #MafwFilterCache
+ * @filter: the string representation of a MAFW filter
+ *
+ * Returns the parsed form of @filter, parsing it only if neither it
+ * nor an equivalent filter is in @cache yet.  The returned tree is
+ * shared and must not be modified.  Give it back with
+ * mafw_filter_cache_release() when no longer needed.
+ *
+ * Returns: a #MafwFilter, or %NULL if @filter contains syntax errors
+ */
+const MafwFilter *mafw_filter_cache_parse(MafwFilterCache *cache,
+					  char const *filter)
+{
+	struct filter_cache_entry *e;
+	MafwFilter *filt;
+
+	g_return_val_if_fail(cache != NULL, NULL);
+
+	if (filter == NULL)
+		return NULL;
+	if ((e = g_hash_table_lookup(cache->by_string, filter)) != NULL)
+		return filter_cache_ref(cache, e);
+	if (!(filt = mafw_filter_parse_compact(filter)))
+		return NULL;
+	return filter_cache_add(cache, filt, g_strdup(filter));
+}
+
+/**
+ * mafw_filter_cache_intern:
+ * @cache:  a #MafwFilterCache
+ * @filter: a #MafwFilter
+ *
+ * Like mafw_filter_cache_parse(), but looks up a filter structurally
+ * equal to @filter, so programmatically built filters can share the
+ * cached instances as well.  @filter itself is not referenced.
+ *
+ * Returns: a #MafwFilter equal to @filter, or %NULL if @filter is invalid
+ */
+const MafwFilter *mafw_filter_cache_intern(MafwFilterCache *cache,
+					   const MafwFilter *filter)
+{
+	struct filter_cache_entry *e;
+	MafwFilter *filt;
+	gchar *str;
+
+	g_return_val_if_fail(cache != NULL, NULL);
+
+	if (filter == NULL)
+		return NULL;
+	if ((e = g_hash_table_lookup(cache->by_filter, filter)) != NULL)
+		return filter_cache_ref(cache, e);
+	if (!(str = mafw_filter_to_string(filter)))
+		return NULL;
+	if (!(filt = mafw_filter_parse_compact(str))) {
+		g_free(str);
+		return NULL;
+	}
+	return filter_cache_add(cache, filt, str);
+}
+
+/**
+ * mafw_filter_cache_release:
+ * @cache:  a #MafwFilterCache
+ * @filter: a #MafwFilter returned by @cache
+ *
+ * Drops a reference to a cached @filter.  Unreferenced filters are
+ * kept in the cache until it exceeds its size limit.
+ */
+void mafw_filter_cache_release(MafwFilterCache *cache,
+			       const MafwFilter *filter)
+{
+	struct filter_cache_entry *e;
+
+	g_return_if_fail(cache != NULL);
+
+	if (filter == NULL)
+		return;
+	e = g_hash_table_lookup(cache->by_filter, filter);
+	g_return_if_fail(e != NULL && e->filter == filter && e->refcount > 0);
+
+	if (--e->refcount == 0) {
+		g_queue_push_head(&cache->unused, e);
+		e->unused = cache->unused.head;
+		filter_cache_trim(cache);
+	}
+}
+
+/* Approximate matching */
+/* Size of the on-stack buffer mafw_filter_glob_match() folds ASCII
+ * strings into. */
+#define GLOB_STACKBUF		256
+
+/**
+ * MafwFilterGlob:
+ *
+ * Opaque structure of a compiled #mafw_f_approx pattern.
+ */
+struct _MafwFilterGlob {
+	/* Common shapes of patterns are matched without backtracking. */
+	enum {
+		GLOB_EXACT,	/* foo */
+		GLOB_PREFIX,	/* foo* */
+		GLOB_SUFFIX,	/* *foo */
+		GLOB_SUBSTR,	/* *foo*, or just * */
+		GLOB_GENERIC,	/* anything else */
+	} kind;
+
+	/* The case-folded pattern.  For the fast kinds only the literal
+	 * part is kept.  For GLOB_GENERIC @wild[i] tells whether @pat[i]
+	 * is a `*' or `?' wildcard (and which), or a literal byte. */
+	gchar *pat;
+	gchar *wild;
+	gsize len;
+};
+
+/*
+ * Case-folds and normalizes the first $len bytes of $str.  ASCII strings
+ * shorter than $bufsize are folded into $buf, otherwise the returned
+ * string is allocated and must be g_free()d.  The length of the result
+ * is returned in $outlen.
+ */
+static gchar *glob_fold(gchar const *str, gsize len,
+			gchar *buf, gsize bufsize, gsize *outlen)
+{
+	gsize i;
+	gchar *ret;
+
+	for (i = 0; i < len; i++)
+		if (str[i] & 0x80)
+			break;
+
+	if (i < len) {
+		gchar *folded;
+
+		folded = g_utf8_casefold(str, len);
+		ret = g_utf8_normalize(folded, -1,
+				       G_NORMALIZE_ALL_COMPOSE);
+		g_free(folded);
+		if (ret) {
+			*outlen = strlen(ret);
+			return ret;
+		}
+		/* Invalid UTF-8, fall back to byte-wise folding. */
+	}
+
+	ret = len < bufsize ? buf : g_malloc(len + 1);
+	for (i = 0; i < len; i++)
+		ret[i] = g_ascii_tolower(str[i]);
+	ret[len] = '\0';
+	*outlen = len;
+	return ret;
+}
+
+/* Appends the folded literal $lit to $pat. */
+static void glob_add_literal(GString *pat, GString *wild, GString *lit)
+{
+	gchar *folded, buf[GLOB_STACKBUF];
+	gsize len;
+
+	if (!lit->len)
+		return;
+	folded = glob_fold(lit->str, lit->len, buf, sizeof(buf), &len);
+	g_string_append_len(pat, folded, len);
+	while (len--)
+		g_string_append_c(wild, '\0');
+	if (folded != buf)
+		g_free(folded);
+	g_string_truncate(lit, 0);
+}
+
+/* Decodes the \XX escape sequence at $p into *$c if it's valid. */
+static gboolean glob_unescape(gchar const *p, char *c)
+{
+	*c = 0;
+	if (!hex2char(c, p[1]))
+		return FALSE;
+	*c <<= 4;
+	return hex2char(c, p[2]);
+}
+
+/**
+ * mafw_filter_glob_new:
+ * @pattern: the value of a #mafw_f_approx filter
+ *
+ * Compiles @pattern for repeated approximate matching with
+ * mafw_filter_glob_match().  In @pattern `*' matches any sequence of
+ * characters and `?' matches exactly one.  They can be matched
+ * literally with the LDAP escapes `\2A' and `\3F' (`\' itself is
+ * `\5C').  Matching ignores case, as defined by Unicode case folding
+ * and compatibility normalization.
+ *
+ * Returns: the compiled pattern, to be freed with mafw_filter_glob_free().
+ */
+MafwFilterGlob *mafw_filter_glob_new(gchar const *pattern)
+{
+	MafwFilterGlob *glob;
+	GString *pat, *wild, *lit;
+	guint nstars, nquestions;
+	gboolean star_first, star_last;
+	gchar const *p;
+
+	g_return_val_if_fail(pattern != NULL, NULL);
+
+	/* Split $pattern into folded literals and wildcards. */
+	pat  = g_string_new("");
+	wild = g_string_new("");
+	lit  = g_string_new("");
+	nstars = nquestions = 0;
+	for (p = pattern; *p; p++) {
+		char c;
+
+		if (*p == '*' || *p == '?') {
+			glob_add_literal(pat, wild, lit);
+			if (*p == '*') {
+				/* Consecutive stars are redundant. */
+				if (wild->len && wild->str[wild->len-1] == '*')
+					continue;
+				nstars++;
+			} else
+				nquestions++;
+			g_string_append_c(pat, *p);
+			g_string_append_c(wild, *p);
+		} else if (*p == '\\' && glob_unescape(p, &c)) {
+			g_string_append_c(lit, c);
+			p += 2;
+		} else
+			g_string_append_c(lit, *p);
+	}
+	glob_add_literal(pat, wild, lit);
+	g_string_free(lit, TRUE);
+
+	glob = g_new0(MafwFilterGlob, 1);
+	star_first = wild->len > 0 && wild->str[0] == '*';
+	star_last  = wild->len > 0 && wild->str[wild->len-1] == '*';
+	if (nquestions > 0 || nstars > 2
+	    || (nstars == 2 && !(star_first && star_last))
+	    || (nstars == 1 && !star_first && !star_last)) {
+		glob->kind = GLOB_GENERIC;
+		glob->len  = pat->len;
+		glob->pat  = g_string_free(pat, FALSE);
+		glob->wild = g_string_free(wild, FALSE);
+		return glob;
+	}
+
+	/* Keep only the literal part. */
+	if (star_last)
+		g_string_truncate(pat, pat->len - 1);
+	if (star_first && pat->len > 0)
+		g_string_erase(pat, 0, 1);
+	if (star_first && star_last)
+		glob->kind = GLOB_SUBSTR;
+	else if (star_first)
+		glob->kind = GLOB_SUFFIX;
+	else if (star_last)
+		glob->kind = GLOB_PREFIX;
+	else
+		glob->kind = GLOB_EXACT;
+	glob->len = pat->len;
+	glob->pat = g_string_free(pat, FALSE);
+	g_string_free(wild, TRUE);
+
+	return glob;
+}
+
+/**
+ * mafw_filter_glob_free:
+ * @glob: a #MafwFilterGlob
+ *
+ * Frees a compiled pattern.  Does nothing if %NULL is passed.
+ */
+void mafw_filter_glob_free(MafwFilterGlob *glob)
+{
+	if (!glob)
+		return;
+	g_free(glob->pat);
+	g_free(glob->wild);
+	g_free(glob);
+}
+
+/* Returns the offset of the character after $str[$i]. */
+static inline gsize glob_next(gchar const *str, gsize i, gsize len)
+{
+	i = g_utf8_next_char(&str[i]) - str;
+	return MIN(i, len);
+}
+
+/* Wildcard matching with backtracking to the last star. */
+static gboolean glob_match_generic(const MafwFilterGlob *glob,
+				   gchar const *str, gsize len)
+{
+	gsize p, s, star_p, star_s;
+	gboolean star;
+
+	p = s = star_p = star_s = 0;
+	star = FALSE;
+	while (s < len) {
+		if (p < glob->len && glob->wild[p] == '?') {
+			p++;
+			s = glob_next(str, s, len);
+		} else if (p < glob->len && glob->wild[p] == '*') {
+			star = TRUE;
+			star_p = ++p;
+			star_s = s;
+		} else if (p < glob->len && glob->pat[p] == str[s]) {
+			p++;
+			s++;
+		} else if (star) {
+			/* Let the last star swallow one more character. */
+			p = star_p;
+			s = star_s = glob_next(str, star_s, len);
+		} else
+			return FALSE;
+	}
+
+	while (p < glob->len && glob->wild[p] == '*')
+		p++;
+	return p == glob->len;
+}
+
+/**
+ * mafw_filter_glob_match:
+ * @glob: a compiled pattern
+ * @str:  the string to match
+ *
+ * Matches @str against @glob, ignoring case.  Substring (`*foo*'),
+ * prefix (`foo*') and suffix (`*foo') patterns are matched without
+ * backtracking.
+ *
+ * Returns: %TRUE if @str matches @glob.
+ */
+gboolean mafw_filter_glob_match(const MafwFilterGlob *glob, gchar const *str)
+{
+	gchar *folded, buf[GLOB_STACKBUF];
+	gsize len;
+	gboolean ret;
+
+	g_return_val_if_fail(glob != NULL, FALSE);
+
+	if (str == NULL)
+		return FALSE;
+
+	folded = glob_fold(str, strlen(str), buf, sizeof(buf), &len);
+	switch (glob->kind) {
+	case GLOB_EXACT:
+		ret = len == glob->len && !memcmp(folded, glob->pat, len);
+		break;
+	case GLOB_PREFIX:
+		ret = len >= glob->len && !memcmp(folded, glob->pat,
+						  glob->len);
+		break;
+	case GLOB_SUFFIX:
+		ret = len >= glob->len && !memcmp(folded + len - glob->len,
+						  glob->pat, glob->len);
+		break;
+	case GLOB_SUBSTR:
+		ret = memmem(folded, len, glob->pat, glob->len) != NULL;
+		break;
+	default:
+		ret = glob_match_generic(glob, folded, len);
+		break;
+	}
+
+	if (folded != buf)
+		g_free(folded);
+	return ret;
+}
@@ -180,6 +180,9 @@ typedef struct MafwFilter {
  */
 #define MAFW_FILTER_EXISTS(k)    mafw_filter_new(mafw_f_exists, k, NULL)
 
+typedef struct _MafwFilterCache MafwFilterCache;
+typedef struct _MafwFilterGlob MafwFilterGlob;
+
 /* API. */
 G_BEGIN_DECLS
 
@@ -210,6 +213,31 @@ extern MafwFilter *mafw_filter_add_children_n(MafwFilter *filter, ...);
 extern MafwFilter *mafw_filter_parse(char const *filter);
 extern gchar *mafw_filter_to_string(const MafwFilter *filter);
 extern MafwFilter *mafw_filter_copy(const MafwFilter *filter);
+extern gchar *mafw_filter_to_string_canonical(const MafwFilter *filter);
+
+extern GByteArray *mafw_filter_freeze_bary(const MafwFilter *filter);
+extern gchar *mafw_filter_freeze(const MafwFilter *filter, gsize *sstreamp);
+extern MafwFilter *mafw_filter_thaw(const gchar *stream, gsize sstream);
+
+extern MafwFilter *mafw_filter_parse_compact(char const *filter);
+extern void mafw_filter_free_compact(MafwFilter *filter);
+
+extern guint mafw_filter_hash(gconstpointer filter);
+extern gboolean mafw_filter_equal(gconstpointer a, gconstpointer b);
+
+extern MafwFilterCache *mafw_filter_cache_new(guint max_entries);
+extern void mafw_filter_cache_free(MafwFilterCache *cache);
+extern const MafwFilter *mafw_filter_cache_parse(MafwFilterCache *cache,
+						 char const *filter);
+extern const MafwFilter *mafw_filter_cache_intern(MafwFilterCache *cache,
+						  const MafwFilter *filter);
+extern void mafw_filter_cache_release(MafwFilterCache *cache,
+				      const MafwFilter *filter);
+
+extern MafwFilterGlob *mafw_filter_glob_new(gchar const *pattern);
+extern void mafw_filter_glob_free(MafwFilterGlob *glob);
+extern gboolean mafw_filter_glob_match(const MafwFilterGlob *glob,
+				       gchar const *str);
 
 G_END_DECLS
 #endif
@@ -271,6 +271,7 @@ GHashTable *mafw_metadata_thaw_bary(GByteArray *bary)
 	gsize i;
 	GHashTable *md;
 	const char *key;
+	gpointer val;
 
 	i = 0;
 	md = NULL;
@@ -279,8 +280,11 @@ GHashTable *mafw_metadata_thaw_bary(GByteArray *bary)
 			/* Now we can be sure we have at least one key. */
 			md = mafw_metadata_new();
 
-		g_hash_table_insert(md, g_strdup(key),
-				mafw_metadata_val_thaw_bary(bary, &i));
+		val = mafw_metadata_val_thaw_bary(bary, &i);
+		mafw_metadata_intern_val(key, val);
+		/* Discounted when the table releases it. */
+		mafw_metadata_val_track(val);
+		g_hash_table_insert(md, g_strdup(key), val);
 	}
 
 	return md;
@@ -0,0 +1,365 @@
+/*
+ * This file is a part of MAFW
+ *
+ * Copyright (C) 2007, 2008, 2009 Nokia Corporation, all rights reserved.
+ *
+ * Contact: Visa Smolander <visa.smolander@nokia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "mafw-metadata-sort.h"
+
+/**
+ * SECTION: mafwmetadatasort
+ * @short_description: asynchronous filtering and sorting of metadata
+ * @see_also: mafw_metadata_filter_batch(), mafw_metadata_compare()
+ *
+ * Filtering and sorting tens of thousands of metadata hash tables takes
+ * long enough to freeze the user interface if done in the main loop.
+ * mafw_metadata_sort_async() does the same as mafw_metadata_filter()
+ * and mafw_metadata_compare() would, but in a pool of worker threads,
+ * and reports the result in the main loop of the caller.
+ *
+ * The tables are split into chunks, which are filtered and sorted in
+ * parallel, then the sorted runs are merged pairwise, in parallel again,
+ * until only one is left.  The result is the same as of a stable sort.
+ *
+ * The GLib thread system must be initialized before using this API.
+ */
+
+/* Chunks smaller than this are not worth a thread. */
+#define MIN_CHUNK		1024
+
+/*
+ * The state of a mafw_metadata_sort_async().  $runs are the sorted
+ * #GArray:s of indices produced by the current phase; in a merge phase
+ * $runs[2i] and $runs[2i+1] are merged into $next[i].  $pending counts
+ * the tasks of the current phase, the last one to finish starts the
+ * next phase or delivers the result.
+ */
+struct _MafwMetadataSort {
+	GHashTable **mds;
+	guint nmds;
+	MafwFilter *filter;
+	gchar **terms;
+	MafwMetadataComparator funcomp;
+
+	GMainContext *context;
+	MafwMetadataSortCb cb;
+	gpointer cbdata;
+
+	volatile gint cancelled;
+	volatile gint pending;
+	GPtrArray *runs, *next;
+};
+
+/* A unit of work: filtering and sorting $first..$last of the tables,
+ * or merging two runs into $next[$idx]. */
+struct sort_task {
+	MafwMetadataSort *op;
+	gboolean merge;
+	guint idx, first, last;
+};
+
+static GThreadPool *Pool;
+G_LOCK_DEFINE_STATIC(Pool);
+
+/* Private functions */
+static guint num_cpus(void)
+{
+#ifdef _SC_NPROCESSORS_ONLN
+	glong n;
+
+	if ((n = sysconf(_SC_NPROCESSORS_ONLN)) > 0)
+		return n;
+#endif
+	return 1;
+}
+
+static void free_runs(GPtrArray *runs)
+{
+	guint i;
+
+	if (!runs)
+		return;
+	for (i = 0; i < runs->len; i++)
+		if (runs->pdata[i])
+			g_array_free(runs->pdata[i], TRUE);
+	g_ptr_array_free(runs, TRUE);
+}
+
+static void op_free(MafwMetadataSort *op)
+{
+	guint i;
+
+	for (i = 0; i < op->nmds; i++)
+		if (op->mds[i])
+			g_hash_table_unref(op->mds[i]);
+	g_free(op->mds);
+	if (op->filter)
+		mafw_filter_free(op->filter);
+	g_strfreev(op->terms);
+	free_runs(op->runs);
+	free_runs(op->next);
+	g_main_context_unref(op->context);
+	g_free(op);
+}
+
+static gint compare_indices(const guint *lhs, const guint *rhs,
+			    MafwMetadataSort *op)
+{
+	return mafw_metadata_compare(op->mds[*lhs], op->mds[*rhs],
+				     (const gchar *const *)op->terms,
+				     op->funcomp);
+}
+
+/* Returns the sorted indices of the matching tables of $first..$last. */
+static GArray *filter_and_sort(MafwMetadataSort *op, guint first, guint last)
+{
+	GArray *run;
+	gulong *bitmap;
+	guint i;
+
+	run = g_array_sized_new(FALSE, FALSE, sizeof(guint), last - first);
+	bitmap = mafw_metadata_filter_batch(&op->mds[first], last - first,
+					    op->filter, op->funcomp);
+	for (i = first; i < last; i++)
+		if (MAFW_METADATA_BITMAP_TEST(bitmap, i - first))
+			g_array_append_val(run, i);
+	g_free(bitmap);
+
+	if (op->terms)
+		g_qsort_with_data(run->data, run->len, sizeof(guint),
+				  (GCompareDataFunc)compare_indices, op);
+	return run;
+}
+
+/* Merges $lhs and $rhs, preferring $lhs on ties to remain stable. */
+static GArray *merge(MafwMetadataSort *op, GArray *lhs, GArray *rhs)
+{
+	GArray *run;
+	guint l, r;
+
+	run = g_array_sized_new(FALSE, FALSE, sizeof(guint),
+				lhs->len + rhs->len);
+	l = r = 0;
+	if (op->terms) {
+		while (l < lhs->len && r < rhs->len) {
+			guint *lp, *rp;
+
+			lp = &g_array_index(lhs, guint, l);
+			rp = &g_array_index(rhs, guint, r);
+			if (compare_indices(lp, rp, op) <= 0) {
+				g_array_append_val(run, *lp);
+				l++;
+			} else {
+				g_array_append_val(run, *rp);
+				r++;
+			}
+		}
+	}
+	g_array_append_vals(run, &g_array_index(lhs, guint, l), lhs->len - l);
+	g_array_append_vals(run, &g_array_index(rhs, guint, r), rhs->len - r);
+	return run;
+}
+
+static gboolean deliver(MafwMetadataSort *op)
+{
+	GArray *result;
+
+	if (!g_atomic_int_get(&op->cancelled)) {
+		result = op->runs->pdata[0];
+		op->cb((guint *)result->data, result->len, op->cbdata);
+	}
+	op_free(op);
+	return FALSE;
+}
+
+static void push_task(MafwMetadataSort *op, gboolean merge, guint idx,
+		      guint first, guint last)
+{
+	struct sort_task *task;
+
+	task = g_new(struct sort_task, 1);
+	task->op = op;
+	task->merge = merge;
+	task->idx = idx;
+	task->first = first;
+	task->last = last;
+	g_thread_pool_push(Pool, task, NULL);
+}
+
+/* Called when all tasks of a phase are done. */
+static void next_phase(MafwMetadataSort *op)
+{
+	guint i, nruns;
+
+	if (g_atomic_int_get(&op->cancelled)) {
+		op_free(op);
+		return;
+	}
+
+	if (op->next) {
+		free_runs(op->runs);
+		op->runs = op->next;
+		op->next = NULL;
+	}
+
+	nruns = op->runs->len;
+	if (nruns <= 1) {
+		GSource *src;
+
+		src = g_idle_source_new();
+		g_source_set_callback(src, (GSourceFunc)deliver, op, NULL);
+		g_source_attach(src, op->context);
+		g_source_unref(src);
+		return;
+	}
+
+	/* Merge the runs pairwise, moving the odd one over. */
+	op->next = g_ptr_array_sized_new((nruns + 1) / 2);
+	g_ptr_array_set_size(op->next, (nruns + 1) / 2);
+	if (nruns % 2) {
+		op->next->pdata[nruns / 2] = op->runs->pdata[nruns - 1];
+		op->runs->pdata[nruns - 1] = NULL;
+	}
+	op->pending = nruns / 2;
+	for (i = 0; i < nruns / 2; i++)
+		push_task(op, TRUE, i, 0, 0);
+}
+
+static void run_task(struct sort_task *task, gpointer unused)
+{
+	MafwMetadataSort *op;
+
+	/* Cancelled tasks are just counted done. */
+	op = task->op;
+	if (g_atomic_int_get(&op->cancelled)) {
+		/* NOP */
+	} else if (task->merge) {
+		GArray *lhs, *rhs;
+
+		lhs = op->runs->pdata[2 * task->idx];
+		rhs = op->runs->pdata[2 * task->idx + 1];
+		op->next->pdata[task->idx] = merge(op, lhs, rhs);
+	} else {
+		op->runs->pdata[task->idx] = filter_and_sort(op, task->first,
+							     task->last);
+	}
+	g_free(task);
+
+	if (g_atomic_int_dec_and_test(&op->pending))
+		next_phase(op);
+}
+
+/* Interface functions */
+
+/**
+ * mafw_metadata_sort_async:
+ * @mds:       array of mafw metadata hash tables
+ * @nmds:      the number of elements in @mds
+ * @filter:    filter, or %NULL to match everything
+ * @sorting:   sort criteria as passed to mafw_source_browse(),
+ *             or %NULL to keep the original order
+ * @funcomp:   comparison function, or %NULL for mafw_metadata_ordered()
+ * @context:   the #GMainContext to call @cb in, or %NULL for the default
+ * @cb:        called with the result
+ * @user_data: passed to @cb
+ *
+ * Filters @mds by @filter and sorts the matching ones by @sorting in
+ * worker threads, like mafw_metadata_filter() and mafw_metadata_compare()
+ * would.  The result is delivered to @cb in @context as the indices of
+ * the matching tables in @mds; tables sorting equally keep their order.
+ * Elements of @mds may be %NULL, which match everything.
+ *
+ * The tables are referenced until the operation finishes, and must not
+ * be modified meanwhile.  @funcomp is called from several threads at
+ * once.  @filter and @sorting are copied.
+ *
+ * Returns: a handle to mafw_metadata_sort_cancel() the operation with,
+ * which becomes invalid when @cb is called
+ */
+MafwMetadataSort *mafw_metadata_sort_async(
+	GHashTable **mds, guint nmds,
+	const MafwFilter *filter, const gchar *sorting,
+	MafwMetadataComparator funcomp, GMainContext *context,
+	MafwMetadataSortCb cb, gpointer user_data)
+{
+	MafwMetadataSort *op;
+	guint i, ncpus, nchunks, chunk;
+
+	g_return_val_if_fail(mds != NULL || nmds == 0, NULL);
+	g_return_val_if_fail(cb != NULL, NULL);
+	g_return_val_if_fail(g_thread_supported(), NULL);
+
+	ncpus = num_cpus();
+	G_LOCK(Pool);
+	if (!Pool)
+		Pool = g_thread_pool_new((GFunc)run_task, NULL, ncpus,
+					 FALSE, NULL);
+	G_UNLOCK(Pool);
+
+	op = g_new0(MafwMetadataSort, 1);
+	op->mds = g_memdup(mds, sizeof(*mds) * nmds);
+	op->nmds = nmds;
+	for (i = 0; i < nmds; i++)
+		if (mds[i])
+			g_hash_table_ref(mds[i]);
+	op->filter = filter ? mafw_filter_copy(filter) : NULL;
+	if (sorting && sorting[0])
+		op->terms = mafw_metadata_sorting_terms(sorting);
+	op->funcomp = funcomp;
+	op->context = g_main_context_ref(context ? context
+					 : g_main_context_default());
+	op->cb = cb;
+	op->cbdata = user_data;
+
+	/* One chunk per CPU, unless they would be too small. */
+	nchunks = MIN(ncpus, (nmds + MIN_CHUNK - 1) / MIN_CHUNK);
+	if (!nchunks)
+		nchunks = 1;
+	chunk = (nmds + nchunks - 1) / nchunks;
+	op->runs = g_ptr_array_sized_new(nchunks);
+	g_ptr_array_set_size(op->runs, nchunks);
+	op->pending = nchunks;
+	for (i = 0; i < nchunks; i++)
+		push_task(op, FALSE, i, MIN(i * chunk, nmds),
+			  MIN((i + 1) * chunk, nmds));
+	return op;
+}
+
+/**
+ * mafw_metadata_sort_cancel:
+ * @op: a pending mafw_metadata_sort_async() operation
+ *
+ * Cancels @op, so its callback won't be called.  The worker threads
+ * stop at the next opportunity and release the tables.  Must be called
+ * from the #GMainContext given to mafw_metadata_sort_async(), before
+ * the callback.
+ */
+void mafw_metadata_sort_cancel(MafwMetadataSort *op)
+{
+	g_return_if_fail(op != NULL);
+	g_atomic_int_set(&op->cancelled, TRUE);
+}
+
+/* vi: set noexpandtab ts=8 sw=8 cino=t0,(0: */
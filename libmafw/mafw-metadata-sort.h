@@ -0,0 +1,65 @@
+/*
+ * This file is a part of MAFW
+ *
+ * Copyright (C) 2007, 2008, 2009 Nokia Corporation, all rights reserved.
+ *
+ * Contact: Visa Smolander <visa.smolander@nokia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#ifndef __MAFW_METADATA_SORT_H__
+#define __MAFW_METADATA_SORT_H__
+
+#include <glib.h>
+
+#include <libmafw/mafw-filter.h>
+#include <libmafw/mafw-metadata.h>
+
+/**
+ * MafwMetadataSort:
+ *
+ * Opaque handle of a pending mafw_metadata_sort_async() operation.
+ */
+typedef struct _MafwMetadataSort MafwMetadataSort;
+
+/**
+ * MafwMetadataSortCb:
+ * @indices:  the indices of the matching tables, in order
+ * @nindices: the number of elements in @indices
+ * @user_data: the data given to mafw_metadata_sort_async()
+ *
+ * Called with the result of mafw_metadata_sort_async().  @indices
+ * is owned by the library and is only valid during the call.
+ */
+typedef void (*MafwMetadataSortCb)(const guint *indices, guint nindices,
+				   gpointer user_data);
+
+G_BEGIN_DECLS
+
+extern MafwMetadataSort *mafw_metadata_sort_async(
+	GHashTable **mds, guint nmds,
+	const MafwFilter *filter, const gchar *sorting,
+	MafwMetadataComparator funcomp, GMainContext *context,
+	MafwMetadataSortCb cb, gpointer user_data);
+extern void mafw_metadata_sort_cancel(MafwMetadataSort *op);
+
+G_END_DECLS
+
+#endif
+
+/* vi: set noexpandtab ts=8 sw=8 cino=t0,(0: */
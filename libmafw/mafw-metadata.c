@@ -26,7 +26,6 @@
 
 #include <stdlib.h>
 #include <string.h>
-#include <fnmatch.h>
 
 #include "mafw-metadata.h"
 #include "mafw-callbas.h"
@@ -48,10 +47,16 @@
  * You can add metadata to the hash table with the mafw_metadata_add_*()
  * functions.  If you set the value of the same tag several times the
  * values will automatically be merged, forming a multiple-valued tag.
- * String values set with mafw_metadata_add_string() are duplicated.
+ * String values set with mafw_metadata_add_string() are duplicated,
+ * unless their key is interned with mafw_metadata_set_interned().
  * Once you set one type of value to a metadata tag you must not set
  * another one with a different type.
  *
+ * mafw_metadata_copy() duplicates a table without duplicating its
+ * values: they are shared between the copies until one of them is
+ * modified.  Don't modify the #GValueArray:s of a table directly
+ * unless you obtained them with mafw_metadata_writable().
+ *
  * One way to query the structure is using ordinary g_hash_table_*()
  * functions.  This case with mafw_metadata_nvalues() you can enable
  * your client to deal with multiple-valued tags correctly.  However,
@@ -92,8 +97,20 @@ static GType check_mdvtype(GType type)
 	}
 }
 
+/* Adds $key to $all unless it's already there.  There are only a few
+ * relevant keys, so a linear search is cheaper than hashing. */
+static void add_key(GPtrArray *all, const gchar *key)
+{
+	guint i;
+
+	for (i = 0; i < all->len; i++)
+		if (!strcmp(all->pdata[i], key))
+			return;
+	g_ptr_array_add(all, (gchar *)key);
+}
+
 /* Traverses a @filter and stores all referenced keys in @all. */
-static void get_keys_from_filter(GHashTable *all, const MafwFilter *filter)
+static void get_keys_from_filter(GPtrArray *all, const MafwFilter *filter)
 {
 	guint i;
 
@@ -101,13 +118,7 @@ static void get_keys_from_filter(GHashTable *all, const MafwFilter *filter)
 		for (i = 0; filter->parts[i]; i++)
 			get_keys_from_filter(all, filter->parts[i]);
 	} else
-		g_hash_table_insert(all, filter->key, NULL);
-}
-
-/* Adds all keys of a hash table to an array.  The strings are not duped. */
-static void hash2ary(const gchar *key, gpointer unused, GPtrArray *all)
-{
-	g_ptr_array_add(all, (gchar *)key);
+		add_key(all, filter->key);
 }
 
 /* GValue transform function to turn strings into integers.
@@ -183,6 +194,7 @@ static gint eval_filter(GHashTable *md, const MafwFilter *filter,
 		gboolean ret;
 		gpointer lhs;
 		GValue rhs_str, rhs_natural, *rhs;
+		MafwFilterGlob *glob;
 
 		/* Simple expression */
 		g_assert(filter->type < MAFW_F_LAST);
@@ -208,14 +220,30 @@ static gint eval_filter(GHashTable *md, const MafwFilter *filter,
 			rhs = &rhs_str;
 
 		/* Multi-valued tag, return whether at least one
-		 * of the values holds against the relation. */
+		 * of the values holds against the relation.  Compile
+		 * the pattern of mafw_metadata_ordered() globbing
+		 * once for all of them. */
 		ret = FALSE;
+		glob = NULL;
 		for (i = 0; i < ((GValueArray *)lhs)->n_values; i++) {
-			ret = funcomp(filter->type, filter->key,
-				      g_value_array_get_nth(lhs, i), rhs);
+			const GValue *lval;
+
+			lval = g_value_array_get_nth(lhs, i);
+			if (filter->type == mafw_f_approx
+			    && vtype == G_TYPE_STRING
+			    && funcomp == mafw_metadata_ordered) {
+				if (!glob)
+					glob = mafw_filter_glob_new(
+							filter->value);
+				ret = mafw_filter_glob_match(glob,
+						g_value_get_string(lval));
+			} else
+				ret = funcomp(filter->type, filter->key,
+					      lval, rhs);
 			if (ret == TRUE)
 				break;
 		}
+		mafw_filter_glob_free(glob);
 
 		/* Free $rhs_natural if we used it. */
 		if (rhs == &rhs_natural)
@@ -244,6 +272,23 @@ static gint compare_mvals(const GValue *lhs, const GValue *rhs,
 		return 0;
 }
 
+/*
+ * Tables made by mafw_metadata_new() hash their keys with md_key_hash(),
+ * which notes when it is asked about $Md_probe.  Looking up $Md_probe
+ * in a table thus tells whether its values are released with
+ * mafw_metadata_val_unref(), and so whether they may be shared.
+ * $Probe_hit is protected by the shared_values lock.
+ */
+static const gchar Md_probe[] = "";
+static gboolean Probe_hit;
+
+static guint md_key_hash(gconstpointer key)
+{
+	if (key == Md_probe)
+		Probe_hit = TRUE;
+	return g_str_hash(key);
+}
+
 /* Interface functions */
 
 /**
@@ -257,8 +302,560 @@ static gint compare_mvals(const GValue *lhs, const GValue *rhs,
  */
 GHashTable *mafw_metadata_new(void)
 {
-	return g_hash_table_new_full(g_str_hash, g_str_equal,
-		g_free, (GDestroyNotify)g_value_array_free);
+	return g_hash_table_new_full(md_key_hash, g_str_equal,
+		g_free, mafw_metadata_val_unref);
+}
+
+/* Memory accounting */
+/*
+ * Live metadata values and the memory they take, as returned by
+ * mafw_metadata_memory_stats().  Values are counted when created by
+ * the functions of this module (or registered by
+ * mafw_metadata_val_track()) and discounted when freed by
+ * mafw_metadata_val_unref().  The counters are updated atomically
+ * and may go negative because of untracked values.
+ */
+static gint live_values;
+static gint live_bytes;
+
+static void account(gint dvalues, gssize dbytes)
+{
+	if (dvalues)
+		g_atomic_int_add(&live_values, dvalues);
+	if (dbytes)
+		g_atomic_int_add(&live_bytes, (gint)dbytes);
+}
+
+/* String interning */
+/*
+ * Strings of interned keys are stored in the values as static strings
+ * pointing into $string_pool, whose entries are counted references.
+ * A string in a value is known to be pooled if the pool has the very
+ * same pointer; mafw_metadata_val_unref() drops these references.
+ * $ninterned_keys and $npooled let the common, non-interning case
+ * skip the locking.
+ */
+struct pooled_string {
+	guint refs;
+	gchar str[1];
+};
+
+G_LOCK_DEFINE_STATIC(string_pool);
+static GHashTable *string_pool;
+static GHashTable *interned_keys;
+static gint ninterned_keys;
+static gint npooled;
+static gsize pool_bytes, pool_saved;
+
+/* Returns a reference to the pooled copy of $str.  The caller must hold
+ * the lock. */
+static const gchar *pool_ref_unlocked(const gchar *str)
+{
+	struct pooled_string *ps;
+	gsize len;
+
+	if (!str)
+		return NULL;
+
+	len = strlen(str) + 1;
+	if (!string_pool)
+		string_pool = g_hash_table_new(g_str_hash, g_str_equal);
+	if ((ps = g_hash_table_lookup(string_pool, str)) != NULL) {
+		ps->refs++;
+		pool_saved += len;
+	} else {
+		ps = g_malloc(G_STRUCT_OFFSET(struct pooled_string, str) + len);
+		ps->refs = 1;
+		memcpy(ps->str, str, len);
+		g_hash_table_insert(string_pool, ps->str, ps);
+		g_atomic_int_inc(&npooled);
+		pool_bytes += len;
+	}
+	return ps->str;
+}
+
+/* Returns the pool entry of $str if it's a pooled string (and not just
+ * equal to one).  The caller must hold the lock. */
+static struct pooled_string *pool_lookup_unlocked(const gchar *str)
+{
+	struct pooled_string *ps;
+
+	if (!string_pool || !(ps = g_hash_table_lookup(string_pool, str)))
+		return NULL;
+	return ps->str == str ? ps : NULL;
+}
+
+/* Drops a reference to $str if it's in the pool.  The caller must hold
+ * the lock. */
+static void pool_unref_unlocked(const gchar *str)
+{
+	struct pooled_string *ps;
+	gsize len;
+
+	if (!str || !(ps = pool_lookup_unlocked(str)))
+		return;
+
+	len = strlen(str) + 1;
+	if (--ps->refs > 0) {
+		pool_saved -= len;
+	} else {
+		g_hash_table_remove(string_pool, ps->str);
+		g_atomic_int_add(&npooled, -1);
+		pool_bytes -= len;
+		g_free(ps);
+	}
+}
+
+static gboolean key_is_interned(const gchar *key)
+{
+	gboolean interned;
+
+	if (!g_atomic_int_get(&ninterned_keys))
+		return FALSE;
+	G_LOCK(string_pool);
+	interned = g_hash_table_lookup(interned_keys, key) != NULL;
+	G_UNLOCK(string_pool);
+	return interned;
+}
+
+/* Releases the pooled strings of $val. */
+static void val_unpool(GValueArray *val)
+{
+	guint i;
+
+	if (!g_atomic_int_get(&npooled))
+		return;
+	G_LOCK(string_pool);
+	for (i = 0; i < val->n_values; i++)
+		if (G_VALUE_HOLDS_STRING(&val->values[i]))
+			pool_unref_unlocked(g_value_get_string(
+							&val->values[i]));
+	G_UNLOCK(string_pool);
+}
+
+/**
+ * mafw_metadata_set_interned:
+ * @key: metadata key
+ * @interned: whether to intern the values of @key
+ *
+ * Enables or disables interning the string values of @key.  The values
+ * of interned keys added with the mafw_metadata_add_*() functions or
+ * deserialized with mafw_metadata_thaw() are stored in a global pool,
+ * so repeated values (artists, albums, genres, MIME types) are stored
+ * only once no matter how many tables they occur in.  Interning is
+ * worthwhile for keys with few distinct values only.
+ */
+void mafw_metadata_set_interned(const gchar *key, gboolean interned)
+{
+	g_return_if_fail(key != NULL);
+
+	G_LOCK(string_pool);
+	if (!interned_keys)
+		interned_keys = g_hash_table_new_full(g_str_hash,
+						      g_str_equal,
+						      g_free, NULL);
+	if (interned && !g_hash_table_lookup(interned_keys, key)) {
+		g_hash_table_insert(interned_keys, g_strdup(key),
+				    GINT_TO_POINTER(TRUE));
+		g_atomic_int_inc(&ninterned_keys);
+	} else if (!interned && g_hash_table_remove(interned_keys, key)) {
+		g_atomic_int_add(&ninterned_keys, -1);
+	}
+	G_UNLOCK(string_pool);
+}
+
+/**
+ * mafw_metadata_intern_val:
+ * @key: metadata key
+ * @val: a metadata value not shared with other tables
+ *
+ * Moves the string values of @val into the string pool if @key is
+ * interned (see mafw_metadata_set_interned()).  This is done
+ * automatically by the functions adding values to metadata tables;
+ * use it if you build #GValueArray:s yourself.
+ */
+void mafw_metadata_intern_val(const gchar *key, gpointer val)
+{
+	GValueArray *vals = val;
+	gsize moved;
+	guint i;
+
+	g_return_if_fail(key != NULL);
+	g_return_if_fail(val != NULL);
+
+	if (!key_is_interned(key))
+		return;
+
+	moved = 0;
+	G_LOCK(string_pool);
+	for (i = 0; i < vals->n_values; i++) {
+		GValue *v;
+		const gchar *str;
+
+		v = &vals->values[i];
+		if (!G_VALUE_HOLDS_STRING(v))
+			continue;
+		str = g_value_get_string(v);
+		if (!str || pool_lookup_unlocked(str))
+			continue;
+		moved += strlen(str) + 1;
+		/* Frees the private copy. */
+		g_value_set_static_string(v, pool_ref_unlocked(str));
+	}
+	G_UNLOCK(string_pool);
+
+	/* The pool is accounted for separately. */
+	if (moved)
+		account(0, -(gssize)moved);
+}
+
+/**
+ * mafw_metadata_intern_stats:
+ * @nstrings: where to store the number of distinct pooled strings, or %NULL
+ * @nbytes:   where to store the memory taken by them, or %NULL
+ * @saved:    where to store the memory saved by sharing them, or %NULL
+ *
+ * Returns statistics about the string pool.
+ */
+void mafw_metadata_intern_stats(guint *nstrings, gsize *nbytes, gsize *saved)
+{
+	G_LOCK(string_pool);
+	if (nstrings)
+		*nstrings = string_pool ? g_hash_table_size(string_pool) : 0;
+	if (nbytes)
+		*nbytes = pool_bytes;
+	if (saved)
+		*saved = pool_saved;
+	G_UNLOCK(string_pool);
+}
+
+/*
+ * An estimate of the memory taken by a #GHashTable with $n entries,
+ * not counting the keys and values.  GLib keeps the keys, values and
+ * hashes in arrays at most twice as large as needed.
+ */
+#define HASH_TABLE_SIZE(n)						\
+	(sizeof(gpointer) * 8						\
+	 + 2 * (n) * (2 * sizeof(gpointer) + sizeof(guint)))
+
+/* Returns the memory taken by the #GValue:s of $vals from $first on
+ * and the strings they own, except for pooled ones. */
+static gsize vals_size(GValueArray *vals, guint first)
+{
+	gboolean pooled;
+	gsize size;
+	guint i;
+
+	if (first >= vals->n_values)
+		return 0;
+
+	size = (vals->n_values - first) * sizeof(GValue);
+	pooled = g_atomic_int_get(&npooled) > 0;
+	if (pooled)
+		G_LOCK(string_pool);
+	for (i = first; i < vals->n_values; i++) {
+		const gchar *str;
+
+		if (!G_VALUE_HOLDS_STRING(&vals->values[i]))
+			continue;
+		str = g_value_get_string(&vals->values[i]);
+		if (str && !(pooled && pool_lookup_unlocked(str)))
+			size += strlen(str) + 1;
+	}
+	if (pooled)
+		G_UNLOCK(string_pool);
+	return size;
+}
+
+/**
+ * mafw_metadata_val_size:
+ * @val: a metadata value
+ *
+ * Computes the memory taken by @val, including the #GValue:s and the
+ * strings it owns.  Pooled strings (see mafw_metadata_set_interned())
+ * are not counted, see mafw_metadata_intern_stats() for them instead.
+ *
+ * Returns: the size of @val in bytes
+ */
+gsize mafw_metadata_val_size(gpointer val)
+{
+	if (val == NULL)
+		return 0;
+	return sizeof(GValueArray) + vals_size(val, 0);
+}
+
+static void add_kv_size(const gchar *key, gpointer val, gsize *size)
+{
+	*size += strlen(key) + 1 + mafw_metadata_val_size(val);
+}
+
+/**
+ * mafw_metadata_size:
+ * @md: a mafw metadata hash table
+ *
+ * Computes the memory taken by @md, including its keys and values.
+ * Values shared with other tables (see mafw_metadata_copy()) are
+ * counted in full.  The overhead of the hash table is estimated.
+ *
+ * Returns: the size of @md in bytes
+ */
+gsize mafw_metadata_size(GHashTable *md)
+{
+	gsize size;
+
+	if (md == NULL)
+		return 0;
+
+	size = HASH_TABLE_SIZE(g_hash_table_size(md));
+	g_hash_table_foreach(md, (GHFunc)add_kv_size, &size);
+	return size;
+}
+
+static void add_md_size(const gchar *objectid, GHashTable *md, gsize *size)
+{
+	*size += strlen(objectid) + 1 + mafw_metadata_size(md);
+}
+
+/**
+ * mafw_metadata_map_size:
+ * @mds: a #GHashTable of object IDs and metadata tables, like
+ *       the one mafw_source_get_metadatas() returns
+ *
+ * Computes the memory taken by @mds and the metadata tables in it,
+ * like mafw_metadata_size() does.
+ *
+ * Returns: the size of @mds in bytes
+ */
+gsize mafw_metadata_map_size(GHashTable *mds)
+{
+	gsize size;
+
+	if (mds == NULL)
+		return 0;
+
+	size = HASH_TABLE_SIZE(g_hash_table_size(mds));
+	g_hash_table_foreach(mds, (GHFunc)add_md_size, &size);
+	return size;
+}
+
+/**
+ * mafw_metadata_val_track:
+ * @val: a metadata value
+ *
+ * Counts @val in the statistics of mafw_metadata_memory_stats().
+ * Values created by this module are counted automatically, use this
+ * function for values you build yourself and hand over to metadata
+ * tables.  @val must not be changed until it is released.
+ */
+void mafw_metadata_val_track(gpointer val)
+{
+	g_return_if_fail(val != NULL);
+	account(1, mafw_metadata_val_size(val));
+}
+
+/**
+ * mafw_metadata_memory_stats:
+ * @nvalues: where to store the number of live metadata values, or %NULL
+ * @nbytes:  where to store the memory they take, or %NULL
+ *
+ * Returns process-wide statistics about the metadata values created
+ * by this module and not released yet.  The sizes are computed like
+ * mafw_metadata_val_size() does, so add the figures of
+ * mafw_metadata_intern_stats() to get the total.  Keys and the hash
+ * tables themselves are not included.
+ */
+void mafw_metadata_memory_stats(guint *nvalues, gsize *nbytes)
+{
+	gint n;
+
+	/* Don't report wrapped around figures. */
+	if (nvalues)
+		*nvalues = (n = g_atomic_int_get(&live_values)) > 0 ? n : 0;
+	if (nbytes)
+		*nbytes = (n = g_atomic_int_get(&live_bytes)) > 0 ? n : 0;
+}
+
+/* Sharing values */
+/*
+ * Values referenced by more than one table are counted in $shared_values,
+ * anything not in there is owned by the only table it is in.  This way
+ * the values can remain plain #GValueArray:s.  $nshared lets us skip
+ * the locking as long as nothing is shared.
+ */
+G_LOCK_DEFINE_STATIC(shared_values);
+static GHashTable *shared_values;
+static gint nshared;
+
+/* Like mafw_metadata_val_ref(), but the caller must hold the lock. */
+static void val_ref_unlocked(gpointer val)
+{
+	guint refs;
+
+	if (!shared_values)
+		shared_values = g_hash_table_new(NULL, NULL);
+	refs = GPOINTER_TO_UINT(g_hash_table_lookup(shared_values, val));
+	if (!refs) {
+		refs = 1;
+		g_atomic_int_inc(&nshared);
+	}
+	g_hash_table_insert(shared_values, val, GUINT_TO_POINTER(refs + 1));
+}
+
+static gboolean val_is_shared(gpointer val)
+{
+	gboolean shared;
+
+	if (!g_atomic_int_get(&nshared))
+		return FALSE;
+	G_LOCK(shared_values);
+	shared = g_hash_table_lookup(shared_values, val) != NULL;
+	G_UNLOCK(shared_values);
+	return shared;
+}
+
+/**
+ * mafw_metadata_val_ref:
+ * @val: a metadata value
+ *
+ * Adds a reference to the metadata value @val, so that it can be
+ * inserted into another mafw metadata hash table.  Shared values must
+ * not be modified directly; the mafw_metadata_add_*() functions and
+ * mafw_metadata_writable() take care of copying them when needed.
+ *
+ * Returns: @val
+ */
+gpointer mafw_metadata_val_ref(gpointer val)
+{
+	g_return_val_if_fail(val != NULL, NULL);
+
+	G_LOCK(shared_values);
+	val_ref_unlocked(val);
+	G_UNLOCK(shared_values);
+	return val;
+}
+
+/**
+ * mafw_metadata_val_unref:
+ * @val: a metadata value
+ *
+ * Drops a reference to @val, freeing it if it was the last one.
+ * This is the value destructor of mafw metadata hash tables.
+ */
+void mafw_metadata_val_unref(gpointer val)
+{
+	guint refs;
+
+	if (val == NULL)
+		return;
+
+	refs = 0;
+	if (g_atomic_int_get(&nshared)) {
+		G_LOCK(shared_values);
+		refs = GPOINTER_TO_UINT(g_hash_table_lookup(shared_values,
+							    val));
+		if (refs > 2) {
+			g_hash_table_insert(shared_values, val,
+					    GUINT_TO_POINTER(refs - 1));
+		} else if (refs == 2) {
+			g_hash_table_remove(shared_values, val);
+			g_atomic_int_add(&nshared, -1);
+		}
+		G_UNLOCK(shared_values);
+	}
+
+	if (!refs) {
+		account(-1, -(gssize)mafw_metadata_val_size(val));
+		val_unpool(val);
+		g_value_array_free(val);
+	}
+}
+
+/* Tells whether $md was made by mafw_metadata_new().  The caller must
+ * hold the shared_values lock. */
+static gboolean is_mafw_metadata_unlocked(GHashTable *md)
+{
+	Probe_hit = FALSE;
+	g_hash_table_lookup(md, Md_probe);
+	return Probe_hit;
+}
+
+static void copy_kv(const gchar *key, gpointer val, GHashTable *copy)
+{
+	val_ref_unlocked(val);
+	g_hash_table_insert(copy, g_strdup(key), val);
+}
+
+static void deep_copy_kv(const gchar *key, gpointer val, GHashTable *copy)
+{
+	/* Pooled strings are copied too, put them back. */
+	val = g_value_array_copy(val);
+	mafw_metadata_val_track(val);
+	mafw_metadata_intern_val(key, val);
+	g_hash_table_insert(copy, g_strdup(key), val);
+}
+
+/**
+ * mafw_metadata_copy:
+ * @md: a metadata hash table
+ *
+ * Creates a copy of @md which shares the metadata values with it.
+ * A value is only duplicated when either table modifies it with the
+ * mafw_metadata_add_*() functions or mafw_metadata_writable(), so
+ * copying is cheap regardless of the size of the values.
+ *
+ * Tables not created with mafw_metadata_new() may free their values
+ * behind our back, so their values are duplicated instead.  The copy
+ * is a mafw metadata hash table in either case.
+ *
+ * Returns: a new mafw metadata hash table, or %NULL if @md is %NULL
+ */
+GHashTable *mafw_metadata_copy(GHashTable *md)
+{
+	GHashTable *copy;
+	gboolean shareable;
+
+	if (md == NULL)
+		return NULL;
+
+	copy = mafw_metadata_new();
+	G_LOCK(shared_values);
+	if ((shareable = is_mafw_metadata_unlocked(md)) != FALSE)
+		g_hash_table_foreach(md, (GHFunc)copy_kv, copy);
+	G_UNLOCK(shared_values);
+	if (!shareable)
+		g_hash_table_foreach(md, (GHFunc)deep_copy_kv, copy);
+	return copy;
+}
+
+/**
+ * mafw_metadata_writable:
+ * @md: hash table created with mafw_metadata_new()
+ * @key: key
+ *
+ * Returns the values of @key in @md for modification.  If they are
+ * shared with other tables they are copied first, so the changes
+ * affect @md only.
+ *
+ * Returns: a #GValueArray private to @md, or %NULL if no such @key
+ * in @md
+ */
+GValueArray *mafw_metadata_writable(GHashTable *md, const gchar *key)
+{
+	gpointer val;
+
+	g_return_val_if_fail(md != NULL, NULL);
+	g_return_val_if_fail(key != NULL, NULL);
+
+	if ((val = g_hash_table_lookup(md, key)) == NULL)
+		return NULL;
+	if (val_is_shared(val)) {
+		/* Pooled strings are copied too, put them back. */
+		val = g_value_array_copy(val);
+		mafw_metadata_val_track(val);
+		mafw_metadata_intern_val(key, val);
+		g_hash_table_insert(md, g_strdup(key), val);
+	}
+	return val;
 }
 
 /**
@@ -293,6 +890,10 @@ void mafw_metadata_add_something(GHashTable *md, const gchar *key,
 	gpointer mdvals;
 	GValue newval;
 	GType mdvtype;
+	gboolean interned;
+	gint dvalues;
+	gssize dbytes;
+	guint first;
 
 	/* Anything to do? */
 	if (!nvalues)
@@ -300,22 +901,48 @@ void mafw_metadata_add_something(GHashTable *md, const gchar *key,
 
 	/* Are we dealing with multiple-valued metadata tags? */
 	va_start(argvals, nvalues);
-	if ((mdvals = g_hash_table_lookup(md, key)) == NULL)
+	if ((mdvals = mafw_metadata_writable(md, key)) == NULL)
 	{
 		mdvals = g_value_array_new(nvalues);
 		mdvtype = G_TYPE_INVALID;
 		g_hash_table_insert(md, g_strdup(key), mdvals);
+		dvalues = 1;
+		dbytes = sizeof(GValueArray);
 	}
 	else
 	{
 		mdvtype = G_VALUE_TYPE(g_value_array_get_nth(mdvals, 0));
+		dvalues = 0;
+		dbytes = 0;
 	}
+	first = ((GValueArray *)mdvals)->n_values;
 
 	/* Append $argvals:s one by one.  First they are temporarily
 	 * placed into $newval, which g_value_array_append() will
-	 * pick up and copy. */
+	 * pick up and copy.  Interned strings are not copied but
+	 * referenced from the pool. */
+	interned = key_is_interned(key);
 	memset(&newval, 0, sizeof(newval));
 	do {
+		if (argvtype == G_TYPE_STRING && interned) {
+			const gchar *str;
+			GValue *v;
+
+			if (mdvtype != G_TYPE_INVALID)
+				g_assert(argvtype == mdvtype);
+			else
+				mdvtype = argvtype;
+			str = va_arg(argvals, const gchar *);
+			g_value_array_append(mdvals, NULL);
+			v = g_value_array_get_nth(mdvals,
+					((GValueArray *)mdvals)->n_values - 1);
+			g_value_init(v, G_TYPE_STRING);
+			G_LOCK(string_pool);
+			g_value_set_static_string(v, pool_ref_unlocked(str));
+			G_UNLOCK(string_pool);
+			continue;
+		}
+
 		if (argvtype == G_TYPE_VALUE) {
 			GValue *argval;
 
@@ -341,6 +968,191 @@ void mafw_metadata_add_something(GHashTable *md, const gchar *key,
 	} while (--nvalues > 0);
 
 	va_end(argvals);
+	/* Only the appended values are new. */
+	account(dvalues, dbytes + vals_size(mdvals, first));
+
+	/* Strings given in #GValue:s. */
+	if (interned && argvtype == G_TYPE_VALUE)
+		mafw_metadata_intern_val(key, mdvals);
+}
+
+/* Typed setters */
+/*
+ * Returns the values of $key in $md to be overwritten with a single
+ * value of $type.  If $key already has exactly one value of this type
+ * it is reused in place, otherwise it's replaced by a new array.
+ */
+static GValueArray *value_for_set(GHashTable *md, const gchar *key,
+				  GType type)
+{
+	GValueArray *vals;
+
+	vals = mafw_metadata_writable(md, key);
+	if (vals && vals->n_values == 1
+	    && G_VALUE_TYPE(&vals->values[0]) == type)
+		return vals;
+
+	vals = g_value_array_new(1);
+	g_value_array_append(vals, NULL);
+	g_value_init(&vals->values[0], type);
+	account(1, mafw_metadata_val_size(vals));
+	g_hash_table_insert(md, g_strdup(key), vals);
+	return vals;
+}
+
+/* And let cpp write the bodies of the non-string setters. */
+#define SETTER(lctype, uctype)						\
+	void mafw_metadata_set_##lctype(GHashTable *md, const gchar *key, \
+					g##lctype val)			\
+	{								\
+		GValueArray *vals;					\
+		g_return_if_fail(md != NULL);				\
+		g_return_if_fail(key != NULL);				\
+		vals = value_for_set(md, key, uctype);			\
+		g_value_set_##lctype(&vals->values[0], val);		\
+	}
+
+/**
+ * mafw_metadata_set_int:
+ * @md:  hash table created with mafw_metadata_new()
+ * @key: key to use
+ * @val: the new value
+ *
+ * Sets @key to the single value @val, replacing all previous values
+ * of @key.  Unlike the mafw_metadata_add_*() functions this doesn't
+ * allocate if @key already has one value of the same type.
+ */
+SETTER(int, G_TYPE_INT)
+
+/**
+ * mafw_metadata_set_uint:
+ * @md:  hash table created with mafw_metadata_new()
+ * @key: key to use
+ * @val: the new value
+ *
+ * Sets @key to the single value @val, replacing all previous values
+ * of @key.  Unlike the mafw_metadata_add_*() functions this doesn't
+ * allocate if @key already has one value of the same type.
+ */
+SETTER(uint, G_TYPE_UINT)
+
+/**
+ * mafw_metadata_set_long:
+ * @md:  hash table created with mafw_metadata_new()
+ * @key: key to use
+ * @val: the new value
+ *
+ * Sets @key to the single value @val, replacing all previous values
+ * of @key.  Unlike the mafw_metadata_add_*() functions this doesn't
+ * allocate if @key already has one value of the same type.
+ */
+SETTER(long, G_TYPE_LONG)
+
+/**
+ * mafw_metadata_set_ulong:
+ * @md:  hash table created with mafw_metadata_new()
+ * @key: key to use
+ * @val: the new value
+ *
+ * Sets @key to the single value @val, replacing all previous values
+ * of @key.  Unlike the mafw_metadata_add_*() functions this doesn't
+ * allocate if @key already has one value of the same type.
+ */
+SETTER(ulong, G_TYPE_ULONG)
+
+/**
+ * mafw_metadata_set_int64:
+ * @md:  hash table created with mafw_metadata_new()
+ * @key: key to use
+ * @val: the new value
+ *
+ * Sets @key to the single value @val, replacing all previous values
+ * of @key.  Unlike the mafw_metadata_add_*() functions this doesn't
+ * allocate if @key already has one value of the same type.
+ */
+SETTER(int64, G_TYPE_INT64)
+
+/**
+ * mafw_metadata_set_uint64:
+ * @md:  hash table created with mafw_metadata_new()
+ * @key: key to use
+ * @val: the new value
+ *
+ * Sets @key to the single value @val, replacing all previous values
+ * of @key.  Unlike the mafw_metadata_add_*() functions this doesn't
+ * allocate if @key already has one value of the same type.
+ */
+SETTER(uint64, G_TYPE_UINT64)
+
+/**
+ * mafw_metadata_set_double:
+ * @md:  hash table created with mafw_metadata_new()
+ * @key: key to use
+ * @val: the new value
+ *
+ * Sets @key to the single value @val, replacing all previous values
+ * of @key.  Unlike the mafw_metadata_add_*() functions this doesn't
+ * allocate if @key already has one value of the same type.
+ */
+SETTER(double, G_TYPE_DOUBLE)
+
+/**
+ * mafw_metadata_set_boolean:
+ * @md:  hash table created with mafw_metadata_new()
+ * @key: key to use
+ * @val: the new value
+ *
+ * Sets @key to the single value @val, replacing all previous values
+ * of @key.  Unlike the mafw_metadata_add_*() functions this doesn't
+ * allocate if @key already has one value of the same type.
+ */
+SETTER(boolean, G_TYPE_BOOLEAN)
+
+/**
+ * mafw_metadata_set_str:
+ * @md:  hash table created with mafw_metadata_new()
+ * @key: key to use
+ * @val: the new value
+ *
+ * Sets @key to the single string @val, replacing all previous values
+ * of @key.  If @key is interned (see mafw_metadata_set_interned()) the
+ * string is referenced from the pool rather than copied.
+ */
+void mafw_metadata_set_str(GHashTable *md, const gchar *key,
+			   const gchar *val)
+{
+	GValueArray *vals;
+	GValue *v;
+	gssize before;
+
+	g_return_if_fail(md != NULL);
+	g_return_if_fail(key != NULL);
+
+	vals = value_for_set(md, key, G_TYPE_STRING);
+	v = &vals->values[0];
+	before = mafw_metadata_val_size(vals);
+	if (key_is_interned(key)) {
+		const gchar *str;
+
+		/* Take the new reference first in case $val is the
+		 * current value. */
+		G_LOCK(string_pool);
+		str = pool_ref_unlocked(val);
+		pool_unref_unlocked(g_value_get_string(v));
+		G_UNLOCK(string_pool);
+		g_value_set_static_string(v, str);
+	} else {
+		gchar *str;
+
+		str = g_strdup(val);
+		if (g_atomic_int_get(&npooled)) {
+			G_LOCK(string_pool);
+			pool_unref_unlocked(g_value_get_string(v));
+			G_UNLOCK(string_pool);
+		}
+		g_value_take_string(v, str);
+	}
+	account(0, mafw_metadata_val_size(vals) - before);
 }
 
 /**
@@ -517,7 +1329,6 @@ const gchar **mafw_metadata_relevant_keys(const gchar *const *keys,
 {
 	guint i;
 	GPtrArray *vall;
-	GHashTable *hall;
 
 	/* Shortcut if possible. */
 	if (!filter && !sorting) {
@@ -534,16 +1345,16 @@ const gchar **mafw_metadata_relevant_keys(const gchar *const *keys,
 		return g_memdup(keys, skeys);
 	}
 
-	/* Collect all tag names in $hall so that we ignore duplicates.
+	/* Collect all tag names in $vall ignoring duplicates.
 	 * (Tags referred in both, say, $keys and $filter.) */
-	hall = g_hash_table_new(g_str_hash, g_str_equal);
+	vall = g_ptr_array_new();
 
 	if (keys != NULL)
 		for (i = 0; keys[i]; i++)
-			g_hash_table_insert(hall, (gchar *)keys[i], NULL);
+			add_key(vall, keys[i]);
 
 	if (filter != NULL)
-		get_keys_from_filter(hall, filter);
+		get_keys_from_filter(vall, filter);
 
 	if (sorting != NULL) {
 		for (i = 0; sorting[i]; i++) {
@@ -552,15 +1363,10 @@ const gchar **mafw_metadata_relevant_keys(const gchar *const *keys,
 			key = sorting[i];
 			if (key[0] == '+' || key[0] == '-')
 				key++;
-			g_hash_table_insert(hall, (gchar *)key, NULL);
+			add_key(vall, key);
 		}
 	}
 
-	/* Get the (uniqe) keys of $hall and put them into an array. */
-	vall = g_ptr_array_new();
-	g_hash_table_foreach(hall, (GHFunc)hash2ary, vall);
-	g_hash_table_unref(hall);
-
 	/* Free the array and return what we have. */
 	if (vall->len > 0) {
 		g_ptr_array_add(vall, NULL);
@@ -571,6 +1377,133 @@ const gchar **mafw_metadata_relevant_keys(const gchar *const *keys,
 	}
 }
 
+/**
+ * mafw_metadata_sorting_terms_view:
+ * @sorting: sorting criteria
+ * @terms:   array to store the terms in
+ * @nterms:  size of @terms
+ *
+ * Like mafw_metadata_sorting_terms(), but doesn't allocate anything:
+ * the terms are returned as views into @sorting.  The #MafwMetadataKeyView
+ * of a term doesn't include its modifier, which is returned in its
+ * @order field.  If @sorting has more than @nterms terms, only the first
+ * @nterms are stored.  @terms may be %NULL if @nterms is zero.
+ *
+ * Returns: the number of terms in @sorting
+ */
+guint mafw_metadata_sorting_terms_view(const gchar *sorting,
+				       MafwMetadataKeyView *terms,
+				       guint nterms)
+{
+	const gchar *term, *end;
+	guint n;
+
+	if (!sorting || !sorting[0])
+		return 0;
+
+	for (n = 0, term = sorting; ; n++, term = end + 1) {
+		if (!(end = strchr(term, ',')))
+			end = term + strlen(term);
+		if (n < nterms) {
+			MafwMetadataKeyView *view = &terms[n];
+
+			view->order = *term == '+' ? 1
+				: *term == '-' ? -1 : 0;
+			view->key = view->order ? term + 1 : term;
+			view->len = end - view->key;
+		}
+		if (!*end)
+			return n + 1;
+	}
+}
+
+/* Adds the $len long $key to $buf unless it's already there, and returns
+ * the new number of keys in it, or $nbuf+1 if it's full. */
+static guint add_key_view(MafwMetadataKeyView *buf, guint nbuf, guint n,
+			  const gchar *key, gsize len)
+{
+	guint i;
+
+	if (n > nbuf)
+		return n;
+	for (i = 0; i < n; i++)
+		if (buf[i].len == len && !memcmp(buf[i].key, key, len))
+			return n;
+	if (n == nbuf)
+		return n + 1;
+	buf[n].key = key;
+	buf[n].len = len;
+	buf[n].order = 0;
+	return n + 1;
+}
+
+static guint get_key_views_from_filter(MafwMetadataKeyView *buf, guint nbuf,
+				       guint n, const MafwFilter *filter)
+{
+	guint i;
+
+	if (filter->type < MAFW_F_COMPLEX) {
+		for (i = 0; filter->parts[i]; i++)
+			n = get_key_views_from_filter(buf, nbuf, n,
+						      filter->parts[i]);
+		return n;
+	} else
+		return add_key_view(buf, nbuf, n, filter->key,
+				    strlen(filter->key));
+}
+
+/**
+ * mafw_metadata_relevant_keys_view:
+ * @keys:    keys
+ * @filter:  filter
+ * @sorting: sorting criteria, as passed to mafw_source_browse()
+ * @buf:     array to store the keys in
+ * @nbuf:    size of @buf
+ *
+ * Like mafw_metadata_relevant_keys(), but stores the keys in @buf
+ * (which is typically on the stack) instead of allocating an array,
+ * and takes the unsplit sorting criteria.  Duplicates are removed.
+ * The keys are views into @keys, @filter and @sorting, and keys from
+ * @sorting are not NUL-terminated.
+ *
+ * Returns: the number of relevant keys, or @nbuf + 1 if they didn't
+ * fit in @buf.  In the latter case use mafw_metadata_relevant_keys().
+ */
+guint mafw_metadata_relevant_keys_view(const gchar *const *keys,
+				       const MafwFilter *filter,
+				       const gchar *sorting,
+				       MafwMetadataKeyView *buf, guint nbuf)
+{
+	const gchar *term, *end;
+	guint i, n;
+
+	n = 0;
+	if (keys != NULL)
+		for (i = 0; keys[i]; i++)
+			n = add_key_view(buf, nbuf, n, keys[i],
+					 strlen(keys[i]));
+
+	if (filter != NULL)
+		n = get_key_views_from_filter(buf, nbuf, n, filter);
+
+	if (sorting != NULL && sorting[0]) {
+		for (term = sorting; ; term = end + 1) {
+			if (!(end = strchr(term, ',')))
+				end = term + strlen(term);
+			if (*term == '+' || *term == '-')
+				n = add_key_view(buf, nbuf, n, term + 1,
+						 end - term - 1);
+			else
+				n = add_key_view(buf, nbuf, n, term,
+						 end - term);
+			if (!*end)
+				break;
+		}
+	}
+
+	return n;
+}
+
 static gint _compare_utf_str(const gchar *lval, const gchar *rval)
 {
 	gchar *lvalk, *rvalk;
@@ -587,6 +1520,22 @@ static gint _compare_utf_str(const gchar *lval, const gchar *rval)
 	return compval;
 }
 
+/*
+ * Matches $str against the $pattern of a mafw_f_approx relation.
+ * eval_filter() and batch_eval_simple() compile the pattern of a filter
+ * node only once themselves, this is for the other callers.
+ */
+static gboolean glob_match(const gchar *pattern, const gchar *str)
+{
+	MafwFilterGlob *glob;
+	gboolean ret;
+
+	glob = mafw_filter_glob_new(pattern);
+	ret = mafw_filter_glob_match(glob, str);
+	mafw_filter_glob_free(glob);
+	return ret;
+}
+
 /**
  * mafw_metadata_ordered:
  * @rel: filter type
@@ -598,7 +1547,8 @@ static gint _compare_utf_str(const gchar *lval, const gchar *rval)
  * strings and integers.  It is used by default, and you are advised
  * to call it as a fallback from your custom comparator function.
  * Strings are compared ignoring their case.  The approximate matching
- * of strings is executed in terms of globbing. @key is ignored.
+ * of strings is executed in terms of globbing, as described at
+ * mafw_filter_glob_new(). @key is ignored.
  *
  * Returns: a positive integer if left argument is bigger than right,
  * a negative if left is smaller than right and 0 if equal.
@@ -624,15 +1574,7 @@ gboolean mafw_metadata_ordered(MafwFilterType rel, const gchar *key,
 		case mafw_f_eq:
 			return !_compare_utf_str(lhs, rhs);
 		case mafw_f_approx:
-			/*
-			 * Wwwwarninghhh, FNM_CASEFOLD is a glibc extension!
-			 * shhhhh!  This is because g_pattern_match() cannot
-			 * ignore case.
-			 *
-			 * TODO fnmatch()'s quoting is different from LDAP,
-			 * which we don't handle at the moment.
-			 */
-			return fnmatch(rhs, lhs, FNM_CASEFOLD) == 0;
+			return glob_match(rhs, lhs);
 		case mafw_f_lt:
 			return _compare_utf_str(lhs, rhs) < 0;
 		case mafw_f_gt:
@@ -669,6 +1611,24 @@ gboolean mafw_metadata_ordered(MafwFilterType rel, const gchar *key,
 	}
 }
 
+/*
+ * We'll need to convert strings of filters into types accepted
+ * in the hash table to perform comparison.  Note that it will
+ * (probably) take over any previous conversions between these
+ * types if the user happened to define one.
+ */
+static void register_transforms(void)
+{
+	/* We may be called from mafw_metadata_sort_async() workers. */
+	static volatile gsize hacked = 0;
+
+	if (g_once_init_enter(&hacked)) {
+		g_value_register_transform_func(G_TYPE_STRING, G_TYPE_INT,
+						gvstr2gvint);
+		g_once_init_leave(&hacked, 1);
+	}
+}
+
 /**
  * mafw_metadata_filter:
  * @md: hash table
@@ -704,28 +1664,270 @@ gboolean mafw_metadata_ordered(MafwFilterType rel, const gchar *key,
 gboolean mafw_metadata_filter(GHashTable *md, const MafwFilter *filter,
 			      MafwMetadataComparator funcomp)
 {
-	static gboolean hacked = FALSE;
-
 	if (!filter || !md)
 		return TRUE;
 
-	/*
-	 * We'll need to convert strings of $filter into types accepted
-	 * in the hash table to perform comparison.  Note that it will
-	 * (probably) take over any previous conversions between these
-	 * types if the user happened to define one.
-	 */
-	if (!hacked) {
-		g_value_register_transform_func(G_TYPE_STRING, G_TYPE_INT,
-						gvstr2gvint);
-		hacked = TRUE;
-	}
-	
+	register_transforms();
 	if (!funcomp)
 		funcomp = mafw_metadata_ordered;
 	return eval_filter(md, filter, funcomp) != FALSE;
 }
 
+/* Batch filtering */
+/* Bits in a word of a bitmap returned by mafw_metadata_filter_batch(). */
+#define BITMAP_WORD_BITS	(8 * sizeof(gulong))
+#define BITMAP_NWORDS(n)	(((n) + BITMAP_WORD_BITS - 1) / BITMAP_WORD_BITS)
+#define BITMAP_SET(bm, i)	\
+	((bm)[(i) / BITMAP_WORD_BITS] |= 1UL << ((i) % BITMAP_WORD_BITS))
+
+/*
+ * Like mafw_metadata_ordered() for strings, but $glob and $rhs_key are
+ * computed from $rhs on demand and reused for subsequent calls.
+ */
+static gboolean batch_ordered_str(MafwFilterType rel, const gchar *lhs,
+				  const gchar *rhs, MafwFilterGlob **glob,
+				  gchar **rhs_key)
+{
+	gchar *lhs_key;
+	gint cmp;
+
+	if (rel == mafw_f_approx) {
+		if (!*glob)
+			*glob = mafw_filter_glob_new(rhs);
+		return mafw_filter_glob_match(*glob, lhs);
+	}
+
+	if (!*rhs_key)
+		*rhs_key = g_utf8_collate_key(rhs, -1);
+	lhs_key = g_utf8_collate_key(lhs, -1);
+	cmp = strcasecmp(lhs_key, *rhs_key);
+	g_free(lhs_key);
+
+	switch (rel) {
+	case mafw_f_eq:
+		return cmp == 0;
+	case mafw_f_lt:
+		return cmp < 0;
+	case mafw_f_gt:
+		return cmp > 0;
+	default:
+		g_assert_not_reached();
+	}
+}
+
+/*
+ * Evaluates the simple expression $filter over all $mds, setting the bits
+ * of those it holds for in $yes and those it does not in $no.  Neither is
+ * set if the relation is undecidable, like in eval_filter().
+ */
+static void batch_eval_simple(GHashTable **mds, guint nmds,
+			      const MafwFilter *filter,
+			      MafwMetadataComparator funcomp,
+			      gulong *yes, gulong *no)
+{
+	guint i, j;
+	GType rhs_type;
+	gboolean rhs_ok, ordered;
+	GValue rhs_str, rhs_natural, *rhs;
+	MafwFilterGlob *glob;
+	gchar *rhs_key;
+
+	if (filter->type == mafw_f_exists) {
+		for (i = 0; i < nmds; i++) {
+			if (!mds[i])
+				continue;
+			if (g_hash_table_lookup(mds[i], filter->key))
+				BITMAP_SET(yes, i);
+			else
+				BITMAP_SET(no, i);
+		}
+		return;
+	}
+
+	/* $rhs is converted to the type of the values once, and again
+	 * only if an other table has a different type for the key. */
+	memset(&rhs_str, 0, sizeof(rhs_str));
+	memset(&rhs_natural, 0, sizeof(rhs_natural));
+	g_value_init(&rhs_str, G_TYPE_STRING);
+	g_value_set_static_string(&rhs_str, filter->value);
+	rhs = &rhs_str;
+	rhs_type = G_TYPE_INVALID;
+	rhs_ok = FALSE;
+
+	/* Take shortcuts for the types mafw_metadata_ordered() knows. */
+	ordered = funcomp == mafw_metadata_ordered;
+	glob = NULL;
+	rhs_key = NULL;
+
+	for (i = 0; i < nmds; i++) {
+		GValueArray *lhs;
+		GType vtype;
+		gboolean ret;
+
+		if (!mds[i] || !(lhs = g_hash_table_lookup(mds[i],
+							   filter->key)))
+			continue;
+
+		vtype = G_VALUE_TYPE(g_value_array_get_nth(lhs, 0));
+		if (vtype != rhs_type) {
+			if (G_IS_VALUE(&rhs_natural))
+				g_value_unset(&rhs_natural);
+			rhs_type = vtype;
+			if (vtype != G_TYPE_STRING) {
+				g_value_init(&rhs_natural, vtype);
+				rhs_ok = g_value_transform(&rhs_str,
+							   &rhs_natural);
+				rhs = &rhs_natural;
+			} else {
+				rhs_ok = TRUE;
+				rhs = &rhs_str;
+			}
+		}
+		if (!rhs_ok)
+			continue;
+
+		ret = FALSE;
+		for (j = 0; j < lhs->n_values && !ret; j++) {
+			const GValue *lval;
+
+			lval = g_value_array_get_nth(lhs, j);
+			if (ordered && vtype == G_TYPE_STRING)
+				ret = batch_ordered_str(
+					filter->type,
+					g_value_get_string(lval),
+					filter->value, &glob, &rhs_key);
+			else
+				ret = funcomp(filter->type, filter->key,
+					      lval, rhs);
+		}
+
+		if (ret)
+			BITMAP_SET(yes, i);
+		else
+			BITMAP_SET(no, i);
+	}
+
+	if (G_IS_VALUE(&rhs_natural))
+		g_value_unset(&rhs_natural);
+	mafw_filter_glob_free(glob);
+	g_free(rhs_key);
+}
+
+/*
+ * The batch equivalent of eval_filter().  Sets the bits of $yes and
+ * $no for the tables $filter holds and does not hold for, respectively.
+ * Both bitmaps are expected to be cleared.
+ */
+static void batch_eval(GHashTable **mds, guint nmds, const MafwFilter *filter,
+		       MafwMetadataComparator funcomp,
+		       gulong *yes, gulong *no)
+{
+	guint i, w, nwords;
+	gulong *part_yes, *part_no;
+
+	if (filter->type > MAFW_F_COMPLEX) {
+		batch_eval_simple(mds, nmds, filter, funcomp, yes, no);
+		return;
+	}
+
+	/* Collect in $yes and $no which tables any of the subexpressions
+	 * held and did not hold for. */
+	nwords = BITMAP_NWORDS(nmds);
+	part_yes = g_new(gulong, nwords);
+	part_no  = g_new(gulong, nwords);
+	for (i = 0; filter->parts[i]; i++) {
+		memset(part_yes, 0, sizeof(*part_yes) * nwords);
+		memset(part_no,  0, sizeof(*part_no)  * nwords);
+		batch_eval(mds, nmds, filter->parts[i], funcomp,
+			   part_yes, part_no);
+		for (w = 0; w < nwords; w++) {
+			yes[w] |= part_yes[w];
+			no[w]  |= part_no[w];
+		}
+	}
+	g_free(part_yes);
+	g_free(part_no);
+
+	/* Apply the same short-circuit rules as eval_filter().
+	 * What is in neither bitmap remains undecidable. */
+	for (w = 0; w < nwords; w++) {
+		gulong any_yes, any_no;
+
+		any_yes = yes[w];
+		any_no  = no[w];
+		switch (filter->type) {
+		case mafw_f_and:
+			/* Any FALSE ==> FALSE */
+			no[w]  = any_no;
+			yes[w] = any_yes & ~any_no;
+			break;
+		case mafw_f_or:
+			/* Any TRUE  ==> TRUE */
+			yes[w] = any_yes;
+			no[w]  = any_no & ~any_yes;
+			break;
+		case mafw_f_not:
+			/* Any TRUE ==> FALSE */
+			no[w]  = any_yes;
+			yes[w] = any_no & ~any_yes;
+			break;
+		default:
+			g_assert_not_reached();
+		}
+	}
+}
+
+/**
+ * mafw_metadata_filter_batch:
+ * @mds: array of mafw metadata hash tables
+ * @nmds: the number of elements in @mds
+ * @filter: filter
+ * @funcomp: comparison function
+ *
+ * Evaluates @filter over a whole array of mafw metadata hash tables at
+ * once, with the same semantics as if mafw_metadata_filter() was called
+ * for each of them, but faster.  Each simple expression of @filter is
+ * evaluated over all of @mds in one go, so the conversion of its value
+ * and the compilation of approximate patterns are done only once, and
+ * the results of the subexpressions are combined a machine word at a
+ * time.  Elements of @mds may be %NULL, which match everything.
+ *
+ * Returns: a newly allocated bitmap of @nmds bits, where the bits of
+ * the matching hash tables are set.  Test them with
+ * MAFW_METADATA_BITMAP_TEST() and free the bitmap with g_free().
+ */
+gulong *mafw_metadata_filter_batch(GHashTable **mds, guint nmds,
+				   const MafwFilter *filter,
+				   MafwMetadataComparator funcomp)
+{
+	guint w, nwords;
+	gulong *yes, *no;
+
+	nwords = BITMAP_NWORDS(nmds);
+	yes = g_new0(gulong, nwords ? nwords : 1);
+	if (!filter) {
+		memset(yes, 0xff, sizeof(*yes) * nwords);
+	} else {
+		register_transforms();
+		if (!funcomp)
+			funcomp = mafw_metadata_ordered;
+
+		no = g_new0(gulong, nwords ? nwords : 1);
+		batch_eval(mds, nmds, filter, funcomp, yes, no);
+
+		/* Undecidable counts as matching. */
+		for (w = 0; w < nwords; w++)
+			yes[w] = ~no[w];
+		g_free(no);
+	}
+
+	/* Clear the bits past $nmds. */
+	if (nmds % BITMAP_WORD_BITS)
+		yes[nwords - 1] &= (1UL << (nmds % BITMAP_WORD_BITS)) - 1;
+
+	return yes;
+}
+
 /**
  * mafw_metadata_compare: 
  * @md1: first hash table
@@ -764,7 +764,35 @@
  */
 #define MAFW_METADATA_KEY_ICON			"icon"
 
+/**
+ * MAFW_METADATA_BITMAP_TEST:
+ * @bitmap: a bitmap returned by mafw_metadata_filter_batch()
+ * @i: index of the bit to test
+ *
+ * Tells whether the @i:th bit of @bitmap is set.
+ */
+#define MAFW_METADATA_BITMAP_TEST(bitmap, i)				\
+	(((bitmap)[(i) / (8 * sizeof(gulong))]				\
+	  >> ((i) % (8 * sizeof(gulong)))) & 1)
+
 /* Type definitions */
+/**
+ * MafwMetadataKeyView:
+ * @key:   the start of a metadata key in a string it is part of
+ * @len:   the length of the key
+ * @order: for sorting terms, 1 if the modifier is `+', -1 if it is
+ *         `-' and 0 if it is missing; 0 otherwise
+ *
+ * Refers to a metadata key without copying it.  See
+ * mafw_metadata_sorting_terms_view() and
+ * mafw_metadata_relevant_keys_view().
+ */
+typedef struct {
+	const gchar *key;
+	gsize len;
+	gint order;
+} MafwMetadataKeyView;
+
 /**
  * MafwMetadataComparator:
  * @rel: the filter
@@ -784,16 +812,256 @@ typedef gboolean (*MafwMetadataComparator)(MafwFilterType rel,
 					   const GValue *lhsgv,
 					   const GValue *rshgv);
 
+/* Typed accessors */
+/*
+ * Returns the first #GValue of $key in $md if it has $type,
+ * otherwise %NULL.  This is private, don't rely on it.
+ */
+static inline const GValue *_mafw_metadata_first_of(GHashTable *md,
+						     const gchar *key,
+						     GType type)
+{
+	GValueArray *vals;
+
+	vals = (GValueArray *)g_hash_table_lookup(md, key);
+	if (!vals || !vals->n_values
+	    || G_VALUE_TYPE(&vals->values[0]) != type)
+		return NULL;
+	return &vals->values[0];
+}
+
+/**
+ * mafw_metadata_get_int:
+ * @md:  a mafw metadata hash table
+ * @key: key
+ * @def: the value to return if @key is not found
+ *
+ * Returns the first value of @key, if it is an integer.
+ * It avoids the lookup overhead of mafw_metadata_first().
+ *
+ * Returns: the value of @key, or @def if @key is missing or has
+ * a different type.
+ */
+static inline gint mafw_metadata_get_int(GHashTable *md,
+					 const gchar *key, gint def)
+{
+	const GValue *v;
+
+	v = _mafw_metadata_first_of(md, key, G_TYPE_INT);
+	return v ? g_value_get_int(v) : def;
+}
+
+/**
+ * mafw_metadata_get_uint:
+ * @md:  a mafw metadata hash table
+ * @key: key
+ * @def: the value to return if @key is not found
+ *
+ * Returns the first value of @key, if it is an unsigned integer.
+ * It avoids the lookup overhead of mafw_metadata_first().
+ *
+ * Returns: the value of @key, or @def if @key is missing or has
+ * a different type.
+ */
+static inline guint mafw_metadata_get_uint(GHashTable *md,
+					   const gchar *key, guint def)
+{
+	const GValue *v;
+
+	v = _mafw_metadata_first_of(md, key, G_TYPE_UINT);
+	return v ? g_value_get_uint(v) : def;
+}
+
+/**
+ * mafw_metadata_get_long:
+ * @md:  a mafw metadata hash table
+ * @key: key
+ * @def: the value to return if @key is not found
+ *
+ * Returns the first value of @key, if it is a long integer.
+ * It avoids the lookup overhead of mafw_metadata_first().
+ *
+ * Returns: the value of @key, or @def if @key is missing or has
+ * a different type.
+ */
+static inline glong mafw_metadata_get_long(GHashTable *md,
+					   const gchar *key, glong def)
+{
+	const GValue *v;
+
+	v = _mafw_metadata_first_of(md, key, G_TYPE_LONG);
+	return v ? g_value_get_long(v) : def;
+}
+
+/**
+ * mafw_metadata_get_ulong:
+ * @md:  a mafw metadata hash table
+ * @key: key
+ * @def: the value to return if @key is not found
+ *
+ * Returns the first value of @key, if it is an unsigned long integer.
+ * It avoids the lookup overhead of mafw_metadata_first().
+ *
+ * Returns: the value of @key, or @def if @key is missing or has
+ * a different type.
+ */
+static inline gulong mafw_metadata_get_ulong(GHashTable *md,
+					     const gchar *key, gulong def)
+{
+	const GValue *v;
+
+	v = _mafw_metadata_first_of(md, key, G_TYPE_ULONG);
+	return v ? g_value_get_ulong(v) : def;
+}
+
+/**
+ * mafw_metadata_get_int64:
+ * @md:  a mafw metadata hash table
+ * @key: key
+ * @def: the value to return if @key is not found
+ *
+ * Returns the first value of @key, if it is a 64 bits integer.
+ * It avoids the lookup overhead of mafw_metadata_first().
+ *
+ * Returns: the value of @key, or @def if @key is missing or has
+ * a different type.
+ */
+static inline gint64 mafw_metadata_get_int64(GHashTable *md,
+					     const gchar *key, gint64 def)
+{
+	const GValue *v;
+
+	v = _mafw_metadata_first_of(md, key, G_TYPE_INT64);
+	return v ? g_value_get_int64(v) : def;
+}
+
+/**
+ * mafw_metadata_get_uint64:
+ * @md:  a mafw metadata hash table
+ * @key: key
+ * @def: the value to return if @key is not found
+ *
+ * Returns the first value of @key, if it is an unsigned 64 bits integer.
+ * It avoids the lookup overhead of mafw_metadata_first().
+ *
+ * Returns: the value of @key, or @def if @key is missing or has
+ * a different type.
+ */
+static inline guint64 mafw_metadata_get_uint64(GHashTable *md,
+					       const gchar *key, guint64 def)
+{
+	const GValue *v;
+
+	v = _mafw_metadata_first_of(md, key, G_TYPE_UINT64);
+	return v ? g_value_get_uint64(v) : def;
+}
+
+/**
+ * mafw_metadata_get_double:
+ * @md:  a mafw metadata hash table
+ * @key: key
+ * @def: the value to return if @key is not found
+ *
+ * Returns the first value of @key, if it is a double.
+ * It avoids the lookup overhead of mafw_metadata_first().
+ *
+ * Returns: the value of @key, or @def if @key is missing or has
+ * a different type.
+ */
+static inline gdouble mafw_metadata_get_double(GHashTable *md,
+					       const gchar *key, gdouble def)
+{
+	const GValue *v;
+
+	v = _mafw_metadata_first_of(md, key, G_TYPE_DOUBLE);
+	return v ? g_value_get_double(v) : def;
+}
+
+/**
+ * mafw_metadata_get_boolean:
+ * @md:  a mafw metadata hash table
+ * @key: key
+ * @def: the value to return if @key is not found
+ *
+ * Returns the first value of @key, if it is a boolean.
+ * It avoids the lookup overhead of mafw_metadata_first().
+ *
+ * Returns: the value of @key, or @def if @key is missing or has
+ * a different type.
+ */
+static inline gboolean mafw_metadata_get_boolean(GHashTable *md,
+						 const gchar *key, gboolean def)
+{
+	const GValue *v;
+
+	v = _mafw_metadata_first_of(md, key, G_TYPE_BOOLEAN);
+	return v ? g_value_get_boolean(v) : def;
+}
+
+/**
+ * mafw_metadata_get_str:
+ * @md:  a mafw metadata hash table
+ * @key: key
+ *
+ * Returns the first value of @key, if it is a string.
+ * It avoids the lookup overhead of mafw_metadata_first().
+ * The string is owned by @md.
+ *
+ * Returns: the value of @key, or %NULL if @key is missing or has
+ * a different type.
+ */
+static inline const gchar *mafw_metadata_get_str(GHashTable *md,
+						 const gchar *key)
+{
+	const GValue *v;
+
+	v = _mafw_metadata_first_of(md, key, G_TYPE_STRING);
+	return v ? g_value_get_string(v) : NULL;
+}
+
 G_BEGIN_DECLS
 
 /* Function prototypes */
 extern GHashTable *mafw_metadata_new(void);
 extern void mafw_metadata_release(GHashTable *md);
+extern GHashTable *mafw_metadata_copy(GHashTable *md);
+extern GValueArray *mafw_metadata_writable(GHashTable *md, const gchar *key);
+extern gpointer mafw_metadata_val_ref(gpointer val);
+extern void mafw_metadata_val_unref(gpointer val);
+
+extern void mafw_metadata_set_interned(const gchar *key, gboolean interned);
+extern void mafw_metadata_intern_val(const gchar *key, gpointer val);
+extern void mafw_metadata_intern_stats(guint *nstrings, gsize *nbytes,
+				       gsize *saved);
+
+extern gsize mafw_metadata_val_size(gpointer val);
+extern gsize mafw_metadata_size(GHashTable *md);
+extern gsize mafw_metadata_map_size(GHashTable *mds);
+extern void mafw_metadata_val_track(gpointer val);
+extern void mafw_metadata_memory_stats(guint *nvalues, gsize *nbytes);
 extern void mafw_metadata_add_something(GHashTable *md, const gchar *key,
 					GType argvtype, guint nvalues, ...);
 extern guint mafw_metadata_nvalues(gconstpointer value);
 extern GValue *mafw_metadata_first(GHashTable *md, const gchar *key);
 
+extern void mafw_metadata_set_int(GHashTable *md, const gchar *key, gint val);
+extern void mafw_metadata_set_uint(GHashTable *md, const gchar *key,
+				   guint val);
+extern void mafw_metadata_set_long(GHashTable *md, const gchar *key,
+				   glong val);
+extern void mafw_metadata_set_ulong(GHashTable *md, const gchar *key,
+				    gulong val);
+extern void mafw_metadata_set_int64(GHashTable *md, const gchar *key,
+				    gint64 val);
+extern void mafw_metadata_set_uint64(GHashTable *md, const gchar *key,
+				     guint64 val);
+extern void mafw_metadata_set_double(GHashTable *md, const gchar *key,
+				     gdouble val);
+extern void mafw_metadata_set_boolean(GHashTable *md, const gchar *key,
+				      gboolean val);
+extern void mafw_metadata_set_str(GHashTable *md, const gchar *key,
+				  const gchar *val);
+
 extern void mafw_metadata_print_one(const gchar *key, gpointer val,
 				    const gchar *domain);
 extern void mafw_metadata_print(GHashTable *md, const gchar *domain);
@@ -802,11 +1070,22 @@ extern gchar **mafw_metadata_sorting_terms(const gchar *sorting);
 extern const gchar **mafw_metadata_relevant_keys(const gchar *const *keys,
 						 const MafwFilter *filter,
 						 const gchar *const *sorting);
+extern guint mafw_metadata_sorting_terms_view(const gchar *sorting,
+					      MafwMetadataKeyView *terms,
+					      guint nterms);
+extern guint mafw_metadata_relevant_keys_view(const gchar *const *keys,
+					      const MafwFilter *filter,
+					      const gchar *sorting,
+					      MafwMetadataKeyView *buf,
+					      guint nbuf);
 
 extern gboolean mafw_metadata_ordered(MafwFilterType rel, const gchar *key,
 				      const GValue *lhsgv, const GValue *rhsgv);
 extern gboolean mafw_metadata_filter(GHashTable *md, const MafwFilter *filter,
 				     MafwMetadataComparator funcomp);
+extern gulong *mafw_metadata_filter_batch(GHashTable **mds, guint nmds,
+					  const MafwFilter *filter,
+					  MafwMetadataComparator funcomp);
 extern gint mafw_metadata_compare(GHashTable *md1, GHashTable *md2,
 				  const gchar *const *terms,
 				  MafwMetadataComparator funcomp);
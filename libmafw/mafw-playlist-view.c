@@ -0,0 +1,667 @@
+/*
+ * This file is a part of MAFW
+ *
+ * Copyright (C) 2007, 2008, 2009 Nokia Corporation, all rights reserved.
+ *
+ * Contact: Visa Smolander <visa.smolander@nokia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "mafw-playlist-view.h"
+#include "mafw-registry.h"
+#include "mafw-source.h"
+
+/**
+ * SECTION: mafwplaylistview
+ * @short_description: scrolling window over a playlist
+ * @see_also: mafw_playlist_get_items_md()
+ *
+ * A #MafwPlaylistView follows the rows of a playlist a user interface
+ * shows, and keeps their metadata at hand.  When the visible window
+ * moves, mafw_playlist_view_set_window() asks the metadata of its rows
+ * from each source in one mafw_source_get_metadatas_full() request, and
+ * the next rows in the direction of scrolling in another one, at
+ * %MAFW_SOURCE_PRIORITY_PREFETCH.  Rows still being prefetched when
+ * they come into the window are asked again interactively, which
+ * promotes the pending requests.  Requests whose rows have all left
+ * both ranges are cancelled.
+ *
+ * Fetched rows are kept until they are the least recently used of more
+ * than @cache_size rows outside of these ranges, so scrolling back and
+ * forth is answered without asking the sources again.  Rows are
+ * forgotten when the contents of the playlist change at or before them.
+ */
+
+/*
+ * $rows maps indices to struct row:s, which are either fetched, and in
+ * $lru, the most recently shown first, or being fetched in a $batch.
+ * The window is [$first, $first + $count), the $prefetch rows before or
+ * after it, depending on the direction of the last scroll, are fetched
+ * too.  While we are calling back the user, $busy is non-zero, and
+ * mafw_playlist_view_free() only sets $freed.
+ */
+struct _MafwPlaylistView {
+	MafwPlaylist *pls;
+	gchar **keys;
+	guint prefetch, cache_size;
+	MafwPlaylistGetItemsCB cb;
+	gpointer user_data;
+
+	guint first, count;
+	gboolean backwards;
+	GHashTable *rows;
+	GQueue lru;
+	gulong changed_id, moved_id;
+
+	guint busy;
+	gboolean freed;
+};
+
+struct row {
+	MafwPlaylistView *view;
+	guint index;
+	gchar *object_id;
+	GHashTable *metadata;
+	struct batch *batch;
+	GList *link;
+};
+
+/*
+ * The rows asked from a source in one request at $priority, which is
+ * cancelled with $token when all of them are gone.  Until it is sent, and while the
+ * results are delivered, $busy is non-zero and the batch is not freed.
+ * $done is set when the request has completed.
+ */
+struct batch {
+	MafwSourceToken *token;
+	MafwSourcePriority priority;
+	GPtrArray *rows;
+	guint busy;
+	gboolean done;
+};
+
+/* Private functions */
+
+/* Frees $batch if it has no rows left. */
+static void batch_release(struct batch *batch)
+{
+	if (batch->rows->len || batch->busy)
+		return;
+	if (!batch->done)
+		mafw_source_token_cancel(batch->token);
+	mafw_source_token_unref(batch->token);
+	g_ptr_array_free(batch->rows, TRUE);
+	g_free(batch);
+}
+
+static void row_free(struct row *row)
+{
+	if (row->batch) {
+		g_ptr_array_remove_fast(row->batch->rows, row);
+		batch_release(row->batch);
+	}
+	if (row->link)
+		g_queue_delete_link(&row->view->lru, row->link);
+	if (row->metadata)
+		mafw_metadata_release(row->metadata);
+	g_free(row->object_id);
+	g_free(row);
+}
+
+static void view_destroy(MafwPlaylistView *view)
+{
+	g_hash_table_destroy(view->rows);
+	g_strfreev(view->keys);
+	g_free(view);
+}
+
+static void view_unbusy(MafwPlaylistView *view)
+{
+	if (!--view->busy && view->freed)
+		view_destroy(view);
+}
+
+static gboolean in_window(MafwPlaylistView *view, guint index)
+{
+	return index >= view->first && index - view->first < view->count;
+}
+
+/* Returns the prefetched rows in [*$from, *$to). */
+static void prefetch_range(MafwPlaylistView *view, guint *from, guint *to)
+{
+	if (view->backwards) {
+		*to = view->first;
+		*from = view->first > view->prefetch
+			? view->first - view->prefetch : 0;
+	} else {
+		*from = view->first + view->count;
+		*to = *from + view->prefetch;
+	}
+}
+
+static gboolean wanted(MafwPlaylistView *view, guint index)
+{
+	guint from, to;
+
+	if (in_window(view, index))
+		return TRUE;
+	prefetch_range(view, &from, &to);
+	return index >= from && index < to;
+}
+
+/* Makes $row the most recently used one. */
+static void touch(struct row *row)
+{
+	GQueue *lru = &row->view->lru;
+
+	g_queue_unlink(lru, row->link);
+	g_queue_push_head_link(lru, row->link);
+}
+
+/* Forgets the least recently used rows not wanted, until at most
+ * $cache_size are left of them. */
+static void cache_trim(MafwPlaylistView *view)
+{
+	GList *link, *prev;
+	guint outside;
+
+	outside = 0;
+	for (link = view->lru.head; link; link = link->next)
+		if (!wanted(view, ((struct row *)link->data)->index))
+			outside++;
+	for (link = view->lru.tail; link && outside > view->cache_size;
+	     link = prev) {
+		struct row *row = link->data;
+
+		prev = link->prev;
+		if (wanted(view, row->index))
+			continue;
+		g_hash_table_remove(view->rows, GUINT_TO_POINTER(row->index));
+		outside--;
+	}
+}
+
+/* Tells the user about $row if it's in the window. */
+static void show(MafwPlaylistView *view, guint index,
+		 const gchar *object_id, GHashTable *metadata)
+{
+	if (!view->freed && in_window(view, index))
+		view->cb(view->pls, index, object_id, metadata,
+			 view->user_data);
+}
+
+/* Stores the result of a $row taken out of its batch, and shows it. */
+static void got_row(MafwPlaylistView *view, struct row *row,
+		    GHashTable *metadata, gboolean failed)
+{
+	guint index = row->index;
+	gchar *object_id;
+
+	if (failed) {
+		/* Don't remember failures, ask again next time. */
+		object_id = row->object_id;
+		row->object_id = NULL;
+		g_hash_table_remove(view->rows, GUINT_TO_POINTER(index));
+		show(view, index, object_id, NULL);
+		g_free(object_id);
+	} else {
+		if (metadata)
+			row->metadata = g_hash_table_ref(metadata);
+		g_queue_push_head(&view->lru, row);
+		row->link = view->lru.head;
+		show(view, index, row->object_id, row->metadata);
+	}
+}
+
+/* Passes the metadata of $object_id to the rows of $batch showing it.
+ * The callback may change the rows of the batch, so the search starts
+ * over after each. */
+static void got_metadata(MafwSource *source, const gchar *object_id,
+			 GHashTable *metadata, struct batch *batch,
+			 const GError *error)
+{
+	MafwPlaylistView *view;
+	struct row *row;
+	guint i;
+
+	if (!batch->rows->len)
+		return;
+	view = ((struct row *)batch->rows->pdata[0])->view;
+
+	view->busy++;
+	batch->busy++;
+	for (i = 0; i < batch->rows->len; ) {
+		row = batch->rows->pdata[i];
+		if (strcmp(row->object_id, object_id)) {
+			i++;
+			continue;
+		}
+		g_ptr_array_remove_index_fast(batch->rows, i);
+		row->batch = NULL;
+		got_row(view, row, metadata, error != NULL);
+		i = 0;
+	}
+	batch->busy--;
+	batch_release(batch);
+	view_unbusy(view);
+}
+
+/* The rows still waiting have not been answered. */
+static void got_metadatas(MafwSource *source, GHashTable *metadatas,
+			  struct batch *batch, const GError *error)
+{
+	MafwPlaylistView *view;
+	struct row *row;
+
+	batch->done = TRUE;
+	if (!batch->rows->len) {
+		batch_release(batch);
+		return;
+	}
+	view = ((struct row *)batch->rows->pdata[0])->view;
+
+	view->busy++;
+	batch->busy++;
+	while (batch->rows->len) {
+		row = g_ptr_array_remove_index_fast(batch->rows,
+						    batch->rows->len - 1);
+		row->batch = NULL;
+		got_row(view, row, NULL, TRUE);
+	}
+	batch->busy--;
+	batch_release(batch);
+	view_unbusy(view);
+}
+
+/* Returns the source of $object_id, or %NULL if there's nothing to
+ * fetch from it. */
+static MafwSource *source_of(MafwPlaylistView *view, const gchar *object_id)
+{
+	MafwSource *source;
+	gchar *uuid;
+
+	if (!view->keys || !mafw_source_split_objectid(object_id, &uuid, NULL))
+		return NULL;
+	source = MAFW_SOURCE(mafw_registry_get_extension_by_uuid(
+			MAFW_REGISTRY(mafw_registry_get_instance()), uuid));
+	g_free(uuid);
+	return source;
+}
+
+/* Takes $row out of its batch if that is less urgent than $priority,
+ * and returns its *$source to ask it again.  The old batch is held in
+ * $promoted, so its request is not cancelled until the new one has
+ * joined it. */
+static gboolean promote_row(MafwPlaylistView *view, struct row *row,
+			    MafwSourcePriority priority, GPtrArray *promoted,
+			    MafwSource **source)
+{
+	struct batch *old = row->batch;
+
+	if (!old || !promoted || old->priority <= priority)
+		return FALSE;
+	if (!(*source = source_of(view, row->object_id)))
+		return FALSE;
+	old->busy++;
+	g_ptr_array_add(promoted, old);
+	g_ptr_array_remove_fast(old->rows, row);
+	return TRUE;
+}
+
+/* Adds the row at $index to the batch of its source in $batches, to be
+ * asked at $priority, unless it's known or being fetched already.  Rows
+ * being fetched less urgently are asked again, see promote_row(). */
+static void fetch_row(MafwPlaylistView *view, GHashTable *batches,
+		      MafwSourcePriority priority, GPtrArray *promoted,
+		      guint index, const gchar *object_id)
+{
+	struct row *row;
+	struct batch *batch;
+	MafwSource *source;
+
+	row = g_hash_table_lookup(view->rows, GUINT_TO_POINTER(index));
+	if (row) {
+		if (!promote_row(view, row, priority, promoted, &source))
+			return;
+	} else {
+		row = g_new0(struct row, 1);
+		row->view = view;
+		row->index = index;
+		row->object_id = g_strdup(object_id);
+		g_hash_table_insert(view->rows, GUINT_TO_POINTER(index), row);
+
+		if (!(source = source_of(view, object_id))) {
+			/* There's nothing to fetch. */
+			g_queue_push_head(&view->lru, row);
+			row->link = view->lru.head;
+			show(view, index, row->object_id, NULL);
+			return;
+		}
+	}
+
+	if (!(batch = g_hash_table_lookup(batches, source))) {
+		batch = g_new0(struct batch, 1);
+		batch->token = mafw_source_token_new();
+		batch->priority = priority;
+		batch->rows = g_ptr_array_new();
+		/* Showing other rows may free the rows of this one
+		 * before it is sent. */
+		batch->busy = 1;
+		g_hash_table_insert(batches, source, batch);
+	}
+	row->batch = batch;
+	g_ptr_array_add(batch->rows, row);
+}
+
+/* Adds the needed rows in [$from, $to) to $batches. */
+static void fetch(MafwPlaylistView *view, GHashTable *batches,
+		  MafwSourcePriority priority, GPtrArray *promoted,
+		  guint from, guint to)
+{
+	gchar **oids;
+	guint i;
+
+	if (from >= to)
+		return;
+	oids = mafw_playlist_get_items(view->pls, from, to - 1, NULL);
+	for (i = 0; oids && oids[i] && !view->freed; i++)
+		/* Callbacks may have moved the window meanwhile. */
+		if (wanted(view, from + i))
+			fetch_row(view, batches, priority, promoted,
+				  from + i, oids[i]);
+	g_strfreev(oids);
+}
+
+/* Asks the rows of $batch from $source, each object once. */
+static void send_batch(MafwSource *source, struct batch *batch,
+		       MafwPlaylistView *view)
+{
+	GPtrArray *oids;
+	guint i, j;
+
+	batch->busy--;
+	if (!batch->rows->len) {
+		/* The callback of a row has freed the rest. */
+		batch_release(batch);
+		return;
+	}
+
+	oids = g_ptr_array_sized_new(batch->rows->len + 1);
+	for (i = 0; i < batch->rows->len; i++) {
+		const gchar *oid;
+
+		oid = ((struct row *)batch->rows->pdata[i])->object_id;
+		for (j = 0; j < oids->len; j++)
+			if (!strcmp(oids->pdata[j], oid))
+				break;
+		if (j == oids->len)
+			g_ptr_array_add(oids, (gpointer)oid);
+	}
+	g_ptr_array_add(oids, NULL);
+
+	/* The results may arrive before this returns. */
+	mafw_source_get_metadatas_full(source, (const gchar **)oids->pdata,
+				       (const gchar *const *)view->keys,
+				       MAFW_SOURCE_METADATAS_CONCURRENCY, 0,
+				       batch->priority, batch->token,
+				       (MafwSourceMetadataResultCb)
+				       got_metadata,
+				       (MafwSourceMetadataResultsCb)
+				       got_metadatas,
+				       batch);
+	g_ptr_array_free(oids, TRUE);
+}
+
+/* Fetches the needed rows of the window, then the ones to prefetch,
+ * in one request per source each. */
+static void refresh(MafwPlaylistView *view)
+{
+	GHashTable *window, *ahead;
+	GPtrArray *promoted;
+	guint from, to, i;
+
+	window = g_hash_table_new(g_direct_hash, g_direct_equal);
+	ahead = g_hash_table_new(g_direct_hash, g_direct_equal);
+	promoted = g_ptr_array_new();
+	fetch(view, window, MAFW_SOURCE_PRIORITY_INTERACTIVE, promoted,
+	      view->first, view->first + view->count);
+	prefetch_range(view, &from, &to);
+	if (!view->freed)
+		fetch(view, ahead, MAFW_SOURCE_PRIORITY_PREFETCH, NULL,
+		      from, to);
+
+	g_hash_table_foreach(window, (GHFunc)send_batch, view);
+	g_hash_table_foreach(ahead, (GHFunc)send_batch, view);
+	g_hash_table_destroy(window);
+	g_hash_table_destroy(ahead);
+
+	/* The requests of the promoted rows have been joined by now. */
+	for (i = 0; i < promoted->len; i++) {
+		struct batch *batch = promoted->pdata[i];
+
+		batch->busy--;
+		batch_release(batch);
+	}
+	g_ptr_array_free(promoted, TRUE);
+}
+
+static gboolean is_unwanted(gpointer index, struct row *row,
+			    MafwPlaylistView *view)
+{
+	return row->batch && !wanted(view, row->index);
+}
+
+static gboolean is_after(gpointer index, struct row *row, gpointer from)
+{
+	return row->index >= GPOINTER_TO_UINT(from);
+}
+
+/* Forgets the rows from $from on, and fetches the needed ones again. */
+static void forget(MafwPlaylistView *view, guint from)
+{
+	view->busy++;
+	g_hash_table_foreach_remove(view->rows, (GHRFunc)is_after,
+				    GUINT_TO_POINTER(from));
+	refresh(view);
+	view_unbusy(view);
+}
+
+static void contents_changed(MafwPlaylist *pls, guint from, guint nremove,
+			     guint nreplace, MafwPlaylistView *view)
+{
+	forget(view, from);
+}
+
+static void item_moved(MafwPlaylist *pls, guint from, guint to,
+		       MafwPlaylistView *view)
+{
+	forget(view, MIN(from, to));
+}
+
+/* Public API */
+
+/**
+ * mafw_playlist_view_new:
+ * @pls:        a #MafwPlaylist instance.
+ * @keys:       metadata keys to retrieve along with the rows, or %NULL.
+ * @prefetch:   the number of rows to fetch ahead of the window.
+ * @cache_size: the number of rows to keep outside of the window and
+ *              the prefetched ones, or 0 for
+ *              #MAFW_PLAYLIST_VIEW_CACHE_SIZE.
+ * @cb:         function to call with the rows in the window.
+ * @user_data:  additional data passed to @cb.
+ *
+ * Creates a view of @pls, whose window is empty until
+ * mafw_playlist_view_set_window() is called.  @cb is called for each row
+ * coming into the window with its object ID and metadata, which is
+ * %NULL if it couldn't be retrieved.  If the metadata is not known yet,
+ * @cb is called once it has arrived, provided that the row is still in
+ * the window.
+ *
+ * Returns: a new #MafwPlaylistView, to be freed with
+ * mafw_playlist_view_free().
+ */
+MafwPlaylistView *mafw_playlist_view_new(MafwPlaylist *pls,
+					 const gchar *const *keys,
+					 guint prefetch, guint cache_size,
+					 MafwPlaylistGetItemsCB cb,
+					 gpointer user_data)
+{
+	MafwPlaylistView *view;
+
+	g_return_val_if_fail(MAFW_IS_PLAYLIST(pls), NULL);
+	g_return_val_if_fail(cb != NULL, NULL);
+
+	view = g_new0(MafwPlaylistView, 1);
+	view->pls = g_object_ref(pls);
+	view->keys = g_strdupv((gchar **)keys);
+	view->prefetch = prefetch;
+	view->cache_size = cache_size ? cache_size
+		: MAFW_PLAYLIST_VIEW_CACHE_SIZE;
+	view->cb = cb;
+	view->user_data = user_data;
+	view->rows = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+					   NULL, (GDestroyNotify)row_free);
+	g_queue_init(&view->lru);
+	view->changed_id = g_signal_connect(pls, "contents-changed",
+					    G_CALLBACK(contents_changed),
+					    view);
+	view->moved_id = g_signal_connect(pls, "item-moved",
+					  G_CALLBACK(item_moved), view);
+	return view;
+}
+
+/**
+ * mafw_playlist_view_set_window:
+ * @view:  a #MafwPlaylistView.
+ * @first: the index of the first visible row.
+ * @count: the number of visible rows.
+ *
+ * Moves the window of @view.  The rows coming into the window which have
+ * been fetched already are passed to the callback of @view before this
+ * function returns, the rest are asked from the sources, followed by the
+ * rows to prefetch.  Requests for rows which are no longer needed are
+ * cancelled.
+ */
+void mafw_playlist_view_set_window(MafwPlaylistView *view,
+				   guint first, guint count)
+{
+	guint old_first, old_count, i;
+	GArray *cached;
+
+	g_return_if_fail(view != NULL);
+	g_return_if_fail(!view->freed);
+
+	old_first = view->first;
+	old_count = view->count;
+	if (first != old_first)
+		view->backwards = first < old_first;
+	view->first = first;
+	view->count = count;
+
+	view->busy++;
+	g_hash_table_foreach_remove(view->rows, (GHRFunc)is_unwanted, view);
+	cache_trim(view);
+
+	/* Collect the rows to show first, the callback may move
+	 * the window again. */
+	cached = g_array_new(FALSE, FALSE, sizeof(guint));
+	for (i = first; i - first < count; i++) {
+		struct row *row;
+
+		row = g_hash_table_lookup(view->rows, GUINT_TO_POINTER(i));
+		if (!row || row->batch)
+			continue;
+		touch(row);
+		if (i < old_first || i - old_first >= old_count)
+			g_array_append_val(cached, i);
+	}
+	for (i = 0; i < cached->len; i++) {
+		struct row *row;
+		guint index;
+
+		index = g_array_index(cached, guint, i);
+		row = g_hash_table_lookup(view->rows, GUINT_TO_POINTER(index));
+		if (row && !row->batch)
+			show(view, index, row->object_id, row->metadata);
+	}
+	g_array_free(cached, TRUE);
+
+	if (!view->freed)
+		refresh(view);
+	view_unbusy(view);
+}
+
+/**
+ * mafw_playlist_view_get_row:
+ * @view:      a #MafwPlaylistView.
+ * @index:     the index of the row.
+ * @object_id: return location for the object ID of the row, or %NULL.
+ * @metadata:  return location for the metadata of the row, or %NULL.
+ *
+ * Looks up a row @view has fetched.  The returned values are owned by
+ * @view and are valid until the window is moved or the playlist changes.
+ *
+ * Returns: %TRUE if the row is known.
+ */
+gboolean mafw_playlist_view_get_row(MafwPlaylistView *view, guint index,
+				    const gchar **object_id,
+				    GHashTable **metadata)
+{
+	struct row *row;
+
+	g_return_val_if_fail(view != NULL, FALSE);
+
+	row = g_hash_table_lookup(view->rows, GUINT_TO_POINTER(index));
+	if (!row || row->batch)
+		return FALSE;
+	touch(row);
+	if (object_id)
+		*object_id = row->object_id;
+	if (metadata)
+		*metadata = row->metadata;
+	return TRUE;
+}
+
+/**
+ * mafw_playlist_view_free:
+ * @view: a #MafwPlaylistView.
+ *
+ * Frees @view and cancels its requests.  Its callback is not called
+ * any more.
+ */
+void mafw_playlist_view_free(MafwPlaylistView *view)
+{
+	g_return_if_fail(view != NULL);
+	g_return_if_fail(!view->freed);
+
+	g_signal_handler_disconnect(view->pls, view->changed_id);
+	g_signal_handler_disconnect(view->pls, view->moved_id);
+	g_object_unref(view->pls);
+	view->freed = TRUE;
+	g_hash_table_remove_all(view->rows);
+	if (!view->busy)
+		view_destroy(view);
+}
+
+/* vi: set noexpandtab ts=8 sw=8 cino=t0,(0: */
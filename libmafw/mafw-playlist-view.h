@@ -0,0 +1,69 @@
+/*
+ * This file is a part of MAFW
+ *
+ * Copyright (C) 2007, 2008, 2009 Nokia Corporation, all rights reserved.
+ *
+ * Contact: Visa Smolander <visa.smolander@nokia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+
+#ifndef __MAFW_PLAYLIST_VIEW_H__
+#define __MAFW_PLAYLIST_VIEW_H__
+
+#include <glib.h>
+
+#include <libmafw/mafw-playlist.h>
+
+/**
+ * MafwPlaylistView:
+ *
+ * Opaque structure of a window over a playlist, see
+ * mafw_playlist_view_new().
+ */
+typedef struct _MafwPlaylistView MafwPlaylistView;
+
+/**
+ * MAFW_PLAYLIST_VIEW_CACHE_SIZE:
+ *
+ * The number of rows outside of the window a #MafwPlaylistView keeps
+ * if the caller passes zero @cache_size.
+ */
+#define MAFW_PLAYLIST_VIEW_CACHE_SIZE (256)
+
+G_BEGIN_DECLS
+
+extern MafwPlaylistView *mafw_playlist_view_new(MafwPlaylist *pls,
+						const gchar *const *keys,
+						guint prefetch,
+						guint cache_size,
+						MafwPlaylistGetItemsCB cb,
+						gpointer user_data);
+extern void mafw_playlist_view_set_window(MafwPlaylistView *view,
+					  guint first, guint count);
+extern gboolean mafw_playlist_view_get_row(MafwPlaylistView *view,
+					   guint index,
+					   const gchar **object_id,
+					   GHashTable **metadata);
+extern void mafw_playlist_view_free(MafwPlaylistView *view);
+
+G_END_DECLS
+
+#endif
+
+/* vi: set noexpandtab ts=8 sw=8 cino=t0,(0: */
@@ -26,9 +26,13 @@
 #include "config.h"
 #endif
 
+#include <string.h>
+
 #include "mafw-errors.h"
 #include "mafw-playlist.h"
 #include "mafw-source.h"
+#include "mafw-source-private.h"
+#include "mafw-metadata.h"
 #include "mafw-marshal.h"
 #include "mafw-registry.h"
 
@@ -49,6 +53,9 @@
  * which operation randomizes the `playing order' (that renderers use to
  * traverse the playlist).  mafw_playlist_get_items_md() provides a convenient
  * way for retrieving multiple items and their metadata asynchronously.
+ * The metadata it has retrieved is remembered per playlist, until the
+ * source signals #MafwSource::metadata-changed about the object or the
+ * contents of the playlist change.
  *
  * Currently the only existing playlist implementation is #MafwProxyPlaylist (in
  * the libmafw-shared library).
@@ -746,19 +753,292 @@ gboolean mafw_playlist_is_shuffled(MafwPlaylist *pls)
 	return shuffled;
 }
 
+/* Metadata cache */
+
+/* The metadata mafw_playlist_get_items_md() has retrieved for a
+ * playlist, attached to it with MD_CACHE_KEY.  $entries maps the object
+ * ID and the requested keys separated by a newline (see md_cache_key())
+ * to struct MdCacheEntry:s.  The head of $lru is the most recently used
+ * entry, and the least recently used ones are evicted when the entries
+ * take more than $budget bytes.  We watch the
+ * #MafwSource::metadata-changed of $sources, mapped to the handler IDs.
+ * $generation is incremented at every invalidation, and results of
+ * requests started before are not cached, because they may be stale. */
+#define MD_CACHE_KEY "mafw-playlist-md-cache"
+
+struct MdCache
+{
+	GHashTable *entries;
+	GQueue lru;
+	gsize size, budget;
+	GHashTable *sources;
+	guint generation;
+};
+
+/* $link is in the LRU queue with $link.data pointing back to the
+ * entry. */
+struct MdCacheEntry
+{
+	gchar *key;
+	GHashTable *metadata;
+	gsize size;
+	GList link;
+};
+
+static gchar *md_cache_key(const gchar *object_id, const gchar *keys)
+{
+	return g_strconcat(object_id, "\n", keys, NULL);
+}
+
+static void md_cache_entry_free(struct MdCacheEntry *e)
+{
+	g_free(e->key);
+	mafw_metadata_release(e->metadata);
+	g_free(e);
+}
+
+static void md_cache_remove(struct MdCache *cache, struct MdCacheEntry *e)
+{
+	g_queue_unlink(&cache->lru, &e->link);
+	cache->size -= e->size;
+	g_hash_table_remove(cache->entries, e->key);
+}
+
+/* Evicts the least recently used entries until the cache fits in
+ * $budget. */
+static void md_cache_trim(struct MdCache *cache, gsize budget)
+{
+	while (cache->size > budget)
+		md_cache_remove(cache, g_queue_peek_tail(&cache->lru));
+}
+
+static void md_cache_clear(struct MdCache *cache)
+{
+	cache->generation++;
+	/* The links are embedded in the entries. */
+	g_hash_table_remove_all(cache->entries);
+	g_queue_init(&cache->lru);
+	cache->size = 0;
+}
+
+static gboolean md_cache_is_of(const gchar *key, struct MdCacheEntry *e,
+			       gpointer args[2])
+{
+	struct MdCache *cache = args[0];
+	const gchar *object_id = args[1];
+	gsize len;
+
+	len = strlen(object_id);
+	if (strncmp(key, object_id, len) || key[len] != '\n')
+		return FALSE;
+	g_queue_unlink(&cache->lru, &e->link);
+	cache->size -= e->size;
+	return TRUE;
+}
+
+static void md_cache_metadata_changed(MafwSource *source,
+				      const gchar *object_id,
+				      struct MdCache *cache)
+{
+	gpointer args[] = { cache, (gpointer)object_id };
+
+	cache->generation++;
+	g_hash_table_foreach_remove(cache->entries, (GHRFunc)md_cache_is_of,
+				    args);
+}
+
+static void md_cache_contents_changed(MafwPlaylist *pls, guint from,
+				      guint nremove, guint nreplace,
+				      struct MdCache *cache)
+{
+	/* It's not known which objects have left. */
+	md_cache_clear(cache);
+}
+
+/* Called when a watched source is finalized.  Its objects may come back
+ * with another instance, forget about them. */
+static void md_cache_source_gone(struct MdCache *cache, GObject *source)
+{
+	g_hash_table_remove(cache->sources, source);
+	md_cache_clear(cache);
+}
+
+static void md_cache_unwatch(MafwSource *source, gpointer handler,
+			     struct MdCache *cache)
+{
+	g_signal_handler_disconnect(source, GPOINTER_TO_SIZE(handler));
+	g_object_weak_unref(G_OBJECT(source),
+			    (GWeakNotify)md_cache_source_gone, cache);
+}
+
+static void md_cache_free(struct MdCache *cache)
+{
+	/* The handler on the playlist has gone with it. */
+	g_hash_table_foreach(cache->sources, (GHFunc)md_cache_unwatch, cache);
+	g_hash_table_destroy(cache->sources);
+	g_hash_table_destroy(cache->entries);
+	g_free(cache);
+}
+
+/* Returns the metadata cache of $pls, creating it if it doesn't have
+ * one yet. */
+static struct MdCache *md_cache_get(MafwPlaylist *pls)
+{
+	struct MdCache *cache;
+
+	cache = g_object_get_data(G_OBJECT(pls), MD_CACHE_KEY);
+	if (cache)
+		return cache;
+
+	cache = g_new0(struct MdCache, 1);
+	cache->entries = g_hash_table_new_full(g_str_hash, g_str_equal,
+					       NULL,
+					       (GDestroyNotify)
+					       md_cache_entry_free);
+	g_queue_init(&cache->lru);
+	cache->budget = MAFW_PLAYLIST_MD_CACHE_BUDGET;
+	cache->sources = g_hash_table_new(g_direct_hash, g_direct_equal);
+	g_signal_connect(pls, "contents-changed",
+			 G_CALLBACK(md_cache_contents_changed), cache);
+	g_object_set_data_full(G_OBJECT(pls), MD_CACHE_KEY, cache,
+			       (GDestroyNotify)md_cache_free);
+	return cache;
+}
+
+static GHashTable *md_cache_lookup(struct MdCache *cache,
+				   const gchar *object_id, const gchar *keys)
+{
+	struct MdCacheEntry *e;
+	gchar *key;
+
+	key = md_cache_key(object_id, keys);
+	e = g_hash_table_lookup(cache->entries, key);
+	g_free(key);
+	if (!e)
+		return NULL;
+
+	g_queue_unlink(&cache->lru, &e->link);
+	g_queue_push_head_link(&cache->lru, &e->link);
+	return e->metadata;
+}
+
+static void md_cache_store(struct MdCache *cache, MafwSource *source,
+			   const gchar *object_id, const gchar *keys,
+			   GHashTable *metadata)
+{
+	struct MdCacheEntry *e;
+	gulong handler;
+	gchar *key;
+	gsize size;
+
+	key = md_cache_key(object_id, keys);
+	size = sizeof(*e) + strlen(key) + 1 + mafw_metadata_size(metadata);
+	if (size > cache->budget) {
+		g_free(key);
+		return;
+	}
+	if ((e = g_hash_table_lookup(cache->entries, key)))
+		md_cache_remove(cache, e);
+	md_cache_trim(cache, cache->budget - size);
+
+	if (!g_hash_table_lookup(cache->sources, source)) {
+		handler = g_signal_connect(source, "metadata-changed",
+					   G_CALLBACK(
+					     md_cache_metadata_changed),
+					   cache);
+		g_object_weak_ref(G_OBJECT(source),
+				  (GWeakNotify)md_cache_source_gone, cache);
+		g_hash_table_insert(cache->sources, source,
+				    GSIZE_TO_POINTER(handler));
+	}
+
+	e = g_new(struct MdCacheEntry, 1);
+	e->key = key;
+	e->metadata = mafw_metadata_copy(metadata);
+	e->size = size;
+	e->link.data = e;
+	e->link.prev = e->link.next = NULL;
+	g_hash_table_insert(cache->entries, e->key, e);
+	g_queue_push_head_link(&cache->lru, &e->link);
+	cache->size += size;
+}
+
+/**
+ * mafw_playlist_set_md_cache_budget:
+ * @pls:    a #MafwPlaylist instance.
+ * @budget: the maximal size of the cache in bytes, or 0 for
+ *          #MAFW_PLAYLIST_MD_CACHE_BUDGET.
+ *
+ * Limits the memory the metadata cache of mafw_playlist_get_items_md()
+ * may take for @pls, as estimated by mafw_metadata_size().  The least
+ * recently used metadata is dropped first.
+ */
+void mafw_playlist_set_md_cache_budget(MafwPlaylist *pls, gsize budget)
+{
+	struct MdCache *cache;
+
+	g_return_if_fail(MAFW_IS_PLAYLIST(pls));
+
+	cache = md_cache_get(pls);
+	cache->budget = budget ? budget : MAFW_PLAYLIST_MD_CACHE_BUDGET;
+	md_cache_trim(cache, cache->budget);
+}
+
+/**
+ * mafw_playlist_get_md_cache_budget:
+ * @pls: a #MafwPlaylist instance.
+ *
+ * Returns: the budget set by mafw_playlist_set_md_cache_budget(), or
+ * #MAFW_PLAYLIST_MD_CACHE_BUDGET.
+ */
+gsize mafw_playlist_get_md_cache_budget(MafwPlaylist *pls)
+{
+	g_return_val_if_fail(MAFW_IS_PLAYLIST(pls),
+			     MAFW_PLAYLIST_MD_CACHE_BUDGET);
+	return md_cache_get(pls)->budget;
+}
+
 /* Multiple Items With Metadata */
 
 /* Active requests (struct GetPlItemData *). */
 static GQueue *Active_miwmds = NULL;
 
+/* The number of batches asked from a source at once. */
+#define MIWMD_BATCHES_IN_FLIGHT 2
+
+/* The object IDs a request asks from a source.  The first $next of them
+ * have been sent in batches of $batch_size, $in_flight of which are not
+ * answered yet. */
+struct MiwmdBatches
+{
+	GPtrArray *oids;
+	guint next;
+	guint batch_size;
+	guint in_flight;
+};
+
+/* Cancelling a request cancels its $token, which makes the sources drop
+ * the get_metadatas() not answered yet.  It's freed right away unless
+ * we are $delivering the results or $issuing batches.  $remaining_reqs
+ * counts the batches not answered, sent or not, of $batches, which maps
+ * sources to struct MiwmdBatches.  $mdkeys is the canonical form of
+ * $keys joined for the metadata cache, whose $generation we started
+ * with. */
 struct GetPlItemData
 {
 	gchar **oids;
 	guint from;
 	gboolean cancelled;
+	gboolean delivering;
+	gboolean issuing;
+	MafwSourceToken *token;
 	guint remaining_reqs;
+	GHashTable *batches;
 	GHashTable *indexhash;
 	gchar **keys;
+	gchar *mdkeys;
+	struct MdCache *cache;
+	guint generation;
 	MafwPlaylistGetItemsCB cb;
 	gpointer cbarg;
 	MafwPlaylist *pls;
@@ -770,6 +1050,12 @@ static void _free_slistcb(gpointer key, GSList *sl, gpointer user_data)
 	g_slist_free(sl);
 }
 
+static void miwmd_batches_free(struct MiwmdBatches *b)
+{
+	g_ptr_array_free(b->oids, TRUE);
+	g_free(b);
+}
+
 static void miwmd_free(struct GetPlItemData *mi)
 {
 	g_assert(g_queue_find(Active_miwmds, mi));
@@ -777,15 +1063,21 @@ static void miwmd_free(struct GetPlItemData *mi)
 	if (mi->free_cbarg)
 		mi->free_cbarg(mi->cbarg);
 	g_strfreev(mi->keys);
+	g_free(mi->mdkeys);
 	if (mi->indexhash)
 	{
 		g_hash_table_foreach(mi->indexhash, (GHFunc)_free_slistcb, NULL);
 		g_hash_table_unref(mi->indexhash);
 	}
+	if (mi->batches)
+		g_hash_table_destroy(mi->batches);
+	mafw_source_token_unref(mi->token);
 	g_strfreev(mi->oids);
         g_object_unref(mi->pls);
 	g_free(mi);
 }
+static void miwd_pump(struct GetPlItemData *data);
+
 static void miwd_got_mdatas(MafwSource *self, GHashTable *metadatas,
 				struct GetPlItemData *data, const GError *error)
 {
@@ -793,7 +1085,20 @@ static void miwd_got_mdatas(MafwSource *self, GHashTable *metadatas,
 	GSList *idxlist, *iter;;
 	gchar *oid;
 	GHashTable *cur_md;
+	struct MiwmdBatches *batches;
 
+	if ((batches = g_hash_table_lookup(data->batches, self)))
+		batches->in_flight--;
+	data->delivering = TRUE;
+	if (metadatas && data->generation == data->cache->generation)
+	{
+		g_hash_table_iter_init(&htiter, metadatas);
+		while (g_hash_table_iter_next(&htiter,
+					      (gpointer*)(void*)&oid,
+					      (gpointer*)(void*)&cur_md))
+			md_cache_store(data->cache, self, oid, data->mdkeys,
+				       cur_md);
+	}
 	if (metadatas)
 	{
 		g_hash_table_iter_init(&htiter, metadatas);
@@ -818,7 +1123,7 @@ static void miwd_got_mdatas(MafwSource *self, GHashTable *metadatas,
 	}
 	data->remaining_reqs--;
 	
-	if (!data->remaining_reqs)
+	if (!data->remaining_reqs && !data->cancelled)
 	{
 		/* Call the remaining objects with NULL mdata */
 		g_hash_table_iter_init(&htiter, data->indexhash);
@@ -834,13 +1139,57 @@ static void miwd_got_mdatas(MafwSource *self, GHashTable *metadatas,
 				iter = g_slist_next(iter);
 			}
 		}
-		miwmd_free(data);
 	}
+	data->delivering = FALSE;
+	/* If we are called back from miwd_pump(), it goes on. */
+	if (!data->issuing)
+		miwd_pump(data);
 }
 
-static void _free_ptr_array(gpointer key, GPtrArray *arr, gpointer user_data)
+/* Sends the next batches to each source, keeping at most
+ * MIWMD_BATCHES_IN_FLIGHT of them in progress, and frees $data
+ * if it has been cancelled or answered completely. */
+static void miwd_pump(struct GetPlItemData *data)
 {
-	g_ptr_array_free(arr, TRUE);
+	GHashTableIter htiter;
+	MafwSource *source;
+	struct MiwmdBatches *b;
+	const gchar **ids;
+	guint n;
+
+	data->issuing = TRUE;
+	g_hash_table_iter_init(&htiter, data->batches);
+	while (!data->cancelled && g_hash_table_iter_next(&htiter,
+						(gpointer*)(void*)&source,
+						(gpointer*)(void*)&b))
+	{
+		while (!data->cancelled
+		       && b->in_flight < MIWMD_BATCHES_IN_FLIGHT
+		       && b->next < b->oids->len)
+		{
+			n = MIN(b->batch_size, b->oids->len - b->next);
+			ids = g_new(const gchar *, n + 1);
+			memcpy(ids, &b->oids->pdata[b->next],
+			       n * sizeof(*ids));
+			ids[n] = NULL;
+			b->next += n;
+			b->in_flight++;
+			mafw_source_get_metadatas_full(source, ids,
+				(const gchar**)data->keys,
+				MAFW_SOURCE_METADATAS_CONCURRENCY
+					/ MIWMD_BATCHES_IN_FLIGHT,
+				mafw_extension_get_timeout(
+					MAFW_EXTENSION(source)),
+				MAFW_SOURCE_PRIORITY_INTERACTIVE,
+				data->token, NULL,
+				(MafwSourceMetadataResultsCb)miwd_got_mdatas,
+				data);
+			g_free(ids);
+		}
+	}
+	data->issuing = FALSE;
+	if (data->cancelled || !data->remaining_reqs)
+		miwmd_free(data);
 }
 
 static gboolean miwd_send_requests(struct GetPlItemData *pldata)
@@ -851,6 +1200,7 @@ static gboolean miwd_send_requests(struct GetPlItemData *pldata)
 	GHashTableIter htiter;
 	GPtrArray *oblist;
 	MafwSource *source;
+	GHashTable *md;
 	gchar *uuid = NULL;
 
 	if (pldata->cancelled)
@@ -863,6 +1213,8 @@ static gboolean miwd_send_requests(struct GetPlItemData *pldata)
 	pldata->indexhash = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
 						NULL);
 	reg = MAFW_REGISTRY(mafw_registry_get_instance());
+	pldata->cache = md_cache_get(pldata->pls);
+	pldata->generation = pldata->cache->generation;
 
 	while(!pldata->cancelled && pldata->oids[i])
 	{
@@ -885,6 +1237,16 @@ static gboolean miwd_send_requests(struct GetPlItemData *pldata)
 				pldata->cb(pldata->pls, pldata->from + i,
 					pldata->oids[i], NULL,
 				       pldata->cbarg);
+			} else if ((md = md_cache_lookup(pldata->cache,
+							 pldata->oids[i],
+							 pldata->mdkeys))) {
+				/* $cb may change $pls, clearing the
+				 * cache. */
+				g_hash_table_ref(md);
+				pldata->cb(pldata->pls, pldata->from + i,
+					   pldata->oids[i], md,
+					   pldata->cbarg);
+				g_hash_table_unref(md);
 			} else {
 				oblist = g_hash_table_lookup(helperhash, source);
 				
@@ -913,29 +1275,32 @@ static gboolean miwd_send_requests(struct GetPlItemData *pldata)
 		i++;
 	}
 
-	if (pldata->cancelled || ((i = g_hash_table_size(helperhash)) == 0))
-	{
-		miwmd_free(pldata);
-		g_hash_table_foreach(helperhash, (GHFunc)_free_ptr_array, NULL);
-		g_hash_table_destroy(helperhash);
-		return FALSE;
-	}
-
-	
-	pldata->remaining_reqs = i;
+	/* Split the objects of each source into batches, which are
+	 * answered as they complete. */
+	pldata->batches = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+					NULL,
+					(GDestroyNotify)miwmd_batches_free);
 	g_hash_table_iter_init(&htiter, helperhash);
 	while (g_hash_table_iter_next(&htiter, (gpointer*)(void*)&source,
 						(gpointer*)(void*)&oblist))
 	{
-		g_ptr_array_add(oblist, NULL);
-		mafw_source_get_metadatas(source, (const gchar**)oblist->pdata,
-					(const gchar**)pldata->keys, 
-					(MafwSourceMetadataResultsCb)miwd_got_mdatas, 
-					pldata);
+		struct MiwmdBatches *b;
+
+		b = g_new0(struct MiwmdBatches, 1);
+		b->oids = oblist;
+		b->batch_size = mafw_source_get_metadatas_batch_size(source);
+		pldata->remaining_reqs += (oblist->len + b->batch_size - 1)
+			/ b->batch_size;
+		g_hash_table_insert(pldata->batches, source, b);
 	}
-	g_hash_table_foreach(helperhash, (GHFunc)_free_ptr_array, NULL);
 	g_hash_table_destroy(helperhash);
 
+	if (pldata->cancelled || !pldata->remaining_reqs)
+	{
+		miwmd_free(pldata);
+		return FALSE;
+	}
+	miwd_pump(pldata);
 	return FALSE;
 }
 
@@ -958,6 +1323,15 @@ static gboolean miwd_send_requests(struct GetPlItemData *pldata)
  * is called.  It is possible to cancel the operation with
  * mafw_playlist_cancel_get_items_md().
  *
+ * Metadata retrieved by earlier calls for the same object and the same
+ * @keys, in any order, is not asked from the source again, unless
+ * the source or @pls has signalled a change since.  The cache is limited
+ * by mafw_playlist_set_md_cache_budget().
+ *
+ * The objects are asked from each source in batches of
+ * mafw_source_get_metadatas_batch_size(), a few of them in progress at
+ * once, and @cb is called with the results of a batch as it completes.
+ *
  * Returns: an opaque identifier which can be used to
  * mafw_playlist_cancel_get_items_md() the operation.
  */
@@ -1021,9 +1395,16 @@ gpointer mafw_playlist_get_items_md(MafwPlaylist *pls,
 		pldata->oids = pl_items;
 		pldata->free_cbarg = free_cbarg;
 		pldata->cancelled = FALSE;
+		pldata->token = mafw_source_token_new();
 		pldata->from = from;
-		if (keys)
+		if (keys) {
+			gchar **canon;
+
 			pldata->keys = g_strdupv((gchar**)keys);
+			canon = _mafw_source_canonical_keys(keys);
+			pldata->mdkeys = g_strjoinv(",", canon);
+			g_strfreev(canon);
+		}
 		pldata->indexhash = NULL;
 	
 		g_queue_push_tail(Active_miwmds, pldata);
@@ -1038,7 +1419,9 @@ gpointer mafw_playlist_get_items_md(MafwPlaylist *pls,
  * mafw_playlist_cancel_get_items_md:
  * @op: the operation identifier.
  *
- * Cancels a previous mafw_playlist_get_items_md() operation.
+ * Cancels a previous mafw_playlist_get_items_md() operation.  The
+ * metadata requests sent to the sources are cancelled too, see
+ * mafw_source_get_metadatas_full().
  */
 void mafw_playlist_cancel_get_items_md(gconstpointer op)
 {
@@ -1053,7 +1436,13 @@ void mafw_playlist_cancel_get_items_md(gconstpointer op)
 		/* Unknown request, probably already freed. */
 		return;
 	mi = link->data;
+	if (mi->cancelled)
+		return;
 	mi->cancelled = TRUE;
+	mafw_source_token_cancel(mi->token);
+	/* Nothing will call us back if the requests have been sent. */
+	if (mi->remaining_reqs && !mi->delivering && !mi->issuing)
+		miwmd_free(mi);
 }
 
 /* vi: set noexpandtab ts=8 sw=8 cino=t0,(0: */
@@ -230,6 +230,18 @@ gpointer mafw_playlist_get_items_md(MafwPlaylist *pls,
 				    GDestroyNotify free_cbarg);
 void mafw_playlist_cancel_get_items_md(gconstpointer op);
 
+/**
+ * MAFW_PLAYLIST_MD_CACHE_BUDGET:
+ *
+ * The default maximal size in bytes of the metadata
+ * mafw_playlist_get_items_md() keeps for a playlist, see
+ * mafw_playlist_set_md_cache_budget().
+ */
+#define MAFW_PLAYLIST_MD_CACHE_BUDGET (256 * 1024)
+
+void mafw_playlist_set_md_cache_budget(MafwPlaylist *pls, gsize budget);
+gsize mafw_playlist_get_md_cache_budget(MafwPlaylist *pls);
+
 G_END_DECLS
 
 #endif
@@ -31,6 +31,7 @@
 #include <stdlib.h>
 #include "mafw-renderer.h"
 #include "mafw-extension.h"
+#include "mafw-extension-private.h"
 #include "mafw-marshal.h"
 #include "mafw-source.h"
 #include "mafw-registry.h"
@@ -556,6 +557,125 @@ mafw_renderer_emit_buffering_info(MafwRenderer *self, gfloat fraction)
 	MAFW_RENDERER_GET_CLASS(self)->emit_buffering_info(self, fraction);
 }
 
+/*----------------------------------------------------------------------------
+  Timeouts
+  ----------------------------------------------------------------------------*/
+
+/*
+ * Operations timed by mafw_extension_set_timeout() pass the serial of
+ * their #MafwExtensionTimedOp to the renderer as user data instead of
+ * the caller's, so a late result finds nothing and is dropped.
+ */
+
+/* Finishes the operation of $deadline. */
+static MafwExtensionTimedOp *timed_op_expire(MafwExtensionDeadline *deadline)
+{
+	_mafw_extension_timed_op_remove(deadline);
+	return (MafwExtensionTimedOp *)deadline;
+}
+
+static void playback_expired(MafwExtensionDeadline *deadline,
+			     const GError *error)
+{
+	MafwExtensionTimedOp *op = timed_op_expire(deadline);
+
+	((MafwRendererPlaybackCB)op->cb)(op->self, op->user_data, error);
+	_mafw_extension_timed_op_free(op);
+}
+
+static void playback_timed(MafwRenderer *self, gpointer serial,
+			   const GError *error)
+{
+	MafwExtensionTimedOp *op;
+
+	if (!(op = _mafw_extension_timed_op_take(serial)))
+		return;
+	((MafwRendererPlaybackCB)op->cb)(self, op->user_data, error);
+	_mafw_extension_timed_op_free(op);
+}
+
+static void status_expired(MafwExtensionDeadline *deadline,
+			   const GError *error)
+{
+	MafwExtensionTimedOp *op = timed_op_expire(deadline);
+
+	((MafwRendererStatusCB)op->cb)(op->self, NULL, 0, Stopped, NULL,
+				       op->user_data, error);
+	_mafw_extension_timed_op_free(op);
+}
+
+static void status_timed(MafwRenderer *self, MafwPlaylist *playlist,
+			 guint index, MafwPlayState state,
+			 const gchar *object_id, gpointer serial,
+			 const GError *error)
+{
+	MafwExtensionTimedOp *op;
+
+	if (!(op = _mafw_extension_timed_op_take(serial)))
+		return;
+	((MafwRendererStatusCB)op->cb)(self, playlist, index, state,
+				       object_id, op->user_data, error);
+	_mafw_extension_timed_op_free(op);
+}
+
+static void position_expired(MafwExtensionDeadline *deadline,
+			     const GError *error)
+{
+	MafwExtensionTimedOp *op = timed_op_expire(deadline);
+
+	((MafwRendererPositionCB)op->cb)(op->self, 0, op->user_data, error);
+	_mafw_extension_timed_op_free(op);
+}
+
+static void position_timed(MafwRenderer *self, gint position,
+			   gpointer serial, const GError *error)
+{
+	MafwExtensionTimedOp *op;
+
+	if (!(op = _mafw_extension_timed_op_take(serial)))
+		return;
+	((MafwRendererPositionCB)op->cb)(self, position, op->user_data,
+					 error);
+	_mafw_extension_timed_op_free(op);
+}
+
+static void metadata_expired(MafwExtensionDeadline *deadline,
+			     const GError *error)
+{
+	MafwExtensionTimedOp *op = timed_op_expire(deadline);
+
+	((MafwRendererMetadataResultCB)op->cb)(op->self, NULL, NULL,
+					       op->user_data, error);
+	_mafw_extension_timed_op_free(op);
+}
+
+static void metadata_timed(MafwRenderer *self, const gchar *object_id,
+			   GHashTable *metadata, gpointer serial,
+			   const GError *error)
+{
+	MafwExtensionTimedOp *op;
+
+	if (!(op = _mafw_extension_timed_op_take(serial)))
+		return;
+	((MafwRendererMetadataResultCB)op->cb)(self, object_id, metadata,
+					       op->user_data, error);
+	_mafw_extension_timed_op_free(op);
+}
+
+/* Replaces $callback and $user_data with the timed variants if needed. */
+#define TIMED(self, kind, callback, user_data)				\
+	do {								\
+		MafwExtensionTimedOp *op;				\
+		op = _mafw_extension_timed_op_new(			\
+				MAFW_EXTENSION(self), sizeof(*op),	\
+				callback, user_data,			\
+				kind##_expired, NULL);			\
+		if (op) {						\
+			callback = (gpointer)kind##_timed;		\
+			user_data = GUINT_TO_POINTER(op->serial);	\
+		}							\
+	} while (0)
+
 /*----------------------------------------------------------------------------
   Public API functions
   ----------------------------------------------------------------------------*/
@@ -577,6 +697,7 @@ mafw_renderer_emit_buffering_info(MafwRenderer *self, gfloat fraction)
 void mafw_renderer_play(MafwRenderer *self, MafwRendererPlaybackCB callback,
 		    gpointer user_data)
 {
+	TIMED(self, playback, callback, user_data);
 	MAFW_RENDERER_GET_CLASS(self)->play(self, callback, user_data);
 }
 
@@ -594,6 +715,7 @@ void mafw_renderer_play(MafwRenderer *self, MafwRendererPlaybackCB callback,
 void mafw_renderer_play_object(MafwRenderer *self, const gchar *object_id,
 			   MafwRendererPlaybackCB callback, gpointer user_data)
 {
+	TIMED(self, playback, callback, user_data);
 	MAFW_RENDERER_GET_CLASS(self)->play_object(self, object_id, callback,
 					       user_data);
 }
@@ -611,6 +733,7 @@ void mafw_renderer_play_object(MafwRenderer *self, const gchar *object_id,
 void mafw_renderer_play_uri(MafwRenderer *self, const gchar *uri,
 			MafwRendererPlaybackCB callback, gpointer user_data)
 {
+	TIMED(self, playback, callback, user_data);
 	MAFW_RENDERER_GET_CLASS(self)->play_uri(self, uri, callback, user_data);
 }
 
@@ -626,6 +749,7 @@ void mafw_renderer_play_uri(MafwRenderer *self, const gchar *uri,
 void mafw_renderer_stop(MafwRenderer *self, MafwRendererPlaybackCB callback,
 		    gpointer user_data)
 {
+	TIMED(self, playback, callback, user_data);
 	MAFW_RENDERER_GET_CLASS(self)->stop(self, callback, user_data);
 }
 	
@@ -640,6 +764,7 @@ void mafw_renderer_stop(MafwRenderer *self, MafwRendererPlaybackCB callback,
 void mafw_renderer_pause(MafwRenderer *self, MafwRendererPlaybackCB callback,
 		     gpointer user_data)
 {
+	TIMED(self, playback, callback, user_data);
 	MAFW_RENDERER_GET_CLASS(self)->pause(self, callback, user_data);
 }
 
@@ -654,6 +779,7 @@ void mafw_renderer_pause(MafwRenderer *self, MafwRendererPlaybackCB callback,
 void mafw_renderer_resume(MafwRenderer *self, MafwRendererPlaybackCB callback,
 		      gpointer user_data)
 {
+	TIMED(self, playback, callback, user_data);
 	MAFW_RENDERER_GET_CLASS(self)->resume(self, callback, user_data);
 }
 
@@ -672,6 +798,7 @@ void mafw_renderer_resume(MafwRenderer *self, MafwRendererPlaybackCB callback,
 void mafw_renderer_get_status(MafwRenderer *self, MafwRendererStatusCB callback,
 			  gpointer user_data)
 {
+	TIMED(self, status, callback, user_data);
 	MAFW_RENDERER_GET_CLASS(self)->get_status(self, callback, user_data);
 }
 
@@ -719,6 +846,7 @@ gboolean mafw_renderer_assign_playlist(MafwRenderer *self, MafwPlaylist *playlis
 void mafw_renderer_next(MafwRenderer *self, MafwRendererPlaybackCB callback,
 		    gpointer user_data)
 {
+	TIMED(self, playback, callback, user_data);
 	MAFW_RENDERER_GET_CLASS(self)->next(self, callback, user_data);
 }
 
@@ -741,6 +869,7 @@ void mafw_renderer_next(MafwRenderer *self, MafwRendererPlaybackCB callback,
 void mafw_renderer_previous(MafwRenderer *self, MafwRendererPlaybackCB callback,
 			gpointer user_data)
 {
+	TIMED(self, playback, callback, user_data);
 	MAFW_RENDERER_GET_CLASS(self)->previous(self, callback, user_data);
 }
 
@@ -763,6 +892,7 @@ void mafw_renderer_previous(MafwRenderer *self, MafwRendererPlaybackCB callback,
 void mafw_renderer_goto_index(MafwRenderer *self, guint index,
 			  MafwRendererPlaybackCB callback, gpointer user_data)
 {
+	TIMED(self, playback, callback, user_data);
 	MAFW_RENDERER_GET_CLASS(self)->goto_index(self, index, callback, user_data);
 }
 
@@ -790,6 +920,7 @@ void mafw_renderer_set_position(MafwRenderer *self, MafwRendererSeekMode mode,
 			     gint seconds, MafwRendererPositionCB callback,
 			     gpointer user_data)
 {
+	TIMED(self, position, callback, user_data);
 	MAFW_RENDERER_GET_CLASS(self)->set_position(self, mode, seconds, callback,
 						 user_data);
 }
@@ -808,6 +939,7 @@ void mafw_renderer_set_position(MafwRenderer *self, MafwRendererSeekMode mode,
 void mafw_renderer_get_position(MafwRenderer *self, MafwRendererPositionCB callback,
 			    gpointer user_data)
 {
+	TIMED(self, position, callback, user_data);
 	MAFW_RENDERER_GET_CLASS(self)->get_position(self, callback, user_data);
 }
 
@@ -825,11 +957,16 @@ void mafw_renderer_get_position(MafwRenderer *self, MafwRendererPositionCB callb
  * Gets the renderer's current media's object ID and its metadata (if there isn't
  * any media the returned object ID will be %NULL). This information is
  * asynchronously returned through a #MafwRendererMetadataResultCB callback.
+ *
+ * Renderers keeping the metadata of the current media in a mafw metadata
+ * hash table should pass mafw_metadata_copy() of it to the callback rather
+ * than duplicating its values one by one.
  */
 void mafw_renderer_get_current_metadata(MafwRenderer *self,
 					MafwRendererMetadataResultCB callback,
 					gpointer user_data)
 {
+	TIMED(self, metadata, callback, user_data);
 	MAFW_RENDERER_GET_CLASS(self)->get_current_metadata(self,
 							    callback,
 							    user_data);
@@ -30,7 +30,9 @@
 #include <regex.h>
 
 #include "mafw-extension.h"
+#include "mafw-extension-private.h"
 #include "mafw-source.h"
+#include "mafw-source-private.h"
 #include "mafw-marshal.h"
 #include "mafw-uri-source.h"
 #include "mafw-errors.h"
@@ -227,7 +229,163 @@ static void mafw_source_default_destroy_object(MafwSource *self,
 	}
 }
 
-#define get_sorting_modifier(key) ((*(key) == '+') ? 1 : ((*(key) =='-') ? -1 : 0))
+/* Frees the object IDs and metadata of browse results. */
+static void free_fetched(GPtrArray *ids, GPtrArray *mds)
+{
+	guint i;
+
+	for (i = 0; i < mds->len; i++) {
+		g_free(ids->pdata[i]);
+		mafw_metadata_release(mds->pdata[i]);
+	}
+	g_ptr_array_free(ids, TRUE);
+	g_ptr_array_free(mds, TRUE);
+}
+
+/*
+ * The default browse_chunked() groups the per-item results of browse()
+ * in $ids and $mds, and passes them on when $chunk_size of them have
+ * been collected, the session ends or fails.  $first is the browse
+ * index of the first item in the buffer.  Adapters are registered in
+ * $Chunk_adapters under $serial, which is passed to the source instead
+ * of the adapter, until the session ends or mafw_source_cancel_browse()
+ * cancels $browse_id.  Results arriving later are dropped.
+ */
+struct chunk_adapter {
+	MafwSource *self;
+	guint serial, browse_id;
+	MafwSourceBrowseChunkCb cb;
+	gpointer user_data;
+	guint chunk_size;
+	guint first;
+	GPtrArray *ids, *mds;
+};
+
+static GHashTable *Chunk_adapters;
+
+static void chunk_adapter_free(struct chunk_adapter *ca)
+{
+	free_fetched(ca->ids, ca->mds);
+	g_free(ca);
+}
+
+static gboolean same_chunked_browse(gpointer serial, struct chunk_adapter *ca,
+				    struct chunk_adapter *which)
+{
+	return ca->self == which->self && ca->browse_id == which->browse_id;
+}
+
+/* Forgets the adapter of $browse_id of $self, if it has one. */
+static void chunk_adapters_cancel(MafwSource *self, guint browse_id)
+{
+	struct chunk_adapter which;
+
+	if (!Chunk_adapters)
+		return;
+	which.self = self;
+	which.browse_id = browse_id;
+	g_hash_table_foreach_remove(Chunk_adapters,
+				    (GHRFunc)same_chunked_browse, &which);
+}
+
+/* Passes on the buffered results.  The callback may cancel the
+ * session, freeing $ca, so it is not touched afterwards. */
+static void flush_chunk(MafwSource *self, guint browse_id,
+			gint remaining_count, struct chunk_adapter *ca,
+			const GError *error)
+{
+	GPtrArray *ids, *mds;
+	guint first;
+
+	ids = ca->ids;
+	mds = ca->mds;
+	first = ca->first;
+	ca->ids = g_ptr_array_sized_new(ca->chunk_size + 1);
+	ca->mds = g_ptr_array_sized_new(ca->chunk_size);
+	ca->first += mds->len;
+
+	g_ptr_array_add(ids, NULL);
+	ca->cb(self, browse_id, remaining_count, first,
+	       (const gchar *const *)ids->pdata,
+	       (GHashTable **)mds->pdata, mds->len,
+	       ca->user_data, error);
+	free_fetched(ids, mds);
+}
+
+static void chunk_collector(MafwSource *self, guint browse_id,
+			    gint remaining_count, guint index,
+			    const gchar *object_id, GHashTable *metadata,
+			    gpointer serial, const GError *error)
+{
+	struct chunk_adapter *ca;
+
+	if (!(ca = g_hash_table_lookup(Chunk_adapters, serial)))
+		return;
+	ca->browse_id = browse_id;
+	if (object_id && !error) {
+		if (!ca->ids->len)
+			ca->first = index;
+		g_ptr_array_add(ca->ids, g_strdup(object_id));
+		/* The source destroys $metadata when we return. */
+		g_ptr_array_add(ca->mds, mafw_metadata_copy(metadata));
+	}
+
+	if (error || remaining_count == 0) {
+		g_hash_table_steal(Chunk_adapters, serial);
+		flush_chunk(self, browse_id, remaining_count, ca, error);
+		chunk_adapter_free(ca);
+	} else if (ca->ids->len >= ca->chunk_size)
+		flush_chunk(self, browse_id, remaining_count, ca, error);
+}
+
+static guint mafw_source_default_browse_chunked(MafwSource *self,
+				const gchar *object_id, gboolean recursive,
+				const MafwFilter *filter,
+				const gchar *sort_criteria,
+				const gchar *const *mdkeys,
+				guint skip_count, guint item_count,
+				guint chunk_size,
+				MafwSourceBrowseChunkCb cb, gpointer user_data)
+{
+	static guint serial;
+	struct chunk_adapter *ca;
+	gpointer key;
+	guint browse_id;
+
+	if (!Chunk_adapters)
+		Chunk_adapters = g_hash_table_new_full(g_direct_hash,
+					g_direct_equal, NULL,
+					(GDestroyNotify)chunk_adapter_free);
+	if (!++serial)
+		serial++;
+	key = GUINT_TO_POINTER(serial);
+
+	ca = g_new0(struct chunk_adapter, 1);
+	ca->self = self;
+	ca->serial = serial;
+	ca->browse_id = MAFW_SOURCE_INVALID_BROWSE_ID;
+	ca->cb = cb;
+	ca->user_data = user_data;
+	ca->chunk_size = chunk_size;
+	ca->first = 0;
+	ca->ids = g_ptr_array_sized_new(chunk_size + 1);
+	ca->mds = g_ptr_array_sized_new(chunk_size);
+	g_hash_table_insert(Chunk_adapters, key, ca);
+	browse_id = MAFW_SOURCE_GET_CLASS(self)->browse(
+			self, object_id, recursive, filter, sort_criteria,
+			mdkeys, skip_count, item_count,
+			(MafwSourceBrowseResultCb)chunk_collector, key);
+
+	/* The session may have ended already. */
+	if ((ca = g_hash_table_lookup(Chunk_adapters, key))) {
+		if (browse_id == MAFW_SOURCE_INVALID_BROWSE_ID)
+			/* Failed without telling. */
+			g_hash_table_remove(Chunk_adapters, key);
+		else
+			ca->browse_id = browse_id;
+	}
+	return browse_id;
+}
 
 static gboolean
 check_sort_criteria (const gchar *criteria, GError **error)
@@ -235,14 +393,22 @@ check_sort_criteria (const gchar *criteria, GError **error)
 	gboolean correct_criteria = TRUE;
 
         if (criteria && criteria[0] != '\0') {
-		guint i = 0;
-		gchar **sort_tokens = NULL;
-
-		sort_tokens = g_strsplit(criteria, ",", 0);
+		MafwMetadataKeyView stack_terms[16], *terms;
+		guint i, nterms;
+
+		/* Browse requests rarely sort by more than a couple of
+		 * keys, so avoid allocating in the common case. */
+		terms = stack_terms;
+		nterms = mafw_metadata_sorting_terms_view(
+				criteria, terms, G_N_ELEMENTS(stack_terms));
+		if (nterms > G_N_ELEMENTS(stack_terms)) {
+			terms = g_new(MafwMetadataKeyView, nterms);
+			mafw_metadata_sorting_terms_view(criteria, terms,
+							 nterms);
+		}
 
-		for (i = 0; (sort_tokens[i] != NULL) && correct_criteria;
-		     i++) {
-			if (get_sorting_modifier(sort_tokens[i]) == 0) {
+		for (i = 0; i < nterms && correct_criteria; i++) {
+			if (terms[i].order == 0) {
 				correct_criteria = FALSE;
 			}
 		}
@@ -256,7 +422,8 @@ check_sort_criteria (const gchar *criteria, GError **error)
 			}
 		}
 
-		g_strfreev(sort_tokens);
+		if (terms != stack_terms)
+			g_free(terms);
 	}
 
 	return correct_criteria;
@@ -298,6 +465,7 @@ static void mafw_source_class_init(MafwSourceClass * klass)
 	klass->set_metadata = mafw_source_default_set_metadata;
 	klass->create_object = mafw_source_default_create_object;
 	klass->destroy_object = mafw_source_default_destroy_object;
+	klass->browse_chunked = mafw_source_default_browse_chunked;
 
 	/**
 	 * MafwSource::metadata-changed:
@@ -361,6 +529,903 @@ static void mafw_source_class_init(MafwSourceClass * klass)
                              G_TYPE_INT, G_TYPE_INT, G_TYPE_INT, G_TYPE_INT);
 }
 
+/* Cancellation */
+/*
+ * A token is cancelled from the main loop, but the get_metadata() of a
+ * threaded source may check it from a worker thread.  Handlers are called
+ * in the order they were connected, and are forgotten afterwards.
+ * $Current_token is the token of the request whose get_metadata() or
+ * get_metadatas() the calling thread is in.
+ */
+struct _MafwSourceToken {
+	volatile gint refcount;
+	volatile gint cancelled;
+	gulong last_handler;
+	GSList *handlers;
+};
+
+struct token_handler {
+	gulong id;
+	MafwSourceTokenCancelledCb cb;
+	gpointer user_data;
+};
+
+static GStaticPrivate Current_token = G_STATIC_PRIVATE_INIT;
+
+/**
+ * mafw_source_token_new:
+ *
+ * Creates a cancellation token to pass to mafw_source_get_metadata_full()
+ * or mafw_source_get_metadatas_full().  The same token may be given to
+ * any number of requests, which are all cancelled by
+ * mafw_source_token_cancel().
+ *
+ * Returns: a new token, to be released with mafw_source_token_unref().
+ */
+MafwSourceToken *mafw_source_token_new(void)
+{
+	MafwSourceToken *token;
+
+	token = g_new0(MafwSourceToken, 1);
+	token->refcount = 1;
+	return token;
+}
+
+/**
+ * mafw_source_token_ref:
+ * @token: a #MafwSourceToken.
+ *
+ * Returns: @token with its reference count incremented.
+ */
+MafwSourceToken *mafw_source_token_ref(MafwSourceToken *token)
+{
+	g_return_val_if_fail(token != NULL, NULL);
+	g_atomic_int_inc(&token->refcount);
+	return token;
+}
+
+/**
+ * mafw_source_token_unref:
+ * @token: a #MafwSourceToken.
+ *
+ * Decrements the reference count of @token, freeing it when it drops
+ * to zero.
+ */
+void mafw_source_token_unref(MafwSourceToken *token)
+{
+	g_return_if_fail(token != NULL);
+	if (!g_atomic_int_dec_and_test(&token->refcount))
+		return;
+	g_slist_foreach(token->handlers, (GFunc)g_free, NULL);
+	g_slist_free(token->handlers);
+	g_free(token);
+}
+
+/**
+ * mafw_source_token_cancel:
+ * @token: a #MafwSourceToken.
+ *
+ * Cancels the requests made with @token: their callbacks won't be
+ * called any more, and the sources are told to drop the work not done
+ * yet.  The handlers of mafw_source_token_connect() are called before
+ * this function returns.  Cancelling a token again does nothing.
+ * Must be called from the main loop's thread.
+ */
+void mafw_source_token_cancel(MafwSourceToken *token)
+{
+	GSList *handlers, *l;
+
+	g_return_if_fail(token != NULL);
+	if (g_atomic_int_get(&token->cancelled))
+		return;
+	g_atomic_int_set(&token->cancelled, TRUE);
+
+	/* Handlers may release the last reference to $token
+	 * or disconnect other handlers. */
+	mafw_source_token_ref(token);
+	handlers = g_slist_reverse(token->handlers);
+	token->handlers = NULL;
+	for (l = handlers; l; l = l->next) {
+		struct token_handler *h = l->data;
+
+		h->cb(token, h->user_data);
+		g_free(h);
+	}
+	g_slist_free(handlers);
+	mafw_source_token_unref(token);
+}
+
+/**
+ * mafw_source_token_is_cancelled:
+ * @token: a #MafwSourceToken or %NULL.
+ *
+ * Sources may call this from any thread to see if they can stop
+ * working on a request, see mafw_source_get_current_token().
+ *
+ * Returns: whether @token has been cancelled.  %NULL never is.
+ */
+gboolean mafw_source_token_is_cancelled(MafwSourceToken *token)
+{
+	return token && g_atomic_int_get(&token->cancelled);
+}
+
+/**
+ * mafw_source_token_connect:
+ * @token:     a #MafwSourceToken.
+ * @cb:        function to call when @token is cancelled.
+ * @user_data: data to pass to @cb.
+ *
+ * Arranges for @cb to be called once @token is cancelled.  Nothing is
+ * called if it has been cancelled already.
+ *
+ * Returns: an identifier for mafw_source_token_disconnect(), or 0 if
+ * @token has been cancelled.
+ */
+gulong mafw_source_token_connect(MafwSourceToken *token,
+				 MafwSourceTokenCancelledCb cb,
+				 gpointer user_data)
+{
+	struct token_handler *h;
+
+	g_return_val_if_fail(token != NULL, 0);
+	g_return_val_if_fail(cb != NULL, 0);
+	if (mafw_source_token_is_cancelled(token))
+		return 0;
+
+	h = g_new(struct token_handler, 1);
+	h->id = ++token->last_handler;
+	h->cb = cb;
+	h->user_data = user_data;
+	token->handlers = g_slist_prepend(token->handlers, h);
+	return h->id;
+}
+
+/**
+ * mafw_source_token_disconnect:
+ * @token:      a #MafwSourceToken.
+ * @handler_id: what mafw_source_token_connect() returned.
+ *
+ * Forgets the handler @handler_id of @token.  Unknown or zero ids,
+ * like those of handlers already called, are ignored.
+ */
+void mafw_source_token_disconnect(MafwSourceToken *token, gulong handler_id)
+{
+	GSList *l;
+
+	g_return_if_fail(token != NULL);
+	for (l = token->handlers; l; l = l->next) {
+		struct token_handler *h = l->data;
+
+		if (h->id == handler_id) {
+			token->handlers = g_slist_delete_link(token->handlers,
+							      l);
+			g_free(h);
+			return;
+		}
+	}
+}
+
+/**
+ * mafw_source_get_current_token:
+ *
+ * Returns the token of the request whose get_metadata() or
+ * get_metadatas() is being called in this thread, so that sources can
+ * give up on requests cancelled meanwhile.  Sources answering
+ * asynchronously should mafw_source_token_ref() it for later.  The
+ * callback of the request must be called even if it's cancelled, though
+ * its arguments will be ignored.
+ *
+ * Returns: the current #MafwSourceToken, or %NULL if the request can't
+ * be cancelled.
+ */
+MafwSourceToken *mafw_source_get_current_token(void)
+{
+	return g_static_private_get(&Current_token);
+}
+
+/* Makes $token the current one, and returns the previous. */
+static MafwSourceToken *set_current_token(MafwSourceToken *token)
+{
+	MafwSourceToken *prev;
+
+	prev = g_static_private_get(&Current_token);
+	g_static_private_set(&Current_token, token, NULL);
+	return prev;
+}
+
+/* Timeouts */
+/*
+ * Operations timed by mafw_extension_set_timeout() pass the serial of
+ * their record to the source as user data instead of the caller's, so
+ * results arriving after the deadline or the last result find nothing
+ * and are dropped.  $browse_id is MAFW_SOURCE_INVALID_BROWSE_ID unless
+ * the operation is a browse session.  Cancelling the $token of an
+ * operation finishes it too.
+ */
+struct timed_op {
+	MafwExtensionTimedOp base;	/*< first for the expire functions */
+	gchar *object_id;
+	guint browse_id;
+	MafwSourceToken *token;
+	gulong handler;
+};
+
+static void timed_op_clear(struct timed_op *op)
+{
+	if (op->token) {
+		mafw_source_token_disconnect(op->token, op->handler);
+		mafw_source_token_unref(op->token);
+	}
+	g_free(op->object_id);
+}
+
+/* Returns NULL if the operation needn't be timed. */
+static struct timed_op *timed_op_new(MafwSource *self, gpointer cb,
+				     gpointer user_data,
+				     const gchar *object_id,
+				     MafwExtensionExpireFunc expire)
+{
+	struct timed_op *op;
+
+	op = _mafw_extension_timed_op_new(MAFW_EXTENSION(self), sizeof(*op),
+					  cb, user_data, expire,
+					  (GDestroyNotify)timed_op_clear);
+	if (op) {
+		op->object_id = g_strdup(object_id);
+		op->browse_id = MAFW_SOURCE_INVALID_BROWSE_ID;
+	}
+	return op;
+}
+
+static void timed_op_cancelled(MafwSourceToken *token, gpointer serial)
+{
+	struct timed_op *op;
+
+	if ((op = _mafw_extension_timed_op_take(serial)) != NULL)
+		_mafw_extension_timed_op_free(op);
+}
+
+/* Finishes $op when $token is cancelled. */
+static void timed_op_set_token(struct timed_op *op, MafwSourceToken *token)
+{
+	op->token = mafw_source_token_ref(token);
+	op->handler = mafw_source_token_connect(
+				token, timed_op_cancelled,
+				GUINT_TO_POINTER(op->base.serial));
+}
+
+static void metadata_expired(MafwExtensionDeadline *deadline,
+			     const GError *error)
+{
+	struct timed_op *op = (struct timed_op *)deadline;
+
+	_mafw_extension_timed_op_remove(op);
+	((MafwSourceMetadataResultCb)op->base.cb)(op->base.self,
+						  op->object_id, NULL,
+						  op->base.user_data, error);
+	_mafw_extension_timed_op_free(op);
+}
+
+static void metadata_timed(MafwSource *self, const gchar *object_id,
+			   GHashTable *metadata, gpointer serial,
+			   const GError *error)
+{
+	struct timed_op *op;
+
+	if (!(op = _mafw_extension_timed_op_take(serial)))
+		return;
+	((MafwSourceMetadataResultCb)op->base.cb)(self, object_id, metadata,
+						  op->base.user_data, error);
+	_mafw_extension_timed_op_free(op);
+}
+
+static void metadata_set_expired(MafwExtensionDeadline *deadline,
+				 const GError *error)
+{
+	struct timed_op *op = (struct timed_op *)deadline;
+
+	_mafw_extension_timed_op_remove(op);
+	((MafwSourceMetadataSetCb)op->base.cb)(op->base.self,
+					       op->object_id, NULL,
+					       op->base.user_data, error);
+	_mafw_extension_timed_op_free(op);
+}
+
+static void metadata_set_timed(MafwSource *self, const gchar *object_id,
+			       const gchar **failed_keys, gpointer serial,
+			       const GError *error)
+{
+	struct timed_op *op;
+
+	if (!(op = _mafw_extension_timed_op_take(serial)))
+		return;
+	((MafwSourceMetadataSetCb)op->base.cb)(self, object_id, failed_keys,
+					       op->base.user_data, error);
+	_mafw_extension_timed_op_free(op);
+}
+
+/* MafwSourceObjectCreatedCb and MafwSourceObjectDestroyedCb are alike.
+ * $object_id is NULL for create_object(). */
+static void object_expired(MafwExtensionDeadline *deadline,
+			   const GError *error)
+{
+	struct timed_op *op = (struct timed_op *)deadline;
+
+	_mafw_extension_timed_op_remove(op);
+	((MafwSourceObjectDestroyedCb)op->base.cb)(op->base.self,
+						   op->object_id,
+						   op->base.user_data,
+						   error);
+	_mafw_extension_timed_op_free(op);
+}
+
+static void object_timed(MafwSource *self, const gchar *object_id,
+			 gpointer serial, const GError *error)
+{
+	struct timed_op *op;
+
+	if (!(op = _mafw_extension_timed_op_take(serial)))
+		return;
+	((MafwSourceObjectDestroyedCb)op->base.cb)(self, object_id,
+						   op->base.user_data,
+						   error);
+	_mafw_extension_timed_op_free(op);
+}
+
+/*
+ * A browse session gets a new deadline with every result.  If it
+ * expires the caller gets an error as the last result and the session
+ * is cancelled.
+ */
+static void browse_expired(MafwExtensionDeadline *deadline,
+			   const GError *error)
+{
+	struct timed_op *op = (struct timed_op *)deadline;
+	MafwSource *self = op->base.self;
+	guint browse_id = op->browse_id;
+
+	_mafw_extension_timed_op_remove(op);
+	((MafwSourceBrowseResultCb)op->base.cb)(self, browse_id, 0, 0,
+						NULL, NULL,
+						op->base.user_data, error);
+	_mafw_extension_timed_op_free(op);
+	if (browse_id != MAFW_SOURCE_INVALID_BROWSE_ID)
+		mafw_source_cancel_browse(self, browse_id, NULL);
+}
+
+/* Returns $op if the result should be passed on.  It's taken out of the
+ * table if the result is the last one. */
+static struct timed_op *browse_result(MafwSource *self, guint browse_id,
+				      gint remaining_count, gpointer serial,
+				      const GError *error)
+{
+	struct timed_op *op;
+
+	if (!(op = _mafw_extension_timed_op_lookup(serial)))
+		return NULL;
+	op->browse_id = browse_id;
+	if (error || remaining_count == 0)
+		_mafw_extension_timed_op_remove(op);
+	else
+		_mafw_extension_deadline_restart(&op->base.deadline);
+	return op;
+}
+
+static void browse_timed(MafwSource *self, guint browse_id,
+			 gint remaining_count, guint index,
+			 const gchar *object_id, GHashTable *metadata,
+			 gpointer serial, const GError *error)
+{
+	struct timed_op *op;
+
+	if (!(op = browse_result(self, browse_id, remaining_count, serial,
+				 error)))
+		return;
+	((MafwSourceBrowseResultCb)op->base.cb)(self, browse_id,
+						remaining_count, index,
+						object_id, metadata,
+						op->base.user_data, error);
+	if (error || remaining_count == 0)
+		_mafw_extension_timed_op_free(op);
+}
+
+static void browse_chunked_expired(MafwExtensionDeadline *deadline,
+				   const GError *error)
+{
+	static const gchar *const no_ids[] = { NULL };
+	struct timed_op *op = (struct timed_op *)deadline;
+	MafwSource *self = op->base.self;
+	guint browse_id = op->browse_id;
+
+	_mafw_extension_timed_op_remove(op);
+	((MafwSourceBrowseChunkCb)op->base.cb)(self, browse_id, 0, 0,
+					       no_ids, NULL, 0,
+					       op->base.user_data, error);
+	_mafw_extension_timed_op_free(op);
+	if (browse_id != MAFW_SOURCE_INVALID_BROWSE_ID)
+		mafw_source_cancel_browse(self, browse_id, NULL);
+}
+
+static void browse_chunked_timed(MafwSource *self, guint browse_id,
+				 gint remaining_count, guint index,
+				 const gchar *const *object_ids,
+				 GHashTable **metadatas, guint nitems,
+				 gpointer serial, const GError *error)
+{
+	struct timed_op *op;
+
+	if (!(op = browse_result(self, browse_id, remaining_count, serial,
+				 error)))
+		return;
+	((MafwSourceBrowseChunkCb)op->base.cb)(self, browse_id,
+					       remaining_count, index,
+					       object_ids, metadatas, nitems,
+					       op->base.user_data, error);
+	if (error || remaining_count == 0)
+		_mafw_extension_timed_op_free(op);
+}
+
+/* Records the session id of the browse timed by $serial, unless it has
+ * already ended. */
+static guint browse_started(guint serial, guint browse_id)
+{
+	struct timed_op *op;
+
+	if ((op = _mafw_extension_timed_op_lookup(GUINT_TO_POINTER(serial))))
+		op->browse_id = browse_id;
+	return browse_id;
+}
+
+/* $op may be a renderer's, so don't look at $browse_id of others. */
+static gboolean same_browse(gpointer serial, struct timed_op *op,
+			    struct timed_op *which)
+{
+	return op->base.self == which->base.self
+		&& op->browse_id == which->browse_id;
+}
+
+/* Scheduling */
+/*
+ * If mafw_source_set_max_requests() limits the get_metadata()s and
+ * browse()s in progress, the rest wait in the $queues of the source's
+ * scheduler, one per priority class.  When a slot frees up, the queue
+ * to take the next request from is chosen by weighted round-robin
+ * along $Turns, so interactive requests get most of the slots but
+ * background work is not starved.
+ *
+ * Queued browse sessions have no id from the source yet, so the caller
+ * gets a made-up $browse_id instead, which is mapped to $real_id of the
+ * source when the session starts.  $browses are looked up by the id the
+ * caller knows; results for a session no longer there are dropped.
+ * Queued metadata requests whose $token is cancelled leave the queue
+ * without bothering the source.
+ */
+#define NPRIORITIES		(MAFW_SOURCE_PRIORITY_BACKGROUND + 1)
+
+static const MafwSourcePriority Turns[] = {
+	MAFW_SOURCE_PRIORITY_INTERACTIVE, MAFW_SOURCE_PRIORITY_INTERACTIVE,
+	MAFW_SOURCE_PRIORITY_PREFETCH, MAFW_SOURCE_PRIORITY_INTERACTIVE,
+	MAFW_SOURCE_PRIORITY_INTERACTIVE, MAFW_SOURCE_PRIORITY_PREFETCH,
+	MAFW_SOURCE_PRIORITY_BACKGROUND,
+};
+
+struct scheduler {
+	guint max_running, running;
+	gboolean dispatching;
+	guint turn;
+	GQueue queues[NPRIORITIES];
+	MafwSourceQueueStats stats[NPRIORITIES];
+	GHashTable *browses;
+};
+
+/* A request waiting for or occupying a slot. */
+struct sched_req {
+	MafwSource *self;
+	MafwSourcePriority priority;
+	gboolean queued;
+	GTimeVal since;
+	void (*start)(struct sched_req *req);
+};
+
+struct sched_metadata {
+	struct sched_req req;	/*< first for metadata_start() */
+	gchar *object_id;
+	gchar **keys;
+	MafwSourceToken *token;
+	gulong handler;
+	MafwSourceMetadataResultCb cb;
+	gpointer user_data;
+};
+
+struct sched_browse {
+	struct sched_req req;	/*< first for browse_start() */
+	guint browse_id, real_id;
+	gboolean cancelled;
+	gchar *object_id;
+	gboolean recursive;
+	MafwFilter *filter;
+	gchar *sort_criteria;
+	gchar **keys;
+	guint skip_count, item_count;
+	MafwSourceBrowseResultCb cb;
+	gpointer user_data;
+};
+
+static void call_get_metadata(MafwSource *self, const gchar *object_id,
+			      const gchar *const *metadata_keys,
+			      MafwSourceToken *token,
+			      MafwSourceMetadataResultCb cb,
+			      gpointer user_data);
+
+static void sched_metadata_free(struct sched_metadata *sm)
+{
+	if (sm->token) {
+		mafw_source_token_disconnect(sm->token, sm->handler);
+		mafw_source_token_unref(sm->token);
+	}
+	g_strfreev(sm->keys);
+	g_free(sm->object_id);
+	g_object_unref(sm->req.self);
+	g_free(sm);
+}
+
+static void sched_browse_free(struct sched_browse *sb)
+{
+	g_free(sb->object_id);
+	if (sb->filter)
+		mafw_filter_free(sb->filter);
+	g_free(sb->sort_criteria);
+	g_strfreev(sb->keys);
+	g_object_unref(sb->req.self);
+	g_free(sb);
+}
+
+static void scheduler_free(struct scheduler *sched)
+{
+	g_hash_table_destroy(sched->browses);
+	g_free(sched);
+}
+
+/* Returns the scheduler of $self, or NULL if it has none and
+ * $create is FALSE. */
+static struct scheduler *scheduler(MafwSource *self, gboolean create)
+{
+	struct scheduler *sched;
+	guint i;
+
+	sched = g_object_get_data(G_OBJECT(self), "mafw-source-scheduler");
+	if (sched || !create)
+		return sched;
+
+	sched = g_new0(struct scheduler, 1);
+	for (i = 0; i < NPRIORITIES; i++)
+		g_queue_init(&sched->queues[i]);
+	sched->browses = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+					NULL, (GDestroyNotify)sched_browse_free);
+	g_object_set_data_full(G_OBJECT(self), "mafw-source-scheduler",
+			       sched, (GDestroyNotify)scheduler_free);
+	return sched;
+}
+
+/* Whether requests of $self need to go through the scheduler. */
+static struct scheduler *scheduling(MafwSource *self)
+{
+	struct scheduler *sched;
+
+	sched = scheduler(self, FALSE);
+	return sched && sched->max_running ? sched : NULL;
+}
+
+/* Takes the request to start next from the queues. */
+static struct sched_req *sched_next(struct scheduler *sched)
+{
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS(Turns); i++) {
+		GQueue *queue;
+
+		queue = &sched->queues[Turns[sched->turn]];
+		sched->turn = (sched->turn + 1) % G_N_ELEMENTS(Turns);
+		if (!g_queue_is_empty(queue))
+			return g_queue_pop_head(queue);
+	}
+	return NULL;
+}
+
+/* Starts queued requests while there are free slots. */
+static void sched_dispatch(MafwSource *self, struct scheduler *sched)
+{
+	struct sched_req *req;
+
+	/* Requests finishing synchronously are handled in this loop. */
+	if (sched->dispatching)
+		return;
+	sched->dispatching = TRUE;
+	g_object_ref(self);
+	while ((!sched->max_running || sched->running < sched->max_running)
+	       && (req = sched_next(sched)) != NULL) {
+		MafwSourceQueueStats *stats;
+		GTimeVal now;
+		guint waited;
+
+		g_get_current_time(&now);
+		waited = (now.tv_sec - req->since.tv_sec) * 1000
+			+ (now.tv_usec - req->since.tv_usec) / 1000;
+		stats = &sched->stats[req->priority];
+		stats->started++;
+		stats->total_wait += waited;
+		if (waited > stats->max_wait)
+			stats->max_wait = waited;
+
+		req->queued = FALSE;
+		sched->running++;
+		req->start(req);
+	}
+	sched->dispatching = FALSE;
+	g_object_unref(self);
+}
+
+static void sched_enqueue(struct scheduler *sched, struct sched_req *req)
+{
+	req->queued = TRUE;
+	g_get_current_time(&req->since);
+	g_queue_push_tail(&sched->queues[req->priority], req);
+	sched_dispatch(req->self, sched);
+}
+
+/* Frees the slot of a finished request. */
+static void sched_finished(MafwSource *self, struct scheduler *sched)
+{
+	sched->running--;
+	sched_dispatch(self, sched);
+}
+
+static void metadata_done(MafwSource *self, const gchar *object_id,
+			  GHashTable *metadata, struct sched_metadata *sm,
+			  const GError *error)
+{
+	sm->cb(self, object_id, metadata, sm->user_data, error);
+	sched_finished(sm->req.self, scheduler(sm->req.self, FALSE));
+	sched_metadata_free(sm);
+}
+
+static void metadata_start(struct sched_req *req)
+{
+	struct sched_metadata *sm = (struct sched_metadata *)req;
+
+	if (sm->token) {
+		mafw_source_token_disconnect(sm->token, sm->handler);
+		sm->handler = 0;
+	}
+	call_get_metadata(req->self, sm->object_id,
+			  (const gchar *const *)sm->keys, sm->token,
+			  (MafwSourceMetadataResultCb)metadata_done, sm);
+}
+
+/* Takes the queued $sm out of the queue, and tells the caller it's over
+ * with an empty result. */
+static void metadata_cancelled(MafwSourceToken *token,
+			       struct sched_metadata *sm)
+{
+	struct scheduler *sched;
+
+	sched = scheduler(sm->req.self, FALSE);
+	g_queue_remove(&sched->queues[sm->req.priority], sm);
+	sm->handler = 0;
+	sm->cb(sm->req.self, sm->object_id, NULL, sm->user_data, NULL);
+	sched_metadata_free(sm);
+}
+
+/* Asks the metadata from the source when there's a free slot.  Requests
+ * without a callback are not waited for.  If $token is cancelled before
+ * the request is started, $cb is called with neither metadata nor
+ * error. */
+static void schedule_metadata(MafwSource *self, const gchar *object_id,
+			      const gchar *const *metadata_keys,
+			      MafwSourcePriority priority,
+			      MafwSourceToken *token,
+			      MafwSourceMetadataResultCb cb,
+			      gpointer user_data)
+{
+	struct scheduler *sched;
+	struct sched_metadata *sm;
+
+	if (!cb || !(sched = scheduling(self))) {
+		call_get_metadata(self, object_id, metadata_keys, token,
+				  cb, user_data);
+		return;
+	}
+
+	sm = g_new0(struct sched_metadata, 1);
+	sm->req.self = g_object_ref(self);
+	sm->req.priority = priority;
+	sm->req.start = metadata_start;
+	sm->object_id = g_strdup(object_id);
+	sm->keys = g_strdupv((gchar **)metadata_keys);
+	sm->cb = cb;
+	sm->user_data = user_data;
+	if (token) {
+		sm->token = mafw_source_token_ref(token);
+		sm->handler = mafw_source_token_connect(token,
+					(MafwSourceTokenCancelledCb)
+					metadata_cancelled, sm);
+	}
+	sched_enqueue(sched, &sm->req);
+}
+
+/* Moves the queued metadata request called back with $cb and $user_data
+ * to a higher $priority class. */
+static void promote_metadata(MafwSource *self,
+			     MafwSourceMetadataResultCb cb, gpointer user_data,
+			     MafwSourcePriority priority)
+{
+	struct scheduler *sched;
+	guint i;
+
+	if (!(sched = scheduler(self, FALSE)))
+		return;
+	for (i = priority + 1; i < NPRIORITIES; i++) {
+		GList *link;
+
+		for (link = sched->queues[i].head; link; link = link->next) {
+			struct sched_metadata *sm = link->data;
+
+			if (sm->req.start != metadata_start
+			    || sm->cb != cb || sm->user_data != user_data)
+				continue;
+			g_queue_delete_link(&sched->queues[i], link);
+			sm->req.priority = priority;
+			g_queue_push_tail(&sched->queues[priority], sm);
+			return;
+		}
+	}
+}
+
+static void browse_done(MafwSource *self, guint real_id,
+			gint remaining_count, guint index,
+			const gchar *object_id, GHashTable *metadata,
+			gpointer browse_id, const GError *error)
+{
+	struct scheduler *sched;
+	struct sched_browse *sb;
+	gboolean last;
+
+	sched = scheduler(self, FALSE);
+	if (!sched || !(sb = g_hash_table_lookup(sched->browses, browse_id)))
+		return;
+
+	sb->real_id = real_id;
+	last = error || remaining_count == 0;
+	if (last)
+		g_hash_table_steal(sched->browses, browse_id);
+	sb->cb(self, sb->browse_id, remaining_count, index, object_id,
+	       metadata, sb->user_data, error);
+	if (last) {
+		sched_finished(self, sched);
+		sched_browse_free(sb);
+	}
+}
+
+static void browse_start(struct sched_req *req)
+{
+	struct sched_browse *sb = (struct sched_browse *)req;
+	MafwSource *self = req->self;
+	gpointer browse_id = GUINT_TO_POINTER(sb->browse_id);
+	struct scheduler *sched;
+	guint real_id;
+
+	real_id = mafw_source_do_browse(self, sb->object_id, sb->recursive,
+				sb->filter, sb->sort_criteria,
+				(const gchar *const *)sb->keys,
+				sb->skip_count, sb->item_count,
+				(MafwSourceBrowseResultCb)browse_done,
+				browse_id);
+
+	/* $sb is freed if the session has already ended. */
+	sched = scheduler(self, FALSE);
+	if (!(sb = g_hash_table_lookup(sched->browses, browse_id)))
+		return;
+	if (real_id != MAFW_SOURCE_INVALID_BROWSE_ID)
+		sb->real_id = real_id;
+	if (sb->real_id != MAFW_SOURCE_INVALID_BROWSE_ID && sb->cancelled)
+		/* Cancelled before we knew the id. */
+		MAFW_SOURCE_GET_CLASS(self)->cancel_browse(self, sb->real_id,
+							   NULL);
+	if (sb->real_id == MAFW_SOURCE_INVALID_BROWSE_ID || sb->cancelled) {
+		/* Failed without telling, or won't tell any more.
+		 * We are called from sched_dispatch(). */
+		g_hash_table_steal(sched->browses, browse_id);
+		sched->running--;
+		sched_browse_free(sb);
+	}
+}
+
+/* Starts a browse session when there's a free slot. */
+static guint schedule_browse(MafwSource *self, const gchar *object_id,
+			     gboolean recursive, const MafwFilter *filter,
+			     const gchar *sort_criteria,
+			     const gchar *const *metadata_keys,
+			     guint skip_count, guint item_count,
+			     MafwSourcePriority priority,
+			     MafwSourceBrowseResultCb browse_cb,
+			     gpointer user_data)
+{
+	static guint last_id = MAFW_SOURCE_INVALID_BROWSE_ID;
+	struct scheduler *sched;
+	struct sched_browse *sb;
+	guint browse_id;
+
+	if (!(sched = scheduling(self)))
+		return mafw_source_do_browse(self, object_id, recursive,
+					     filter, sort_criteria,
+					     metadata_keys, skip_count,
+					     item_count, browse_cb, user_data);
+
+	/* Count down from the top to keep out of the way of the ids of
+	 * the sources. */
+	if (--last_id == 0)
+		last_id = MAFW_SOURCE_INVALID_BROWSE_ID - 1;
+	browse_id = last_id;
+
+	sb = g_new0(struct sched_browse, 1);
+	sb->req.self = g_object_ref(self);
+	sb->req.priority = priority;
+	sb->req.start = browse_start;
+	sb->browse_id = browse_id;
+	sb->real_id = MAFW_SOURCE_INVALID_BROWSE_ID;
+	sb->object_id = g_strdup(object_id);
+	sb->recursive = recursive;
+	sb->filter = filter ? mafw_filter_copy(filter) : NULL;
+	sb->sort_criteria = g_strdup(sort_criteria);
+	sb->keys = g_strdupv((gchar **)metadata_keys);
+	sb->skip_count = skip_count;
+	sb->item_count = item_count;
+	sb->cb = browse_cb;
+	sb->user_data = user_data;
+	g_hash_table_insert(sched->browses, GUINT_TO_POINTER(browse_id), sb);
+	sched_enqueue(sched, &sb->req);
+	return browse_id;
+}
+
+/* Returns whether $browse_id is a scheduled session, which is cancelled
+ * then.  Sources don't call back after cancel_browse(), so a running
+ * session frees its slot right away, and browse_done() drops whatever
+ * comes late.  A queued one is dropped without calling back, like the
+ * sources do. */
+static gboolean sched_cancel_browse(MafwSource *self, guint browse_id,
+				    GError **error)
+{
+	struct scheduler *sched;
+	struct sched_browse *sb;
+	gpointer key;
+
+	key = GUINT_TO_POINTER(browse_id);
+	sched = scheduler(self, FALSE);
+	if (!sched || !(sb = g_hash_table_lookup(sched->browses, key)))
+		return FALSE;
+
+	if (!sb->req.queued) {
+		gboolean ret;
+
+		if (sb->real_id == MAFW_SOURCE_INVALID_BROWSE_ID) {
+			/* Still in browse_start(), which finishes it. */
+			sb->cancelled = TRUE;
+			return TRUE;
+		}
+		g_hash_table_steal(sched->browses, key);
+		ret = MAFW_SOURCE_GET_CLASS(self)->cancel_browse(
+				self, sb->real_id, error);
+		sched_finished(self, sched);
+		sched_browse_free(sb);
+		return ret;
+	}
+
+	g_hash_table_steal(sched->browses, key);
+	g_queue_remove(&sched->queues[sb->req.priority], sb);
+	sched_browse_free(sb);
+	return TRUE;
+}
+
 /**
  * mafw_source_browse:
  * @self:          A #MafwSource instance to browse.
@@ -406,8 +1471,48 @@ guint mafw_source_browse(MafwSource *self,
 			 guint skip_count, guint item_count,
 			 MafwSourceBrowseResultCb browse_cb,
 			 gpointer user_data)
+{
+	return mafw_source_browse_full(self, object_id, recursive, filter,
+				       sort_criteria, metadata_keys,
+				       skip_count, item_count,
+				       MAFW_SOURCE_PRIORITY_INTERACTIVE,
+				       browse_cb, user_data);
+}
+
+/**
+ * mafw_source_browse_full:
+ * @self:          A #MafwSource instance to browse.
+ * @object_id:     The starting object id to browse from (usually a container).
+ * @recursive:     %TRUE, if browsing should be recursive.
+ * @filter:        Filter criteria, see #MafwFilter.
+ * @sort_criteria: Sort criteria (i.e. the order in which results are expected)
+ * @metadata_keys: A %NULL-terminated array of requested metadata keys.
+ * @skip_count:    Number of items to skip from the beginning.
+ * @item_count:    Number of items to return.
+ * @priority:      How urgent the session is.
+ * @browse_cb:     Function to call with browse results, or inform about the
+ *                 error.
+ * @user_data:     Optional user data pointer passed along with @browse_cb.
+ *
+ * Like mafw_source_browse(), but if the number of requests in progress
+ * is limited by mafw_source_set_max_requests(), the session waits for
+ * its turn according to @priority.  A waiting session can be cancelled
+ * like a running one, and then @browse_cb is not called at all.
+ *
+ * Returns: The identifier of the browse session, see mafw_source_browse().
+ */
+guint mafw_source_browse_full(MafwSource *self,
+			      const gchar *object_id,
+			      gboolean recursive, const MafwFilter *filter,
+			      const gchar *sort_criteria,
+			      const gchar *const *metadata_keys,
+			      guint skip_count, guint item_count,
+			      MafwSourcePriority priority,
+			      MafwSourceBrowseResultCb browse_cb,
+			      gpointer user_data)
 {
 	GError *error = NULL;
+	struct timed_op *op;
 	/* This implements the Template Method Pattern
 	 * (http://en.wikipedia.org/wiki/Template_method_pattern). We'll
 	 * do some stuff and then we let subclasses implement the real
@@ -417,18 +1522,337 @@ guint mafw_source_browse(MafwSource *self,
 	 * overriden and then we let the subclasses do the other
 	 * stuff. */
 
-	if (!check_sort_criteria (sort_criteria, &error)) {
-		browse_cb(self, MAFW_SOURCE_INVALID_BROWSE_ID, 0, 0, NULL, NULL,
-					user_data, error);
-		g_error_free(error);
-		return MAFW_SOURCE_INVALID_BROWSE_ID;
+	if (!check_sort_criteria (sort_criteria, &error)) {
+		browse_cb(self, MAFW_SOURCE_INVALID_BROWSE_ID, 0, 0, NULL, NULL,
+					user_data, error);
+		g_error_free(error);
+		return MAFW_SOURCE_INVALID_BROWSE_ID;
+	}
+
+	op = timed_op_new(self, browse_cb, user_data, NULL, browse_expired);
+	if (op) {
+		guint serial = op->base.serial;
+
+		return browse_started(serial, schedule_browse(self,
+				object_id, recursive, filter, sort_criteria,
+				metadata_keys, skip_count, item_count,
+				priority,
+				(MafwSourceBrowseResultCb)browse_timed,
+				GUINT_TO_POINTER(serial)));
+	}
+
+	return schedule_browse(self, object_id, recursive,
+			       filter, sort_criteria,
+			       metadata_keys,
+			       skip_count, item_count,
+			       priority, browse_cb, user_data);
+}
+
+/**
+ * mafw_source_browse_chunked:
+ * @self:          A #MafwSource instance to browse.
+ * @object_id:     The starting object id to browse from (usually a container).
+ * @recursive:     %TRUE, if browsing should be recursive.
+ * @filter:        Filter criteria, see #MafwFilter.
+ * @sort_criteria: Sort criteria (i.e. the order in which results are expected)
+ * @metadata_keys: A %NULL-terminated array of requested metadata keys.
+ * @skip_count:    Number of items to skip from the beginning.
+ * @item_count:    Number of items to return.
+ * @chunk_size:    The maximal number of items per callback, or 0 for
+ *                 #MAFW_SOURCE_BROWSE_CHUNK_SIZE.
+ * @chunk_cb:      Function to call with browse results, or inform about the
+ *                 error.
+ * @user_data:     Optional user data pointer passed along with @chunk_cb.
+ *
+ * Like mafw_source_browse(), but @chunk_cb receives the results in chunks
+ * of @chunk_size items rather than one by one, which saves the overhead
+ * of a call per item when browsing large containers.  Sources can
+ * implement it natively, otherwise the results of mafw_source_browse()
+ * are grouped.  The session can be cancelled by mafw_source_cancel_browse().
+ *
+ * Returns: The identifier of the browse session (which is also passed
+ *          to @chunk_cb). If some arguments were invalid,
+ *          #MAFW_SOURCE_INVALID_BROWSE_ID is returned, but the @chunk_cb
+ *          will be called.
+ */
+guint mafw_source_browse_chunked(MafwSource *self,
+				 const gchar *object_id,
+				 gboolean recursive, const MafwFilter *filter,
+				 const gchar *sort_criteria,
+				 const gchar *const *metadata_keys,
+				 guint skip_count, guint item_count,
+				 guint chunk_size,
+				 MafwSourceBrowseChunkCb chunk_cb,
+				 gpointer user_data)
+{
+	static const gchar *const no_ids[] = { NULL };
+	GError *error = NULL;
+	struct timed_op *op;
+
+	if (!check_sort_criteria (sort_criteria, &error)) {
+		chunk_cb(self, MAFW_SOURCE_INVALID_BROWSE_ID, 0, 0,
+			 no_ids, NULL, 0, user_data, error);
+		g_error_free(error);
+		return MAFW_SOURCE_INVALID_BROWSE_ID;
+	}
+
+	if (!chunk_size)
+		chunk_size = MAFW_SOURCE_BROWSE_CHUNK_SIZE;
+
+	op = timed_op_new(self, chunk_cb, user_data, NULL,
+			  browse_chunked_expired);
+	if (op) {
+		guint serial = op->base.serial;
+
+		return browse_started(serial,
+			MAFW_SOURCE_GET_CLASS(self)->browse_chunked(self,
+					object_id, recursive, filter,
+					sort_criteria, metadata_keys,
+					skip_count, item_count, chunk_size,
+					(MafwSourceBrowseChunkCb)
+					browse_chunked_timed,
+					GUINT_TO_POINTER(serial)));
+	}
+
+	return MAFW_SOURCE_GET_CLASS(self)->browse_chunked(self, object_id,
+						recursive, filter,
+						sort_criteria, metadata_keys,
+						skip_count, item_count,
+						chunk_size, chunk_cb,
+						user_data);
+}
+
+/* Pull-based browsing */
+/*
+ * A cursor fetches $count items at a time from the $native session of
+ * the source's cursor_fetch(), or if it has none, by browsing them
+ * from $position with mafw_source_browse_chunked().  The items are
+ * collected in $ids and $mds until the fetch ends.  While a fetch is in
+ * progress the cursor is in $Fetching under its $serial, which is
+ * passed to the source instead of the cursor.  Freeing the cursor takes
+ * it out of the table, so chunks arriving after the fetch has been
+ * cancelled are dropped.
+ */
+struct _MafwSourceCursor {
+	MafwSource *source;
+	gchar *object_id;
+	gboolean recursive;
+	MafwFilter *filter;
+	gchar *sort_criteria;
+	gchar **mdkeys;
+	gpointer native;
+
+	guint position;
+	gboolean finished;
+
+	guint serial;
+	guint browse_id, count;
+	MafwSourceCursorFetchCb cb;
+	gpointer user_data;
+	GPtrArray *ids, *mds;
+};
+
+static GHashTable *Fetching;
+
+static void cursor_free(MafwSourceCursor *cursor)
+{
+	if (cursor->ids)
+		free_fetched(cursor->ids, cursor->mds);
+	g_object_unref(cursor->source);
+	g_free(cursor->object_id);
+	if (cursor->filter)
+		mafw_filter_free(cursor->filter);
+	g_free(cursor->sort_criteria);
+	g_strfreev(cursor->mdkeys);
+	g_free(cursor);
+}
+
+static void cursor_got_chunk(MafwSource *self, guint browse_id,
+			     gint remaining_count, guint index,
+			     const gchar *const *object_ids,
+			     GHashTable **metadatas, guint nitems,
+			     gpointer serial, const GError *error)
+{
+	MafwSourceCursor *cursor;
+	GPtrArray *ids, *mds;
+	guint i, first;
+
+	if (!(cursor = g_hash_table_lookup(Fetching, serial)))
+		return;
+	for (i = 0; i < nitems; i++) {
+		g_ptr_array_add(cursor->ids, g_strdup(object_ids[i]));
+		g_ptr_array_add(cursor->mds, mafw_metadata_copy(metadatas[i]));
+	}
+	if (!error && remaining_count != 0)
+		return;
+
+	g_hash_table_remove(Fetching, serial);
+	cursor->serial = 0;
+
+	/* Reset the cursor before calling back, which may fetch
+	 * again or free it. */
+	ids = cursor->ids;
+	mds = cursor->mds;
+	cursor->ids = cursor->mds = NULL;
+	first = cursor->position;
+	cursor->position += mds->len;
+	if (!error && mds->len < cursor->count)
+		cursor->finished = TRUE;
+
+	g_ptr_array_add(ids, NULL);
+	cursor->cb(cursor, first, (const gchar *const *)ids->pdata,
+		   (GHashTable **)mds->pdata, mds->len,
+		   cursor->finished, cursor->user_data, error);
+	free_fetched(ids, mds);
+}
+
+/**
+ * mafw_source_cursor_new:
+ * @self:          A #MafwSource instance to browse.
+ * @object_id:     The starting object id to browse from (usually a container).
+ * @recursive:     %TRUE, if browsing should be recursive.
+ * @filter:        Filter criteria, see #MafwFilter.
+ * @sort_criteria: Sort criteria (i.e. the order in which results are expected)
+ * @metadata_keys: A %NULL-terminated array of requested metadata keys.
+ *
+ * Creates a pull-based browse session.  Unlike mafw_source_browse(),
+ * which makes the source push all results as fast as it can, the source
+ * only produces results when they are asked for by
+ * mafw_source_cursor_fetch().  This bounds the memory needed by huge
+ * browses and lets user interfaces fetch just what they show.  The
+ * arguments have the same meaning as of mafw_source_browse(), and
+ * are copied.  Sources keeping their place between fetches implement
+ * the cursor functions of #MafwSourceClass, for the others each fetch
+ * is a new browse skipping the items fetched before, so they should
+ * handle @skip_count efficiently.
+ *
+ * Returns: a new #MafwSourceCursor, free it with mafw_source_cursor_free().
+ */
+MafwSourceCursor *mafw_source_cursor_new(MafwSource *self,
+					 const gchar *object_id,
+					 gboolean recursive,
+					 const MafwFilter *filter,
+					 const gchar *sort_criteria,
+					 const gchar *const *metadata_keys)
+{
+	MafwSourceCursor *cursor;
+
+	g_return_val_if_fail(MAFW_IS_SOURCE(self), NULL);
+
+	cursor = g_new0(MafwSourceCursor, 1);
+	cursor->source = g_object_ref(self);
+	cursor->object_id = g_strdup(object_id);
+	cursor->recursive = recursive;
+	cursor->filter = filter ? mafw_filter_copy(filter) : NULL;
+	cursor->sort_criteria = g_strdup(sort_criteria);
+	cursor->mdkeys = g_strdupv((gchar **)metadata_keys);
+	cursor->browse_id = MAFW_SOURCE_INVALID_BROWSE_ID;
+	if (MAFW_SOURCE_GET_CLASS(self)->cursor_new)
+		cursor->native = MAFW_SOURCE_GET_CLASS(self)->cursor_new(self,
+					object_id, recursive, filter,
+					sort_criteria, metadata_keys);
+	return cursor;
+}
+
+/**
+ * mafw_source_cursor_fetch:
+ * @cursor:    A #MafwSourceCursor.
+ * @count:     The number of items to fetch.
+ * @fetch_cb:  Function to call with the results.
+ * @user_data: Optional user data pointer passed along with @fetch_cb.
+ *
+ * Fetches the next @count items of @cursor.  The source is asked to
+ * browse these items only, and @cursor advances past them.  Only one
+ * fetch can be in progress at a time.  Once @cursor is finished,
+ * fetching returns no items.  @fetch_cb may be called before this
+ * function returns.
+ */
+void mafw_source_cursor_fetch(MafwSourceCursor *cursor, guint count,
+			      MafwSourceCursorFetchCb fetch_cb,
+			      gpointer user_data)
+{
+	static guint serial;
+	guint browse_id;
+
+	g_return_if_fail(cursor != NULL);
+	g_return_if_fail(!cursor->serial);
+	g_return_if_fail(count > 0);
+	g_return_if_fail(fetch_cb != NULL);
+
+	if (cursor->finished) {
+		static const gchar *const no_ids[] = { NULL };
+
+		fetch_cb(cursor, cursor->position, no_ids, NULL, 0, TRUE,
+			 user_data, NULL);
+		return;
+	}
+
+	if (!Fetching)
+		Fetching = g_hash_table_new(g_direct_hash, g_direct_equal);
+	if (!++serial)
+		serial++;
+	cursor->serial = serial;
+	g_hash_table_insert(Fetching, GUINT_TO_POINTER(serial), cursor);
+	cursor->count = count;
+	cursor->cb = fetch_cb;
+	cursor->user_data = user_data;
+	cursor->ids = g_ptr_array_sized_new(count + 1);
+	cursor->mds = g_ptr_array_sized_new(count);
+	cursor->browse_id = MAFW_SOURCE_INVALID_BROWSE_ID;
+	if (cursor->native) {
+		MAFW_SOURCE_GET_CLASS(cursor->source)->cursor_fetch(
+				cursor->source, cursor->native, count,
+				(MafwSourceBrowseChunkCb)cursor_got_chunk,
+				GUINT_TO_POINTER(serial));
+		return;
 	}
+	browse_id = mafw_source_browse_chunked(cursor->source,
+				cursor->object_id, cursor->recursive,
+				cursor->filter, cursor->sort_criteria,
+				(const gchar *const *)cursor->mdkeys,
+				cursor->position, count, count,
+				(MafwSourceBrowseChunkCb)cursor_got_chunk,
+				GUINT_TO_POINTER(serial));
+
+	/* The source may have finished already. */
+	if (cursor->serial == serial)
+		cursor->browse_id = browse_id;
+}
+
+/**
+ * mafw_source_cursor_get_position:
+ * @cursor: A #MafwSourceCursor.
+ *
+ * Returns: the number of items fetched by @cursor so far.
+ */
+guint mafw_source_cursor_get_position(MafwSourceCursor *cursor)
+{
+	g_return_val_if_fail(cursor != NULL, 0);
+	return cursor->position;
+}
 
-	return mafw_source_do_browse(self, object_id, recursive,
-				      filter, sort_criteria,
-				      metadata_keys,
-				      skip_count, item_count,
-				      browse_cb, user_data);
+/**
+ * mafw_source_cursor_free:
+ * @cursor: A #MafwSourceCursor.
+ *
+ * Frees @cursor.  A fetch in progress is cancelled and its callback
+ * won't be called.
+ */
+void mafw_source_cursor_free(MafwSourceCursor *cursor)
+{
+	g_return_if_fail(cursor != NULL);
+
+	if (cursor->serial) {
+		g_hash_table_remove(Fetching,
+				    GUINT_TO_POINTER(cursor->serial));
+		if (cursor->browse_id != MAFW_SOURCE_INVALID_BROWSE_ID)
+			mafw_source_cancel_browse(cursor->source,
+						  cursor->browse_id, NULL);
+	}
+	if (cursor->native)
+		MAFW_SOURCE_GET_CLASS(cursor->source)->cursor_free(
+				cursor->source, cursor->native);
+	cursor_free(cursor);
 }
 
 /**
@@ -462,6 +1886,18 @@ gboolean mafw_source_all_keys(const gchar *const *keys)
 gboolean mafw_source_cancel_browse(MafwSource *self, guint browse_id,
 				   GError **error)
 {
+	/* Don't time out a session the caller is not interested in. */
+	if (browse_id != MAFW_SOURCE_INVALID_BROWSE_ID) {
+		struct timed_op which;
+
+		which.base.self = self;
+		which.browse_id = browse_id;
+		_mafw_extension_timed_ops_cancel((GHRFunc)same_browse,
+						 &which);
+	}
+	chunk_adapters_cancel(self, browse_id);
+	if (sched_cancel_browse(self, browse_id, error))
+		return TRUE;
 	return MAFW_SOURCE_GET_CLASS(self)->cancel_browse(self,
 							  browse_id,
 							  error);
@@ -490,6 +1926,406 @@ gint mafw_source_get_update_progress(MafwSource *self,
                                                                 remaining_time);
 }
 
+/* In-flight get_metadata() requests */
+
+/* A call of the get_metadata() implementation whose result is fanned
+ * out to every caller asking for the same or fewer keys meanwhile.
+ * Waiters whose token is cancelled leave; when the last one has left,
+ * the request is forgotten and its own $token is cancelled, but it is
+ * only freed when the source answers. */
+struct inflight {
+	MafwSource *self;
+	gchar *object_id;
+	/* Sorted and unique, or just the wildcard. */
+	gchar **keys;
+	/* struct waiter:s, the latest first. */
+	GSList *waiters;
+	/* The most urgent of the waiters. */
+	MafwSourcePriority priority;
+	/* %NULL unless the first waiter could be cancelled. */
+	MafwSourceToken *token;
+};
+
+struct waiter {
+	struct inflight *req;
+	MafwSourceMetadataResultCb cb;
+	gpointer user_data;
+	/* The keys to leave in the result, or %NULL to pass it as is. */
+	gchar **keys;
+	MafwSourceToken *token;
+	gulong handler;
+};
+
+static gint cmp_keys(const gchar **lhs, const gchar **rhs)
+{
+	return strcmp(*lhs, *rhs);
+}
+
+/*
+ * Returns a sorted, duplicate-free copy of $mdkeys, or just the
+ * wildcard if it's among them, so that key sets asking the same can
+ * be compared.
+ */
+gchar **_mafw_source_canonical_keys(const gchar *const *mdkeys)
+{
+	gchar **keys;
+	guint i, o, n;
+
+	for (i = 0; mdkeys && mdkeys[i]; i++)
+		if (!strcmp(mdkeys[i], MAFW_SOURCE_KEY_WILDCARD))
+			return g_strdupv((gchar **)MAFW_SOURCE_ALL_KEYS);
+
+	keys = g_strdupv((gchar **)mdkeys);
+	n = keys ? g_strv_length(keys) : 0;
+	g_qsort_with_data(keys, n, sizeof(*keys),
+			  (GCompareDataFunc)cmp_keys, NULL);
+	for (i = o = 0; i < n; i++) {
+		if (o > 0 && !strcmp(keys[i], keys[o-1]))
+			g_free(keys[i]);
+		else
+			keys[o++] = keys[i];
+	}
+	if (keys)
+		keys[o] = NULL;
+	return keys;
+}
+
+static gboolean is_wildcard(gchar **keys)
+{
+	return keys && keys[0] && !strcmp(keys[0], MAFW_SOURCE_KEY_WILDCARD)
+		&& !keys[1];
+}
+
+/* Returns whether canonical $super includes all of canonical $sub. */
+static gboolean keys_cover(gchar **super, gchar **sub)
+{
+	if (is_wildcard(super))
+		return TRUE;
+	if (is_wildcard(sub) || !super)
+		return !sub || !sub[0];
+	for (; sub && *sub; sub++) {
+		while (*super && strcmp(*super, *sub) < 0)
+			super++;
+		if (!*super || strcmp(*super, *sub))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static gboolean keys_equal(gchar **lhs, gchar **rhs)
+{
+	for (; lhs && *lhs && rhs && *rhs; lhs++, rhs++)
+		if (strcmp(*lhs, *rhs))
+			return FALSE;
+	return !(lhs && *lhs) && !(rhs && *rhs);
+}
+
+/* Returns the object ID -> list of struct inflight table of $self. */
+static GHashTable *inflight_table(MafwSource *self)
+{
+	GHashTable *table;
+
+	table = g_object_get_data(G_OBJECT(self), "mafw-source-inflight");
+	if (!table) {
+		table = g_hash_table_new_full(g_str_hash, g_str_equal,
+					      g_free, NULL);
+		g_object_set_data_full(G_OBJECT(self),
+				       "mafw-source-inflight", table,
+				       (GDestroyNotify)g_hash_table_destroy);
+	}
+	return table;
+}
+
+static void inflight_remove(struct inflight *req)
+{
+	GHashTable *table;
+	GSList *reqs;
+
+	table = inflight_table(req->self);
+	reqs = g_hash_table_lookup(table, req->object_id);
+	reqs = g_slist_remove(reqs, req);
+	if (reqs)
+		g_hash_table_insert(table, g_strdup(req->object_id), reqs);
+	else
+		g_hash_table_remove(table, req->object_id);
+}
+
+static void waiter_free(struct waiter *w)
+{
+	if (w->token) {
+		mafw_source_token_disconnect(w->token, w->handler);
+		mafw_source_token_unref(w->token);
+	}
+	g_strfreev(w->keys);
+	g_free(w);
+}
+
+static void waiter_cancelled(MafwSourceToken *token, struct waiter *w)
+{
+	struct inflight *req = w->req;
+
+	req->waiters = g_slist_remove(req->waiters, w);
+	waiter_free(w);
+	if (!req->waiters) {
+		/* Nobody wants the result any more. */
+		inflight_remove(req);
+		mafw_source_token_cancel(req->token);
+	}
+}
+
+static gboolean not_requested(const gchar *key, gpointer val, gchar **keys)
+{
+	for (; *keys; keys++)
+		if (!strcmp(*keys, key))
+			return FALSE;
+	return TRUE;
+}
+
+/* Delivers the result of the source to all waiters of $req. */
+static void inflight_done(MafwSource *self, const gchar *object_id,
+			  GHashTable *metadata, struct inflight *req,
+			  const GError *error)
+{
+	GSList *waiters, *l;
+
+	/* Requests made by the callbacks go to the source again.
+	 * Those may cancel the tokens of the waiters after them. */
+	inflight_remove(req);
+	waiters = g_slist_reverse(req->waiters);
+	req->waiters = NULL;
+	for (l = waiters; l; l = l->next) {
+		struct waiter *w = l->data;
+
+		if (w->token) {
+			mafw_source_token_disconnect(w->token, w->handler);
+			w->handler = 0;
+		}
+	}
+	for (l = waiters; l; l = l->next) {
+		struct waiter *w = l->data;
+
+		if (mafw_source_token_is_cancelled(w->token))
+			/* NOP */;
+		else if (w->keys && metadata) {
+			GHashTable *md;
+
+			md = mafw_metadata_copy(metadata);
+			g_hash_table_foreach_remove(md,
+						    (GHRFunc)not_requested,
+						    w->keys);
+			w->cb(self, object_id, md, w->user_data, error);
+			mafw_metadata_release(md);
+		} else
+			/* Shared by the waiters, see
+			 * mafw_source_get_metadata(). */
+			w->cb(self, object_id, metadata, w->user_data, error);
+		waiter_free(w);
+	}
+
+	g_slist_free(waiters);
+	if (req->token)
+		mafw_source_token_unref(req->token);
+	g_strfreev(req->keys);
+	g_free(req->object_id);
+	g_object_unref(req->self);
+	g_free(req);
+}
+
+/* Worker threads */
+/*
+ * Sources setting @threaded_get_metadata have their get_metadata() run
+ * in $Workers.  The result is stored in the task, then passed to the
+ * caller from the main loop.
+ */
+#define WORKER_THREADS		4
+
+static GThreadPool *Workers;
+G_LOCK_DEFINE_STATIC(Workers);
+
+struct worker_task {
+	MafwSource *self;
+	gchar *object_id;
+	gchar **keys;
+	MafwSourceToken *token;
+	MafwSourceMetadataResultCb cb;
+	gpointer user_data;
+
+	GHashTable *metadata;
+	GError *error;
+};
+
+static void worker_task_free(struct worker_task *task)
+{
+	mafw_metadata_release(task->metadata);
+	if (task->error)
+		g_error_free(task->error);
+	if (task->token)
+		mafw_source_token_unref(task->token);
+	g_strfreev(task->keys);
+	g_free(task->object_id);
+	g_object_unref(task->self);
+	g_free(task);
+}
+
+static gboolean worker_deliver(struct worker_task *task)
+{
+	task->cb(task->self, task->object_id, task->metadata,
+		 task->user_data, task->error);
+	worker_task_free(task);
+	return FALSE;
+}
+
+/* Called by the source in a worker thread, or later from the main loop
+ * if it deferred the callback. */
+static void worker_answered(MafwSource *self, const gchar *object_id,
+			    GHashTable *metadata, struct worker_task *task,
+			    const GError *error)
+{
+	if (metadata)
+		task->metadata = g_hash_table_ref(metadata);
+	if (error)
+		task->error = g_error_copy(error);
+	g_idle_add((GSourceFunc)worker_deliver, task);
+}
+
+static void worker_run(struct worker_task *task, gpointer unused)
+{
+	MafwSourceClass *klass;
+	MafwSourceToken *prev;
+
+	klass = MAFW_SOURCE_GET_CLASS(task->self);
+	if (mafw_source_token_is_cancelled(task->token))
+		/* Cancelled while waiting for a thread. */
+		g_idle_add((GSourceFunc)worker_deliver, task);
+	else if (task->cb) {
+		prev = set_current_token(task->token);
+		klass->get_metadata(task->self, task->object_id,
+				    (const gchar *const *)task->keys,
+				    (MafwSourceMetadataResultCb)
+				    worker_answered, task);
+		set_current_token(prev);
+	} else {
+		klass->get_metadata(task->self, task->object_id,
+				    (const gchar *const *)task->keys,
+				    NULL, NULL);
+		worker_task_free(task);
+	}
+}
+
+/* Calls the get_metadata() of the source, in a worker thread if it
+ * asked for that, with $token being the current one. */
+static void call_get_metadata(MafwSource *self, const gchar *object_id,
+			      const gchar *const *metadata_keys,
+			      MafwSourceToken *token,
+			      MafwSourceMetadataResultCb cb,
+			      gpointer user_data)
+{
+	struct worker_task *task;
+	MafwSourceToken *prev;
+
+	if (!MAFW_SOURCE_GET_CLASS(self)->threaded_get_metadata
+	    || !g_thread_supported()) {
+		prev = set_current_token(token);
+		MAFW_SOURCE_GET_CLASS(self)->get_metadata(self, object_id,
+							 metadata_keys,
+							 cb, user_data);
+		set_current_token(prev);
+		return;
+	}
+
+	G_LOCK(Workers);
+	if (!Workers)
+		Workers = g_thread_pool_new((GFunc)worker_run, NULL,
+					    WORKER_THREADS, FALSE, NULL);
+	G_UNLOCK(Workers);
+
+	task = g_new0(struct worker_task, 1);
+	task->self = g_object_ref(self);
+	task->object_id = g_strdup(object_id);
+	task->keys = g_strdupv((gchar **)metadata_keys);
+	if (token)
+		task->token = mafw_source_token_ref(token);
+	task->cb = cb;
+	task->user_data = user_data;
+	g_thread_pool_push(Workers, task, NULL);
+}
+
+/*
+ * Asks the metadata of $object_id from the source, unless it's already
+ * working on it, in which case $metadata_cb is added to the waiters of
+ * the pending request.  $metadata_cb is not called once $token is
+ * cancelled.
+ */
+static void get_metadata_coalesced(MafwSource *self,
+				   const gchar *object_id,
+				   const gchar *const *metadata_keys,
+				   MafwSourcePriority priority,
+				   MafwSourceToken *token,
+				   MafwSourceMetadataResultCb metadata_cb,
+				   gpointer user_data)
+{
+	GHashTable *table;
+	GSList *reqs, *l;
+	struct inflight *req;
+	struct waiter *w;
+	gchar **keys;
+
+	if (!metadata_cb) {
+		call_get_metadata(self, object_id, metadata_keys, NULL,
+				  NULL, user_data);
+		return;
+	}
+
+	keys = _mafw_source_canonical_keys(metadata_keys);
+	w = g_new0(struct waiter, 1);
+	w->cb = metadata_cb;
+	w->user_data = user_data;
+	if (token) {
+		w->token = mafw_source_token_ref(token);
+		w->handler = mafw_source_token_connect(token,
+					(MafwSourceTokenCancelledCb)
+					waiter_cancelled, w);
+	}
+
+	/* Join a pending request covering $keys. */
+	table = inflight_table(self);
+	reqs = g_hash_table_lookup(table, object_id);
+	for (l = reqs; l; l = l->next) {
+		req = l->data;
+		if (!keys_cover(req->keys, keys))
+			continue;
+		if (keys_equal(req->keys, keys))
+			g_strfreev(keys);
+		else
+			w->keys = keys;
+		w->req = req;
+		req->waiters = g_slist_prepend(req->waiters, w);
+		if (priority < req->priority) {
+			req->priority = priority;
+			promote_metadata(self,
+					 (MafwSourceMetadataResultCb)
+					 inflight_done, req, priority);
+		}
+		return;
+	}
+
+	req = g_new(struct inflight, 1);
+	req->self = g_object_ref(self);
+	req->object_id = g_strdup(object_id);
+	req->keys = keys;
+	req->waiters = g_slist_prepend(NULL, w);
+	req->priority = priority;
+	req->token = token ? mafw_source_token_new() : NULL;
+	w->req = req;
+	g_hash_table_insert(table, g_strdup(object_id),
+			    g_slist_prepend(reqs, req));
+
+	/* $req may be gone when this returns. */
+	schedule_metadata(self, object_id, metadata_keys, priority,
+			  req->token,
+			  (MafwSourceMetadataResultCb)inflight_done, req);
+}
+
 /**
  * mafw_source_get_metadata:
  * @self:          A #MafwSource instance.
@@ -505,6 +2341,18 @@ gint mafw_source_get_update_progress(MafwSource *self,
  * try to retrieve all possible (see <link
  * linkend="mafw-MafwMetadata">MafwMetadata</link>) metadata it can
  * related to the given object.
+ *
+ * Requests for an object made while the source is still working on
+ * the same or more keys of it are not passed to the source again, but
+ * answered with the result of the pending request, leaving out the
+ * keys which were not asked for.  Callers asking for the same keys as
+ * the pending request are all passed the very same hash table, so
+ * @metadata_cb must not modify it.  Use mafw_metadata_copy() to get
+ * one of your own.
+ *
+ * If the source doesn't answer within mafw_extension_get_timeout(),
+ * @metadata_cb is called with a
+ * %MAFW_EXTENSION_ERROR_EXTENSION_NOT_RESPONDING error.
  */
 void mafw_source_get_metadata(MafwSource *self,
 				  const gchar *object_id,
@@ -512,42 +2360,157 @@ void mafw_source_get_metadata(MafwSource *self,
 				  MafwSourceMetadataResultCb metadata_cb,
 				  gpointer user_data)
 {
-	MAFW_SOURCE_GET_CLASS(self)->get_metadata(self,
-							 object_id,
-							 metadata_keys,
-							 metadata_cb,
-							 user_data);
+	mafw_source_get_metadata_full(self, object_id, metadata_keys,
+				      MAFW_SOURCE_PRIORITY_INTERACTIVE, NULL,
+				      metadata_cb, user_data);
+}
+
+/**
+ * mafw_source_get_metadata_full:
+ * @self:          A #MafwSource instance.
+ * @object_id:     The object ID, whose metadata is being requested.
+ * @metadata_keys: A %NULL-terminated array of requested metadata keys.
+ * @priority:      How urgent the request is.
+ * @token:         Optional #MafwSourceToken to cancel the request with.
+ * @metadata_cb:   The function to call with results.
+ * @user_data:     Optional user data pointer passed along with @metadata_cb.
+ *
+ * Like mafw_source_get_metadata(), but if the number of requests in
+ * progress is limited by mafw_source_set_max_requests(), the request
+ * waits for its turn according to @priority.
+ *
+ * Once @token is cancelled, @metadata_cb is not called.  A request still
+ * waiting for its turn is dropped, and the source is asked to give up
+ * when no other caller is interested in the result, see
+ * mafw_source_get_current_token().
+ */
+void mafw_source_get_metadata_full(MafwSource *self,
+				   const gchar *object_id,
+				   const gchar *const *metadata_keys,
+				   MafwSourcePriority priority,
+				   MafwSourceToken *token,
+				   MafwSourceMetadataResultCb metadata_cb,
+				   gpointer user_data)
+{
+	struct timed_op *op;
+
+	g_return_if_fail(MAFW_IS_SOURCE(self));
+	g_return_if_fail(object_id != NULL);
+	g_return_if_fail(priority < NPRIORITIES);
+
+	if (mafw_source_token_is_cancelled(token))
+		return;
+	if (!metadata_cb)
+		token = NULL;
+
+	op = timed_op_new(self, metadata_cb, user_data, object_id,
+			  metadata_expired);
+	if (op) {
+		if (token)
+			timed_op_set_token(op, token);
+		get_metadata_coalesced(self, object_id, metadata_keys,
+				       priority, token, metadata_timed,
+				       GUINT_TO_POINTER(op->base.serial));
+	} else
+		get_metadata_coalesced(self, object_id, metadata_keys,
+				       priority, token, metadata_cb,
+				       user_data);
 }
 
+/* State of a mafw_source_get_metadatas_full() request.  It's freed when
+ * the result has been delivered or cancelled, no get_metadata() is in
+ * progress and none of our callbacks are on the stack. */
 struct metadatas_data
 {
+	MafwExtensionDeadline deadline;	/*< first for _deadline_passed */
 	MafwSource *self;
-	GHashTable *metadatas;	/*< collected metadatas */
+	gchar **object_ids;
+	gchar **keys;
+	guint nobjects;
+	guint next;		/*< index of the next object to ask */
+	guint in_flight;	/*< number of get_metadata()s in progress */
+	guint max_in_flight;
+	MafwSourcePriority priority;
 	guint remaining_count;	/*< number or missing metadata-requests */
+	gboolean issuing;
+	gboolean delivering;	/*< calling back the caller */
+	gboolean native;	/*< the source's get_metadatas() was called */
+	gboolean done;		/*< the result was delivered or scheduled */
+	gboolean emitted;	/*< ...or cancelled */
+	GHashTable *metadatas;	/*< collected metadatas */
 	guint result_id;	/*< source-id of the _emit_result idle cb */
+	MafwSourceMetadataResultCb partial_cb;
 	MafwSourceMetadataResultsCb cb;
 	GError *err;
 	gpointer udata;
+	MafwSourceToken *token;
+	gulong handler;
 };
 
-/* Calls the get_metadatas_cb */
-static gboolean _emit_result(struct metadatas_data *mdatas_data)
+static void _metadatas_data_free(struct metadatas_data *mdatas_data)
 {
-	if (mdatas_data->remaining_count)
-	{
-		mdatas_data->result_id = 0;
-		return FALSE;
+	if (!mdatas_data->emitted || mdatas_data->in_flight
+	    || mdatas_data->issuing || mdatas_data->delivering)
+		return;
+	if (mdatas_data->token) {
+		mafw_source_token_disconnect(mdatas_data->token,
+					     mdatas_data->handler);
+		mafw_source_token_unref(mdatas_data->token);
 	}
-	mdatas_data->cb(mdatas_data->self, mdatas_data->metadatas, mdatas_data->udata,
-				mdatas_data->err);
 	g_hash_table_unref(mdatas_data->metadatas);
 	if (mdatas_data->err)
 		g_error_free(mdatas_data->err);
+	g_strfreev(mdatas_data->object_ids);
+	g_strfreev(mdatas_data->keys);
 	g_object_unref(mdatas_data->self);
 	g_free(mdatas_data);
+}
+
+/* Calls the get_metadatas_cb */
+static gboolean _emit_result(struct metadatas_data *mdatas_data)
+{
+	_mafw_extension_deadline_stop(&mdatas_data->deadline);
+	mdatas_data->result_id = 0;
+	mdatas_data->done = mdatas_data->emitted = TRUE;
+	mdatas_data->delivering = TRUE;
+	mdatas_data->cb(mdatas_data->self, mdatas_data->metadatas, mdatas_data->udata,
+				mdatas_data->err);
+	mdatas_data->delivering = FALSE;
+	_metadatas_data_free(mdatas_data);
 	return FALSE;
 }
 
+/* Drops the result.  The get_metadata()s we asked had the same token,
+ * so they won't call back, unlike the source's own get_metadatas(). */
+static void _metadatas_cancelled(MafwSourceToken *token,
+				 struct metadatas_data *mdatas_data)
+{
+	_mafw_extension_deadline_stop(&mdatas_data->deadline);
+	if (mdatas_data->result_id)
+		g_source_remove(mdatas_data->result_id);
+	mdatas_data->result_id = 0;
+	mdatas_data->handler = 0;
+	mdatas_data->done = mdatas_data->emitted = TRUE;
+	if (!mdatas_data->native)
+		mdatas_data->in_flight = 0;
+	_metadatas_data_free(mdatas_data);
+}
+
+/* Delivers what we have got so far and ignores the rest. */
+static void _deadline_passed(MafwExtensionDeadline *deadline,
+			     const GError *error)
+{
+	struct metadatas_data *mdatas_data;
+
+	mdatas_data = (struct metadatas_data *)deadline;
+	if (mdatas_data->err)
+		g_error_free(mdatas_data->err);
+	mdatas_data->err = g_error_copy(error);
+	_emit_result(mdatas_data);
+}
+
+static void _metadata_request_more(struct metadatas_data *mdatas_data);
+
 /* Collect the requested metadatas */
 static void _metadata_collector(MafwSource *self,
 					   const gchar *object_id,
@@ -555,6 +2518,12 @@ static void _metadata_collector(MafwSource *self,
 					   struct metadatas_data *mdatas_data,
 					   const GError *error)
 {
+	mdatas_data->in_flight--;
+	if (mdatas_data->done) {
+		_metadatas_data_free(mdatas_data);
+		return;
+	}
+
 	mdatas_data->remaining_count--;
 	if (metadata)
 		g_hash_table_insert(mdatas_data->metadatas, g_strdup(object_id),
@@ -564,12 +2533,98 @@ static void _metadata_collector(MafwSource *self,
 	{
 		mdatas_data->err = g_error_copy(error);
 	}
+	if (mdatas_data->partial_cb) {
+		mdatas_data->delivering = TRUE;
+		mdatas_data->partial_cb(mdatas_data->self, object_id, metadata,
+					mdatas_data->udata, error);
+		mdatas_data->delivering = FALSE;
+		if (mafw_source_token_is_cancelled(mdatas_data->token)) {
+			_metadatas_data_free(mdatas_data);
+			return;
+		}
+	}
 
-	if (!mdatas_data->remaining_count && !mdatas_data->result_id)
+	if (!mdatas_data->remaining_count)
 	{/* Call the cb on idle, so it should work with sync get_metadata too*/
+		_mafw_extension_deadline_stop(&mdatas_data->deadline);
+		mdatas_data->done = TRUE;
 		mdatas_data->result_id = g_idle_add((GSourceFunc)_emit_result,
 					(gpointer)mdatas_data);
 	}
+	else if (!mdatas_data->issuing)
+		_metadata_request_more(mdatas_data);
+}
+
+/* Asks for the metadata of the next objects as long as the limit
+ * allows it. */
+static void _metadata_request_more(struct metadatas_data *mdatas_data)
+{
+	/* Synchronous results are handled in this loop, not recursively. */
+	mdatas_data->issuing = TRUE;
+	while (!mdatas_data->done
+	       && mdatas_data->next < mdatas_data->nobjects
+	       && (!mdatas_data->max_in_flight
+		   || mdatas_data->in_flight < mdatas_data->max_in_flight))
+	{
+		mdatas_data->in_flight++;
+		get_metadata_coalesced(mdatas_data->self,
+				mdatas_data->object_ids[mdatas_data->next++],
+				(const gchar *const *)mdatas_data->keys,
+				mdatas_data->priority,
+				mdatas_data->token,
+				(MafwSourceMetadataResultCb)_metadata_collector,
+				mdatas_data);
+	}
+	mdatas_data->issuing = FALSE;
+	/* In case a partial_cb cancelled the request. */
+	_metadatas_data_free(mdatas_data);
+}
+
+static void _collect_partial(const gchar *object_id, GHashTable *metadata,
+			     struct metadatas_data *mdatas_data)
+{
+	if (mafw_source_token_is_cancelled(mdatas_data->token))
+		return;
+	if (metadata)
+		g_hash_table_insert(mdatas_data->metadatas,
+				    g_strdup(object_id),
+				    g_hash_table_ref(metadata));
+	mdatas_data->partial_cb(mdatas_data->self, object_id, metadata,
+				mdatas_data->udata, NULL);
+}
+
+/* Result of the source's own get_metadatas(). */
+static void _metadatas_collector(MafwSource *self,
+				 GHashTable *metadatas,
+				 struct metadatas_data *mdatas_data,
+				 const GError *error)
+{
+	mdatas_data->in_flight--;
+	if (mdatas_data->done) {
+		_metadatas_data_free(mdatas_data);
+		return;
+	}
+
+	if (metadatas && mdatas_data->partial_cb) {
+		mdatas_data->delivering = TRUE;
+		g_hash_table_foreach(metadatas, (GHFunc)_collect_partial,
+				     mdatas_data);
+		mdatas_data->delivering = FALSE;
+		if (mafw_source_token_is_cancelled(mdatas_data->token)) {
+			_metadatas_data_free(mdatas_data);
+			return;
+		}
+	} else if (metadatas) {
+		g_hash_table_unref(mdatas_data->metadatas);
+		mdatas_data->metadatas = g_hash_table_ref(metadatas);
+	}
+	if (error)
+		mdatas_data->err = g_error_copy(error);
+	mdatas_data->remaining_count = 0;
+	_mafw_extension_deadline_stop(&mdatas_data->deadline);
+	mdatas_data->done = TRUE;
+	mdatas_data->result_id = g_idle_add((GSourceFunc)_emit_result,
+					    mdatas_data);
 }
 
 /**
@@ -587,6 +2642,12 @@ static void _metadata_collector(MafwSource *self,
  * try to retrieve all possible (see <link
  * linkend="mafw-MafwMetadata">MafwMetadata</link>) metadata it can
  * related to the given object.
+ *
+ * If the source doesn't implement it, the metadata of the objects is
+ * asked with mafw_source_get_metadata(), with at most
+ * #MAFW_SOURCE_METADATAS_CONCURRENCY requests in progress at once.
+ * If the results don't arrive within mafw_extension_get_timeout(), see
+ * mafw_source_get_metadatas_full().
  */
 void mafw_source_get_metadatas(MafwSource *self,
 				  const gchar **object_ids,
@@ -594,7 +2655,10 @@ void mafw_source_get_metadatas(MafwSource *self,
 				  MafwSourceMetadataResultsCb metadatas_cb,
 				  gpointer user_data)
 {
-	if (MAFW_SOURCE_GET_CLASS(self)->get_metadatas)
+	guint timeout;
+
+	timeout = mafw_extension_get_timeout(MAFW_EXTENSION(self));
+	if (MAFW_SOURCE_GET_CLASS(self)->get_metadatas && !timeout)
 	{
 		MAFW_SOURCE_GET_CLASS(self)->get_metadatas(self,
 							 object_ids,
@@ -604,28 +2668,117 @@ void mafw_source_get_metadatas(MafwSource *self,
 	}
 	else
 	{
-		gint i;
-		struct metadatas_data *mdatas_data = g_new0(struct metadatas_data, 1);
-
-		g_assert(object_ids && object_ids[0]);
+		mafw_source_get_metadatas_full(self, object_ids,
+					metadata_keys,
+					MAFW_SOURCE_METADATAS_CONCURRENCY,
+					timeout,
+					MAFW_SOURCE_PRIORITY_INTERACTIVE,
+					NULL, NULL, metadatas_cb,
+					user_data);
+	}
+}
 
-		mdatas_data->cb = metadatas_cb;
-		mdatas_data->udata = user_data;
-		mdatas_data->self = g_object_ref(self);
-		mdatas_data->metadatas = g_hash_table_new_full(g_str_hash,
-						g_str_equal,
-						(GDestroyNotify)g_free,
-						(GDestroyNotify)mafw_metadata_release);
+/**
+ * mafw_source_get_metadatas_full:
+ * @self:          A #MafwSource instance.
+ * @object_ids:    %NULL terminated list of object IDs, whose metadata is
+ *                 being requested.
+ * @metadata_keys: A %NULL-terminated array of requested metadata keys.
+ * @max_in_flight: The maximal number of mafw_source_get_metadata() calls
+ *                 in progress at once, or 0 for no limit.
+ * @timeout:       Milliseconds to wait for the results, or 0 to wait
+ *                 for all of them.
+ * @priority:      How urgent the request is.
+ * @token:         Optional #MafwSourceToken to cancel the request with.
+ * @partial_cb:    Optional function to call with the metadata of each
+ *                 object as it arrives.
+ * @metadatas_cb:  The function to call with the results.
+ * @user_data:     Optional user data pointer passed along with the
+ *                 callbacks.
+ *
+ * Like mafw_source_get_metadatas(), but with more control.  If the source
+ * doesn't implement get_metadatas, the metadata of the objects is asked
+ * one by one, keeping at most @max_in_flight requests in progress, each
+ * waiting for its turn according to @priority as with
+ * mafw_source_get_metadata_full().
+ * @partial_cb is called for each object with the arguments of
+ * #MafwSourceMetadataResultCb; if the source answers synchronously
+ * it can be called before this function returns.
+ *
+ * If the results don't arrive within @timeout, @metadatas_cb is called
+ * with the ones received so far and a
+ * %MAFW_EXTENSION_ERROR_EXTENSION_NOT_RESPONDING error, and no more
+ * callbacks are made.  It counts as one timeout of the source, see
+ * mafw_extension_get_timeout_count().  @metadatas_cb is called exactly once, and never
+ * before this function returns, unless @token is cancelled first.
+ *
+ * Once @token is cancelled no more callbacks are made, the objects not
+ * asked yet are not asked at all, and the pending get_metadata()s are
+ * cancelled as with mafw_source_get_metadata_full().  If the source
+ * implements get_metadatas, @token is its current token, see
+ * mafw_source_get_current_token().
+ */
+void mafw_source_get_metadatas_full(MafwSource *self,
+				    const gchar **object_ids,
+				    const gchar *const *metadata_keys,
+				    guint max_in_flight, guint timeout,
+				    MafwSourcePriority priority,
+				    MafwSourceToken *token,
+				    MafwSourceMetadataResultCb partial_cb,
+				    MafwSourceMetadataResultsCb metadatas_cb,
+				    gpointer user_data)
+{
+	struct metadatas_data *mdatas_data;
+	MafwSourceToken *prev;
+
+	g_return_if_fail(MAFW_IS_SOURCE(self));
+	g_return_if_fail(object_ids && object_ids[0]);
+	g_return_if_fail(metadatas_cb != NULL);
+	g_return_if_fail(priority < NPRIORITIES);
+
+	if (mafw_source_token_is_cancelled(token))
+		return;
+
+	mdatas_data = g_new0(struct metadatas_data, 1);
+	mdatas_data->cb = metadatas_cb;
+	mdatas_data->partial_cb = partial_cb;
+	mdatas_data->udata = user_data;
+	mdatas_data->self = g_object_ref(self);
+	mdatas_data->metadatas = g_hash_table_new_full(g_str_hash,
+					g_str_equal,
+					(GDestroyNotify)g_free,
+					(GDestroyNotify)mafw_metadata_release);
+	mdatas_data->object_ids = g_strdupv((gchar **)object_ids);
+	mdatas_data->keys = g_strdupv((gchar **)metadata_keys);
+	mdatas_data->nobjects = g_strv_length(mdatas_data->object_ids);
+	mdatas_data->remaining_count = mdatas_data->nobjects;
+	mdatas_data->max_in_flight = max_in_flight;
+	mdatas_data->priority = priority;
+	_mafw_extension_deadline_start(MAFW_EXTENSION(self),
+				       &mdatas_data->deadline, timeout,
+				       _deadline_passed);
+	if (token) {
+		mdatas_data->token = mafw_source_token_ref(token);
+		mdatas_data->handler = mafw_source_token_connect(token,
+					(MafwSourceTokenCancelledCb)
+					_metadatas_cancelled, mdatas_data);
+	}
 
-		for (i = 0; object_ids[i]; i++)
-		{
-			mdatas_data->remaining_count++;
-			mafw_source_get_metadata(self, object_ids[i],
-							metadata_keys,
-							(MafwSourceMetadataResultCb)_metadata_collector,
-							mdatas_data);
-		}
+	if (MAFW_SOURCE_GET_CLASS(self)->get_metadatas)
+	{
+		mdatas_data->native = TRUE;
+		mdatas_data->in_flight++;
+		prev = set_current_token(token);
+		MAFW_SOURCE_GET_CLASS(self)->get_metadatas(self,
+				(const gchar **)mdatas_data->object_ids,
+				metadata_keys,
+				(MafwSourceMetadataResultsCb)
+				_metadatas_collector,
+				mdatas_data);
+		set_current_token(prev);
 	}
+	else
+		_metadata_request_more(mdatas_data);
 }
 
 /**
@@ -651,6 +2804,14 @@ void mafw_source_set_metadata(MafwSource *self,
 				  MafwSourceMetadataSetCb cb,
 				  gpointer user_data)
 {
+	struct timed_op *op;
+
+	op = timed_op_new(self, cb, user_data, object_id,
+			  metadata_set_expired);
+	if (op) {
+		cb = (MafwSourceMetadataSetCb)metadata_set_timed;
+		user_data = GUINT_TO_POINTER(op->base.serial);
+	}
 	MAFW_SOURCE_GET_CLASS(self)->set_metadata(self,
 							 object_id,
 							 metadata,
@@ -679,6 +2840,13 @@ void mafw_source_create_object(MafwSource *self,
                                    MafwSourceObjectCreatedCb cb,
                                    gpointer user_data)
 {
+	struct timed_op *op;
+
+	op = timed_op_new(self, cb, user_data, NULL, object_expired);
+	if (op) {
+		cb = (MafwSourceObjectCreatedCb)object_timed;
+		user_data = GUINT_TO_POINTER(op->base.serial);
+	}
         MAFW_SOURCE_GET_CLASS(self)->create_object(self,
                                                           parent,
                                                           metadata,
@@ -707,12 +2875,124 @@ void mafw_source_destroy_object(MafwSource *self,
                                     MafwSourceObjectDestroyedCb cb,
                                     gpointer user_data)
 {
+	struct timed_op *op;
+
+	op = timed_op_new(self, cb, user_data, object_id, object_expired);
+	if (op) {
+		cb = (MafwSourceObjectDestroyedCb)object_timed;
+		user_data = GUINT_TO_POINTER(op->base.serial);
+	}
         MAFW_SOURCE_GET_CLASS(self)->destroy_object(self,
                                                            object_id,
                                                            cb,
                                                            user_data);
 }
 
+/**
+ * mafw_source_set_max_requests:
+ * @self:         A #MafwSource instance.
+ * @max_requests: The maximal number of requests in progress, or 0 for
+ *                no limit.
+ *
+ * Limits the number of get_metadata() and browse() calls of @self in
+ * progress at once.  Further requests wait in a queue per
+ * #MafwSourcePriority, and are started as the running ones finish.
+ * Interactive requests get most of the turns, but prefetch and
+ * background ones are not starved.  Browse sessions are in progress
+ * until their last result.  mafw_source_browse_chunked() and requests
+ * without a callback are not limited.  By default there's no limit.
+ */
+void mafw_source_set_max_requests(MafwSource *self, guint max_requests)
+{
+	struct scheduler *sched;
+
+	g_return_if_fail(MAFW_IS_SOURCE(self));
+
+	sched = scheduler(self, max_requests != 0);
+	if (!sched)
+		return;
+	sched->max_running = max_requests;
+	sched_dispatch(self, sched);
+}
+
+/**
+ * mafw_source_get_max_requests:
+ * @self: A #MafwSource instance.
+ *
+ * Returns: the limit set by mafw_source_set_max_requests().
+ */
+guint mafw_source_get_max_requests(MafwSource *self)
+{
+	struct scheduler *sched;
+
+	g_return_val_if_fail(MAFW_IS_SOURCE(self), 0);
+	sched = scheduler(self, FALSE);
+	return sched ? sched->max_running : 0;
+}
+
+/**
+ * mafw_source_set_metadatas_batch_size:
+ * @self:       A #MafwSource instance.
+ * @batch_size: The maximal number of objects in one request, or 0 for
+ *              #MAFW_SOURCE_METADATAS_BATCH_SIZE.
+ *
+ * Tells how many objects mafw_playlist_get_items_md() should ask from
+ * @self at once.  Smaller batches deliver the first results sooner,
+ * larger ones save on the overhead of the requests.
+ */
+void mafw_source_set_metadatas_batch_size(MafwSource *self, guint batch_size)
+{
+	g_return_if_fail(MAFW_IS_SOURCE(self));
+	g_object_set_data(G_OBJECT(self), "mafw-source-batch-size",
+			  GUINT_TO_POINTER(batch_size));
+}
+
+/**
+ * mafw_source_get_metadatas_batch_size:
+ * @self: A #MafwSource instance.
+ *
+ * Returns: the batch size set by mafw_source_set_metadatas_batch_size(),
+ * or #MAFW_SOURCE_METADATAS_BATCH_SIZE.
+ */
+guint mafw_source_get_metadatas_batch_size(MafwSource *self)
+{
+	guint batch_size;
+
+	g_return_val_if_fail(MAFW_IS_SOURCE(self),
+			     MAFW_SOURCE_METADATAS_BATCH_SIZE);
+	batch_size = GPOINTER_TO_UINT(g_object_get_data(G_OBJECT(self),
+						"mafw-source-batch-size"));
+	return batch_size ? batch_size : MAFW_SOURCE_METADATAS_BATCH_SIZE;
+}
+
+/**
+ * mafw_source_get_queue_stats:
+ * @self:     A #MafwSource instance.
+ * @priority: The priority class to query.
+ * @stats:    Where to store the statistics.
+ *
+ * Tells how many requests of @priority are waiting for their turn,
+ * see mafw_source_set_max_requests(), and how long the started ones
+ * have waited.
+ */
+void mafw_source_get_queue_stats(MafwSource *self,
+				 MafwSourcePriority priority,
+				 MafwSourceQueueStats *stats)
+{
+	struct scheduler *sched;
+
+	g_return_if_fail(MAFW_IS_SOURCE(self));
+	g_return_if_fail(priority < NPRIORITIES);
+	g_return_if_fail(stats != NULL);
+
+	if (!(sched = scheduler(self, FALSE))) {
+		memset(stats, 0, sizeof(*stats));
+		return;
+	}
+	*stats = sched->stats[priority];
+	stats->depth = g_queue_get_length(&sched->queues[priority]);
+}
+
 /**
  * mafw_source_split_objectid:
  * @objectid: An object id to split.
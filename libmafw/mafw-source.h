@@ -50,6 +50,32 @@ G_BEGIN_DECLS
 typedef struct _MafwSource MafwSource;
 typedef struct _MafwSourceClass MafwSourceClass;
 
+/**
+ * MafwSourceCursor:
+ *
+ * Opaque structure of a pull-based browse session, see
+ * mafw_source_cursor_new().
+ */
+typedef struct _MafwSourceCursor MafwSourceCursor;
+
+/**
+ * MafwSourceToken:
+ *
+ * Opaque, reference counted cancellation token of metadata requests,
+ * see mafw_source_token_new().
+ */
+typedef struct _MafwSourceToken MafwSourceToken;
+
+/**
+ * MafwSourceTokenCancelledCb:
+ * @token:     The token being cancelled.
+ * @user_data: The data given to mafw_source_token_connect().
+ *
+ * Called by mafw_source_token_cancel().
+ */
+typedef void (*MafwSourceTokenCancelledCb)(MafwSourceToken *token,
+					   gpointer user_data);
+
 /**
  * MAFW_SOURCE_KEY_WILDCARD:
  *
@@ -72,6 +98,62 @@ typedef struct _MafwSourceClass MafwSourceClass;
  */
 #define MAFW_SOURCE_BROWSE_ALL (0)
 
+/**
+ * MAFW_SOURCE_BROWSE_CHUNK_SIZE:
+ *
+ * The number of items mafw_source_browse_chunked() groups into one
+ * callback if the caller passes zero @chunk_size.
+ */
+#define MAFW_SOURCE_BROWSE_CHUNK_SIZE (64)
+
+/**
+ * MAFW_SOURCE_METADATAS_CONCURRENCY:
+ *
+ * The number of mafw_source_get_metadata() calls mafw_source_get_metadatas()
+ * keeps in progress at once if the source doesn't implement it.
+ */
+#define MAFW_SOURCE_METADATAS_CONCURRENCY (16)
+
+/**
+ * MAFW_SOURCE_METADATAS_BATCH_SIZE:
+ *
+ * The number of objects mafw_playlist_get_items_md() asks from a source
+ * in one mafw_source_get_metadatas() call, unless changed with
+ * mafw_source_set_metadatas_batch_size().
+ */
+#define MAFW_SOURCE_METADATAS_BATCH_SIZE (64)
+
+/**
+ * MafwSourcePriority:
+ * @MAFW_SOURCE_PRIORITY_INTERACTIVE: The user is waiting for the result.
+ * @MAFW_SOURCE_PRIORITY_PREFETCH:    The result will likely be needed soon.
+ * @MAFW_SOURCE_PRIORITY_BACKGROUND:  Bulk work, like indexing.
+ *
+ * Priority classes of the requests queued when the number of requests
+ * in progress is limited by mafw_source_set_max_requests().
+ */
+typedef enum {
+	MAFW_SOURCE_PRIORITY_INTERACTIVE,
+	MAFW_SOURCE_PRIORITY_PREFETCH,
+	MAFW_SOURCE_PRIORITY_BACKGROUND,
+} MafwSourcePriority;
+
+/**
+ * MafwSourceQueueStats:
+ * @depth:      The number of requests waiting.
+ * @started:    The number of requests started from the queue.
+ * @total_wait: Milliseconds the started requests waited altogether.
+ * @max_wait:   The longest wait in milliseconds.
+ *
+ * Statistics of a priority class, see mafw_source_get_queue_stats().
+ */
+typedef struct {
+	guint depth;
+	guint started;
+	guint64 total_wait;
+	guint max_wait;
+} MafwSourceQueueStats;
+
 extern const gchar * const _mafw_source_no_keys[];
  /**
  * MAFW_SOURCE_NO_KEYS:
@@ -194,6 +276,66 @@ typedef void (*MafwSourceBrowseResultCb)(MafwSource *self,
 					  gpointer user_data,
 					  const GError *error);
 
+/**
+ * MafwSourceBrowseChunkCb:
+ * @self:      The emitting #MafwSource.
+ * @browse_id: The browse session ID that these results are associated to.
+ * @remaining_count: Number of remaining results after this chunk.
+ * @index:     The index of the first item of the chunk in the browse session.
+ * @object_ids: %NULL-terminated array of the object IDs of the items.
+ * @metadatas: Metadata of the items, in the same order as @object_ids.
+ *             Elements can be %NULL, like @metadata of
+ *             #MafwSourceBrowseResultCb.
+ * @nitems:    The number of items in the chunk.
+ * @user_data: Optional user data pointer passed to
+ *             mafw_source_browse_chunked().
+ * @error:     Non-%NULL if an error occurred.
+ *
+ * Callback prototype for mafw_source_browse_chunked().  It's the same as
+ * #MafwSourceBrowseResultCb, except that it's called with up to the
+ * requested number of items at once.  @remaining_count and @index apply
+ * to the chunk as a whole, so a session ends with exactly one callback
+ * with zero @remaining_count, which may carry the last items or may be
+ * empty (@nitems is zero).  If @error is set the chunk may still contain
+ * the items received before the error.  @object_ids and @metadatas are
+ * destroyed after the callback returns.
+ */
+typedef void (*MafwSourceBrowseChunkCb)(MafwSource *self,
+					 guint browse_id,
+					 gint remaining_count,
+					 guint index,
+					 const gchar *const *object_ids,
+					 GHashTable **metadatas,
+					 guint nitems,
+					 gpointer user_data,
+					 const GError *error);
+
+/**
+ * MafwSourceCursorFetchCb:
+ * @cursor:     The #MafwSourceCursor the results belong to.
+ * @index:      The index of the first item in the whole browse.
+ * @object_ids: %NULL-terminated array of the object IDs of the items.
+ * @metadatas:  Metadata of the items, in the same order as @object_ids.
+ * @nitems:     The number of items fetched.
+ * @finished:   %TRUE if there are no more items to fetch.
+ * @user_data:  Optional user data pointer passed to
+ *              mafw_source_cursor_fetch().
+ * @error:      Non-%NULL if an error occurred.
+ *
+ * Callback prototype for mafw_source_cursor_fetch(), called exactly once
+ * per fetch with at most the requested number of items.  It may fetch
+ * more or free @cursor.  @object_ids and @metadatas are destroyed after
+ * the callback returns.
+ */
+typedef void (*MafwSourceCursorFetchCb)(MafwSourceCursor *cursor,
+					 guint index,
+					 const gchar *const *object_ids,
+					 GHashTable **metadatas,
+					 guint nitems,
+					 gboolean finished,
+					 gpointer user_data,
+					 const GError *error);
+
 /**
  * MafwSourceMetadataResultCb:
  * @self:      The emitting #MafwSource.
@@ -311,6 +453,24 @@ struct _MafwSource {
  * @set_metadata:   Virtual function for mafw_source_set_metadata().
  * @create_object:  Virtual function for mafw_source_create_object().
  * @destroy_object: Virtual function for mafw_source_destroy_object().
+ * @browse_chunked: Virtual function for mafw_source_browse_chunked().
+ *                  The default groups the results of @browse.
+ * @cursor_new:     Optional virtual function for mafw_source_cursor_new(),
+ *                  returning the state of a pull-based browse session.
+ *                  Without it each mafw_source_cursor_fetch() is a new
+ *                  @browse_chunked skipping the items fetched before.
+ * @cursor_fetch:   Browses the next @count items of a @cursor_new
+ *                  session, passing them to @cb like @browse_chunked,
+ *                  with %MAFW_SOURCE_INVALID_BROWSE_ID.  Fewer items
+ *                  than asked mean the end of the session.
+ * @cursor_free:    Frees a @cursor_new session.  A fetch in progress is
+ *                  cancelled and must not call back any more.
+ * @threaded_get_metadata: If set, @get_metadata is called in a pool of
+ *                  worker threads shared by all sources, and its result
+ *                  is passed to the caller from the main loop.  Such
+ *                  @get_metadata may block, but it must be thread-safe
+ *                  and call the callback before returning, or defer it
+ *                  with mafw_callbas_defer().
  *
  * Base class for MAFW source components.
  */
@@ -362,6 +522,28 @@ struct _MafwSourceClass {
 				   const gchar *object_id,
 				   MafwSourceObjectDestroyedCb cb,
 				   gpointer user_data);
+
+	guint (*browse_chunked)(MafwSource *self,
+				const gchar *object_id, gboolean recursive,
+				const MafwFilter *filter,
+				const gchar *sort_criteria,
+				const gchar *const *mdkeys,
+				guint skip_count, guint item_count,
+				guint chunk_size,
+				MafwSourceBrowseChunkCb cb, gpointer user_data);
+
+	gboolean threaded_get_metadata;
+
+	gpointer (*cursor_new)(MafwSource *self,
+			       const gchar *object_id, gboolean recursive,
+			       const MafwFilter *filter,
+			       const gchar *sort_criteria,
+			       const gchar *const *mdkeys);
+
+	void (*cursor_fetch)(MafwSource *self, gpointer cursor, guint count,
+			     MafwSourceBrowseChunkCb cb, gpointer user_data);
+
+	void (*cursor_free)(MafwSource *self, gpointer cursor);
 };
 
 extern GType mafw_source_get_type(void);
@@ -376,6 +558,39 @@ extern guint mafw_source_browse(MafwSource *self,
 				MafwSourceBrowseResultCb browse_cb,
 				gpointer user_data);
 
+extern guint mafw_source_browse_full(MafwSource *self,
+				     const gchar *object_id,
+				     gboolean recursive, const MafwFilter *filter,
+				     const gchar *sort_criteria,
+				     const gchar *const *metadata_keys,
+				     guint skip_count, guint item_count,
+				     MafwSourcePriority priority,
+				     MafwSourceBrowseResultCb browse_cb,
+				     gpointer user_data);
+
+extern guint mafw_source_browse_chunked(MafwSource *self,
+					const gchar *object_id,
+					gboolean recursive,
+					const MafwFilter *filter,
+					const gchar *sort_criteria,
+					const gchar *const *metadata_keys,
+					guint skip_count, guint item_count,
+					guint chunk_size,
+					MafwSourceBrowseChunkCb chunk_cb,
+					gpointer user_data);
+
+extern MafwSourceCursor *mafw_source_cursor_new(MafwSource *self,
+					const gchar *object_id,
+					gboolean recursive,
+					const MafwFilter *filter,
+					const gchar *sort_criteria,
+					const gchar *const *metadata_keys);
+extern void mafw_source_cursor_fetch(MafwSourceCursor *cursor, guint count,
+				     MafwSourceCursorFetchCb fetch_cb,
+				     gpointer user_data);
+extern guint mafw_source_cursor_get_position(MafwSourceCursor *cursor);
+extern void mafw_source_cursor_free(MafwSourceCursor *cursor);
+
 extern gboolean mafw_source_cancel_browse(MafwSource *self, guint browse_id,
 					  GError **error);
 
@@ -390,12 +605,30 @@ extern void mafw_source_get_metadata(MafwSource *self,
 					 MafwSourceMetadataResultCb metadata_cb,
 					 gpointer user_data);
 
+extern void mafw_source_get_metadata_full(MafwSource *self,
+					  const gchar *object_id,
+					  const gchar *const *metadata_keys,
+					  MafwSourcePriority priority,
+					  MafwSourceToken *token,
+					  MafwSourceMetadataResultCb metadata_cb,
+					  gpointer user_data);
+
 extern void mafw_source_get_metadatas(MafwSource *self,
 					 const gchar **object_ids,
 					 const gchar *const *metadata_keys,
 					 MafwSourceMetadataResultsCb metadatas_cb,
 					 gpointer user_data);
 
+extern void mafw_source_get_metadatas_full(MafwSource *self,
+					   const gchar **object_ids,
+					   const gchar *const *metadata_keys,
+					   guint max_in_flight, guint timeout,
+					   MafwSourcePriority priority,
+					   MafwSourceToken *token,
+					   MafwSourceMetadataResultCb partial_cb,
+					   MafwSourceMetadataResultsCb metadatas_cb,
+					   gpointer user_data);
+
 extern void mafw_source_set_metadata(MafwSource *self,
 					 const gchar *object_id,
 					 GHashTable *metadata,
@@ -413,6 +646,28 @@ extern void mafw_source_destroy_object(MafwSource *self,
 					   MafwSourceObjectDestroyedCb cb,
 					   gpointer user_data);
 
+extern void mafw_source_set_max_requests(MafwSource *self,
+					 guint max_requests);
+extern guint mafw_source_get_max_requests(MafwSource *self);
+extern void mafw_source_set_metadatas_batch_size(MafwSource *self,
+						 guint batch_size);
+extern guint mafw_source_get_metadatas_batch_size(MafwSource *self);
+extern void mafw_source_get_queue_stats(MafwSource *self,
+					MafwSourcePriority priority,
+					MafwSourceQueueStats *stats);
+
+extern MafwSourceToken *mafw_source_token_new(void);
+extern MafwSourceToken *mafw_source_token_ref(MafwSourceToken *token);
+extern void mafw_source_token_unref(MafwSourceToken *token);
+extern void mafw_source_token_cancel(MafwSourceToken *token);
+extern gboolean mafw_source_token_is_cancelled(MafwSourceToken *token);
+extern gulong mafw_source_token_connect(MafwSourceToken *token,
+					MafwSourceTokenCancelledCb cb,
+					gpointer user_data);
+extern void mafw_source_token_disconnect(MafwSourceToken *token,
+					 gulong handler_id);
+extern MafwSourceToken *mafw_source_get_current_token(void);
+
 extern gboolean mafw_source_split_objectid(gchar const *objectid,
 					   gchar **extensionid, gchar **itemid);
 extern gchar *mafw_source_create_objectid(const gchar *uri);
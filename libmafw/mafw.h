@@ -29,13 +29,17 @@
 #include <libmafw/mafw-property.h>
 #include <libmafw/mafw-registry.h>
 #include <libmafw/mafw-playlist.h>
+#include <libmafw/mafw-playlist-view.h>
 #include <libmafw/mafw-source.h>
 #include <libmafw/mafw-metadata.h>
+#include <libmafw/mafw-metadata-sort.h>
 #include <libmafw/mafw-filter.h>
+#include <libmafw/mafw-catalogue.h>
 #include <libmafw/mafw-renderer.h>
 #include <libmafw/mafw-errors.h>
 #include <libmafw/mafw-log.h>
 #include <libmafw/mafw-uri-source.h>
+#include <libmafw/mafw-caching-source.h>
 
 #endif
 
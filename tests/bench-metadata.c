@@ -0,0 +1,140 @@
+/*
+ * This file is a part of MAFW
+ *
+ * Copyright (C) 2007, 2008, 2009 Nokia Corporation, all rights reserved.
+ *
+ * Contact: Visa Smolander <visa.smolander@nokia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+/*
+ * Microbenchmark of building and reading metadata tables the way sources
+ * do, with the variadic mafw_metadata_add_*() and mafw_metadata_first()
+ * versus the typed setters and getters.
+ *
+ * Usage: bench-metadata [iterations]
+ */
+#include <stdlib.h>
+#include <libmafw/mafw.h>
+
+#define DEFAULT_ITERATIONS 200000
+
+/* Keeps the compiler from optimizing the lookups away. */
+static volatile gint64 Sink;
+
+static void bench_generic(guint iterations)
+{
+	GHashTable *md;
+	guint i;
+
+	md = mafw_metadata_new();
+	for (i = 0; i < iterations; i++) {
+		GValue *v;
+
+		mafw_metadata_add_int(md, MAFW_METADATA_KEY_DURATION, i);
+		mafw_metadata_add_int64(md, MAFW_METADATA_KEY_FILESIZE,
+					(gint64)i);
+		mafw_metadata_add_str(md, MAFW_METADATA_KEY_TITLE, "Title");
+
+		v = mafw_metadata_first(md, MAFW_METADATA_KEY_DURATION);
+		Sink += g_value_get_int(v);
+		v = mafw_metadata_first(md, MAFW_METADATA_KEY_FILESIZE);
+		Sink += g_value_get_int64(v);
+		v = mafw_metadata_first(md, MAFW_METADATA_KEY_TITLE);
+		Sink += *g_value_get_string(v);
+
+		/* Start over like a new browse result would. */
+		g_hash_table_remove_all(md);
+	}
+	mafw_metadata_release(md);
+}
+
+static void bench_typed(guint iterations)
+{
+	GHashTable *md;
+	guint i;
+
+	md = mafw_metadata_new();
+	for (i = 0; i < iterations; i++) {
+		mafw_metadata_set_int(md, MAFW_METADATA_KEY_DURATION, i);
+		mafw_metadata_set_int64(md, MAFW_METADATA_KEY_FILESIZE,
+					(gint64)i);
+		mafw_metadata_set_str(md, MAFW_METADATA_KEY_TITLE, "Title");
+
+		Sink += mafw_metadata_get_int(md, MAFW_METADATA_KEY_DURATION,
+					      0);
+		Sink += mafw_metadata_get_int64(md, MAFW_METADATA_KEY_FILESIZE,
+						0);
+		Sink += *mafw_metadata_get_str(md, MAFW_METADATA_KEY_TITLE);
+
+		g_hash_table_remove_all(md);
+	}
+	mafw_metadata_release(md);
+}
+
+/* Like bench_typed() but reusing the table, which lets the setters
+ * overwrite the values in place. */
+static void bench_typed_reuse(guint iterations)
+{
+	GHashTable *md;
+	guint i;
+
+	md = mafw_metadata_new();
+	for (i = 0; i < iterations; i++) {
+		mafw_metadata_set_int(md, MAFW_METADATA_KEY_DURATION, i);
+		mafw_metadata_set_int64(md, MAFW_METADATA_KEY_FILESIZE,
+					(gint64)i);
+		mafw_metadata_set_str(md, MAFW_METADATA_KEY_TITLE, "Title");
+
+		Sink += mafw_metadata_get_int(md, MAFW_METADATA_KEY_DURATION,
+					      0);
+		Sink += mafw_metadata_get_int64(md, MAFW_METADATA_KEY_FILESIZE,
+						0);
+		Sink += *mafw_metadata_get_str(md, MAFW_METADATA_KEY_TITLE);
+	}
+	mafw_metadata_release(md);
+}
+
+static void run(const gchar *name, void (*bench)(guint), guint iterations)
+{
+	GTimer *timer;
+	gdouble secs;
+
+	timer = g_timer_new();
+	bench(iterations);
+	secs = g_timer_elapsed(timer, NULL);
+	g_timer_destroy(timer);
+	g_print("%-24s %8.3f s %10.1f ns/iteration\n", name, secs,
+		secs * 1e9 / iterations);
+}
+
+int main(int argc, char *argv[])
+{
+	guint iterations;
+
+	iterations = argc > 1 ? strtoul(argv[1], NULL, 0) : 0;
+	if (!iterations)
+		iterations = DEFAULT_ITERATIONS;
+
+	g_type_init();
+	run("add + first", bench_generic, iterations);
+	run("set + get", bench_typed, iterations);
+	run("set + get, reused table", bench_typed_reuse, iterations);
+	return 0;
+}
+
+/* vi: set noexpandtab ts=8 sw=8 cino=t0,(0: */
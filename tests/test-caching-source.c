@@ -0,0 +1,475 @@
+/*
+ * This file is a part of MAFW
+ *
+ * Copyright (C) 2007, 2008, 2009 Nokia Corporation, all rights reserved.
+ *
+ * Contact: Visa Smolander <visa.smolander@nokia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "checkmore.h"
+#include <libmafw/mafw.h>
+
+
+/* A source which answers get_metadata() synchronously with the
+ * requested keys set to the object ID.  $Csrc_calls counts the
+ * requests.  If $Csrc_hold is set, the request is kept in $Held instead,
+ * along with its current token.  Browse sessions never return any
+ * results. */
+static GType csrc_get_type(void);
+typedef struct { MafwSourceClass parent; } CsrcClass;
+typedef struct { MafwSource parent; } Csrc;
+G_DEFINE_TYPE(Csrc, csrc, MAFW_TYPE_SOURCE);
+
+static guint Csrc_calls;
+static gboolean Csrc_hold;
+static struct {
+	MafwSource *self;
+	MafwSourceToken *token;
+	gchar *object_id;
+	MafwSourceMetadataResultCb cb;
+	gpointer user_data;
+} Held;
+
+static void csrc_get_metadata(MafwSource *self, const gchar *object_id,
+			      const gchar *const *mdkeys,
+			      MafwSourceMetadataResultCb cb,
+			      gpointer user_data)
+{
+	GHashTable *md;
+	guint i;
+
+	Csrc_calls++;
+	if (Csrc_hold) {
+		fail_if(Held.cb != NULL);
+		Held.token = mafw_source_get_current_token();
+		if (Held.token)
+			mafw_source_token_ref(Held.token);
+		Held.self = self;
+		Held.object_id = g_strdup(object_id);
+		Held.cb = cb;
+		Held.user_data = user_data;
+		return;
+	}
+	md = mafw_metadata_new();
+	for (i = 0; mdkeys[i]; i++)
+		mafw_metadata_add_str(md, mdkeys[i], object_id);
+	cb(self, object_id, md, user_data, NULL);
+	mafw_metadata_release(md);
+}
+
+static guint csrc_browse(MafwSource *self, const gchar *object_id,
+			 gboolean recursive, const MafwFilter *filter,
+			 const gchar *sort_criteria,
+			 const gchar *const *mdkeys,
+			 guint skip_count, guint item_count,
+			 MafwSourceBrowseResultCb cb, gpointer user_data)
+{
+	return 1;
+}
+
+static gboolean csrc_cancel_browse(MafwSource *self, guint browse_id,
+				   GError **error)
+{
+	return TRUE;
+}
+
+static void csrc_class_init(CsrcClass *x)
+{
+	MAFW_SOURCE_CLASS(x)->get_metadata = csrc_get_metadata;
+	MAFW_SOURCE_CLASS(x)->browse = csrc_browse;
+	MAFW_SOURCE_CLASS(x)->cancel_browse = csrc_cancel_browse;
+}
+
+static void csrc_init(Csrc *y)
+{
+	mafw_extension_add_property(MAFW_EXTENSION(y), "testp", G_TYPE_DOUBLE);
+}
+
+/* Helpers */
+static MafwSource *new_csrc(void)
+{
+	/* The wrapper sinks floating references. */
+	return g_object_ref_sink(g_object_new(csrc_get_type(),
+					      "uuid", "csrc", NULL));
+}
+
+static void metadata_cb(MafwSource *self, const gchar *object_id,
+			GHashTable *metadata, gchar **title,
+			const GError *error)
+{
+	fail_if(error != NULL);
+	fail_if(!MAFW_IS_CACHING_SOURCE(self));
+	*title = g_strdup(mafw_metadata_get_str(metadata,
+						MAFW_METADATA_KEY_TITLE));
+}
+
+/* Returns whether $object_id's title was right and checks
+ * the number of requests reaching the wrapped source. */
+static gboolean title_of(MafwSource *src, const gchar *object_id,
+			 const gchar *const *keys, guint calls)
+{
+	gchar *title;
+	gboolean ok;
+
+	title = NULL;
+	mafw_source_get_metadata(src, object_id, keys,
+				 (gpointer)metadata_cb, &title);
+	while (!title)
+		g_main_context_iteration(NULL, TRUE);
+	ok = !strcmp(title, object_id) && Csrc_calls == calls;
+	g_free(title);
+	return ok;
+}
+
+static void property_cb(MafwExtension *self, const gchar *name,
+			GValue *value, guint *count, const GError *error)
+{
+	fail_if(error != NULL);
+	*count = g_value_get_uint(value);
+}
+
+static guint get_uint(MafwSource *src, const gchar *name)
+{
+	guint count;
+
+	count = ~0;
+	mafw_extension_get_property(MAFW_EXTENSION(src), name,
+				    (gpointer)property_cb, &count);
+	fail_if(count == ~0);
+	return count;
+}
+
+static void changed_cb(MafwSource *self, const gchar *object_id,
+		       guint *count)
+{
+	(*count)++;
+}
+
+static void metadatas_cb(MafwSource *self, GHashTable *metadatas,
+			 GHashTable **result, const GError *error)
+{
+	fail_if(error != NULL);
+	*result = g_hash_table_ref(metadatas);
+}
+
+/* Checks that the held request was cancelled and answers it. */
+static void answer_held(void)
+{
+	fail_if(Held.cb == NULL);
+	fail_if(Held.token == NULL);
+	fail_unless(mafw_source_token_is_cancelled(Held.token));
+	Held.cb(Held.self, Held.object_id, NULL, Held.user_data, NULL);
+	mafw_source_token_unref(Held.token);
+	g_free(Held.object_id);
+	memset(&Held, 0, sizeof(Held));
+}
+
+static void browse_cb(MafwSource *self, guint browse_id, gint remaining,
+		      guint index, gconstpointer results, gconstpointer extra,
+		      gpointer user_data, const GError *error)
+{
+	fail("Result of a browse session which returns none");
+}
+
+/* Test cases */
+START_TEST(test_hits)
+{
+	MafwSource *csrc, *src;
+	GValue v = { 0 };
+
+	Csrc_calls = 0;
+	csrc = new_csrc();
+	src = mafw_caching_source_new(csrc,
+				      MAFW_CACHING_SOURCE_DEFAULT_BUDGET,
+				      MAFW_CACHING_SOURCE_DEFAULT_TTL);
+	fail_if(strcmp(mafw_extension_get_uuid(MAFW_EXTENSION(src)), "csrc"));
+	fail_if(mafw_caching_source_get_wrapped(MAFW_CACHING_SOURCE(src))
+		!= csrc);
+
+	/* The order and duplicates of the keys don't matter. */
+	fail_unless(title_of(src, "csrc::a",
+			     MAFW_SOURCE_LIST(MAFW_METADATA_KEY_TITLE,
+					      MAFW_METADATA_KEY_URI), 1));
+	fail_unless(title_of(src, "csrc::a",
+			     MAFW_SOURCE_LIST(MAFW_METADATA_KEY_URI,
+					      MAFW_METADATA_KEY_TITLE,
+					      MAFW_METADATA_KEY_URI), 1));
+	fail_unless(title_of(src, "csrc::a",
+			     MAFW_SOURCE_LIST(MAFW_METADATA_KEY_TITLE), 2));
+	fail_unless(title_of(src, "csrc::b",
+			     MAFW_SOURCE_LIST(MAFW_METADATA_KEY_TITLE), 3));
+	fail_unless(title_of(src, "csrc::b",
+			     MAFW_SOURCE_LIST(MAFW_METADATA_KEY_TITLE), 3));
+	fail_if(get_uint(src, MAFW_PROPERTY_CACHE_HITS) != 2);
+	fail_if(get_uint(src, MAFW_PROPERTY_CACHE_MISSES) != 3);
+
+	/* The properties of the wrapped source are there too. */
+	fail_if(mafw_extension_list_properties(MAFW_EXTENSION(src))->len != 5);
+
+	/* Zero budget disables caching. */
+	g_value_init(&v, G_TYPE_ULONG);
+	g_value_set_ulong(&v, 0);
+	fail_unless(mafw_extension_set_property(MAFW_EXTENSION(src),
+						MAFW_PROPERTY_CACHE_BUDGET,
+						&v));
+	fail_unless(title_of(src, "csrc::b",
+			     MAFW_SOURCE_LIST(MAFW_METADATA_KEY_TITLE), 4));
+	fail_unless(title_of(src, "csrc::b",
+			     MAFW_SOURCE_LIST(MAFW_METADATA_KEY_TITLE), 5));
+
+	g_object_unref(src);
+	g_object_unref(csrc);
+}
+END_TEST
+
+START_TEST(test_invalidation)
+{
+	MafwSource *csrc, *src;
+	const gchar *const *keys;
+	guint nchanged;
+
+	Csrc_calls = 0;
+	csrc = new_csrc();
+	src = mafw_caching_source_new(csrc,
+				      MAFW_CACHING_SOURCE_DEFAULT_BUDGET, 0);
+	nchanged = 0;
+	g_signal_connect(src, "metadata-changed",
+			 G_CALLBACK(changed_cb), &nchanged);
+	g_signal_connect(src, "container-changed",
+			 G_CALLBACK(changed_cb), &nchanged);
+
+	keys = MAFW_SOURCE_LIST(MAFW_METADATA_KEY_TITLE);
+	fail_unless(title_of(src, "csrc::a", keys, 1));
+	fail_unless(title_of(src, "csrc::b", keys, 2));
+
+	/* Only the changed object is dropped. */
+	g_signal_emit_by_name(csrc, "metadata-changed", "csrc::a");
+	fail_if(nchanged != 1);
+	fail_unless(title_of(src, "csrc::b", keys, 2));
+	fail_unless(title_of(src, "csrc::a", keys, 3));
+	fail_unless(title_of(src, "csrc::a", keys, 3));
+
+	/* Everything is dropped. */
+	g_signal_emit_by_name(csrc, "container-changed", "csrc::");
+	fail_if(nchanged != 2);
+	fail_unless(title_of(src, "csrc::a", keys, 4));
+	fail_unless(title_of(src, "csrc::b", keys, 5));
+
+	mafw_caching_source_invalidate(MAFW_CACHING_SOURCE(src), "csrc::b");
+	fail_unless(title_of(src, "csrc::a", keys, 5));
+	fail_unless(title_of(src, "csrc::b", keys, 6));
+
+	g_object_unref(src);
+	g_object_unref(csrc);
+}
+END_TEST
+
+START_TEST(test_budget_ttl)
+{
+	MafwSource *csrc, *src;
+	const gchar *const *keys;
+	GHashTable *md;
+	gsize budget;
+
+	/* Make room for two entries. */
+	keys = MAFW_SOURCE_LIST(MAFW_METADATA_KEY_TITLE);
+	md = mafw_metadata_new();
+	mafw_metadata_add_str(md, MAFW_METADATA_KEY_TITLE, "csrc::a");
+	budget = 2 * (mafw_metadata_size(md) + 128);
+	mafw_metadata_release(md);
+
+	Csrc_calls = 0;
+	csrc = new_csrc();
+	src = mafw_caching_source_new(csrc, budget, 1);
+
+	/* The least recently used one is evicted. */
+	fail_unless(title_of(src, "csrc::a", keys, 1));
+	fail_unless(title_of(src, "csrc::b", keys, 2));
+	fail_unless(title_of(src, "csrc::a", keys, 2));
+	fail_unless(title_of(src, "csrc::c", keys, 3));
+	fail_unless(title_of(src, "csrc::a", keys, 3));
+	fail_unless(title_of(src, "csrc::b", keys, 4));
+
+	/* They expire. */
+	fail_unless(title_of(src, "csrc::b", keys, 4));
+	g_usleep(1100000);
+	fail_unless(title_of(src, "csrc::b", keys, 5));
+
+	g_object_unref(src);
+	g_object_unref(csrc);
+}
+END_TEST
+
+START_TEST(test_metadatas)
+{
+	MafwSource *csrc, *src;
+	const gchar *const *keys;
+	GHashTable *result;
+
+	Csrc_calls = 0;
+	csrc = new_csrc();
+	src = mafw_caching_source_new(csrc,
+				      MAFW_CACHING_SOURCE_DEFAULT_BUDGET, 0);
+	keys = MAFW_SOURCE_LIST(MAFW_METADATA_KEY_TITLE);
+	fail_unless(title_of(src, "csrc::a", keys, 1));
+
+	/* Only the missing ones are asked from the wrapped source. */
+	result = NULL;
+	mafw_source_get_metadatas(src,
+				  (const gchar **)MAFW_SOURCE_LIST("csrc::a",
+								   "csrc::b"),
+				  keys, (gpointer)metadatas_cb, &result);
+	while (!result)
+		g_main_context_iteration(NULL, TRUE);
+	fail_if(Csrc_calls != 2);
+	fail_if(g_hash_table_size(result) != 2);
+	fail_if(strcmp(mafw_metadata_get_str(g_hash_table_lookup(result,
+								 "csrc::b"),
+					     MAFW_METADATA_KEY_TITLE),
+		       "csrc::b"));
+	g_hash_table_unref(result);
+
+	/* All of them are cached now. */
+	result = NULL;
+	mafw_source_get_metadatas(src,
+				  (const gchar **)MAFW_SOURCE_LIST("csrc::b",
+								   "csrc::a"),
+				  keys, (gpointer)metadatas_cb, &result);
+	while (!result)
+		g_main_context_iteration(NULL, TRUE);
+	fail_if(Csrc_calls != 2);
+	fail_if(g_hash_table_size(result) != 2);
+	g_hash_table_unref(result);
+	fail_if(get_uint(src, MAFW_PROPERTY_CACHE_HITS) != 3);
+	fail_if(get_uint(src, MAFW_PROPERTY_CACHE_MISSES) != 2);
+
+	g_object_unref(src);
+	g_object_unref(csrc);
+}
+END_TEST
+
+START_TEST(test_cancel)
+{
+	MafwSource *csrc, *src;
+	gpointer alive;
+	guint browse_id;
+
+	csrc = new_csrc();
+	src = mafw_caching_source_new(csrc,
+				      MAFW_CACHING_SOURCE_DEFAULT_BUDGET, 0);
+	alive = src;
+	g_object_add_weak_pointer(G_OBJECT(src), &alive);
+
+	/* Cancelled sessions don't keep the wrapper alive. */
+	browse_id = mafw_source_browse(src, "csrc::", FALSE, NULL, NULL,
+				       NULL, 0, 10,
+				       (gpointer)browse_cb, NULL);
+	fail_if(browse_id == MAFW_SOURCE_INVALID_BROWSE_ID);
+	fail_unless(mafw_source_cancel_browse(src, browse_id, NULL));
+	browse_id = mafw_source_browse_chunked(src, "csrc::", FALSE, NULL,
+					       NULL, NULL, 0, 10, 5,
+					       (gpointer)browse_cb, NULL);
+	fail_if(browse_id == MAFW_SOURCE_INVALID_BROWSE_ID);
+	fail_unless(mafw_source_cancel_browse(src, browse_id, NULL));
+
+	g_object_unref(src);
+	fail_if(alive != NULL);
+	g_object_unref(csrc);
+}
+END_TEST
+
+static void never_cb(MafwSource *self, gconstpointer object_id,
+		     gconstpointer metadata, gpointer user_data,
+		     const GError *error)
+{
+	fail("Callback of a cancelled request");
+}
+
+START_TEST(test_cancel_metadata)
+{
+	MafwSource *csrc, *src;
+	MafwSourceToken *token;
+	const gchar *const *keys;
+	gpointer alive;
+
+	Csrc_calls = 0;
+	csrc = new_csrc();
+	src = mafw_caching_source_new(csrc,
+				      MAFW_CACHING_SOURCE_DEFAULT_BUDGET, 0);
+	alive = src;
+	g_object_add_weak_pointer(G_OBJECT(src), &alive);
+	keys = MAFW_SOURCE_LIST(MAFW_METADATA_KEY_TITLE);
+	Csrc_hold = TRUE;
+
+	/* The wrapped source sees the cancellation, and the
+	 * wrapper answers for it. */
+	token = mafw_source_token_new();
+	mafw_source_get_metadata_full(src, "csrc::a", keys,
+				      MAFW_SOURCE_PRIORITY_INTERACTIVE,
+				      token, (gpointer)never_cb, NULL);
+	fail_if(Held.token == NULL);
+	fail_if(mafw_source_token_is_cancelled(Held.token));
+	mafw_source_token_cancel(token);
+	mafw_source_token_unref(token);
+	answer_held();
+	checkmore_spin_loop(50);
+
+	/* Likewise for the missing objects of get_metadatas(). */
+	token = mafw_source_token_new();
+	mafw_source_get_metadatas_full(src, (const gchar **)
+				       MAFW_SOURCE_LIST("csrc::b"), keys,
+				       0, 0, MAFW_SOURCE_PRIORITY_INTERACTIVE,
+				       token, NULL, (gpointer)never_cb, NULL);
+	fail_if(Held.token == NULL);
+	mafw_source_token_cancel(token);
+	mafw_source_token_unref(token);
+	answer_held();
+	checkmore_spin_loop(50);
+	Csrc_hold = FALSE;
+	fail_if(Csrc_calls != 2);
+
+	/* The requests don't keep the wrapper alive. */
+	g_object_unref(src);
+	fail_if(alive != NULL);
+	g_object_unref(csrc);
+}
+END_TEST
+
+int main(void)
+{
+	TCase *tc;
+	Suite *suite;
+
+	suite = suite_create("MafwCachingSource");
+	tc = tcase_create("Caching");
+	suite_add_tcase(suite, tc);
+
+	if (1) tcase_add_test(tc, test_hits);
+	if (1) tcase_add_test(tc, test_invalidation);
+	if (1) tcase_add_test(tc, test_budget_ttl);
+	if (1) tcase_add_test(tc, test_metadatas);
+	if (1) tcase_add_test(tc, test_cancel);
+	if (1) tcase_add_test(tc, test_cancel_metadata);
+
+	return checkmore_run(srunner_create(suite), FALSE);
+}
@@ -0,0 +1,296 @@
+/*
+ * This file is a part of MAFW
+ *
+ * Copyright (C) 2007, 2008, 2009 Nokia Corporation, all rights reserved.
+ *
+ * Contact: Visa Smolander <visa.smolander@nokia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "checkmore.h"
+#include <libmafw/mafw-catalogue.h>
+#include <libmafw/mafw-metadata.h>
+#include <libmafw/mafw-filter.h>
+
+/* Helpers {{{ */
+static const gchar *const Artists[] = {
+	"Belga", "Betlehem", "Kispál", "KISPÁL", "Quimby", "Zorán",
+};
+
+/* Fills a catalogue with $n objects and returns the same metadata
+ * in $mds for reference. */
+static MafwCatalogue *populate(GHashTable **mds, guint n)
+{
+	MafwCatalogue *cat;
+	guint i;
+
+	cat = mafw_catalogue_new();
+	for (i = 0; i < n; i++) {
+		gchar *oid, *title;
+
+		mds[i] = mafw_metadata_new();
+		if (i % 11)
+			mafw_metadata_add_str(mds[i], "artist",
+					      Artists[i % G_N_ELEMENTS(Artists)]);
+		title = g_strdup_printf("Track %03u", i);
+		mafw_metadata_add_str(mds[i], "title", title);
+		g_free(title);
+		mafw_metadata_add_int(mds[i], "year", 1980 + i % 30);
+		if (i % 4 == 0)
+			mafw_metadata_add_int(mds[i], "track", i % 4, i % 7);
+		/* Mixed types: not indexed but must work. */
+		if (i % 3 == 0)
+			mafw_metadata_add_int(mds[i], "misc", i);
+		else
+			mafw_metadata_add_str(mds[i], "misc", "x");
+
+		oid = g_strdup_printf("oid::%u", i);
+		mafw_catalogue_add(cat, oid, mds[i]);
+		g_free(oid);
+	}
+	return cat;
+}
+
+/* Checks that querying $cat with $filter_str returns the same objects
+ * as filtering $mds one by one. */
+static void check_query(MafwCatalogue *cat, GHashTable **mds, guint n,
+			const gchar *filter_str)
+{
+	MafwFilter *filter;
+	GPtrArray *ret;
+	guint i, j, total;
+
+	filter = mafw_filter_parse(filter_str);
+	fail_if(!filter, "cannot parse %s", filter_str);
+	ret = mafw_catalogue_query(cat, filter, NULL, 0, 0, &total);
+	fail_if(ret->len != total);
+
+	for (i = j = 0; i < n; i++) {
+		gchar *oid;
+
+		if (!mds[i] || !mafw_metadata_filter(mds[i], filter, NULL))
+			continue;
+		oid = g_strdup_printf("oid::%u", i);
+		fail_if(j >= ret->len, "%s: %s missing", filter_str, oid);
+		fail_if(strcmp(g_ptr_array_index(ret, j), oid),
+			"%s: %s instead of %s", filter_str,
+			(gchar *)g_ptr_array_index(ret, j), oid);
+		g_free(oid);
+		j++;
+	}
+	fail_if(j != ret->len, "%s: %u extra results", filter_str,
+		ret->len - j);
+
+	g_ptr_array_free(ret, TRUE);
+	mafw_filter_free(filter);
+}
+
+static gchar **Sort_terms;
+
+static gint compare_mds(gconstpointer a, gconstpointer b, gpointer mds)
+{
+	return mafw_metadata_compare(((GHashTable **)mds)[*(const guint *)a],
+				     ((GHashTable **)mds)[*(const guint *)b],
+				     (const gchar *const *)Sort_terms, NULL);
+}
+
+/* Checks that querying $cat sorted by $sorting returns the objects
+ * of $mds in the same order as a stable sort of them. */
+static void check_sort(MafwCatalogue *cat, GHashTable **mds, guint n,
+		       const gchar *sorting)
+{
+	GArray *ref;
+	GPtrArray *ret;
+	guint i;
+
+	ref = g_array_new(FALSE, FALSE, sizeof(guint));
+	for (i = 0; i < n; i++)
+		if (mds[i])
+			g_array_append_val(ref, i);
+	Sort_terms = mafw_metadata_sorting_terms(sorting);
+	g_qsort_with_data(ref->data, ref->len, sizeof(guint),
+			  compare_mds, mds);
+	g_strfreev(Sort_terms);
+
+	ret = mafw_catalogue_query(cat, NULL, sorting, 0, 0, NULL);
+	fail_if(ret->len != ref->len);
+	for (i = 0; i < ref->len; i++) {
+		gchar *oid;
+
+		oid = g_strdup_printf("oid::%u",
+				      g_array_index(ref, guint, i));
+		fail_if(strcmp(g_ptr_array_index(ret, i), oid),
+			"%s: %s instead of %s at %u", sorting,
+			(gchar *)g_ptr_array_index(ret, i), oid, i);
+		g_free(oid);
+	}
+	g_ptr_array_free(ret, TRUE);
+	g_array_free(ref, TRUE);
+}
+/* }}} */
+
+/* test_filter() {{{ */
+START_TEST(test_filter)
+{
+	static const gchar *const filters[] = {
+		"(artist=kispál)", "(artist=Nobody)", "(artist<c)",
+		"(artist>kispál)", "(artist~*isp*)", "(artist~b*)",
+		"(artist~*em)", "(artist~k*sp\\C3\\A1l)", "(artist?)",
+		"(title=Track 007)", "(title~*ck 01*)", "(title~*)",
+		"(year=1985)", "(year<1983)", "(year>2007)", "(year~1999)",
+		"(track=3)", "(track>5)", "(misc=x)", "(misc<100)",
+		"(nokey=1)", "(!(year>1990))",
+		"(&(artist~*e*)(year>2000))", "(|(artist=Belga)(year=1981))",
+		"(&(|(artist=Quimby)(track=0))(!(title~*5)))",
+	};
+	GHashTable *mds[200];
+	MafwCatalogue *cat;
+	guint i;
+
+	cat = populate(mds, G_N_ELEMENTS(mds));
+	fail_if(mafw_catalogue_size(cat) != G_N_ELEMENTS(mds));
+	for (i = 0; i < G_N_ELEMENTS(filters); i++)
+		check_query(cat, mds, G_N_ELEMENTS(mds), filters[i]);
+
+	/* Remove and replace some, enough to trigger rebuilding. */
+	for (i = 0; i < G_N_ELEMENTS(mds); i++) {
+		gchar *oid;
+
+		oid = g_strdup_printf("oid::%u", i);
+		if (i % 5 == 0) {
+			fail_unless(mafw_catalogue_remove(cat, oid));
+			fail_if(mafw_catalogue_lookup(cat, oid) != NULL);
+			mafw_metadata_release(mds[i]);
+			mds[i] = NULL;
+		} else if (i % 5 == 1) {
+			mafw_metadata_release(mds[i]);
+			mds[i] = mafw_metadata_new();
+			mafw_metadata_add_str(mds[i], "artist", "Belga");
+			mafw_metadata_add_int(mds[i], "year", 1999);
+			mafw_catalogue_add(cat, oid, mds[i]);
+			fail_unless(mafw_catalogue_lookup(cat, oid) == mds[i]);
+		}
+		g_free(oid);
+	}
+	fail_if(mafw_catalogue_remove(cat, "oid::0"));
+	fail_if(mafw_catalogue_size(cat) != G_N_ELEMENTS(mds) * 4 / 5);
+
+	/* Replaced objects come last now, so only check membership. */
+	for (i = 0; i < G_N_ELEMENTS(filters); i++) {
+		MafwFilter *filter;
+		GPtrArray *ret;
+		guint j, n, total;
+
+		filter = mafw_filter_parse(filters[i]);
+		ret = mafw_catalogue_query(cat, filter, NULL, 0, 0, &total);
+		for (j = n = 0; j < G_N_ELEMENTS(mds); j++)
+			if (mds[j] && mafw_metadata_filter(mds[j], filter,
+							   NULL))
+				n++;
+		fail_if(n != total, "%s: %u instead of %u", filters[i],
+			total, n);
+		for (j = 0; j < ret->len; j++) {
+			guint oid;
+
+			oid = atoi((gchar *)g_ptr_array_index(ret, j) + 5);
+			fail_unless(mafw_metadata_filter(mds[oid], filter,
+							 NULL));
+		}
+		g_ptr_array_free(ret, TRUE);
+		mafw_filter_free(filter);
+	}
+
+	mafw_catalogue_free(cat);
+	for (i = 0; i < G_N_ELEMENTS(mds); i++)
+		mafw_metadata_release(mds[i]);
+}
+END_TEST
+/* }}} */
+
+/* test_sort() {{{ */
+START_TEST(test_sort)
+{
+	GHashTable *mds[50];
+	MafwCatalogue *cat;
+	MafwFilter *filter;
+	GPtrArray *ret;
+	guint total;
+
+	cat = populate(mds, G_N_ELEMENTS(mds));
+
+	/* Years descending, then titles: 2009 is year of 29 only. */
+	ret = mafw_catalogue_query(cat, NULL, "-year,+title", 0, 3, &total);
+	fail_if(total != G_N_ELEMENTS(mds));
+	fail_if(ret->len != 3);
+	fail_if(strcmp(g_ptr_array_index(ret, 0), "oid::29"));
+	fail_if(strcmp(g_ptr_array_index(ret, 1), "oid::28"));
+	fail_if(strcmp(g_ptr_array_index(ret, 2), "oid::27"));
+	g_ptr_array_free(ret, TRUE);
+
+	/* Paging */
+	filter = mafw_filter_parse("(year<1982)");
+	ret = mafw_catalogue_query(cat, filter, "+title", 1, 2, &total);
+	fail_if(total != 4);
+	fail_if(ret->len != 2);
+	fail_if(strcmp(g_ptr_array_index(ret, 0), "oid::1"));
+	fail_if(strcmp(g_ptr_array_index(ret, 1), "oid::30"));
+	g_ptr_array_free(ret, TRUE);
+
+	ret = mafw_catalogue_query(cat, filter, "+title", 10, 0, &total);
+	fail_if(total != 4);
+	fail_if(ret->len != 0);
+	g_ptr_array_free(ret, TRUE);
+	mafw_filter_free(filter);
+
+	/* By the indexes, with ties, missing keys and multiple values. */
+	check_sort(cat, mds, G_N_ELEMENTS(mds), "+artist");
+	check_sort(cat, mds, G_N_ELEMENTS(mds), "-artist");
+	check_sort(cat, mds, G_N_ELEMENTS(mds), "-artist,-title");
+	check_sort(cat, mds, G_N_ELEMENTS(mds), "+year,-artist");
+	check_sort(cat, mds, G_N_ELEMENTS(mds), "-track,+title");
+	mafw_catalogue_remove(cat, "oid::3");
+	mafw_metadata_release(mds[3]);
+	mds[3] = NULL;
+	check_sort(cat, mds, G_N_ELEMENTS(mds), "+artist,+year");
+
+	mafw_catalogue_free(cat);
+	for (total = 0; total < G_N_ELEMENTS(mds); total++)
+		if (mds[total])
+			mafw_metadata_release(mds[total]);
+}
+END_TEST
+/* }}} */
+
+/* main() {{{ */
+int main(void)
+{
+	Suite *suite;
+
+	suite = suite_create("MafwCatalogue");
+	if (1)	checkmore_add_tcase(suite, "filter", test_filter);
+	if (1)	checkmore_add_tcase(suite, "sort", test_sort);
+
+	return checkmore_run(srunner_create(suite), FALSE);
+} /* }}} */
+
+/* vi: set noexpandtab ts=8 sw=8 cino=t0,(0 foldmethod=marker: */
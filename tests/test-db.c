@@ -24,6 +24,7 @@
 
 #include <glib.h>
 #include <glib/gstdio.h>
+#include <string.h>
  
 #include "checkmore.h"
 #include <libmafw/mafw-db.h>
@@ -135,6 +136,115 @@ START_TEST(test_basic)
 }
 END_TEST
 
+START_TEST(test_filter_to_sql)
+{
+	static gchar const *const rows[][2] = {
+		{ "Alpha", "rock" }, { "Beta", "pop" }, { "Gamma", "rock" },
+		{ "Delta", "jazz" }, { "Rock_and_Roll", "rock" },
+		{ "Who?", "pop" }, { "Whom", "pop" },
+	};
+	guint i;
+	gint nrows;
+	gchar *sql, *query, **binds;
+	GHashTable *columns;
+	MafwFilter *filter;
+	sqlite3_stmt *stmt;
+
+	mafw_db_exec("CREATE TABLE IF NOT EXISTS sqlfilter(\n"
+		     "title	TEXT	NOT NULL,\n"
+		     "genre	TEXT)");
+	stmt = mafw_db_prepare("INSERT INTO sqlfilter(title, genre) "
+			       "VALUES(:title, :genre)");
+	for (i = 0; i < G_N_ELEMENTS(rows); i++) {
+		mafw_db_bind_text(stmt, 0, rows[i][0]);
+		mafw_db_bind_text(stmt, 1, rows[i][1]);
+		fail_if(mafw_db_change(stmt, FALSE) != SQLITE_DONE);
+		sqlite3_reset(stmt);
+	}
+	sqlite3_finalize(stmt);
+
+	columns = g_hash_table_new(g_str_hash, g_str_equal);
+	g_hash_table_insert(columns, "title", "title");
+	g_hash_table_insert(columns, "genre", "genre");
+
+	/* Nothing to restrict. */
+	sql = mafw_db_filter_to_sql(NULL, NULL, 0, 0, columns, &binds);
+	fail_unless(sql && !strcmp(sql, ""));
+	fail_unless(binds && !binds[0]);
+	g_free(sql);
+	g_strfreev(binds);
+
+	/* Unknown key and malformed sort criteria. */
+	filter = mafw_filter_parse("(artist=x)");
+	binds = NULL;
+	fail_if(mafw_db_filter_to_sql(filter, NULL, 0, 0, columns, &binds));
+	fail_if(binds != NULL);
+	mafw_filter_free(filter);
+	fail_if(mafw_db_filter_to_sql(NULL, "title", 0, 0, columns, &binds));
+	fail_if(mafw_db_filter_to_sql(NULL, "+artist", 0, 0, columns,
+				      &binds));
+
+	/* Without a column map keys are quoted. */
+	filter = mafw_filter_parse("(play-count?)");
+	sql = mafw_db_filter_to_sql(filter, NULL, 0, 0, NULL, &binds);
+	fail_unless(!strcmp(sql, " WHERE \"play-count\" IS NOT NULL"));
+	g_free(sql);
+	g_strfreev(binds);
+	mafw_filter_free(filter);
+
+	/* Values are passed through placeholders.  Of the rock titles
+	 * but Alpha only the second one in descending order is wanted. */
+	filter = mafw_filter_parse("(&(genre=rock)(!(title=Alpha)))");
+	sql = mafw_db_filter_to_sql(filter, "-title", 1, 1, columns, &binds);
+	fail_unless(!strcmp(sql, " WHERE (genre = ? AND NOT (title = ?))"
+			    " ORDER BY title DESC LIMIT 1 OFFSET 1"));
+	fail_unless(g_strv_length(binds) == 2);
+	query = g_strconcat("SELECT title FROM sqlfilter", sql, NULL);
+	stmt = mafw_db_prepare(query);
+	mafw_db_bind_strv(stmt, 0, (gchar const *const *)binds);
+	fail_if(mafw_db_select(stmt, TRUE) != SQLITE_ROW);
+	fail_if(strcmp(mafw_db_column_text(stmt, 0), "Gamma"));
+	fail_if(mafw_db_select(stmt, FALSE) != SQLITE_DONE);
+	sqlite3_finalize(stmt);
+	g_free(query);
+	g_free(sql);
+	g_strfreev(binds);
+	mafw_filter_free(filter);
+
+	/* LIKE metacharacters are matched literally. */
+	filter = mafw_filter_parse("(|(title~*_*)(title~?eta))");
+	sql = mafw_db_filter_to_sql(filter, NULL, 0, 0, columns, &binds);
+	query = g_strconcat("SELECT title FROM sqlfilter", sql, NULL);
+	stmt = mafw_db_prepare(query);
+	mafw_db_bind_strv(stmt, 0, (gchar const *const *)binds);
+	for (nrows = 0; mafw_db_select(stmt, FALSE) == SQLITE_ROW; nrows++)
+		;
+	fail_if(nrows != 2);
+	sqlite3_finalize(stmt);
+	g_free(query);
+	g_free(sql);
+	g_strfreev(binds);
+	mafw_filter_free(filter);
+
+	/* Escaped wildcards are matched literally, like in globs. */
+	filter = MAFW_FILTER_APPROX("title", "Who\\3F");
+	sql = mafw_db_filter_to_sql(filter, NULL, 0, 0, columns, &binds);
+	query = g_strconcat("SELECT title FROM sqlfilter", sql, NULL);
+	stmt = mafw_db_prepare(query);
+	mafw_db_bind_strv(stmt, 0, (gchar const *const *)binds);
+	fail_if(mafw_db_select(stmt, TRUE) != SQLITE_ROW);
+	fail_if(strcmp(mafw_db_column_text(stmt, 0), "Who?"));
+	fail_if(mafw_db_select(stmt, FALSE) != SQLITE_DONE);
+	sqlite3_finalize(stmt);
+	g_free(query);
+	g_free(sql);
+	g_strfreev(binds);
+	mafw_filter_free(filter);
+
+	g_hash_table_destroy(columns);
+}
+END_TEST
+
 int main(void)
 {
 	TCase *tc;
@@ -150,6 +260,7 @@ int main(void)
 	if (1) tcase_add_test(tc, test_basic);
 	if (1) tcase_add_test(tc, test_statements);
 	if (1) tcase_add_test(tc, test_error_statements);
+	if (1) tcase_add_test(tc, test_filter_to_sql);
 
 	return checkmore_run(srunner_create(suite), FALSE);
 }
@@ -22,6 +22,8 @@
  *
  */
 
+#include <string.h>
+
 #include <glib.h>
 
 #include "checkmore.h"
@@ -44,6 +46,292 @@ static void fsrc_init(Fsrc *y)
 }
 
 
+/* A source which browses a container of 10 items synchronously,
+ * or an empty one if $object_id is "empty".  $Bsrc_produced counts
+ * the items browsed. */
+static GType bsrc_get_type(void);
+typedef struct { MafwSourceClass parent; } BsrcClass;
+typedef struct { MafwSource parent; } Bsrc;
+G_DEFINE_TYPE(Bsrc, bsrc, MAFW_TYPE_SOURCE);
+
+static guint Bsrc_produced;
+
+static guint bsrc_browse(MafwSource *self, const gchar *object_id,
+			 gboolean recursive, const MafwFilter *filter,
+			 const gchar *sort_criteria,
+			 const gchar *const *mdkeys,
+			 guint skip_count, guint item_count,
+			 MafwSourceBrowseResultCb cb, gpointer user_data)
+{
+	guint i, total;
+
+	total = strcmp(object_id, "empty") ? 10 : 0;
+	if (skip_count >= total) {
+		cb(self, 1, 0, 0, NULL, NULL, user_data, NULL);
+		return 1;
+	}
+
+	if (item_count == MAFW_SOURCE_BROWSE_ALL
+	    || item_count > total - skip_count)
+		item_count = total - skip_count;
+	for (i = 0; i < item_count; i++) {
+		GHashTable *md;
+		gchar *oid;
+
+		oid = g_strdup_printf("bsrc::%u", skip_count + i);
+		md = mafw_metadata_new();
+		mafw_metadata_add_int(md, "index", skip_count + i);
+		cb(self, 1, item_count - i - 1, i, oid, md, user_data, NULL);
+		g_hash_table_destroy(md);
+		g_free(oid);
+		Bsrc_produced++;
+	}
+	return 1;
+}
+
+static void bsrc_class_init(BsrcClass *x)
+{
+	MAFW_SOURCE_CLASS(x)->browse = bsrc_browse;
+}
+
+static void bsrc_init(Bsrc *y)
+{
+}
+
+/* A Bsrc which keeps its place between cursor fetches.  $Psrc_fetches
+ * records them as "<first>+<count>" strings, and $Psrc_cursors counts
+ * the open cursors. */
+static GType psrc_get_type(void);
+typedef struct { BsrcClass parent; } PsrcClass;
+typedef struct { Bsrc parent; } Psrc;
+G_DEFINE_TYPE(Psrc, psrc, bsrc_get_type());
+
+static GString *Psrc_fetches;
+static guint Psrc_cursors;
+
+static gpointer psrc_cursor_new(MafwSource *self, const gchar *object_id,
+				gboolean recursive, const MafwFilter *filter,
+				const gchar *sort_criteria,
+				const gchar *const *mdkeys)
+{
+	Psrc_cursors++;
+	return g_new0(guint, 1);
+}
+
+static void psrc_cursor_fetch(MafwSource *self, gpointer cursor,
+			      guint count, MafwSourceBrowseChunkCb cb,
+			      gpointer user_data)
+{
+	guint *next = cursor;
+	GHashTable *mds[10];
+	gchar *ids[11];
+	guint i, n;
+
+	g_string_append_printf(Psrc_fetches, "%u+%u ", *next, count);
+	n = MIN(count, 10 - *next);
+	for (i = 0; i < n; i++) {
+		ids[i] = g_strdup_printf("bsrc::%u", *next + i);
+		mds[i] = mafw_metadata_new();
+		mafw_metadata_add_int(mds[i], "index", *next + i);
+	}
+	ids[n] = NULL;
+	*next += n;
+	cb(self, MAFW_SOURCE_INVALID_BROWSE_ID, 0, 0,
+	   (const gchar *const *)ids, mds, n, user_data, NULL);
+	for (i = 0; i < n; i++) {
+		g_free(ids[i]);
+		mafw_metadata_release(mds[i]);
+	}
+}
+
+static void psrc_cursor_free(MafwSource *self, gpointer cursor)
+{
+	Psrc_cursors--;
+	g_free(cursor);
+}
+
+static void psrc_class_init(PsrcClass *x)
+{
+	MAFW_SOURCE_CLASS(x)->cursor_new = psrc_cursor_new;
+	MAFW_SOURCE_CLASS(x)->cursor_fetch = psrc_cursor_fetch;
+	MAFW_SOURCE_CLASS(x)->cursor_free = psrc_cursor_free;
+}
+
+static void psrc_init(Psrc *y)
+{
+}
+
+/* A source which answers get_metadata() from an idle callback with
+ * the requested keys (title and uri for the wildcard) set to the
+ * object ID, or after 200ms if the object ID is "msrc::slow".
+ * $Msrc_calls counts the requests, $Msrc_max_pending the most
+ * requests in progress at once, $Msrc_cancelled the ones whose
+ * token was cancelled by the time of the answer.  browse() sessions
+ * end with their only item from an idle callback, and are silent after
+ * cancel_browse(); $Msrc_browsing counts the sessions in progress. */
+static GType msrc_get_type(void);
+typedef struct { MafwSourceClass parent; } MsrcClass;
+typedef struct { MafwSource parent; } Msrc;
+G_DEFINE_TYPE(Msrc, msrc, MAFW_TYPE_SOURCE);
+
+static guint Msrc_calls, Msrc_pending, Msrc_max_pending, Msrc_cancelled;
+
+struct msrc_result {
+	MafwSource *self;
+	gchar *object_id;
+	GHashTable *md;
+	MafwSourceToken *token;
+	MafwSourceMetadataResultCb cb;
+	gpointer user_data;
+};
+
+static gboolean msrc_result(struct msrc_result *res)
+{
+	Msrc_pending--;
+	if (res->token) {
+		if (mafw_source_token_is_cancelled(res->token))
+			Msrc_cancelled++;
+		mafw_source_token_unref(res->token);
+	}
+	res->cb(res->self, res->object_id, res->md, res->user_data, NULL);
+	mafw_metadata_release(res->md);
+	g_free(res->object_id);
+	g_free(res);
+	return FALSE;
+}
+
+static void msrc_get_metadata(MafwSource *self, const gchar *object_id,
+			      const gchar *const *mdkeys,
+			      MafwSourceMetadataResultCb cb,
+			      gpointer user_data)
+{
+	static const gchar *const all[] = {
+		MAFW_METADATA_KEY_TITLE, MAFW_METADATA_KEY_URI, NULL
+	};
+	struct msrc_result *res;
+	guint i;
+
+	Msrc_calls++;
+	res = g_new(struct msrc_result, 1);
+	res->self = self;
+	res->object_id = g_strdup(object_id);
+	res->md = mafw_metadata_new();
+	res->token = mafw_source_get_current_token();
+	if (res->token)
+		mafw_source_token_ref(res->token);
+	res->cb = cb;
+	res->user_data = user_data;
+	if (mafw_source_all_keys(mdkeys))
+		mdkeys = all;
+	for (i = 0; mdkeys[i]; i++)
+		mafw_metadata_add_str(res->md, mdkeys[i], object_id);
+	if (++Msrc_pending > Msrc_max_pending)
+		Msrc_max_pending = Msrc_pending;
+	if (!strcmp(object_id, "msrc::slow"))
+		g_timeout_add(200, (GSourceFunc)msrc_result, res);
+	else
+		g_idle_add((GSourceFunc)msrc_result, res);
+}
+
+static guint Msrc_browsing;
+
+struct msrc_browse {
+	MafwSource *self;
+	guint browse_id;
+	MafwSourceBrowseResultCb cb;
+	gpointer user_data;
+};
+
+static gboolean msrc_browse_result(struct msrc_browse *b)
+{
+	GHashTable *md;
+
+	md = mafw_metadata_new();
+	mafw_metadata_add_str(md, MAFW_METADATA_KEY_TITLE, "msrc::item");
+	b->cb(b->self, b->browse_id, 0, 0, "msrc::item", md, b->user_data,
+	      NULL);
+	mafw_metadata_release(md);
+	return FALSE;
+}
+
+static void msrc_browse_done(struct msrc_browse *b)
+{
+	Msrc_browsing--;
+	g_free(b);
+}
+
+static guint msrc_browse(MafwSource *self, const gchar *object_id,
+			 gboolean recursive, const MafwFilter *filter,
+			 const gchar *sort_criteria,
+			 const gchar *const *mdkeys,
+			 guint skip_count, guint item_count,
+			 MafwSourceBrowseResultCb cb, gpointer user_data)
+{
+	struct msrc_browse *b;
+
+	Msrc_browsing++;
+	b = g_new(struct msrc_browse, 1);
+	b->self = self;
+	b->cb = cb;
+	b->user_data = user_data;
+	b->browse_id = g_idle_add_full(G_PRIORITY_DEFAULT_IDLE,
+				       (GSourceFunc)msrc_browse_result, b,
+				       (GDestroyNotify)msrc_browse_done);
+	return b->browse_id;
+}
+
+static gboolean msrc_cancel_browse(MafwSource *self, guint browse_id,
+				   GError **error)
+{
+	g_source_remove(browse_id);
+	return TRUE;
+}
+
+static void msrc_class_init(MsrcClass *x)
+{
+	MAFW_SOURCE_CLASS(x)->get_metadata = msrc_get_metadata;
+	MAFW_SOURCE_CLASS(x)->browse = msrc_browse;
+	MAFW_SOURCE_CLASS(x)->cancel_browse = msrc_cancel_browse;
+}
+
+static void msrc_init(Msrc *y)
+{
+}
+
+/* A source with a blocking get_metadata() run in worker threads.
+ * $Tsrc_thread is the thread it was last called in. */
+static GType tsrc_get_type(void);
+typedef struct { MafwSourceClass parent; } TsrcClass;
+typedef struct { MafwSource parent; } Tsrc;
+G_DEFINE_TYPE(Tsrc, tsrc, MAFW_TYPE_SOURCE);
+
+static GThread *volatile Tsrc_thread;
+
+static void tsrc_get_metadata(MafwSource *self, const gchar *object_id,
+			      const gchar *const *mdkeys,
+			      MafwSourceMetadataResultCb cb,
+			      gpointer user_data)
+{
+	GHashTable *md;
+
+	Tsrc_thread = g_thread_self();
+	g_usleep(50000);
+	md = mafw_metadata_new();
+	mafw_metadata_add_str(md, MAFW_METADATA_KEY_TITLE, object_id);
+	cb(self, object_id, md, user_data, NULL);
+	mafw_metadata_release(md);
+}
+
+static void tsrc_class_init(TsrcClass *x)
+{
+	MAFW_SOURCE_CLASS(x)->get_metadata = tsrc_get_metadata;
+	MAFW_SOURCE_CLASS(x)->threaded_get_metadata = TRUE;
+}
+
+static void tsrc_init(Tsrc *y)
+{
+}
+
 static GType frenderer_get_type(void);
 typedef struct { MafwRendererClass parent; } FrendererClass;
 typedef struct { MafwRenderer parent; } Frenderer;
@@ -57,6 +345,41 @@ static void frenderer_init(Frenderer *y)
 {
 }
 
+/* A renderer which never answers play() and get_position(), but keeps
+ * the callback in $Srenderer_cb and $Srenderer_data. */
+static GType srenderer_get_type(void);
+typedef struct { MafwRendererClass parent; } SrendererClass;
+typedef struct { MafwRenderer parent; } Srenderer;
+G_DEFINE_TYPE(Srenderer, srenderer, MAFW_TYPE_RENDERER);
+
+static gpointer Srenderer_cb, Srenderer_data;
+
+static void srenderer_play(MafwRenderer *self,
+			   MafwRendererPlaybackCB callback,
+			   gpointer user_data)
+{
+	Srenderer_cb = callback;
+	Srenderer_data = user_data;
+}
+
+static void srenderer_get_position(MafwRenderer *self,
+				   MafwRendererPositionCB callback,
+				   gpointer user_data)
+{
+	Srenderer_cb = callback;
+	Srenderer_data = user_data;
+}
+
+static void srenderer_class_init(SrendererClass *x)
+{
+	MAFW_RENDERER_CLASS(x)->play = srenderer_play;
+	MAFW_RENDERER_CLASS(x)->get_position = srenderer_get_position;
+}
+
+static void srenderer_init(Srenderer *y)
+{
+}
+
 static void browse_cb(MafwSource *self,
 					  guint browse_id,
 					  gint remaining_count,
@@ -72,6 +395,70 @@ static void browse_cb(MafwSource *self,
 	*user_data = TRUE;
 }
 
+static void browse_chunk_error_cb(MafwSource *self, guint browse_id,
+				  gint remaining_count, guint index,
+				  const gchar *const *object_ids,
+				  GHashTable **metadatas, guint nitems,
+				  gboolean *user_data, const GError *error)
+{
+	fail_if(!error);
+	fail_if(nitems != 0);
+	fail_if(object_ids[0] != NULL);
+	fail_if(*user_data);
+	*user_data = TRUE;
+}
+
+/* Records the chunks as "<index>/<nitems>/<remaining_count>" strings
+ * and checks that the items are in order. */
+static void browse_chunk_cb(MafwSource *self, guint browse_id,
+			    gint remaining_count, guint index,
+			    const gchar *const *object_ids,
+			    GHashTable **metadatas, guint nitems,
+			    GString *chunks, const GError *error)
+{
+	guint i;
+
+	fail_if(error != NULL);
+	fail_if(browse_id != 1);
+	for (i = 0; i < nitems; i++) {
+		gchar *oid;
+
+		oid = g_strdup_printf("bsrc::%u", index + i);
+		fail_if(strcmp(object_ids[i], oid));
+		g_free(oid);
+		fail_if(mafw_metadata_get_int(metadatas[i], "index", -1)
+			!= index + i);
+	}
+	fail_if(object_ids[nitems] != NULL);
+	g_string_append_printf(chunks, "%u/%u/%d ", index, nitems,
+			       remaining_count);
+}
+
+/* Checks the items like browse_chunk_cb() and records the fetches
+ * as "<index>/<nitems>/<finished>" strings. */
+static void cursor_fetch_cb(MafwSourceCursor *cursor, guint index,
+			    const gchar *const *object_ids,
+			    GHashTable **metadatas, guint nitems,
+			    gboolean finished, GString *fetches,
+			    const GError *error)
+{
+	guint i;
+
+	fail_if(error != NULL);
+	for (i = 0; i < nitems; i++) {
+		gchar *oid;
+
+		oid = g_strdup_printf("bsrc::%u", index + i);
+		fail_if(strcmp(object_ids[i], oid));
+		g_free(oid);
+		fail_if(mafw_metadata_get_int(metadatas[i], "index", -1)
+			!= index + i);
+	}
+	fail_if(object_ids[nitems] != NULL);
+	g_string_append_printf(fetches, "%u/%u/%d ", index, nitems,
+			       finished);
+}
+
 static void metadata_cb(MafwSource *self,
 					   const gchar *object_id,
 					   GHashTable *metadata,
@@ -83,6 +470,117 @@ static void metadata_cb(MafwSource *self,
 	*user_data = TRUE;
 }
 
+/* Records the results as "<object_id>:<keys> " strings, where <keys>
+ * are the first letters of the keys in alphabetical order. */
+static void coalesced_cb(MafwSource *self, const gchar *object_id,
+			 GHashTable *metadata, GString *results,
+			 const GError *error)
+{
+	static const gchar *const keys[] = {
+		MAFW_METADATA_KEY_ALBUM, MAFW_METADATA_KEY_TITLE,
+		MAFW_METADATA_KEY_URI, NULL
+	};
+	guint i;
+
+	fail_if(error != NULL);
+	fail_if(g_hash_table_size(metadata) == 0);
+	g_string_append_printf(results, "%s:", object_id);
+	for (i = 0; keys[i]; i++) {
+		if (!g_hash_table_lookup(metadata, keys[i]))
+			continue;
+		fail_if(strcmp(mafw_metadata_get_str(metadata, keys[i]),
+			       object_id));
+		g_string_append_c(results, keys[i][0]);
+	}
+	g_string_append_c(results, ' ');
+}
+
+struct metadatas_result {
+	GString *partials;
+	guint nresults;
+	GError *error;
+};
+
+/* Records the partial results as "<object_id> " strings. */
+static void partial_cb(MafwSource *self, const gchar *object_id,
+		       GHashTable *metadata, struct metadatas_result *res,
+		       const GError *error)
+{
+	fail_if(error != NULL);
+	fail_if(strcmp(mafw_metadata_get_str(metadata,
+					     MAFW_METADATA_KEY_TITLE),
+		       object_id));
+	g_string_append_printf(res->partials, "%s ", object_id);
+}
+
+/* Records the error, or a MAFW_EXTENSION_ERROR_FAILED if none. */
+static void metadatas_cb(MafwSource *self, GHashTable *metadatas,
+			 struct metadatas_result *res, const GError *error)
+{
+	fail_if(res->error != NULL);
+	fail_if(g_hash_table_size(metadatas) != res->nresults);
+	res->error = error ? g_error_copy(error)
+		: g_error_new_literal(MAFW_EXTENSION_ERROR,
+				      MAFW_EXTENSION_ERROR_FAILED, "none");
+}
+
+/* Records the results as "<object_id>:ok " or "<object_id>:timeout ". */
+static void timed_cb(MafwSource *self, const gchar *object_id,
+		     GHashTable *metadata, GString *results,
+		     const GError *error)
+{
+	if (error) {
+		fail_if(error->code
+			!= MAFW_EXTENSION_ERROR_EXTENSION_NOT_RESPONDING);
+		fail_if(metadata != NULL);
+	} else
+		fail_if(metadata == NULL);
+	g_string_append_printf(results, "%s:%s ", object_id,
+			       error ? "timeout" : "ok");
+}
+
+/* Checks that it's called in the main thread and counts the calls. */
+static void threaded_cb(MafwSource *self, const gchar *object_id,
+			GHashTable *metadata, guint *ncalls,
+			const GError *error)
+{
+	fail_if(error != NULL);
+	fail_if(g_thread_self() == Tsrc_thread);
+	fail_if(strcmp(mafw_metadata_get_str(metadata,
+					     MAFW_METADATA_KEY_TITLE),
+		       object_id));
+	(*ncalls)++;
+}
+
+/* Records the results as "<object_id> ", or "- " for the end of the
+ * session, starting two more sessions from the first result. */
+static void scheduled_browse_cb(MafwSource *self, guint browse_id,
+				gint remaining_count, guint index,
+				const gchar *object_id, GHashTable *metadata,
+				GString *results, const GError *error)
+{
+	static gboolean nested;
+	guint nested_id;
+
+	fail_if(error != NULL);
+	/* Bsrc's own id is always 1. */
+	fail_if(browse_id == 1);
+	g_string_append_printf(results, "%s ", object_id ? object_id : "-");
+
+	if (!object_id || nested)
+		return;
+	nested = TRUE;
+	nested_id = mafw_source_browse_full(self, "bsrc::", FALSE, NULL,
+					    NULL, NULL, 0, 1,
+					    MAFW_SOURCE_PRIORITY_INTERACTIVE,
+					    (gpointer)scheduled_browse_cb,
+					    results);
+	mafw_source_browse_full(self, "bsrc::", FALSE, NULL, NULL, NULL, 0, 1,
+				MAFW_SOURCE_PRIORITY_PREFETCH,
+				(gpointer)scheduled_browse_cb, results);
+	fail_if(!mafw_source_cancel_browse(self, nested_id, NULL));
+}
+
 static void metadata_set_cb(MafwSource *self,
 					const gchar *object_id,
 					const gchar **failed_keys,
@@ -152,6 +650,12 @@ START_TEST(test_source)
 					!= MAFW_SOURCE_INVALID_BROWSE_ID);
 	fail_if(!cb_called);
 	cb_called = FALSE;
+	fail_if(mafw_source_browse_chunked(src, "srcuuid:://", FALSE, NULL,
+				NULL, NULL, 0, 0, 0,
+				(gpointer)browse_chunk_error_cb, &cb_called)
+					!= MAFW_SOURCE_INVALID_BROWSE_ID);
+	fail_if(!cb_called);
+	cb_called = FALSE;
 	fail_if(mafw_source_cancel_browse(src, 1, &error) != FALSE);
 	fail_if(!error);
 	g_error_free(error);
@@ -224,6 +728,537 @@ static void renderer_mdata_chd_cb(MafwRenderer *self, gchar *name,
 	*(gboolean*)user_data = TRUE;
 }
 
+START_TEST(test_browse_chunked)
+{
+	MafwSource *src;
+	GString *chunks;
+	guint browse_id;
+
+	src = g_object_new(bsrc_get_type(), "uuid", "bsrc", NULL);
+	chunks = g_string_new("");
+
+	mafw_source_browse_chunked(src, "bsrc::", FALSE, NULL, NULL, NULL,
+				   0, 0, 4, (gpointer)browse_chunk_cb, chunks);
+	fail_if(strcmp(chunks->str, "0/4/6 4/4/2 8/2/0 "));
+
+	g_string_truncate(chunks, 0);
+	mafw_source_browse_chunked(src, "bsrc::", FALSE, NULL, NULL, NULL,
+				   0, 8, 4, (gpointer)browse_chunk_cb, chunks);
+	fail_if(strcmp(chunks->str, "0/4/4 4/4/0 "));
+
+	/* The default chunk size */
+	g_string_truncate(chunks, 0);
+	mafw_source_browse_chunked(src, "bsrc::", FALSE, NULL, NULL, NULL,
+				   0, 0, 0, (gpointer)browse_chunk_cb, chunks);
+	fail_if(strcmp(chunks->str, "0/10/0 "));
+
+	/* Empty result */
+	g_string_truncate(chunks, 0);
+	mafw_source_browse_chunked(src, "empty", FALSE, NULL, NULL, NULL,
+				   0, 0, 4, (gpointer)browse_chunk_cb, chunks);
+	fail_if(strcmp(chunks->str, "0/0/0 "));
+	g_object_unref(src);
+
+	/* Cancelling a session the source won't answer any more. */
+	src = g_object_new(msrc_get_type(), "uuid", "msrc", NULL);
+	g_string_truncate(chunks, 0);
+	browse_id = mafw_source_browse_chunked(src, "msrc::", FALSE, NULL,
+					       NULL, NULL, 0, 0, 4,
+					       (gpointer)browse_chunk_cb,
+					       chunks);
+	fail_if(!mafw_source_cancel_browse(src, browse_id, NULL));
+	fail_if(Msrc_browsing != 0);
+	while (g_main_context_iteration(NULL, FALSE))
+		/* NOP */;
+	fail_if(chunks->len != 0);
+
+	g_string_free(chunks, TRUE);
+	g_object_unref(src);
+}
+END_TEST
+
+/* For fetches which are cancelled before any result. */
+static void silent_fetch_cb(MafwSourceCursor *cursor, guint index,
+			    const gchar *const *object_ids,
+			    GHashTable **metadatas, guint nitems,
+			    gboolean finished, gpointer user_data,
+			    const GError *error)
+{
+	fail("called back after free");
+}
+
+START_TEST(test_cursor)
+{
+	MafwSource *src;
+	MafwSourceCursor *cursor;
+	GString *fetches;
+
+	src = g_object_new(bsrc_get_type(), "uuid", "bsrc", NULL);
+	fetches = g_string_new("");
+
+	/* The source browses only what's fetched. */
+	Bsrc_produced = 0;
+	cursor = mafw_source_cursor_new(src, "bsrc::", FALSE, NULL, NULL,
+					MAFW_SOURCE_ALL_KEYS);
+	mafw_source_cursor_fetch(cursor, 4, (gpointer)cursor_fetch_cb,
+				 fetches);
+	fail_if(Bsrc_produced != 4);
+	fail_if(mafw_source_cursor_get_position(cursor) != 4);
+	mafw_source_cursor_fetch(cursor, 4, (gpointer)cursor_fetch_cb,
+				 fetches);
+	mafw_source_cursor_fetch(cursor, 4, (gpointer)cursor_fetch_cb,
+				 fetches);
+	mafw_source_cursor_fetch(cursor, 4, (gpointer)cursor_fetch_cb,
+				 fetches);
+	fail_if(Bsrc_produced != 10);
+	fail_if(strcmp(fetches->str, "0/4/0 4/4/0 8/2/1 10/0/1 "));
+	mafw_source_cursor_free(cursor);
+
+	/* The end is only known when fetching past it. */
+	g_string_truncate(fetches, 0);
+	cursor = mafw_source_cursor_new(src, "bsrc::", FALSE, NULL, NULL,
+					NULL);
+	mafw_source_cursor_fetch(cursor, 5, (gpointer)cursor_fetch_cb,
+				 fetches);
+	mafw_source_cursor_fetch(cursor, 5, (gpointer)cursor_fetch_cb,
+				 fetches);
+	mafw_source_cursor_fetch(cursor, 5, (gpointer)cursor_fetch_cb,
+				 fetches);
+	fail_if(strcmp(fetches->str, "0/5/0 5/5/0 10/0/1 "));
+	mafw_source_cursor_free(cursor);
+
+	g_string_truncate(fetches, 0);
+	cursor = mafw_source_cursor_new(src, "empty", FALSE, NULL, NULL,
+					NULL);
+	mafw_source_cursor_fetch(cursor, 5, (gpointer)cursor_fetch_cb,
+				 fetches);
+	fail_if(strcmp(fetches->str, "0/0/1 "));
+	mafw_source_cursor_free(cursor);
+	g_object_unref(src);
+
+	/* Sources with their own cursors are not browsed. */
+	src = g_object_new(psrc_get_type(), "uuid", "psrc", NULL);
+	Psrc_fetches = g_string_new("");
+	Bsrc_produced = 0;
+	g_string_truncate(fetches, 0);
+	cursor = mafw_source_cursor_new(src, "psrc::", FALSE, NULL, NULL,
+					NULL);
+	fail_if(Psrc_cursors != 1);
+	mafw_source_cursor_fetch(cursor, 4, (gpointer)cursor_fetch_cb,
+				 fetches);
+	mafw_source_cursor_fetch(cursor, 4, (gpointer)cursor_fetch_cb,
+				 fetches);
+	mafw_source_cursor_fetch(cursor, 4, (gpointer)cursor_fetch_cb,
+				 fetches);
+	mafw_source_cursor_fetch(cursor, 4, (gpointer)cursor_fetch_cb,
+				 fetches);
+	fail_if(Bsrc_produced != 0);
+	fail_if(strcmp(fetches->str, "0/4/0 4/4/0 8/2/1 10/0/1 "));
+	fail_if(strcmp(Psrc_fetches->str, "0+4 4+4 8+4 "));
+	mafw_source_cursor_free(cursor);
+	fail_if(Psrc_cursors != 0);
+	g_string_free(Psrc_fetches, TRUE);
+	g_object_unref(src);
+
+	/* Freeing the cursor during a fetch cancels the browse, which
+	 * the source doesn't answer any more. */
+	src = g_object_new(msrc_get_type(), "uuid", "msrc", NULL);
+	cursor = mafw_source_cursor_new(src, "msrc::", FALSE, NULL, NULL,
+					NULL);
+	mafw_source_cursor_fetch(cursor, 5, silent_fetch_cb, NULL);
+	fail_if(Msrc_browsing != 1);
+	mafw_source_cursor_free(cursor);
+	fail_if(Msrc_browsing != 0);
+	while (g_main_context_iteration(NULL, FALSE))
+		/* NOP */;
+
+	g_string_free(fetches, TRUE);
+	g_object_unref(src);
+}
+END_TEST
+
+START_TEST(test_coalescing)
+{
+	MafwSource *src;
+	GString *results;
+
+	src = g_object_new(msrc_get_type(), "uuid", "msrc", NULL);
+	results = g_string_new("");
+
+	/* The second and third requests are covered by the first one,
+	 * the fourth is not. */
+	Msrc_calls = 0;
+	mafw_source_get_metadata(src, "msrc::a",
+				 MAFW_SOURCE_LIST(MAFW_METADATA_KEY_TITLE,
+						  MAFW_METADATA_KEY_URI),
+				 (gpointer)coalesced_cb, results);
+	mafw_source_get_metadata(src, "msrc::a",
+				 MAFW_SOURCE_LIST(MAFW_METADATA_KEY_URI,
+						  MAFW_METADATA_KEY_TITLE),
+				 (gpointer)coalesced_cb, results);
+	mafw_source_get_metadata(src, "msrc::a",
+				 MAFW_SOURCE_LIST(MAFW_METADATA_KEY_URI),
+				 (gpointer)coalesced_cb, results);
+	mafw_source_get_metadata(src, "msrc::a",
+				 MAFW_SOURCE_LIST(MAFW_METADATA_KEY_ALBUM),
+				 (gpointer)coalesced_cb, results);
+	mafw_source_get_metadata(src, "msrc::b",
+				 MAFW_SOURCE_LIST(MAFW_METADATA_KEY_URI),
+				 (gpointer)coalesced_cb, results);
+	fail_if(Msrc_calls != 3);
+	while (g_main_context_iteration(NULL, FALSE))
+		/* NOP */;
+	fail_if(strcmp(results->str,
+		       "msrc::a:tu msrc::a:tu msrc::a:u msrc::a:a msrc::b:u "));
+
+	/* The wildcard covers everything. */
+	g_string_truncate(results, 0);
+	mafw_source_get_metadata(src, "msrc::a", MAFW_SOURCE_ALL_KEYS,
+				 (gpointer)coalesced_cb, results);
+	mafw_source_get_metadata(src, "msrc::a",
+				 MAFW_SOURCE_LIST(MAFW_METADATA_KEY_TITLE),
+				 (gpointer)coalesced_cb, results);
+	fail_if(Msrc_calls != 4);
+	while (g_main_context_iteration(NULL, FALSE))
+		/* NOP */;
+	fail_if(strcmp(results->str, "msrc::a:tu msrc::a:t "));
+
+	/* Finished requests are not reused. */
+	mafw_source_get_metadata(src, "msrc::a",
+				 MAFW_SOURCE_LIST(MAFW_METADATA_KEY_TITLE),
+				 (gpointer)coalesced_cb, results);
+	fail_if(Msrc_calls != 5);
+	while (g_main_context_iteration(NULL, FALSE))
+		/* NOP */;
+
+	g_string_free(results, TRUE);
+	g_object_unref(src);
+}
+END_TEST
+
+START_TEST(test_metadatas)
+{
+	MafwSource *src;
+	struct metadatas_result res;
+	const gchar *ids[] = {
+		"msrc::1", "msrc::2", "msrc::slow", "msrc::3", NULL
+	};
+
+	src = g_object_new(msrc_get_type(), "uuid", "msrc", NULL);
+	res.partials = g_string_new("");
+	res.error = NULL;
+
+	/* At most two at once, results streamed as they arrive. */
+	Msrc_max_pending = 0;
+	res.nresults = 4;
+	mafw_source_get_metadatas_full(src, ids,
+				       MAFW_SOURCE_LIST(MAFW_METADATA_KEY_TITLE),
+				       2, 0, MAFW_SOURCE_PRIORITY_INTERACTIVE,
+				       NULL, (gpointer)partial_cb,
+				       (gpointer)metadatas_cb, &res);
+	fail_if(Msrc_max_pending != 2);
+	while (!res.error)
+		g_main_context_iteration(NULL, TRUE);
+	fail_if(res.error->code != MAFW_EXTENSION_ERROR_FAILED);
+	g_clear_error(&res.error);
+	fail_if(Msrc_max_pending != 2);
+	fail_if(strcmp(res.partials->str,
+		       "msrc::1 msrc::2 msrc::3 msrc::slow "));
+
+	/* The slow one is left out after the deadline. */
+	g_string_truncate(res.partials, 0);
+	ids[2] = "msrc::4";
+	ids[3] = "msrc::slow";
+	res.nresults = 3;
+	mafw_source_get_metadatas_full(src, ids,
+				       MAFW_SOURCE_LIST(MAFW_METADATA_KEY_TITLE),
+				       0, 100, MAFW_SOURCE_PRIORITY_INTERACTIVE,
+				       NULL, (gpointer)partial_cb,
+				       (gpointer)metadatas_cb, &res);
+	while (!res.error)
+		g_main_context_iteration(NULL, TRUE);
+	fail_if(res.error->code
+		!= MAFW_EXTENSION_ERROR_EXTENSION_NOT_RESPONDING);
+	g_clear_error(&res.error);
+	while (Msrc_pending)
+		g_main_context_iteration(NULL, TRUE);
+	fail_if(strcmp(res.partials->str, "msrc::1 msrc::2 msrc::4 "));
+
+	g_string_free(res.partials, TRUE);
+	g_object_unref(src);
+}
+END_TEST
+
+START_TEST(test_timeout)
+{
+	MafwSource *src;
+	GString *results;
+	struct metadatas_result res;
+	const gchar *ids[] = { "msrc::1", "msrc::slow", NULL };
+
+	src = g_object_new(msrc_get_type(), "uuid", "msrc", NULL);
+	results = g_string_new("");
+	mafw_extension_set_timeout(MAFW_EXTENSION(src), 100);
+	fail_if(mafw_extension_get_timeout(MAFW_EXTENSION(src)) != 100);
+
+	/* The late result is not passed on. */
+	mafw_source_get_metadata(src, "msrc::slow",
+				 MAFW_SOURCE_LIST(MAFW_METADATA_KEY_TITLE),
+				 (gpointer)timed_cb, results);
+	mafw_source_get_metadata(src, "msrc::a",
+				 MAFW_SOURCE_LIST(MAFW_METADATA_KEY_TITLE),
+				 (gpointer)timed_cb, results);
+	while (Msrc_pending)
+		g_main_context_iteration(NULL, TRUE);
+	fail_if(strcmp(results->str, "msrc::a:ok msrc::slow:timeout "));
+	fail_if(mafw_extension_get_timeout_count(MAFW_EXTENSION(src)) != 1);
+
+	/* get_metadatas() times out as a whole. */
+	res.partials = g_string_new("");
+	res.error = NULL;
+	res.nresults = 1;
+	mafw_source_get_metadatas(src, ids,
+				  MAFW_SOURCE_LIST(MAFW_METADATA_KEY_TITLE),
+				  (gpointer)metadatas_cb, &res);
+	while (!res.error)
+		g_main_context_iteration(NULL, TRUE);
+	fail_if(res.error->code
+		!= MAFW_EXTENSION_ERROR_EXTENSION_NOT_RESPONDING);
+	g_clear_error(&res.error);
+	while (Msrc_pending)
+		g_main_context_iteration(NULL, TRUE);
+	fail_if(mafw_extension_get_timeout_count(MAFW_EXTENSION(src)) != 2);
+
+	/* Not timed without a timeout. */
+	g_string_truncate(results, 0);
+	mafw_extension_set_timeout(MAFW_EXTENSION(src), 0);
+	mafw_source_get_metadata(src, "msrc::slow",
+				 MAFW_SOURCE_LIST(MAFW_METADATA_KEY_TITLE),
+				 (gpointer)timed_cb, results);
+	while (Msrc_pending)
+		g_main_context_iteration(NULL, TRUE);
+	fail_if(strcmp(results->str, "msrc::slow:ok "));
+	fail_if(mafw_extension_get_timeout_count(MAFW_EXTENSION(src)) != 2);
+
+	g_string_free(res.partials, TRUE);
+	g_string_free(results, TRUE);
+	g_object_unref(src);
+}
+END_TEST
+
+START_TEST(test_threaded)
+{
+	MafwSource *src;
+	guint ncalls;
+
+	src = g_object_new(tsrc_get_type(), "uuid", "tsrc", NULL);
+
+	ncalls = 0;
+	mafw_source_get_metadata(src, "tsrc::a",
+				 MAFW_SOURCE_LIST(MAFW_METADATA_KEY_TITLE),
+				 (gpointer)threaded_cb, &ncalls);
+	mafw_source_get_metadata(src, "tsrc::b",
+				 MAFW_SOURCE_LIST(MAFW_METADATA_KEY_TITLE),
+				 (gpointer)threaded_cb, &ncalls);
+	fail_if(ncalls != 0);
+	while (ncalls < 2)
+		g_main_context_iteration(NULL, TRUE);
+	fail_if(Tsrc_thread == NULL);
+	fail_if(Tsrc_thread == g_thread_self());
+
+	g_object_unref(src);
+}
+END_TEST
+
+START_TEST(test_scheduler)
+{
+	MafwSource *src;
+	GString *results;
+	MafwSourceQueueStats stats;
+
+	src = g_object_new(msrc_get_type(), "uuid", "msrc", NULL);
+	results = g_string_new("");
+	mafw_source_set_max_requests(src, 1);
+	fail_if(mafw_source_get_max_requests(src) != 1);
+
+	Msrc_calls = Msrc_max_pending = 0;
+	mafw_source_get_metadata_full(src, "msrc::b1",
+				MAFW_SOURCE_LIST(MAFW_METADATA_KEY_TITLE),
+				MAFW_SOURCE_PRIORITY_BACKGROUND, NULL,
+				(gpointer)coalesced_cb, results);
+	mafw_source_get_metadata_full(src, "msrc::b2",
+				MAFW_SOURCE_LIST(MAFW_METADATA_KEY_TITLE),
+				MAFW_SOURCE_PRIORITY_BACKGROUND, NULL,
+				(gpointer)coalesced_cb, results);
+	mafw_source_get_metadata_full(src, "msrc::p",
+				MAFW_SOURCE_LIST(MAFW_METADATA_KEY_TITLE),
+				MAFW_SOURCE_PRIORITY_PREFETCH, NULL,
+				(gpointer)coalesced_cb, results);
+	mafw_source_get_metadata_full(src, "msrc::i",
+				MAFW_SOURCE_LIST(MAFW_METADATA_KEY_TITLE),
+				MAFW_SOURCE_PRIORITY_INTERACTIVE, NULL,
+				(gpointer)coalesced_cb, results);
+	mafw_source_get_metadata_full(src, "msrc::b3",
+				MAFW_SOURCE_LIST(MAFW_METADATA_KEY_TITLE),
+				MAFW_SOURCE_PRIORITY_BACKGROUND, NULL,
+				(gpointer)coalesced_cb, results);
+	/* Someone is waiting for b3 now. */
+	mafw_source_get_metadata(src, "msrc::b3",
+				 MAFW_SOURCE_LIST(MAFW_METADATA_KEY_TITLE),
+				 (gpointer)coalesced_cb, results);
+	fail_if(Msrc_calls != 1);
+	mafw_source_get_queue_stats(src, MAFW_SOURCE_PRIORITY_INTERACTIVE,
+				    &stats);
+	fail_if(stats.depth != 2);
+	mafw_source_get_queue_stats(src, MAFW_SOURCE_PRIORITY_BACKGROUND,
+				    &stats);
+	fail_if(stats.depth != 1);
+	fail_if(stats.started != 1);
+
+	while (Msrc_calls < 5 || Msrc_pending)
+		g_main_context_iteration(NULL, TRUE);
+	fail_if(Msrc_max_pending != 1);
+	fail_if(strcmp(results->str, "msrc::b1:t msrc::i:t msrc::b3:t "
+		       "msrc::b3:t msrc::p:t msrc::b2:t "));
+	mafw_source_get_queue_stats(src, MAFW_SOURCE_PRIORITY_BACKGROUND,
+				    &stats);
+	fail_if(stats.depth != 0);
+	fail_if(stats.started != 2);
+	g_object_unref(src);
+
+	/* A queued browse session can be cancelled without a callback,
+	 * the others start when the running one ends. */
+	src = g_object_new(bsrc_get_type(), "uuid", "bsrc", NULL);
+	mafw_source_set_max_requests(src, 1);
+	g_string_truncate(results, 0);
+	mafw_source_browse_full(src, "bsrc::", FALSE, NULL, NULL, NULL, 0, 2,
+				MAFW_SOURCE_PRIORITY_BACKGROUND,
+				(gpointer)scheduled_browse_cb, results);
+	fail_if(strcmp(results->str, "bsrc::0 bsrc::1 bsrc::0 "));
+	mafw_source_get_queue_stats(src, MAFW_SOURCE_PRIORITY_INTERACTIVE,
+				    &stats);
+	fail_if(stats.started != 0);
+	mafw_source_get_queue_stats(src, MAFW_SOURCE_PRIORITY_PREFETCH,
+				    &stats);
+	fail_if(stats.started != 1);
+
+	g_string_free(results, TRUE);
+	g_object_unref(src);
+}
+END_TEST
+
+/* For browse sessions which are cancelled before any result. */
+static void silent_browse_cb(MafwSource *self, guint browse_id,
+			     gint remaining_count, guint index,
+			     const gchar *object_id, GHashTable *metadata,
+			     gpointer user_data, const GError *error)
+{
+	fail("called back after cancel");
+}
+
+START_TEST(test_cancel)
+{
+	MafwSource *src;
+	MafwSourceToken *token;
+	guint browse_id;
+	GString *results;
+	const gchar *ids[] = { "msrc::1", "msrc::2", "msrc::3", NULL };
+
+	src = g_object_new(msrc_get_type(), "uuid", "msrc", NULL);
+	results = g_string_new("");
+
+	/* The source is told to give up on what nobody waits for,
+	 * and the cancelled ones don't time out. */
+	mafw_extension_set_timeout(MAFW_EXTENSION(src), 100);
+	token = mafw_source_token_new();
+	Msrc_calls = Msrc_cancelled = 0;
+	mafw_source_get_metadata_full(src, "msrc::slow",
+				MAFW_SOURCE_LIST(MAFW_METADATA_KEY_TITLE),
+				MAFW_SOURCE_PRIORITY_INTERACTIVE, token,
+				(gpointer)coalesced_cb, results);
+	mafw_source_get_metadata_full(src, "msrc::a",
+				MAFW_SOURCE_LIST(MAFW_METADATA_KEY_TITLE),
+				MAFW_SOURCE_PRIORITY_INTERACTIVE, token,
+				(gpointer)coalesced_cb, results);
+	mafw_source_get_metadata(src, "msrc::a",
+				 MAFW_SOURCE_LIST(MAFW_METADATA_KEY_TITLE),
+				 (gpointer)coalesced_cb, results);
+	mafw_source_token_cancel(token);
+	mafw_source_token_cancel(token);
+	mafw_source_get_metadata_full(src, "msrc::b",
+				MAFW_SOURCE_LIST(MAFW_METADATA_KEY_TITLE),
+				MAFW_SOURCE_PRIORITY_INTERACTIVE, token,
+				(gpointer)coalesced_cb, results);
+	mafw_source_token_unref(token);
+	while (Msrc_pending)
+		g_main_context_iteration(NULL, TRUE);
+	fail_if(Msrc_calls != 2);
+	fail_if(Msrc_cancelled != 1);
+	fail_if(strcmp(results->str, "msrc::a:t "));
+	fail_if(mafw_extension_get_timeout_count(MAFW_EXTENSION(src)) != 0);
+	mafw_extension_set_timeout(MAFW_EXTENSION(src), 0);
+
+	/* Queued requests never reach the source. */
+	mafw_source_set_max_requests(src, 1);
+	g_string_truncate(results, 0);
+	token = mafw_source_token_new();
+	Msrc_calls = 0;
+	mafw_source_get_metadata(src, "msrc::x",
+				 MAFW_SOURCE_LIST(MAFW_METADATA_KEY_TITLE),
+				 (gpointer)coalesced_cb, results);
+	mafw_source_get_metadata_full(src, "msrc::y",
+				MAFW_SOURCE_LIST(MAFW_METADATA_KEY_TITLE),
+				MAFW_SOURCE_PRIORITY_PREFETCH, token,
+				(gpointer)coalesced_cb, results);
+	mafw_source_token_cancel(token);
+	mafw_source_token_unref(token);
+	while (Msrc_pending)
+		g_main_context_iteration(NULL, TRUE);
+	fail_if(Msrc_calls != 1);
+	fail_if(strcmp(results->str, "msrc::x:t "));
+	mafw_source_set_max_requests(src, 0);
+
+	/* Nor do the objects of get_metadatas() not asked yet. */
+	token = mafw_source_token_new();
+	Msrc_calls = Msrc_cancelled = 0;
+	mafw_source_get_metadatas_full(src, ids,
+				       MAFW_SOURCE_LIST(MAFW_METADATA_KEY_TITLE),
+				       1, 0, MAFW_SOURCE_PRIORITY_INTERACTIVE,
+				       token, (gpointer)partial_cb,
+				       (gpointer)metadatas_cb, NULL);
+	mafw_source_token_cancel(token);
+	mafw_source_token_unref(token);
+	while (Msrc_pending)
+		g_main_context_iteration(NULL, TRUE);
+	fail_if(Msrc_calls != 1);
+	fail_if(Msrc_cancelled != 1);
+
+	/* A cancelled browse session gives its turn to the next request,
+	 * although the source doesn't tell it's over. */
+	mafw_source_set_max_requests(src, 1);
+	g_string_truncate(results, 0);
+	Msrc_calls = 0;
+	browse_id = mafw_source_browse_full(src, "msrc::", FALSE, NULL, NULL,
+					    NULL, 0, 0,
+					    MAFW_SOURCE_PRIORITY_INTERACTIVE,
+					    (gpointer)silent_browse_cb, NULL);
+	mafw_source_get_metadata(src, "msrc::x",
+				 MAFW_SOURCE_LIST(MAFW_METADATA_KEY_TITLE),
+				 (gpointer)coalesced_cb, results);
+	fail_if(Msrc_calls != 0);
+	fail_if(!mafw_source_cancel_browse(src, browse_id, NULL));
+	fail_if(Msrc_browsing != 0);
+	fail_if(Msrc_calls != 1);
+	while (Msrc_pending)
+		g_main_context_iteration(NULL, TRUE);
+	fail_if(strcmp(results->str, "msrc::x:t "));
+	mafw_source_set_max_requests(src, 0);
+
+	g_string_free(results, TRUE);
+	g_object_unref(src);
+}
+END_TEST
+
 START_TEST(test_renderer)
 {
 	MafwRenderer *renderer = g_object_new(frenderer_get_type(),
@@ -319,18 +1354,82 @@ START_TEST(test_renderer)
 }
 END_TEST
 
+/* Count the callbacks, which may only report the timeout. */
+static void timed_play_cb(MafwRenderer *self, guint *calls,
+			  const GError *error)
+{
+	fail_if(!error);
+	fail_if(error->code != MAFW_EXTENSION_ERROR_EXTENSION_NOT_RESPONDING);
+	(*calls)++;
+}
+
+static void timed_pos_cb(MafwRenderer *self, gint position, guint *calls,
+			 const GError *error)
+{
+	fail_if(!error);
+	fail_if(error->code != MAFW_EXTENSION_ERROR_EXTENSION_NOT_RESPONDING);
+	(*calls)++;
+}
+
+START_TEST(test_renderer_timeout)
+{
+	MafwRenderer *renderer;
+	guint calls;
+
+	renderer = g_object_new(srenderer_get_type(), "uuid", "srnd", NULL);
+	mafw_extension_set_timeout(MAFW_EXTENSION(renderer), 100);
+
+	/* The renderer doesn't answer in time, and its late answer
+	 * is dropped. */
+	calls = 0;
+	mafw_renderer_play(renderer, (gpointer)timed_play_cb, &calls);
+	fail_if(Srenderer_cb == NULL);
+	while (!calls)
+		g_main_context_iteration(NULL, TRUE);
+	fail_if(mafw_extension_get_timeout_count(MAFW_EXTENSION(renderer))
+		!= 1);
+	((MafwRendererPlaybackCB)Srenderer_cb)(renderer, Srenderer_data,
+					       NULL);
+	fail_if(calls != 1);
+
+	calls = 0;
+	mafw_renderer_get_position(renderer, (gpointer)timed_pos_cb, &calls);
+	while (!calls)
+		g_main_context_iteration(NULL, TRUE);
+	fail_if(mafw_extension_get_timeout_count(MAFW_EXTENSION(renderer))
+		!= 2);
+	((MafwRendererPositionCB)Srenderer_cb)(renderer, 3, Srenderer_data,
+					       NULL);
+	fail_if(calls != 1);
+
+	g_object_unref(renderer);
+}
+END_TEST
+
 
 int main(void)
 {
 	TCase *tc;
 	Suite *suite;
 
+	if (!g_thread_supported())
+		g_thread_init(NULL);
+
 	suite = suite_create("MafwDefaults");
 	tc = tcase_create("Defaults");
 	suite_add_tcase(suite, tc);
 
 	if (1) tcase_add_test(tc, test_source);
+	if (1) tcase_add_test(tc, test_browse_chunked);
+	if (1) tcase_add_test(tc, test_cursor);
+	if (1) tcase_add_test(tc, test_coalescing);
+	if (1) tcase_add_test(tc, test_metadatas);
+	if (1) tcase_add_test(tc, test_timeout);
+	if (1) tcase_add_test(tc, test_threaded);
+	if (1) tcase_add_test(tc, test_scheduler);
+	if (1) tcase_add_test(tc, test_cancel);
 	if (1) tcase_add_test(tc, test_renderer);
+	if (1) tcase_add_test(tc, test_renderer_timeout);
 
 	return checkmore_run(srunner_create(suite), FALSE);
 }
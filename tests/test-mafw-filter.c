@@ -417,6 +417,286 @@ START_TEST(test_parse_to_string_copy)
 }
 END_TEST
 
+START_TEST(test_freeze)
+{
+	static const gchar *const filters[] = {
+		"(artist=belga)",
+		"(artist?)",
+		"(&(!(artist=\\28belga\\29))(|(genre=rock)(album?)))",
+		"(|(year<2000)(year>2005)(title~Sz\xc3\xa1m)(title=))",
+	};
+	MafwFilter *filter, *thawed;
+	gchar *stream, *str;
+	gsize sstream, i;
+	guint j;
+
+	for (j = 0; j < G_N_ELEMENTS(filters); j++) {
+		filter = mafw_filter_parse(filters[j]);
+		stream = mafw_filter_freeze(filter, &sstream);
+		fail_if(stream == NULL);
+		fail_unless(sstream <= strlen(filters[j]));
+
+		thawed = mafw_filter_thaw(stream, sstream);
+		fail_unless(mafw_filter_equal(filter, thawed));
+		str = mafw_filter_to_string(thawed);
+		fail_if(strcmp(str, filters[j]), "%s != %s", str, filters[j]);
+		g_free(str);
+		mafw_filter_free(thawed);
+
+		/* Truncated and overlong streams are rejected. */
+		for (i = 0; i < sstream; i++)
+			fail_if(mafw_filter_thaw(stream, i) != NULL);
+		stream = g_realloc(stream, sstream + 1);
+		fail_if(mafw_filter_thaw(stream, sstream + 1) != NULL);
+
+		g_free(stream);
+		mafw_filter_free(filter);
+	}
+
+	/* Programmatic exists filters get an empty value. */
+	filter = MAFW_FILTER_EXISTS("artist");
+	stream = mafw_filter_freeze(filter, &sstream);
+	thawed = mafw_filter_thaw(stream, sstream);
+	fail_unless(thawed->type == mafw_f_exists);
+	fail_if(strcmp(thawed->key, "artist"));
+	fail_if(thawed->value == NULL || thawed->value[0] != '\0');
+	g_free(stream);
+	mafw_filter_free(thawed);
+	mafw_filter_free(filter);
+
+	/* Incorrect filters and streams. */
+	filter = mafw_filter_parse("(&(genre=rock))");
+	filter->parts[0]->type = MAFW_F_COMPLEX;
+	fail_if(mafw_filter_freeze_bary(filter) != NULL);
+	mafw_filter_free(filter);
+	fail_if(mafw_filter_thaw("\x00", 1) != NULL);
+	fail_if(mafw_filter_thaw("\x04", 1) != NULL);
+	fail_if(mafw_filter_thaw("\x03\x02\x06\x01k\x00\x06\x01k\x00", 10));
+	fail_if(mafw_filter_thaw("\x06\x00\x00", 3) != NULL);
+	fail_if(mafw_filter_thaw("\x06\x01k\x01\x00", 5) != NULL);
+	fail_if(mafw_filter_thaw("\x05\x01k\x01v", 5) != NULL);
+	fail_if(mafw_filter_thaw("\x01\xff\xff\xff\xff\x0f", 6) != NULL);
+	thawed = mafw_filter_thaw("\x03\x01\x06\x01k\x01v", 7);
+	fail_if(thawed == NULL);
+	mafw_filter_free(thawed);
+}
+END_TEST
+
+START_TEST(test_canonical)
+{
+	MafwFilter *f1, *f2;
+	gchar *s1, *s2;
+
+	f1 = mafw_filter_parse("(&(type=audio)(|(artist=b)(artist=a))"
+			       "(!(&(year>1)(album?))))");
+	f2 = mafw_filter_parse("(&(!(&(album?)(year>1)))"
+			       "(|(artist=a)(artist=b))(type=audio))");
+	fail_if(mafw_filter_equal(f1, f2));
+	s1 = mafw_filter_to_string_canonical(f1);
+	s2 = mafw_filter_to_string_canonical(f2);
+	fail_if(strcmp(s1, s2), "%s != %s", s1, s2);
+	fail_if(strcmp(s1, "(&(!(&(album?)(year>1)))(type=audio)"
+		       "(|(artist=a)(artist=b)))"), "%s", s1);
+	g_free(s1);
+	g_free(s2);
+	mafw_filter_free(f2);
+
+	/* The original is left alone. */
+	s1 = mafw_filter_to_string(f1);
+	fail_if(strcmp(s1, "(&(type=audio)(|(artist=b)(artist=a))"
+		       "(!(&(year>1)(album?))))"), "%s", s1);
+	g_free(s1);
+	mafw_filter_free(f1);
+
+	f1 = MAFW_FILTER_OR(MAFW_FILTER_EXISTS("b*"),
+			    MAFW_FILTER_EQ("a", "(x)"));
+	s1 = mafw_filter_to_string_canonical(f1);
+	fail_if(strcmp(s1, "(|(a=\\28x\\29)(b\\2A?))"), "%s", s1);
+	g_free(s1);
+	mafw_filter_free(f1);
+
+	fail_if(mafw_filter_to_string_canonical(NULL) != NULL);
+}
+END_TEST
+
+START_TEST(test_compact)
+{
+	static char const *const good[] = {
+		"(artist=belga)",
+		"(album?)",
+		"(publication-year<1999)",
+		"(!(year>2004))",
+		"(&(!(artist=\\28belga\\29))(|(genre=rock)(album?)))",
+		"(|(id=a)(id=b)(id=c)(id=d)(&(x~y*)(z>1)))",
+		"(|(&(a=1)(b=2)(c=3))(!(d=4))(&(e=5)(|(f=6)(g=7)(h=8))))",
+	};
+	static char const *const bad[] = {
+		"=belga)",
+		"(&(foo=bar()(xxx>yyy",
+		"(title!=something)",
+		"(!(year>2004)(foo=bar))",
+		"((title=something))",
+	};
+	guint i;
+	MafwFilter *compact, *filter;
+	gchar *str, *str_compact;
+
+	for (i = 0; i < G_N_ELEMENTS(good); i++) {
+		filter = mafw_filter_parse(good[i]);
+		compact = mafw_filter_parse_compact(good[i]);
+		fail_if(!compact, "Could not parse %s", good[i]);
+		str = mafw_filter_to_string(filter);
+		str_compact = mafw_filter_to_string(compact);
+		fail_if(g_strcmp0(str, str_compact) != 0,
+			"%s and %s differ", str, str_compact);
+		g_free(str);
+		g_free(str_compact);
+		mafw_filter_free(filter);
+		mafw_filter_free_compact(compact);
+	}
+
+	for (i = 0; i < G_N_ELEMENTS(bad); i++)
+		fail_if(mafw_filter_parse_compact(bad[i]) != NULL,
+			"%s should not parse", bad[i]);
+
+	/* Structure and values are the same as with mafw_filter_parse(). */
+	compact = mafw_filter_parse_compact("(&(artist~bel\\2Aga)(year>2004))");
+	fail_unless(compact->type == mafw_f_and);
+	fail_unless(compact->parts[2] == NULL);
+	fail_unless(compact->parts[0]->type == mafw_f_approx);
+	fail_unless(!strcmp(compact->parts[0]->key, "artist"));
+	fail_unless(!strcmp(compact->parts[0]->value, "bel*ga"));
+	fail_unless(compact->parts[1]->type == mafw_f_gt);
+	fail_unless(!strcmp(compact->parts[1]->value, "2004"));
+	mafw_filter_free_compact(compact);
+
+	/* Improperly quoted values are dropped like in the regular parser. */
+	compact = mafw_filter_parse_compact("(artist=bel\\2G)");
+	fail_unless(compact != NULL);
+	fail_unless(compact->value == NULL);
+	mafw_filter_free_compact(compact);
+}
+END_TEST
+
+START_TEST(test_cache)
+{
+	MafwFilterCache *cache;
+	MafwFilter *built;
+	const MafwFilter *f1, *f2, *f3;
+	guint i;
+
+	/* Structural equality. */
+	built = MAFW_FILTER_AND(MAFW_FILTER_EQ("type", "audio"),
+				MAFW_FILTER_EXISTS("artist"));
+	f1 = mafw_filter_parse("(&(type=audio)(artist?))");
+	fail_unless(mafw_filter_equal(built, f1));
+	fail_unless(mafw_filter_hash(built) == mafw_filter_hash(f1));
+	mafw_filter_free((MafwFilter *)f1);
+	f1 = mafw_filter_parse("(&(artist?)(type=audio))");
+	fail_if(mafw_filter_equal(built, f1));
+	mafw_filter_free((MafwFilter *)f1);
+
+	cache = mafw_filter_cache_new(1);
+
+	/* Same string and equivalent filters yield the same instance. */
+	f1 = mafw_filter_cache_parse(cache, "(&(type=audio)(artist?))");
+	f2 = mafw_filter_cache_parse(cache, "(&(type=audio)(artist?))");
+	f3 = mafw_filter_cache_intern(cache, built);
+	fail_unless(f1 && f1 == f2 && f2 == f3);
+	fail_unless(mafw_filter_equal(f1, built));
+	f2 = mafw_filter_cache_parse(cache, "(&(type=\\61udio)(artist?))");
+	fail_unless(f1 == f2);
+	fail_if(mafw_filter_cache_parse(cache, "(type=audio"));
+
+	/* Referenced filters are not evicted even if the cache is full. */
+	f3 = mafw_filter_cache_parse(cache, "(type=video)");
+	fail_unless(f3 != NULL && f3 != f1);
+	fail_unless(f1 == mafw_filter_cache_parse(cache,
+						  "(&(type=audio)(artist?))"));
+	mafw_filter_cache_release(cache, f1);
+	mafw_filter_cache_release(cache, f1);
+	mafw_filter_cache_release(cache, f1);
+	mafw_filter_cache_release(cache, f1);
+	mafw_filter_cache_release(cache, f1);
+	mafw_filter_cache_release(cache, f3);
+
+	/* Only one of them should have survived, but lookups still work. */
+	f1 = mafw_filter_cache_intern(cache, built);
+	fail_unless(mafw_filter_equal(f1, built));
+	mafw_filter_cache_release(cache, f1);
+
+	/* Many spellings of the same filter share it, but the oldest
+	 * ones are forgotten. */
+	f1 = mafw_filter_cache_intern(cache, built);
+	for (i = 0; i < 32; i++) {
+		gchar *str;
+
+		str = g_strdup_printf("(&(type=%s%s%s%s%s)(artist?))",
+				      i & 1 ? "\\61" : "a",
+				      i & 2 ? "\\75" : "u",
+				      i & 4 ? "\\64" : "d",
+				      i & 8 ? "\\69" : "i",
+				      i & 16 ? "\\6F" : "o");
+		f2 = mafw_filter_cache_parse(cache, str);
+		fail_unless(f2 == f1, "%s is not shared", str);
+		mafw_filter_cache_release(cache, f2);
+		g_free(str);
+	}
+	fail_unless(f1 == mafw_filter_cache_parse(cache,
+						  "(&(type=audio)(artist?))"));
+	mafw_filter_cache_release(cache, f1);
+	mafw_filter_cache_release(cache, f1);
+
+	mafw_filter_free(built);
+	mafw_filter_cache_free(cache);
+}
+END_TEST
+
+START_TEST(test_glob)
+{
+	static struct {
+		const gchar *pattern, *str;
+		gboolean match;
+	} const cases[] = {
+		{ "foo",	"FOO",		TRUE  },
+		{ "foo",	"foobar",	FALSE },
+		{ "foo*",	"Foobar",	TRUE  },
+		{ "foo*",	"barfoo",	FALSE },
+		{ "*bar",	"fooBAR",	TRUE  },
+		{ "*bar",	"barfoo",	FALSE },
+		{ "*oba*",	"fooBar",	TRUE  },
+		{ "*oba*",	"fooar",	FALSE },
+		{ "*",		"",		TRUE  },
+		{ "**",		"anything",	TRUE  },
+		{ "",		"",		TRUE  },
+		{ "f*o*r",	"foobar",	TRUE  },
+		{ "f*o*r",	"foobaz",	FALSE },
+		{ "f?o",	"FOO",		TRUE  },
+		{ "f?o",	"fo",		FALSE },
+		{ "t*e",	"tralalae",	TRUE  },
+		/* Escaped wildcards are literals. */
+		{ "a\\2Ab",	"a*b",		TRUE  },
+		{ "a\\2Ab",	"axb",		FALSE },
+		{ "*\\3F",	"what?",	TRUE  },
+		{ "*\\3F",	"what!",	FALSE },
+		/* Unicode case folding; `?' is one character. */
+		{ "*\xc3\x89t\xc3\xa9*", "l'\xc3\xa9T\xc3\x89",	TRUE  },
+		{ "M?tley",	"M\xc3\xb6tley",	TRUE  },
+		{ "stra\xc3\x9f*", "STRASSE",	TRUE  },
+	};
+	guint i;
+	MafwFilterGlob *glob;
+
+	for (i = 0; i < G_N_ELEMENTS(cases); i++) {
+		glob = mafw_filter_glob_new(cases[i].pattern);
+		fail_if(mafw_filter_glob_match(glob, cases[i].str)
+			!= cases[i].match, "`%s' ~ `%s' should be %d",
+			cases[i].str, cases[i].pattern, cases[i].match);
+		mafw_filter_glob_free(glob);
+	}
+}
+END_TEST
+
 int main(void)
 {
 	TCase *tc;
@@ -438,6 +718,11 @@ int main(void)
 	tcase_add_test(tc, test_build_sql);
 	tcase_add_test(tc, test_build_url);
 	tcase_add_test(tc, test_parse_to_string_copy);
+	tcase_add_test(tc, test_freeze);
+	tcase_add_test(tc, test_canonical);
+	tcase_add_test(tc, test_compact);
+	tcase_add_test(tc, test_cache);
+	tcase_add_test(tc, test_glob);
 	suite_add_tcase(suite, tc);
 
 	return checkmore_run(srunner_create(suite), FALSE);
@@ -0,0 +1,218 @@
+/*
+ * This file is a part of MAFW
+ *
+ * Copyright (C) 2007, 2008, 2009 Nokia Corporation, all rights reserved.
+ *
+ * Contact: Visa Smolander <visa.smolander@nokia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "checkmore.h"
+#include <libmafw/mafw-metadata-sort.h>
+#include <libmafw/mafw-metadata.h>
+#include <libmafw/mafw-filter.h>
+
+/* Helpers {{{ */
+static const gchar *const Artists[] = {
+	"Belga", "Betlehem", "Kispál", "Quimby", "Zorán",
+};
+
+/* Creates $n metadata tables, some of them NULL. */
+static GHashTable **populate(guint n)
+{
+	GHashTable **mds;
+	guint i;
+
+	mds = g_new(GHashTable *, n);
+	for (i = 0; i < n; i++) {
+		gchar *title;
+
+		if (i % 97 == 0) {
+			mds[i] = NULL;
+			continue;
+		}
+		mds[i] = mafw_metadata_new();
+		if (i % 11)
+			mafw_metadata_add_str(mds[i], "artist",
+					      Artists[i % G_N_ELEMENTS(Artists)]);
+		title = g_strdup_printf("Track %05u", (i * 7919) % n);
+		mafw_metadata_add_str(mds[i], "title", title);
+		g_free(title);
+		mafw_metadata_add_int(mds[i], "year", 1980 + i % 30);
+	}
+	return mds;
+}
+
+static void release(GHashTable **mds, guint n)
+{
+	guint i;
+
+	for (i = 0; i < n; i++)
+		mafw_metadata_release(mds[i]);
+	g_free(mds);
+}
+
+struct result {
+	gboolean called;
+	GArray *indices;
+};
+
+static void got_result(const guint *indices, guint nindices,
+		       struct result *res)
+{
+	fail_if(res->called);
+	res->called = TRUE;
+	res->indices = g_array_new(FALSE, FALSE, sizeof(guint));
+	g_array_append_vals(res->indices, indices, nindices);
+	checkmore_stop_loop();
+}
+
+static gint compare_indices(const guint *lhs, const guint *rhs,
+			    GHashTable **mds, gchar **terms)
+{
+	return mafw_metadata_compare(mds[*lhs], mds[*rhs],
+				     (const gchar *const *)terms, NULL);
+}
+
+static GHashTable **Ref_mds;
+static gchar **Ref_terms;
+
+static gint compare_ref(gconstpointer lhs, gconstpointer rhs,
+			gpointer unused)
+{
+	return compare_indices(lhs, rhs, Ref_mds, Ref_terms);
+}
+
+/* Checks that mafw_metadata_sort_async() returns the same as filtering
+ * and (stable) sorting $mds synchronously. */
+static void check_sort(GHashTable **mds, guint n, const gchar *filter_str,
+		       const gchar *sorting)
+{
+	MafwFilter *filter;
+	struct result res;
+	GArray *exp;
+	guint i;
+
+	filter = filter_str ? mafw_filter_parse(filter_str) : NULL;
+	fail_if(filter_str && !filter);
+
+	exp = g_array_new(FALSE, FALSE, sizeof(guint));
+	for (i = 0; i < n; i++)
+		if (mafw_metadata_filter(mds[i], filter, NULL))
+			g_array_append_val(exp, i);
+	if (sorting) {
+		Ref_mds = mds;
+		Ref_terms = mafw_metadata_sorting_terms(sorting);
+		g_qsort_with_data(exp->data, exp->len, sizeof(guint),
+				  compare_ref, NULL);
+		g_strfreev(Ref_terms);
+	}
+
+	memset(&res, 0, sizeof(res));
+	fail_if(!mafw_metadata_sort_async(mds, n, filter, sorting, NULL, NULL,
+					  (MafwMetadataSortCb)got_result,
+					  &res));
+	mafw_filter_free(filter);
+	checkmore_spin_loop(-1);
+
+	fail_unless(res.called);
+	fail_if(res.indices->len != exp->len);
+	fail_if(memcmp(res.indices->data, exp->data,
+		       sizeof(guint) * exp->len));
+	g_array_free(res.indices, TRUE);
+	g_array_free(exp, TRUE);
+}
+/* }}} */
+
+/* test_sort() {{{ */
+START_TEST(test_sort)
+{
+	GHashTable **mds;
+	guint n;
+
+	n = 20000;
+	mds = populate(n);
+	check_sort(mds, n, NULL, NULL);
+	check_sort(mds, n, "(year>1995)", NULL);
+	check_sort(mds, n, NULL, "+title");
+	check_sort(mds, n, "(year>1995)", "-artist,+year");
+	check_sort(mds, n, "(|(artist=Belga)(artist=Quimby))", "+year");
+	check_sort(mds, n, "(title=nothing)", "+title");
+
+	/* Less than a chunk */
+	check_sort(mds, 100, NULL, "+artist,-title");
+	check_sort(mds, 0, NULL, "+artist");
+	release(mds, n);
+}
+END_TEST
+/* }}} */
+
+/* test_cancel() {{{ */
+static gboolean stop_loop(gpointer unused)
+{
+	checkmore_stop_loop();
+	return FALSE;
+}
+
+START_TEST(test_cancel)
+{
+	GHashTable **mds;
+	MafwMetadataSort *op;
+	struct result res;
+	guint n;
+
+	n = 20000;
+	mds = populate(n);
+
+	/* The callback must not be called after cancellation, and
+	 * the tables may be released right away. */
+	memset(&res, 0, sizeof(res));
+	op = mafw_metadata_sort_async(mds, n, NULL, "+title", NULL, NULL,
+				      (MafwMetadataSortCb)got_result, &res);
+	fail_if(!op);
+	mafw_metadata_sort_cancel(op);
+	release(mds, n);
+
+	g_timeout_add(200, stop_loop, NULL);
+	checkmore_spin_loop(-1);
+	fail_if(res.called);
+}
+END_TEST
+/* }}} */
+
+/* main() {{{ */
+int main(void)
+{
+	Suite *suite;
+
+	if (!g_thread_supported())
+		g_thread_init(NULL);
+
+	suite = suite_create("MafwMetadataSort");
+	if (1)	checkmore_add_tcase(suite, "filter and sort", test_sort);
+	if (1)	checkmore_add_tcase(suite, "cancellation", test_cancel);
+
+	return checkmore_run(srunner_create(suite), FALSE);
+} /* }}} */
+
+/* vi: set noexpandtab ts=8 sw=8 cino=t0,(0 foldmethod=marker: */
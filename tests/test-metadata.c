@@ -28,6 +28,7 @@
 #include "libmafw/mafw-source.h"
 #include "libmafw/mafw-metadata.h"
 #include "libmafw/mafw-filter.h"
+#include "libmafw/mafw-metadata-serializer.h"
 
 #include "checkmore.h"
 
@@ -497,10 +498,12 @@ static void check_relevant_keys(const gchar *const *keys,
 			  const gchar *filter_str,
 			  const gchar *const *exp)
 {
-	guint i, o;
+	guint i, o, nviews;
 	const gchar **ret;
 	gchar **sorting;
 	MafwFilter *filter;
+	MafwMetadataKeyView views[8];
+	const gchar *const *wanted = exp;
 
 	filter = filter_str ? mafw_filter_parse(filter_str) : NULL;
 	sorting = mafw_metadata_sorting_terms(sorting_str);
@@ -518,6 +521,24 @@ static void check_relevant_keys(const gchar *const *keys,
 	}
 
 	g_free(ret);
+
+	/* The same without allocation. */
+	nviews = mafw_metadata_relevant_keys_view(keys, filter, sorting_str,
+						  views, G_N_ELEMENTS(views));
+	fail_if(nviews != g_strv_length((gchar **)wanted));
+	for (i = 0; wanted[i]; i++) {
+		for (o = 0; o < nviews; o++)
+			if (views[o].len == strlen(wanted[i])
+			    && !strncmp(views[o].key, wanted[i],
+					views[o].len))
+				break;
+		fail_if(o == nviews, "%s is missing", wanted[i]);
+	}
+	if (nviews > 2)
+		fail_if(mafw_metadata_relevant_keys_view(keys, filter,
+							 sorting_str,
+							 views, 2) != 3);
+
 	mafw_filter_free(filter);
 	g_strfreev(sorting);
 }
@@ -542,6 +563,31 @@ START_TEST(test_relevant_keys)
 	check_relevant_keys(keys, "gamma", "(delta=10)",
 			    MAFW_SOURCE_LIST("alpha", "beta",
 					     "gamma", "delta"));
+	check_relevant_keys(NULL, "+gamma,-alpha", "(&(alpha=0)(zeta=1))",
+			    MAFW_SOURCE_LIST("alpha", "gamma", "zeta"));
+}
+END_TEST
+
+START_TEST(test_sorting_terms_view)
+{
+	MafwMetadataKeyView terms[2];
+
+	fail_if(mafw_metadata_sorting_terms_view(NULL, terms, 2) != 0);
+	fail_if(mafw_metadata_sorting_terms_view("", terms, 2) != 0);
+
+	fail_if(mafw_metadata_sorting_terms_view("+alpha,-beta", terms, 2)
+		!= 2);
+	fail_if(terms[0].order != 1 || terms[0].len != 5
+		|| strncmp(terms[0].key, "alpha", 5));
+	fail_if(terms[1].order != -1 || terms[1].len != 4
+		|| strcmp(terms[1].key, "beta"));
+
+	/* Terms which don't fit are counted only. */
+	fail_if(mafw_metadata_sorting_terms_view("-a,b,,+c", terms, 2) != 4);
+	fail_if(terms[0].order != -1 || terms[0].len != 1);
+	fail_if(terms[1].order != 0 || terms[1].len != 1
+		|| terms[1].key[0] != 'b');
+	fail_if(mafw_metadata_sorting_terms_view("-a,b,,+c", NULL, 0) != 4);
 }
 END_TEST
 /* }}} */
@@ -598,6 +644,61 @@ START_TEST(test_filter)
 END_TEST
 /* }}} */
 
+/* test_filter_batch() {{{ */
+START_TEST(test_filter_batch)
+{
+	static const gchar *const filters[] = {
+		"(alpha=10)", "(alpha>30)", "(alpha<15)", "(beta~t*e)",
+		"(beta=TWO)", "(beta<threee)", "(gamma?)", "(berta=one)",
+		"(&(alpha=10)(beta=one))", "(&(alpha=15)(berta=one))",
+		"(|(alpha=15)(beta=one))", "(|(alpha=15)(berta=ohne))",
+		"(!(alpha=15))", "(!(alpha=10))", "(!(berta=1))",
+		"(&(|(alpha>5)(gamma?))(!(beta~*o*)))",
+	};
+	GHashTable *mds[100];
+	guint i, j;
+
+	/* Make up various tables, a few of them NULL or empty,
+	 * with some keys being ints in one and strings in the other. */
+	for (i = 0; i < G_N_ELEMENTS(mds); i++) {
+		if (i % 17 == 0) {
+			mds[i] = NULL;
+			continue;
+		}
+		mds[i] = mafw_metadata_new();
+		if (i % 3)
+			mafw_metadata_add_int(mds[i], "alpha", i % 20, i % 40);
+		if (i % 5 == 1)
+			mafw_metadata_add_str(mds[i], "beta", "one", "two");
+		else if (i % 5 == 2)
+			mafw_metadata_add_str(mds[i], "beta", "three");
+		else if (i % 5 == 3)
+			mafw_metadata_add_int(mds[i], "beta", 3);
+		if (i % 7 == 0)
+			mafw_metadata_add_str(mds[i], "gamma", "x");
+	}
+
+	for (i = 0; i < G_N_ELEMENTS(filters); i++) {
+		MafwFilter *filter;
+		gulong *bitmap;
+
+		filter = mafw_filter_parse(filters[i]);
+		bitmap = mafw_metadata_filter_batch(mds, G_N_ELEMENTS(mds),
+						    filter, NULL);
+		for (j = 0; j < G_N_ELEMENTS(mds); j++)
+			fail_if(MAFW_METADATA_BITMAP_TEST(bitmap, j)
+				!= mafw_metadata_filter(mds[j], filter, NULL),
+				"%s differs at %u", filters[i], j);
+		g_free(bitmap);
+		mafw_filter_free(filter);
+	}
+
+	for (i = 0; i < G_N_ELEMENTS(mds); i++)
+		mafw_metadata_release(mds[i]);
+}
+END_TEST
+/* }}} */
+
 /* test_compare() {{{ */
 START_TEST(test_compare)
 {
@@ -688,6 +789,319 @@ START_TEST(test_compare)
 END_TEST
 /* }}} */
 
+/* test_copy() {{{ */
+START_TEST(test_copy)
+{
+	GHashTable *md1, *md2, *md3;
+	GValueArray *artist;
+
+	md1 = mafw_metadata_new();
+	mafw_metadata_add_str(md1, "artist", "Belga");
+	mafw_metadata_add_int(md1, "year", 2002);
+	artist = g_hash_table_lookup(md1, "artist");
+
+	/* Copies share the values. */
+	md2 = mafw_metadata_copy(md1);
+	md3 = mafw_metadata_copy(md2);
+	fail_if(g_hash_table_size(md2) != 2);
+	fail_unless(g_hash_table_lookup(md2, "artist") == artist);
+	fail_unless(g_hash_table_lookup(md3, "artist") == artist);
+
+	/* Modification unshares only the modified value. */
+	mafw_metadata_add_str(md2, "artist", "Quimby");
+	fail_if(g_hash_table_lookup(md2, "artist") == artist);
+	fail_if(mafw_metadata_nvalues(g_hash_table_lookup(md2, "artist"))
+		!= 2);
+	fail_if(mafw_metadata_nvalues(artist) != 1);
+	fail_unless(g_hash_table_lookup(md2, "year")
+		    == g_hash_table_lookup(md1, "year"));
+
+	/* Values outlive the table they were created in. */
+	mafw_metadata_release(md1);
+	fail_unless(g_hash_table_lookup(md3, "artist") == artist);
+	fail_if(strcmp(g_value_get_string(mafw_metadata_first(md3, "artist")),
+		       "Belga"));
+
+	/* The last owner may modify it in place. */
+	fail_unless(mafw_metadata_writable(md3, "artist") == artist);
+	fail_if(mafw_metadata_writable(md3, "title") != NULL);
+	mafw_metadata_add_str(md3, "artist", "Zorán");
+	fail_unless(g_hash_table_lookup(md3, "artist") == artist);
+	fail_if(mafw_metadata_nvalues(artist) != 2);
+
+	fail_if(mafw_metadata_copy(NULL) != NULL);
+	mafw_metadata_release(md2);
+	mafw_metadata_release(md3);
+
+	/* Tables freeing their values themselves are copied deeply. */
+	md1 = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+				    (GDestroyNotify)g_value_array_free);
+	mafw_metadata_add_str(md1, "artist", "Belga");
+	artist = g_hash_table_lookup(md1, "artist");
+	md2 = mafw_metadata_copy(md1);
+	fail_if(g_hash_table_lookup(md2, "artist") == artist);
+	g_hash_table_destroy(md1);
+	fail_if(strcmp(g_value_get_string(mafw_metadata_first(md2, "artist")),
+		       "Belga"));
+	md3 = mafw_metadata_copy(md2);
+	fail_unless(g_hash_table_lookup(md3, "artist")
+		    == g_hash_table_lookup(md2, "artist"));
+	mafw_metadata_release(md2);
+	mafw_metadata_release(md3);
+}
+END_TEST
+/* }}} */
+
+/* test_intern() {{{ */
+START_TEST(test_intern)
+{
+	GHashTable *mds[3], *thawed;
+	const gchar *belga;
+	GValue gv = { 0 };
+	gchar *stream;
+	gsize sstream, nbytes, saved;
+	guint i, nstrings;
+
+	mafw_metadata_set_interned("artist", TRUE);
+	for (i = 0; i < G_N_ELEMENTS(mds); i++) {
+		mds[i] = mafw_metadata_new();
+		mafw_metadata_add_str(mds[i], "artist", "Belga");
+		mafw_metadata_add_str(mds[i], "title", "Nehéz");
+	}
+	mafw_metadata_add_str(mds[0], "artist", "Quimby");
+
+	/* Only the artists are shared. */
+	belga = g_value_get_string(mafw_metadata_first(mds[0], "artist"));
+	for (i = 1; i < G_N_ELEMENTS(mds); i++) {
+		fail_unless(g_value_get_string(mafw_metadata_first(
+					mds[i], "artist")) == belga);
+		fail_if(g_value_get_string(mafw_metadata_first(mds[i],
+							       "title"))
+			== g_value_get_string(mafw_metadata_first(mds[0],
+								  "title")));
+	}
+	mafw_metadata_intern_stats(&nstrings, &nbytes, &saved);
+	fail_if(nstrings != 2);
+	fail_if(nbytes != sizeof("Belga") + sizeof("Quimby"));
+	fail_if(saved != 2 * sizeof("Belga"));
+
+	/* Strings in GValues, deserialization and unsharing. */
+	g_value_init(&gv, G_TYPE_STRING);
+	g_value_set_string(&gv, "Quimby");
+	mafw_metadata_add_val(mds[1], "artist", &gv);
+	g_value_unset(&gv);
+	fail_unless(g_value_get_string(g_value_array_get_nth(
+			g_hash_table_lookup(mds[1], "artist"), 1))
+		    == g_value_get_string(g_value_array_get_nth(
+			g_hash_table_lookup(mds[0], "artist"), 1)));
+
+	stream = mafw_metadata_freeze(mds[0], &sstream);
+	thawed = mafw_metadata_thaw(stream, sstream);
+	g_free(stream);
+	fail_unless(g_value_get_string(mafw_metadata_first(thawed, "artist"))
+		    == belga);
+
+	mafw_metadata_release(mds[2]);
+	mds[2] = mafw_metadata_copy(thawed);
+	mafw_metadata_add_str(mds[2], "artist", "Zorán");
+	fail_unless(g_value_get_string(mafw_metadata_first(mds[2], "artist"))
+		    == belga);
+
+	/* Everything is given back. */
+	mafw_metadata_intern_stats(&nstrings, NULL, NULL);
+	fail_if(nstrings != 3);
+	mafw_metadata_release(thawed);
+	for (i = 0; i < G_N_ELEMENTS(mds); i++)
+		mafw_metadata_release(mds[i]);
+	mafw_metadata_intern_stats(&nstrings, &nbytes, &saved);
+	fail_if(nstrings || nbytes || saved);
+
+	/* Disabled again. */
+	mafw_metadata_set_interned("artist", FALSE);
+	mds[0] = mafw_metadata_new();
+	mafw_metadata_add_str(mds[0], "artist", "Belga");
+	mafw_metadata_intern_stats(&nstrings, NULL, NULL);
+	fail_if(nstrings != 0);
+	mafw_metadata_release(mds[0]);
+}
+END_TEST
+/* }}} */
+
+/* test_memory() {{{ */
+START_TEST(test_memory)
+{
+	GHashTable *md, *copy, *mds;
+	gsize size, nbytes0, nbytes, i;
+	guint nvalues0, nvalues;
+	gchar *stream;
+	GByteArray *bary;
+	gpointer val;
+
+	mafw_metadata_memory_stats(&nvalues0, &nbytes0);
+
+	md = mafw_metadata_new();
+	mafw_metadata_add_str(md, "artist", "Belga");
+	mafw_metadata_add_int(md, "year", 2002, 2003);
+	size = mafw_metadata_val_size(g_hash_table_lookup(md, "artist"));
+	fail_if(size != sizeof(GValueArray) + sizeof(GValue)
+		+ sizeof("Belga"));
+	size += mafw_metadata_val_size(g_hash_table_lookup(md, "year"));
+	fail_if(mafw_metadata_val_size(g_hash_table_lookup(md, "year"))
+		!= sizeof(GValueArray) + 2 * sizeof(GValue));
+	fail_if(mafw_metadata_size(md) < size + sizeof("artist")
+		+ sizeof("year"));
+
+	mafw_metadata_memory_stats(&nvalues, &nbytes);
+	fail_if(nvalues != nvalues0 + 2);
+	fail_if(nbytes != nbytes0 + size);
+
+	/* Maps of tables */
+	mds = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+				    (GDestroyNotify)mafw_metadata_release);
+	g_hash_table_insert(mds, g_strdup("oid::1"), md);
+	g_hash_table_insert(mds, g_strdup("oid::2"), NULL);
+	fail_if(mafw_metadata_map_size(mds) <= mafw_metadata_size(md));
+
+	/* Copying doesn't take more until the values are modified. */
+	copy = mafw_metadata_copy(md);
+	mafw_metadata_memory_stats(&nvalues, &nbytes);
+	fail_if(nvalues != nvalues0 + 2);
+	mafw_metadata_add_str(copy, "artist", "Quimby");
+	mafw_metadata_memory_stats(&nvalues, &nbytes);
+	fail_if(nvalues != nvalues0 + 3);
+	fail_if(nbytes != nbytes0 + size
+		+ mafw_metadata_val_size(g_hash_table_lookup(copy, "artist")));
+
+	/* Deserialized values are counted as well. */
+	stream = mafw_metadata_freeze(copy, &size);
+	mafw_metadata_release(copy);
+	copy = mafw_metadata_thaw(stream, size);
+	g_free(stream);
+	mafw_metadata_memory_stats(&nvalues, NULL);
+	fail_if(nvalues != nvalues0 + 4);
+
+	/* Except single values, which the caller frees with
+	 * g_value_array_free(). */
+	bary = g_byte_array_new();
+	mafw_metadata_val_freeze_bary(bary, g_hash_table_lookup(md, "year"));
+	i = 0;
+	val = mafw_metadata_val_thaw_bary(bary, &i);
+	g_value_array_free(val);
+	g_byte_array_free(bary, TRUE);
+	mafw_metadata_memory_stats(&nvalues, NULL);
+	fail_if(nvalues != nvalues0 + 4);
+
+	mafw_metadata_release(copy);
+	g_hash_table_unref(mds);
+	mafw_metadata_memory_stats(&nvalues, &nbytes);
+	fail_if(nvalues != nvalues0);
+	fail_if(nbytes != nbytes0);
+}
+END_TEST
+/* }}} */
+
+/* test_typed() {{{ */
+START_TEST(test_typed)
+{
+	GHashTable *md, *copy;
+	gpointer vals;
+	const gchar *str;
+	guint nvalues0, nvalues;
+	gsize nbytes0, nbytes;
+
+	mafw_metadata_memory_stats(&nvalues0, &nbytes0);
+
+	md = mafw_metadata_new();
+	mafw_metadata_add_int(md, "year", 2002, 2003);
+	mafw_metadata_add_str(md, "artist", "Belga");
+
+	/* Getters */
+	fail_if(mafw_metadata_get_int(md, "year", -1) != 2002);
+	fail_if(mafw_metadata_get_int(md, "track", -1) != -1);
+	fail_if(mafw_metadata_get_uint(md, "year", 7) != 7);
+	fail_if(strcmp(mafw_metadata_get_str(md, "artist"), "Belga"));
+	fail_if(mafw_metadata_get_str(md, "year") != NULL);
+	fail_if(mafw_metadata_get_str(md, "album") != NULL);
+
+	/* Setting replaces all values. */
+	mafw_metadata_set_int(md, "year", 1999);
+	fail_if(mafw_metadata_nvalues(g_hash_table_lookup(md, "year")) != 1);
+	fail_if(mafw_metadata_get_int(md, "year", -1) != 1999);
+
+	/* A single value of the same type is overwritten in place. */
+	vals = g_hash_table_lookup(md, "year");
+	mafw_metadata_set_int(md, "year", 2000);
+	fail_if(g_hash_table_lookup(md, "year") != vals);
+	fail_if(mafw_metadata_get_int(md, "year", -1) != 2000);
+
+	/* Different type */
+	mafw_metadata_set_double(md, "year", 2000.5);
+	fail_if(mafw_metadata_get_int(md, "year", -1) != -1);
+	fail_if(mafw_metadata_get_double(md, "year", 0) != 2000.5);
+
+	mafw_metadata_set_uint(md, "track", 3);
+	mafw_metadata_set_long(md, "duration", 240);
+	mafw_metadata_set_ulong(md, "filesize", 4096);
+	mafw_metadata_set_int64(md, "added", -5);
+	mafw_metadata_set_uint64(md, "modified", 10);
+	mafw_metadata_set_boolean(md, "is-seekable", TRUE);
+	fail_if(mafw_metadata_get_uint(md, "track", 0) != 3);
+	fail_if(mafw_metadata_get_long(md, "duration", 0) != 240);
+	fail_if(mafw_metadata_get_ulong(md, "filesize", 0) != 4096);
+	fail_if(mafw_metadata_get_int64(md, "added", 0) != -5);
+	fail_if(mafw_metadata_get_uint64(md, "modified", 0) != 10);
+	fail_if(!mafw_metadata_get_boolean(md, "is-seekable", FALSE));
+
+	/* Shared values are not modified. */
+	copy = mafw_metadata_copy(md);
+	mafw_metadata_set_str(copy, "artist", "Quimby");
+	mafw_metadata_set_int(copy, "track", 4);
+	fail_if(strcmp(mafw_metadata_get_str(md, "artist"), "Belga"));
+	fail_if(strcmp(mafw_metadata_get_str(copy, "artist"), "Quimby"));
+	fail_if(mafw_metadata_get_uint(md, "track", 0) != 3);
+	fail_if(mafw_metadata_get_int(copy, "track", 0) != 4);
+
+	/* Setting a string to itself. */
+	mafw_metadata_set_str(copy, "artist",
+			      mafw_metadata_get_str(copy, "artist"));
+	fail_if(strcmp(mafw_metadata_get_str(copy, "artist"), "Quimby"));
+
+	/* Interned strings */
+	mafw_metadata_set_interned("genre", TRUE);
+	mafw_metadata_set_str(md, "genre", "Rock");
+	mafw_metadata_set_str(copy, "genre", "Rock");
+	fail_if(mafw_metadata_get_str(md, "genre")
+		!= mafw_metadata_get_str(copy, "genre"));
+	mafw_metadata_set_str(copy, "genre",
+			      mafw_metadata_get_str(copy, "genre"));
+	fail_if(strcmp(mafw_metadata_get_str(copy, "genre"), "Rock"));
+	mafw_metadata_set_str(copy, "genre", "Jazz");
+	fail_if(strcmp(mafw_metadata_get_str(md, "genre"), "Rock"));
+	mafw_metadata_set_interned("genre", FALSE);
+	mafw_metadata_set_str(md, "genre", "Blues");
+	str = mafw_metadata_get_str(md, "genre");
+	fail_if(strcmp(str, "Blues"));
+
+	mafw_metadata_release(copy);
+	mafw_metadata_release(md);
+	mafw_metadata_memory_stats(&nvalues, &nbytes);
+	fail_if(nvalues != nvalues0);
+	fail_if(nbytes != nbytes0);
+
+	/* Getters don't look at the values of a key having none. */
+	md = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+				   (GDestroyNotify)g_value_array_free);
+	g_hash_table_insert(md, "year", g_value_array_new(0));
+	fail_if(mafw_metadata_get_int(md, "year", -1) != -1);
+	fail_if(mafw_metadata_get_str(md, "year") != NULL);
+	g_hash_table_destroy(md);
+	mafw_metadata_memory_stats(&nvalues, &nbytes);
+	fail_if(nvalues != nvalues0);
+	fail_if(nbytes != nbytes0);
+}
+END_TEST
+/* }}} */
+
 int main(void)
 { /* {{{ */
 	TCase *tc;
@@ -720,10 +1134,21 @@ if (1){	tc = tcase_create("multivalued metadata");
 
 	if (1)	checkmore_add_tcase(suite, "getting relevant keys",
 				    test_relevant_keys);
+	if (1)	checkmore_add_tcase(suite, "splitting sorting terms",
+				    test_sorting_terms_view);
 	if (1)	checkmore_add_tcase(suite, "filter by metadata",
 				    test_filter);
+	if (1)	checkmore_add_tcase(suite, "batch filter by metadata",
+				    test_filter_batch);
 	if (1)	checkmore_add_tcase(suite, "sort by metadata",
 				    test_compare);
+	if (1)	checkmore_add_tcase(suite, "copy-on-write metadata",
+				    test_copy);
+	if (1)	checkmore_add_tcase(suite, "string interning",
+				    test_intern);
+	if (1)	checkmore_add_tcase(suite, "memory accounting",
+				    test_memory);
+	if (1)	checkmore_add_tcase(suite, "typed accessors", test_typed);
 
 	return checkmore_run(srunner_create(suite), FALSE);
 } /* }}} */
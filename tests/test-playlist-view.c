@@ -0,0 +1,428 @@
+/*
+ * This file is a part of MAFW
+ *
+ * Copyright (C) 2007, 2008, 2009 Nokia Corporation, all rights reserved.
+ *
+ * Contact: Visa Smolander <visa.smolander@nokia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+
+#include <string.h>
+#include "checkmore.h"
+
+#include <libmafw/mafw.h>
+#include <libmafw/mafw-uri-source.h>
+
+/* A playlist of PLS_SIZE items. */
+typedef struct {
+	GObjectClass parent;
+} DumbPlsClass;
+
+typedef struct {
+	GObject parent;
+} DumbPls;
+
+#define PLS_SIZE 100
+#define OID_PREFIX MAFW_URI_SOURCE_UUID "::" "file:///"
+
+/* If set, the odd items are from a source not registered. */
+static gboolean Mixed;
+
+static gchar *dumbpls_get_item(MafwPlaylist *pls, guint index, GError **errp)
+{
+	if (index >= PLS_SIZE)
+		return NULL;
+	if (Mixed && index % 2)
+		return g_strdup_printf("nosuchsource::%u", index);
+	return g_strdup_printf(OID_PREFIX "%u", index);
+}
+static guint dumbpls_get_size(MafwPlaylist *pls, GError **errp)
+{
+	return PLS_SIZE;
+}
+static GType dumbpls_get_type(void);
+static void dumbpls_init(DumbPls *obj) {/* NOP */}
+static void dumbpls_class_init(DumbPlsClass *cls)
+{
+	GObjectClass *ocls;
+
+	ocls = G_OBJECT_CLASS(cls);
+	ocls->set_property = (gpointer)0xfafafafa;
+	ocls->get_property = (gpointer)0xdededede;
+	g_object_class_override_property(ocls, 1, "name");
+	g_object_class_override_property(ocls, 1, "repeat");
+	g_object_class_override_property(ocls, 1, "is-shuffled");
+}
+static void dumbpls_iface_init(MafwPlaylistIface *iface)
+{
+	iface->get_item = dumbpls_get_item;
+	iface->get_size = dumbpls_get_size;
+}
+
+G_DEFINE_TYPE_WITH_CODE(DumbPls, dumbpls, G_TYPE_OBJECT,
+			G_IMPLEMENT_INTERFACE(MAFW_TYPE_PLAYLIST,
+					      dumbpls_iface_init));
+
+/* URI source hook, counting the requests. */
+static void (*Old_md)(MafwSource *self,
+		      const gchar *object_id,
+		      const gchar *const *mdkeys,
+		      MafwSourceMetadataResultCb cb,
+		      gpointer user_data);
+static guint Old_md_called;
+
+static void mymd(MafwSource *self,
+		 const gchar *object_id,
+		 const gchar *const *mdkeys,
+		 MafwSourceMetadataResultCb cb,
+		 gpointer user_data)
+{
+	Old_md_called++;
+	Old_md(self, object_id, mdkeys, cb, user_data);
+}
+
+/* get_metadatas() for the URI source, counting the requests and the
+ * objects asked. */
+static guint Mds_called, Mds_objects;
+
+static void mymds(MafwSource *self, const gchar **object_ids,
+		  const gchar *const *mdkeys,
+		  MafwSourceMetadataResultsCb cb, gpointer user_data)
+{
+	GHashTable *results, *md;
+	guint i;
+
+	Mds_called++;
+	results = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+					(GDestroyNotify)mafw_metadata_release);
+	for (i = 0; object_ids[i]; i++, Mds_objects++) {
+		md = mafw_metadata_new();
+		mafw_metadata_add_str(md, MAFW_METADATA_KEY_URI,
+				      object_ids[i]
+				      + strlen(MAFW_URI_SOURCE_UUID "::"));
+		g_hash_table_insert(results, g_strdup(object_ids[i]), md);
+	}
+	cb(self, results, user_data, NULL);
+	g_hash_table_unref(results);
+}
+
+/* The rows shown, in order. */
+static MafwPlaylist *Pls;
+static MafwPlaylistView *View;
+static GArray *Shown;
+
+static void itemcb(MafwPlaylist *pls, guint idx, const gchar *oid,
+		   GHashTable *md, gpointer _)
+{
+	gchar *uri;
+	GValue *vuri;
+
+	fail_unless(pls == Pls);
+	fail_unless(md != NULL);
+	vuri = mafw_metadata_first(md, MAFW_METADATA_KEY_URI);
+	fail_unless(vuri != NULL);
+	uri = g_strdup_printf("file:///%u", idx);
+	fail_if(strcmp(g_value_get_string(vuri), uri));
+	g_free(uri);
+	g_array_append_val(Shown, idx);
+}
+
+static void new_view(guint prefetch, guint cache_size)
+{
+	View = mafw_playlist_view_new(Pls,
+				      MAFW_SOURCE_LIST(MAFW_METADATA_KEY_URI),
+				      prefetch, cache_size, itemcb, NULL);
+	fail_unless(View != NULL);
+}
+
+/* Checks that the rows [$first, $first + $count) have been shown since
+ * the last call, in any order. */
+static void shown(guint first, guint count)
+{
+	guint i, j;
+
+	fail_unless(Shown->len == count, "%u != %u", Shown->len, count);
+	for (i = first; i < first + count; i++) {
+		for (j = 0; j < Shown->len; j++)
+			if (g_array_index(Shown, guint, j) == i)
+				break;
+		fail_unless(j < Shown->len, "%u not shown", i);
+	}
+	g_array_set_size(Shown, 0);
+}
+
+/* Test cases. */
+START_TEST(test_window)
+{
+	const gchar *oid;
+	GHashTable *md;
+
+	/* The window and the next five rows are fetched. */
+	new_view(5, 0);
+	mafw_playlist_view_set_window(View, 0, 5);
+	checkmore_spin_loop(50);
+	shown(0, 5);
+	fail_unless(Old_md_called == 10);
+
+	fail_unless(mafw_playlist_view_get_row(View, 7, &oid, &md));
+	fail_unless(!strcmp(oid, OID_PREFIX "7"));
+	fail_unless(md != NULL);
+	fail_if(mafw_playlist_view_get_row(View, 10, NULL, NULL));
+}
+END_TEST
+
+START_TEST(test_scroll)
+{
+	new_view(5, 0);
+	mafw_playlist_view_set_window(View, 0, 5);
+	checkmore_spin_loop(50);
+	shown(0, 5);
+
+	/* The prefetched rows are shown right away, and the next ones
+	 * are prefetched. */
+	mafw_playlist_view_set_window(View, 3, 5);
+	shown(5, 3);
+	checkmore_spin_loop(50);
+	fail_unless(Shown->len == 0);
+	fail_unless(Old_md_called == 13);
+
+	/* Scrolling back is answered from the cache, and there's
+	 * nothing to prefetch before the first row. */
+	mafw_playlist_view_set_window(View, 0, 5);
+	shown(0, 3);
+	checkmore_spin_loop(50);
+	fail_unless(Shown->len == 0);
+	fail_unless(Old_md_called == 13);
+}
+END_TEST
+
+START_TEST(test_jump)
+{
+	MafwSource *src;
+
+	/* The requests for the rows left behind are cancelled
+	 * before the source gets them. */
+	src = mafw_get_uri_source();
+	mafw_source_set_max_requests(src, 1);
+	new_view(5, 0);
+	mafw_playlist_view_set_window(View, 0, 5);
+	while (!Old_md_called)
+		g_main_context_iteration(NULL, TRUE);
+	mafw_playlist_view_set_window(View, 50, 5);
+	checkmore_spin_loop(200);
+	mafw_source_set_max_requests(src, 0);
+	shown(50, 5);
+	fail_unless(Old_md_called == 1 + 10, "%u", Old_md_called);
+}
+END_TEST
+
+START_TEST(test_cache)
+{
+	/* Only the two most recently used rows are kept
+	 * out of the window. */
+	new_view(0, 2);
+	mafw_playlist_view_set_window(View, 0, 5);
+	checkmore_spin_loop(50);
+	shown(0, 5);
+	fail_unless(mafw_playlist_view_get_row(View, 1, NULL, NULL));
+	mafw_playlist_view_set_window(View, 10, 5);
+	checkmore_spin_loop(50);
+	shown(10, 5);
+	fail_unless(Old_md_called == 10);
+
+	fail_unless(mafw_playlist_view_get_row(View, 1, NULL, NULL));
+	fail_unless(mafw_playlist_view_get_row(View, 4, NULL, NULL));
+	fail_if(mafw_playlist_view_get_row(View, 0, NULL, NULL));
+	fail_if(mafw_playlist_view_get_row(View, 2, NULL, NULL));
+	fail_if(mafw_playlist_view_get_row(View, 3, NULL, NULL));
+}
+END_TEST
+
+START_TEST(test_changed)
+{
+	new_view(5, 0);
+	mafw_playlist_view_set_window(View, 0, 5);
+	checkmore_spin_loop(50);
+	shown(0, 5);
+
+	/* The rows from the changed one on are fetched again. */
+	g_signal_emit_by_name(Pls, "contents-changed", 2, 1, 1);
+	checkmore_spin_loop(50);
+	shown(2, 3);
+	fail_unless(Old_md_called == 10 + 8);
+
+	g_signal_emit_by_name(Pls, "item-moved", 7, 4);
+	checkmore_spin_loop(50);
+	shown(4, 1);
+	fail_unless(Old_md_called == 18 + 6);
+}
+END_TEST
+
+START_TEST(test_batch)
+{
+	MafwSourceClass *klass;
+
+	/* The window and the rows to prefetch are asked in one request
+	 * each. */
+	klass = MAFW_SOURCE_GET_CLASS(mafw_get_uri_source());
+	klass->get_metadatas = mymds;
+	Mds_called = Mds_objects = 0;
+	new_view(5, 0);
+	mafw_playlist_view_set_window(View, 0, 5);
+	checkmore_spin_loop(50);
+	shown(0, 5);
+	fail_unless(Mds_called == 2);
+	fail_unless(Mds_objects == 10);
+
+	/* Only the new rows are asked. */
+	mafw_playlist_view_set_window(View, 3, 5);
+	checkmore_spin_loop(50);
+	shown(5, 3);
+	fail_unless(Mds_called == 3);
+	fail_unless(Mds_objects == 13);
+	klass->get_metadatas = NULL;
+}
+END_TEST
+
+START_TEST(test_promote)
+{
+	MafwSource *src;
+	MafwSourceQueueStats stats;
+
+	/* The rows to prefetch wait behind the window. */
+	src = mafw_get_uri_source();
+	mafw_source_set_max_requests(src, 1);
+	new_view(5, 0);
+	mafw_playlist_view_set_window(View, 0, 5);
+	mafw_source_get_queue_stats(src, MAFW_SOURCE_PRIORITY_PREFETCH,
+				    &stats);
+	fail_unless(stats.depth == 5, "%u", stats.depth);
+
+	/* Scrolling them into the window promotes their requests
+	 * without asking them twice. */
+	while (!Old_md_called)
+		g_main_context_iteration(NULL, TRUE);
+	mafw_playlist_view_set_window(View, 5, 5);
+	mafw_source_get_queue_stats(src, MAFW_SOURCE_PRIORITY_INTERACTIVE,
+				    &stats);
+	fail_unless(stats.depth == 5, "%u", stats.depth);
+	mafw_source_get_queue_stats(src, MAFW_SOURCE_PRIORITY_PREFETCH,
+				    &stats);
+	fail_unless(stats.depth == 5, "%u", stats.depth);
+	checkmore_spin_loop(200);
+	mafw_source_set_max_requests(src, 0);
+	shown(5, 5);
+	fail_unless(Old_md_called == 1 + 10, "%u", Old_md_called);
+}
+END_TEST
+
+/* Freeing the view from its own callback. */
+static void itemcb_free(MafwPlaylist *pls, guint idx, const gchar *oid,
+			GHashTable *md, gpointer _)
+{
+	g_array_append_val(Shown, idx);
+	mafw_playlist_view_free(View);
+	View = NULL;
+}
+
+START_TEST(test_free)
+{
+	View = mafw_playlist_view_new(Pls,
+				      MAFW_SOURCE_LIST(MAFW_METADATA_KEY_URI),
+				      5, 0, itemcb_free, NULL);
+	mafw_playlist_view_set_window(View, 0, 5);
+	checkmore_spin_loop(50);
+	fail_unless(Shown->len == 1);
+	g_array_set_size(Shown, 0);
+}
+END_TEST
+
+/* Moving the window when an unregistered row is shown. */
+static void itemcb_jump(MafwPlaylist *pls, guint idx, const gchar *oid,
+			GHashTable *md, gpointer _)
+{
+	g_array_append_val(Shown, idx);
+	if (!md && idx < 50)
+		mafw_playlist_view_set_window(View, 50, 5);
+}
+
+START_TEST(test_mixed)
+{
+	/* Row 1 can't be fetched, so it is shown while the batch
+	 * of row 0 is being filled, and the callback leaves it
+	 * empty before it is sent. */
+	Mixed = TRUE;
+	View = mafw_playlist_view_new(Pls,
+				      MAFW_SOURCE_LIST(MAFW_METADATA_KEY_URI),
+				      5, 0, itemcb_jump, NULL);
+	mafw_playlist_view_set_window(View, 0, 5);
+	checkmore_spin_loop(50);
+	fail_unless(Shown->len > 0);
+	fail_unless(g_array_index(Shown, guint, 0) == 1);
+	g_array_remove_index(Shown, 0);
+	shown(50, 5);
+	fail_unless(Old_md_called == 2 + 3, "%u", Old_md_called);
+}
+END_TEST
+
+/* Fixtures. */
+static void setup(void)
+{
+	Pls = g_object_new(dumbpls_get_type(), NULL);
+	Shown = g_array_new(FALSE, FALSE, sizeof(guint));
+	Old_md_called = 0;
+	Mixed = FALSE;
+}
+
+static void teardown(void)
+{
+	if (View)
+		mafw_playlist_view_free(View);
+	View = NULL;
+	g_array_free(Shown, TRUE);
+	g_object_unref(Pls);
+	Pls = NULL;
+}
+
+int main(void)
+{
+	TCase *tc;
+	Suite *suite;
+
+	g_type_init();
+	Old_md = MAFW_SOURCE_GET_CLASS(mafw_get_uri_source())->get_metadata;
+	MAFW_SOURCE_GET_CLASS(mafw_get_uri_source())->get_metadata = mymd;
+
+	suite = suite_create("PlaylistView");
+	tc = tcase_create("Window");
+	suite_add_tcase(suite, tc);
+	tcase_add_checked_fixture(tc, setup, teardown);
+
+	if (1) tcase_add_test(tc, test_window);
+	if (1) tcase_add_test(tc, test_scroll);
+	if (1) tcase_add_test(tc, test_jump);
+	if (1) tcase_add_test(tc, test_cache);
+	if (1) tcase_add_test(tc, test_changed);
+	if (1) tcase_add_test(tc, test_batch);
+	if (1) tcase_add_test(tc, test_promote);
+	if (1) tcase_add_test(tc, test_free);
+	if (1) tcase_add_test(tc, test_mixed);
+
+	return checkmore_run(srunner_create(suite), FALSE);
+}
@@ -142,7 +142,7 @@ START_TEST(test_valid)
 	fail_unless(Itemcb_called == 3);
 	fail_unless(Old_md_called == 3);
 	fail_unless(Destructed);
-	/* [0..0], valid metadata key. */
+	/* [0..0], valid metadata key, cached. */
 	Old_md_called = 0;
 	Itemcb_called = 0;
 	Destructed = FALSE;
@@ -151,9 +151,9 @@ START_TEST(test_valid)
 					 itemcb_valid, &Destructed, destruct);
 	checkmore_spin_loop(-1);
 	fail_unless(Itemcb_called == 1);
-	fail_unless(Old_md_called == 1);
+	fail_unless(Old_md_called == 0);
 	fail_unless(Destructed);
-	/* [0..inf), valid metadata key. */
+	/* [0..inf), valid metadata key, partially cached. */
 	Old_md_called = 0;
 	Itemcb_called = 0;
 	Destructed = FALSE;
@@ -162,9 +162,9 @@ START_TEST(test_valid)
 					 itemcb_valid, &Destructed, destruct);
 	checkmore_spin_loop(-1);
 	fail_unless(Itemcb_called == PLS_SIZE);
-	fail_unless(Old_md_called == PLS_SIZE);
+	fail_unless(Old_md_called == PLS_SIZE - 3);
 	fail_unless(Destructed);
-	/* [2..inf), valid metadata key. */
+	/* [2..inf), valid metadata key, cached. */
 	Old_md_called = 0;
 	Itemcb_called = 0;
 	Destructed = FALSE;
@@ -173,11 +173,116 @@ START_TEST(test_valid)
 					 itemcb_valid, &Destructed, destruct);
 	checkmore_spin_loop(-1);
 	fail_unless(Itemcb_called == PLS_SIZE - 2);
-	fail_unless(Old_md_called == PLS_SIZE - 2);
+	fail_unless(Old_md_called == 0);
 	fail_unless(Destructed);
 }
 END_TEST
 
+START_TEST(test_cache)
+{
+	/* Only what has changed is asked again. */
+	Req = mafw_playlist_get_items_md(Pls, 0, -1,
+					 MAFW_SOURCE_LIST(MAFW_METADATA_KEY_URI),
+					 itemcb_valid, &Destructed, destruct);
+	checkmore_spin_loop(-1);
+	fail_unless(Old_md_called == PLS_SIZE);
+
+	Old_md_called = 0;
+	Destructed = FALSE;
+	g_signal_emit_by_name(mafw_get_uri_source(), "metadata-changed",
+			      Contents[1]);
+	Req = mafw_playlist_get_items_md(Pls, 0, -1,
+					 MAFW_SOURCE_LIST(MAFW_METADATA_KEY_URI),
+					 itemcb_valid, &Destructed, destruct);
+	checkmore_spin_loop(-1);
+	fail_unless(Old_md_called == 1);
+
+	/* Other keys are not cached yet. */
+	Old_md_called = 0;
+	Destructed = FALSE;
+	Req = mafw_playlist_get_items_md(Pls, 0, -1,
+					 MAFW_SOURCE_LIST(MAFW_METADATA_KEY_URI,
+							  MAFW_METADATA_KEY_TITLE),
+					 itemcb_valid, &Destructed, destruct);
+	checkmore_spin_loop(-1);
+	fail_unless(Old_md_called == PLS_SIZE);
+
+	/* The order and duplicates of the keys don't matter. */
+	Old_md_called = 0;
+	Destructed = FALSE;
+	Req = mafw_playlist_get_items_md(Pls, 0, -1,
+					 MAFW_SOURCE_LIST(MAFW_METADATA_KEY_TITLE,
+							  MAFW_METADATA_KEY_URI,
+							  MAFW_METADATA_KEY_TITLE),
+					 itemcb_valid, &Destructed, destruct);
+	checkmore_spin_loop(-1);
+	fail_unless(Old_md_called == 0);
+
+	/* Changing the playlist forgets everything. */
+	Old_md_called = 0;
+	Itemcb_called = 0;
+	Destructed = FALSE;
+	g_signal_emit_by_name(Pls, "contents-changed", 3, 0, 1);
+	Req = mafw_playlist_get_items_md(Pls, 0, -1,
+					 MAFW_SOURCE_LIST(MAFW_METADATA_KEY_URI),
+					 itemcb_valid, &Destructed, destruct);
+	checkmore_spin_loop(-1);
+	fail_unless(Old_md_called == PLS_SIZE);
+	fail_unless(Itemcb_called == PLS_SIZE);
+
+	/* Nothing fits in a tiny cache. */
+	mafw_playlist_set_md_cache_budget(Pls, 1);
+	fail_unless(mafw_playlist_get_md_cache_budget(Pls) == 1);
+	Old_md_called = 0;
+	Destructed = FALSE;
+	Req = mafw_playlist_get_items_md(Pls, 0, -1,
+					 MAFW_SOURCE_LIST(MAFW_METADATA_KEY_URI),
+					 itemcb_valid, &Destructed, destruct);
+	checkmore_spin_loop(-1);
+	fail_unless(Old_md_called == PLS_SIZE);
+	mafw_playlist_set_md_cache_budget(Pls, 0);
+	fail_unless(mafw_playlist_get_md_cache_budget(Pls)
+		    == MAFW_PLAYLIST_MD_CACHE_BUDGET);
+}
+END_TEST
+
+/* The number of objects asked when the first item arrives. */
+static guint First_md_called;
+
+static void itemcb_batched(MafwPlaylist *pls,
+			   guint idx,
+			   const gchar *oid,
+			   GHashTable *md,
+			   gpointer _)
+{
+	if (!Itemcb_called)
+		First_md_called = Old_md_called;
+	itemcb_valid(pls, idx, oid, md, _);
+}
+
+START_TEST(test_batches)
+{
+	MafwSource *src;
+
+	/* Three batches, the first items are delivered before
+	 * the last batch is asked. */
+	src = mafw_get_uri_source();
+	mafw_source_set_metadatas_batch_size(src, 3);
+	fail_unless(mafw_source_get_metadatas_batch_size(src) == 3);
+	Req = mafw_playlist_get_items_md(Pls, 0, -1,
+					 MAFW_SOURCE_LIST(MAFW_METADATA_KEY_URI),
+					 itemcb_batched, &Destructed, destruct);
+	checkmore_spin_loop(-1);
+	mafw_source_set_metadatas_batch_size(src, 0);
+	fail_unless(mafw_source_get_metadatas_batch_size(src)
+		    == MAFW_SOURCE_METADATAS_BATCH_SIZE);
+	fail_unless(Destructed);
+	fail_unless(Itemcb_called == PLS_SIZE);
+	fail_unless(Old_md_called == PLS_SIZE);
+	fail_unless(First_md_called > 0 && First_md_called <= 6);
+}
+END_TEST
+
 
 static void itemcb_nomd(MafwPlaylist *pls,
 			   guint idx,
@@ -263,6 +368,28 @@ START_TEST(test_cancel_2)
 }
 END_TEST
 
+START_TEST(test_cancel_3)
+{
+	MafwSource *src;
+
+	/* Cancelling while the source is working on it.  The rest of
+	 * the objects are not asked from it at all. */
+	src = mafw_get_uri_source();
+	mafw_source_set_max_requests(src, 1);
+	Req = mafw_playlist_get_items_md(Pls, 0, PLS_SIZE - 1,
+					 MAFW_SOURCE_LIST(MAFW_METADATA_KEY_URI),
+					 itemcb_valid, &Destructed, destruct);
+	while (!Old_md_called)
+		g_main_context_iteration(NULL, TRUE);
+	mafw_playlist_cancel_get_items_md(Req);
+	fail_unless(Destructed);
+	checkmore_spin_loop(50);
+	mafw_source_set_max_requests(src, 0);
+	fail_unless(Itemcb_called == 0);
+	fail_unless(Old_md_called == 1);
+}
+END_TEST
+
 static void multi_dest(gpointer called)
 {
 	if (++*(guint *)called == 2)
@@ -355,6 +482,7 @@ static void setup(void)
 	Pls = g_object_new(dumbpls_get_type(), NULL);
 	Itemcb_called = 0;
 	Old_md_called = 0;
+	First_md_called = 0;
 	Destructed = FALSE;
 }
 
@@ -381,11 +509,14 @@ int main(void)
 
 	if (1) tcase_add_test(tc, test_get_metadatas);
 	if (1) tcase_add_test(tc, test_valid);
+	if (1) tcase_add_test(tc, test_cache);
+	if (1) tcase_add_test(tc, test_batches);
 	if (1) tcase_add_test(tc, test_invalid);
 	if (1) tcase_add_test(tc, test_invalid_2);
 	if (1) tcase_add_test(tc, test_no_md);
 	if (1) tcase_add_test(tc, test_cancel_1);
 	if (1) tcase_add_test(tc, test_cancel_2);
+	if (1) tcase_add_test(tc, test_cancel_3);
 	if (1) tcase_add_test(tc, test_multi_1);
 	if (1) tcase_add_test(tc, test_multi_2);
 